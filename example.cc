@@ -4,11 +4,17 @@
 
 #include <iostream>
 // std::cout
+#include <thread>
+// std::thread
 
+// Compiles the dumps, which exactly one translation unit of the program does.
+#define MINPROF_IMPLEMENTATION
 #include "minprof.hh"
 // MINPROF_TIMED
 // MINPROF_SECTION
 // MINPROF_DUMP
+#include "minprof/autotune.hh"
+// MINPROF_AUTOTUNE
 
 using namespace std;
 
@@ -106,6 +112,20 @@ void tight()
             MINPROF_SECTION("MILLION_SECTIONS");
     }
 
+    // Thread-local slots avoid contention, but still write to memory on every increment:
+    MINPROF_TIMED("MILLION_SHARDED|T") {
+        auto& sharded = ::minprof::StaticCounter<typestring_is("MILLION_SHARDED|C")>::local();
+        for (unsigned i = 0; i < 1000000; ++i)
+            ++sharded;
+    }
+
+    // ...which LocalCounters avoid by buffering until they go out of scope (or are flushed):
+    MINPROF_TIMED("MILLION_LOCAL|T") {
+        minprof::LocalCounter<> local{MINPROF_COUNTER("MILLION_LOCAL|C")};
+        for (unsigned i = 0; i < 1000000; ++i)
+            ++local;
+    }
+
     // Inspecting an optimized dump should show you that a counter increment reduces to:
     //
     //      lock addq $0x1,0x0(%rip)
@@ -114,6 +134,59 @@ void tight()
     // translation units (which is totally fine and safe). The lock prefix stems from using atomics.
 }
 
+void threads()
+{
+    // Local slots are private to the calling thread, so a pool can count without contention:
+    auto worker = [](const char* name, unsigned work) {
+        // Names show up in the per-thread dump (otherwise the OS thread name is used).
+        minprof::set_thread_name(name);
+
+        for (unsigned i = 0; i < work; ++i)
+            ++::minprof::StaticCounter<typestring_is("POOL_WORK|C")>::local();
+    };
+
+    // Let's be unfair on purpose.
+    std::thread a{worker, "worker_a", 800000u};
+    std::thread b{worker, "worker_b", 100000u};
+    std::thread c{worker, "worker_c", 100000u};
+    a.join();
+    b.join();
+    c.join();
+
+    // Defining MINPROF_PER_THREAD before including minprof.hh makes all the macros do this. Totals
+    // are then read using MINPROF_TOTAL.
+    assert(MINPROF_TOTAL("POOL_WORK|C") == 1000000);
+}
+
+// Busy-wait for about the given number of ns, standing in for a variant doing real work.
+unsigned spin(unsigned ns)
+{
+    const auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds{ns};
+    unsigned spins = 0;
+    while (std::chrono::steady_clock::now() < end)
+        ++spins;
+    return spins;
+}
+
+unsigned slow_variant(unsigned ns) { return spin(ns + ns / 2); }
+unsigned fast_variant(unsigned ns) { return spin(ns); }
+
+void autotune()
+{
+    // Variants are picked by their exact median duration, so even close ones are told apart. The
+    // slower one is registered first, so it does not win by the order alone:
+    using Variant = MINPROF_AUTOTUNE("variant", unsigned(unsigned));
+    Variant::add("slow", &slow_variant);
+    Variant::add("fast", &fast_variant);
+
+    // Exploration ends after the budget of 512 calls, from then on calls go straight to the winner.
+    for (unsigned i = 0; i < 1024; ++i)
+        Variant::call(2200u);
+
+    cout << "Autotune picked the " << Variant::winner() << " variant" << endl;
+    Variant::dump(cout);
+}
+
 int main(int argc, char* argv[])
 {
     cout << "TESTS:" << endl << endl;
@@ -127,6 +200,12 @@ int main(int argc, char* argv[])
     // Internals.
     tight();
 
+    // Threads.
+    threads();
+
+    // Variants.
+    autotune();
+
     cout << endl << "STATS:" << endl << endl;
 
     // Let's see...
@@ -139,6 +218,15 @@ int main(int argc, char* argv[])
     const auto sect_time = MINPROF_TIMER("MILLION_SECTIONS|T").value();
     cout << "Section entry takes  " << sect_time.count() / sect_entrys << "ns" << endl;
 
+    const auto sharded_incs = MINPROF_TOTAL("MILLION_SHARDED|C");
+    const auto sharded_time = MINPROF_TIMER("MILLION_SHARDED|T").value();
+    cout << "Sharded increase takes " << sharded_time.count() / double(sharded_incs) << "ns";
+    cout << endl;
+
+    const auto local_incs = MINPROF_COUNTER("MILLION_LOCAL|C").value();
+    const auto local_time = MINPROF_TIMER("MILLION_LOCAL|T").value();
+    cout << "Local increase takes   " << local_time.count() / double(local_incs) << "ns" << endl;
+
     cout << endl << "DUMP:" << endl << endl;
 
     // This will dump all counters as CSV to console.
@@ -150,5 +238,10 @@ int main(int argc, char* argv[])
     // You can even be fancy and do this, so your program auto-dumps at graceful exit!
 /*  atexit(MINPROF_DUMP); */
 
+    cout << endl << "THREADS:" << endl << endl;
+
+    // This will break all counters down by thread, and tell you how imbalanced they were.
+    MINPROF_DUMP_THREADS(cout);
+
     return EXIT_SUCCESS;
 }
\ No newline at end of file
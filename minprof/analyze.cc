@@ -0,0 +1,756 @@
+/** \brief Offline analyzer for trace files of the minimal profiler.
+ *
+ * Build with "make analyze" and run as
+ *
+ *      minprof-analyze [-j jobs] [-i interval_ms] [-r request [-n slowest] [-s]] file.trace
+ *
+ * to print, as CSV:
+ *
+ * - thread, <id>, <name>, <events>, <dropped>, <busy fraction>
+ * - utilization, thread, <interval start ms>... followed by one row per thread holding the
+ *   fraction of every interval it spent inside any traced section.
+ * - latency, <section>, <count>, <total ns>, <min>, <p50>, <p90>, <p99>, <max>
+ * - critical, <rank>, <start ns>, <duration ns>, <threads>
+ * - critical_share, <rank>, <section>, <ns>, <fraction>
+ * - critical_path, <rank>, <thread>, <begin ns>, <end ns>, <section>   (only with -s)
+ *
+ * The critical path is computed for the slowest instances of the request section. It is followed
+ * backwards from the end of the request: on the current thread up to the most recent WAKE event
+ * whose SIGNAL (see MINPROF_TRACE_SIGNAL) happened on another thread after the waking thread's
+ * previous event, i.e. while it was presumably blocked, then over to that thread at the time of the
+ * SIGNAL, and so on until the start of the request. Time between a SIGNAL and its WAKE is
+ * accounted as "(wakeup)", time outside of any section as "(untraced)".
+ *
+ * Blocks are decoded in parallel from a memory mapping of the file, and every thread's events are
+ * analyzed in parallel, so the runtime is dominated by the memory bandwidth.
+ *
+ * \file    minprof/analyze.cc
+ * \author  Karl Friebel
+ */
+
+#include "trace.hh"
+// minprof::TraceEvent
+// minprof::trace_format
+
+#include <cstddef>
+// std::size_t
+#include <cstdint>
+// std::uint8_t
+// std::uint32_t
+// std::uint64_t
+#include <cstdlib>
+// std::strtoul
+// EXIT_FAILURE
+// EXIT_SUCCESS
+#include <cstring>
+// std::memcmp
+// std::strcmp
+
+#include <algorithm>
+// std::find
+// std::find_if
+// std::is_sorted
+// std::max
+// std::min
+// std::nth_element
+// std::partial_sort
+// std::reverse
+// std::sort
+// std::stable_sort
+// std::upper_bound
+#include <atomic>
+// std::atomic
+#include <iostream>
+// std::cerr
+// std::cout
+#include <limits>
+// std::numeric_limits
+#include <string>
+// std::string
+// std::to_string
+#include <thread>
+// std::thread
+#include <unordered_map>
+// std::unordered_map
+#include <utility>
+// std::pair
+#include <vector>
+// std::vector
+
+namespace {
+
+using minprof::TraceEvent;
+namespace format = minprof::trace_format;
+
+// Id of the pseudo-section outside of any section.
+constexpr std::uint32_t untraced = std::numeric_limits<std::uint32_t>::max();
+// Id of the pseudo-section between a SIGNAL and its WAKE.
+constexpr std::uint32_t wakeup = untraced - 1;
+
+// Command line options.
+struct Options {
+    // Trace file.
+    const char*     file        = nullptr;
+    // Number of worker threads.
+    unsigned        jobs        = std::max(1u, std::thread::hardware_concurrency());
+    // Utilization interval in ns.
+    std::uint64_t   interval    = 100000000;
+    // Name of the request section, nullptr to skip the critical path.
+    const char*     request     = nullptr;
+    // Number of slowest requests to analyze.
+    unsigned        slowest     = 1;
+    // If true, print the critical path segments.
+    bool            segments    = false;
+};
+
+// EVENTS block of the file.
+struct Block {
+    // Block header.
+    format::BlockHeader     header;
+    // Payload.
+    const std::uint8_t*     payload;
+};
+
+// Section instance.
+struct Interval {
+    // Time of the BEGIN event.
+    std::uint64_t   begin;
+    // Time of the END event.
+    std::uint64_t   end;
+    // Section id.
+    std::uint32_t   id;
+};
+
+// Analysis of a single thread.
+struct Thread {
+    // Thread name.
+    std::string                                         name;
+    // Events dropped by the ring.
+    std::uint64_t                                       dropped     = 0;
+    // Events in push order.
+    std::vector<TraceEvent>                             events;
+    // Completed section instances, ordered by end.
+    std::vector<Interval>                               intervals;
+    // Times at which the innermost section changed, and the new innermost section id.
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> innermost;
+    // Busy time per utilization interval in ns.
+    std::vector<std::uint64_t>                          busy;
+    // Total busy time in ns.
+    std::uint64_t                                       busy_total  = 0;
+};
+
+// Whole trace.
+struct Trace {
+    // Section names by id.
+    std::unordered_map<std::uint32_t, std::string>  names;
+    // Threads by id, possibly with gaps.
+    std::vector<Thread>                             threads;
+    // Time of the earliest event.
+    std::uint64_t                                   begin       = 0;
+    // Time of the latest event.
+    std::uint64_t                                   end         = 0;
+    // Number of events.
+    std::uint64_t                                   events      = 0;
+};
+
+// Run fn(idx) for all idx < count on jobs threads.
+template<typename F>
+void parallel_for(unsigned jobs, std::size_t count, F fn)
+{
+    std::atomic<std::size_t> next{0};
+    auto worker = [&]() {
+        for (auto idx = next++; idx < count; idx = next++) {
+            fn(idx);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < jobs && i < count; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+}
+
+// Decode an EVENTS block, calling emit(event) for every event, returning false if it is corrupt.
+template<typename F>
+bool decode(const Block& block, F emit)
+{
+    return format::unpack_block(block.header, block.payload, emit);
+}
+
+// Get the thread of an id, creating it if necessary.
+Thread& thread(Trace& trace, std::uint32_t id)
+{
+    if (id >= trace.threads.size()) {
+        trace.threads.resize(id + 1u);
+    }
+    return trace.threads[id];
+}
+
+// Load a trace file, returning false on errors.
+bool load(const format::Mapping& file, unsigned jobs, Trace& trace)
+{
+    auto pos = file.data();
+    const auto end = pos + file.size();
+
+    format::FileHeader header;
+    if (!format::get(pos, end, header)
+        || std::memcmp(header.magic, format::magic, sizeof(header.magic)) != 0
+        || header.version < format::min_version || header.version > format::version) {
+        std::cerr << "minprof-analyze: not a trace file" << std::endl;
+        return false;
+    }
+
+    // Skipping through the block headers is cheap, so only decoding is done in parallel.
+    std::vector<Block> blocks;
+    while (pos < end) {
+        Block block;
+        if (!format::get(pos, end, block.header)
+            || static_cast<std::uint64_t>(end - pos) < block.header.size) {
+            // The streamer may have been killed while writing, so use what is complete.
+            std::cerr << "minprof-analyze: truncated block, ignoring the rest" << std::endl;
+            break;
+        }
+        block.payload = pos;
+        pos += block.header.size;
+
+        const auto payload_end = block.payload + block.header.size;
+        auto payload = block.payload;
+        if (block.header.type == format::EVENTS) {
+            blocks.push_back(block);
+        } else if (block.header.type == format::NAMES) {
+            // Later blocks supersede earlier ones.
+            for (std::uint64_t i = 0; i < block.header.count; ++i) {
+                std::uint32_t id;
+                std::string name;
+                if (!format::get(payload, payload_end, id)
+                    || !format::get_string(payload, payload_end, name)) {
+                    break;
+                }
+                if (name.size() > 2 && name.compare(name.size() - 2, 2, "|C") == 0) {
+                    name.resize(name.size() - 2);
+                }
+                trace.names[id] = std::move(name);
+            }
+        } else if (block.header.type == format::THREADS) {
+            for (std::uint64_t i = 0; i < block.header.count; ++i) {
+                std::uint32_t id;
+                std::uint64_t dropped;
+                std::string name;
+                if (!format::get(payload, payload_end, id)
+                    || !format::get(payload, payload_end, dropped)
+                    || !format::get_string(payload, payload_end, name)) {
+                    break;
+                }
+                auto& target = thread(trace, id);
+                target.name = std::move(name);
+                target.dropped = dropped;
+            }
+        }
+    }
+
+    // Events are split by thread, keeping their order, by decoding every block twice: once to
+    // count the events per thread, so that the second pass can write them in place in parallel.
+    std::vector<std::vector<std::uint64_t>> offsets(blocks.size());
+    std::atomic<bool> good{true};
+    parallel_for(jobs, blocks.size(), [&](std::size_t idx) {
+        auto& counts = offsets[idx];
+        const auto ok = decode(blocks[idx], [&](const TraceEvent& event) {
+            if (event.thread() >= counts.size()) {
+                counts.resize(event.thread() + 1u);
+            }
+            ++counts[event.thread()];
+        });
+        if (!ok) {
+            good = false;
+        }
+    });
+    if (!good) {
+        std::cerr << "minprof-analyze: corrupt events block" << std::endl;
+        return false;
+    }
+
+    // Turn the counts into offsets.
+    std::vector<std::uint64_t> fill;
+    for (auto& offset : offsets) {
+        if (offset.size() > fill.size()) {
+            fill.resize(offset.size());
+        }
+        for (std::size_t id = 0; id < offset.size(); ++id) {
+            const auto count = offset[id];
+            offset[id] = fill[id];
+            fill[id] += count;
+        }
+    }
+
+    for (std::uint32_t id = 0; id < fill.size(); ++id) {
+        thread(trace, id).events.resize(fill[id]);
+        trace.events += fill[id];
+    }
+    parallel_for(jobs, blocks.size(), [&](std::size_t idx) {
+        auto& offset = offsets[idx];
+        decode(blocks[idx], [&](const TraceEvent& event) {
+            trace.threads[event.thread()].events[offset[event.thread()]++] = event;
+        });
+    });
+
+    // The TailSampler pushes the events of a kept request after the fact, behind younger ones, so
+    // every thread is put back into time order. Simultaneous events keep their push order.
+    parallel_for(jobs, trace.threads.size(), [&](std::size_t id) {
+        auto& events = trace.threads[id].events;
+        const auto earlier = [](const TraceEvent& lhs, const TraceEvent& rhs) {
+            return lhs.time < rhs.time;
+        };
+        if (!std::is_sorted(events.begin(), events.end(), earlier)) {
+            std::stable_sort(events.begin(), events.end(), earlier);
+        }
+    });
+
+    trace.begin = std::numeric_limits<std::uint64_t>::max();
+    for (const auto& target : trace.threads) {
+        if (!target.events.empty()) {
+            trace.begin = std::min(trace.begin, target.events.front().time);
+            trace.end = std::max(trace.end, target.events.back().time);
+        }
+    }
+    if (trace.events == 0) {
+        trace.begin = 0;
+    }
+
+    return true;
+}
+
+// Add a busy period to the utilization intervals of a thread.
+void add_busy(Thread& target, const Trace& trace, std::uint64_t interval, std::uint64_t begin,
+              std::uint64_t end)
+{
+    target.busy_total += end - begin;
+    while (begin < end) {
+        const auto idx = (begin - trace.begin) / interval;
+        const auto next = std::min(end, trace.begin + (idx + 1) * interval);
+        target.busy[idx] += next - begin;
+        begin = next;
+    }
+}
+
+// Reconstruct the section instances and utilization of a thread, and its innermost timeline if
+// required for critical paths.
+void analyze(Thread& target, const Trace& trace, std::uint64_t interval, bool timeline)
+{
+    target.busy.assign((trace.end - trace.begin) / interval + 1, 0);
+    target.intervals.reserve(target.events.size() / 2);
+
+    // Sections still open at the start of a flight recorder capture have no BEGIN, so their ENDs
+    // are ignored, while missing ENDs are ignored along with everything nested in them.
+    std::vector<Interval> stack;
+    auto innermost = untraced;
+    for (const auto& event : target.events) {
+        if (event.kind == TraceEvent::BEGIN) {
+            stack.push_back(Interval{event.time, 0, event.id});
+        } else if (event.kind == TraceEvent::END) {
+            auto pos = stack.size();
+            while (pos > 0 && stack[pos - 1].id != event.id) {
+                --pos;
+            }
+            if (pos == 0) {
+                continue;
+            }
+
+            stack.resize(pos);
+            stack.back().end = event.time;
+            target.intervals.push_back(stack.back());
+            stack.pop_back();
+
+            if (stack.empty()) {
+                add_busy(target, trace, interval, target.intervals.back().begin, event.time);
+            }
+        } else {
+            continue;
+        }
+
+        const auto current = stack.empty() ? untraced : stack.back().id;
+        if (timeline && current != innermost) {
+            innermost = current;
+            target.innermost.emplace_back(event.time, current);
+        }
+    }
+}
+
+// Latency distribution of a section.
+struct Latency {
+    std::uint32_t               id;
+    std::vector<std::uint64_t>  durations;
+    std::uint64_t               count   = 0;
+    std::uint64_t               total   = 0;
+    std::uint64_t               min     = 0;
+    std::uint64_t               p50     = 0;
+    std::uint64_t               p90     = 0;
+    std::uint64_t               p99     = 0;
+    std::uint64_t               max     = 0;
+};
+
+// Compute the latency distributions of all sections.
+std::vector<Latency> latencies(const Trace& trace, unsigned jobs)
+{
+    std::unordered_map<std::uint32_t, std::size_t> index;
+    std::vector<Latency> result;
+    for (const auto& target : trace.threads) {
+        for (const auto& interval : target.intervals) {
+            auto found = index.find(interval.id);
+            if (found == index.end()) {
+                found = index.emplace(interval.id, result.size()).first;
+                result.emplace_back();
+                result.back().id = interval.id;
+            }
+            result[found->second].durations.push_back(interval.end - interval.begin);
+        }
+    }
+
+    parallel_for(jobs, result.size(), [&](std::size_t idx) {
+        auto& latency = result[idx];
+        auto& durations = latency.durations;
+        const auto quantile = [&](double q) {
+            const auto rank = static_cast<std::size_t>(q * static_cast<double>(durations.size()
+                                                                               - 1));
+            std::nth_element(durations.begin(), durations.begin() + rank, durations.end());
+            return durations[rank];
+        };
+
+        latency.count = durations.size();
+        for (const auto duration : durations) {
+            latency.total += duration;
+        }
+        latency.min = quantile(0.0);
+        latency.max = quantile(1.0);
+        latency.p50 = quantile(0.5);
+        latency.p90 = quantile(0.9);
+        latency.p99 = quantile(0.99);
+        std::vector<std::uint64_t>{}.swap(durations);
+    });
+
+    std::sort(result.begin(), result.end(), [](const Latency& a, const Latency& b) {
+        return a.total > b.total;
+    });
+    return result;
+}
+
+// SIGNAL event.
+struct Signal {
+    std::uint64_t   time;
+    std::uint32_t   thread;
+};
+
+// Segment of a critical path.
+struct Segment {
+    std::uint32_t   thread;
+    std::uint64_t   begin;
+    std::uint64_t   end;
+    std::uint32_t   id;
+};
+
+// Critical path search over all threads.
+class CriticalPath {
+public:
+    explicit CriticalPath(const Trace& trace)
+    : m_trace{trace}, m_signals{}
+    {
+        for (std::uint32_t id = 0; id < trace.threads.size(); ++id) {
+            for (const auto& event : trace.threads[id].events) {
+                if (event.kind == TraceEvent::SIGNAL) {
+                    m_signals[event.id].push_back(Signal{event.time, id});
+                }
+            }
+        }
+        for (auto& entry : m_signals) {
+            std::sort(entry.second.begin(), entry.second.end(),
+                      [](const Signal& a, const Signal& b) { return a.time < b.time; });
+        }
+    }
+
+    // Find the critical path of a request, returning its segments latest first.
+    std::vector<Segment> find(std::uint32_t thread, const Interval& request) const
+    {
+        std::vector<Segment> result;
+
+        auto current = thread;
+        auto time = request.end;
+        while (time > request.begin) {
+            const auto& events = m_trace.threads[current].events;
+
+            // Latest event at or before the current time, then walk back to the start.
+            auto pos = std::upper_bound(events.begin(), events.end(), time,
+                [](std::uint64_t value, const TraceEvent& event) { return value < event.time; });
+
+            bool jumped = false;
+            while (pos != events.begin() && (pos - 1)->time > request.begin) {
+                --pos;
+                if (pos->kind != TraceEvent::WAKE) {
+                    continue;
+                }
+
+                const auto previous = pos == events.begin() ? request.begin : (pos - 1)->time;
+                const auto signal = latest(pos->id, pos->time, current);
+                if (!signal || signal->time <= previous || signal->time < request.begin
+                    || signal->time >= time) {
+                    continue;
+                }
+
+                attribute(result, current, pos->time, time);
+                result.push_back(Segment{current, signal->time, pos->time, wakeup});
+                current = signal->thread;
+                time = signal->time;
+                jumped = true;
+                break;
+            }
+
+            if (!jumped) {
+                attribute(result, current, request.begin, time);
+                break;
+            }
+        }
+
+        return result;
+    }
+
+private:
+    // Latest SIGNAL of a key on another thread at or before a time.
+    const Signal* latest(std::uint32_t key, std::uint64_t time, std::uint32_t thread) const
+    {
+        const auto found = m_signals.find(key);
+        if (found == m_signals.end()) {
+            return nullptr;
+        }
+
+        const auto& signals = found->second;
+        auto pos = std::upper_bound(signals.begin(), signals.end(), time,
+            [](std::uint64_t value, const Signal& signal) { return value < signal.time; });
+        while (pos != signals.begin()) {
+            --pos;
+            if (pos->thread != thread) {
+                return &*pos;
+            }
+        }
+        return nullptr;
+    }
+
+    // Split a span of a thread by its innermost sections, appending the segments latest first.
+    void attribute(std::vector<Segment>& out, std::uint32_t thread, std::uint64_t begin,
+                   std::uint64_t end) const
+    {
+        const auto& innermost = m_trace.threads[thread].innermost;
+        auto pos = std::upper_bound(innermost.begin(), innermost.end(), end,
+            [](std::uint64_t value, const std::pair<std::uint64_t, std::uint32_t>& change) {
+                return value < change.first;
+            });
+
+        while (end > begin) {
+            const auto start = pos == innermost.begin() ? begin : std::max(begin, (pos - 1)->first);
+            const auto id = pos == innermost.begin() ? untraced : (pos - 1)->second;
+            if (end > start) {
+                out.push_back(Segment{thread, start, end, id});
+            }
+            end = start;
+            if (pos != innermost.begin()) {
+                --pos;
+            }
+        }
+    }
+
+    // Trace.
+    const Trace&                                                m_trace;
+    // SIGNAL events by key, ordered by time.
+    std::unordered_map<std::uint32_t, std::vector<Signal>>     m_signals;
+};
+
+// Get the display name of a section id.
+std::string name(const Trace& trace, std::uint32_t id)
+{
+    if (id == untraced) {
+        return "(untraced)";
+    }
+    if (id == wakeup) {
+        return "(wakeup)";
+    }
+
+    const auto found = trace.names.find(id);
+    return found != trace.names.end() ? found->second : "section_" + std::to_string(id);
+}
+
+// Get the display name of a thread.
+std::string thread_name(const Trace& trace, std::uint32_t id)
+{
+    const auto& name = trace.threads[id].name;
+    return name.empty() ? "thread_" + std::to_string(id) : name;
+}
+
+// Print the critical paths of the slowest requests.
+void print_critical(const Trace& trace, const Options& options, std::ostream& out)
+{
+    std::uint32_t request = untraced;
+    for (const auto& entry : trace.names) {
+        if (entry.second == options.request) {
+            request = entry.first;
+        }
+    }
+    if (request == untraced) {
+        std::cerr << "minprof-analyze: unknown section " << options.request << std::endl;
+        return;
+    }
+
+    std::vector<std::pair<std::uint32_t, Interval>> requests;
+    for (std::uint32_t id = 0; id < trace.threads.size(); ++id) {
+        for (const auto& interval : trace.threads[id].intervals) {
+            if (interval.id == request) {
+                requests.emplace_back(id, interval);
+            }
+        }
+    }
+
+    const auto count = std::min<std::size_t>(options.slowest, requests.size());
+    std::partial_sort(requests.begin(), requests.begin() + count, requests.end(),
+        [](const std::pair<std::uint32_t, Interval>& a,
+           const std::pair<std::uint32_t, Interval>& b) {
+            return a.second.end - a.second.begin > b.second.end - b.second.begin;
+        });
+
+    const CriticalPath search{trace};
+    for (std::size_t rank = 0; rank < count; ++rank) {
+        const auto& interval = requests[rank].second;
+        const auto duration = interval.end - interval.begin;
+        auto segments = search.find(requests[rank].first, interval);
+        std::reverse(segments.begin(), segments.end());
+
+        std::vector<std::uint32_t> threads;
+        std::vector<std::pair<std::uint32_t, std::uint64_t>> shares;
+        for (const auto& segment : segments) {
+            if (std::find(threads.begin(), threads.end(), segment.thread) == threads.end()) {
+                threads.push_back(segment.thread);
+            }
+
+            auto share = std::find_if(shares.begin(), shares.end(),
+                [&](const std::pair<std::uint32_t, std::uint64_t>& entry) {
+                    return entry.first == segment.id;
+                });
+            if (share == shares.end()) {
+                shares.emplace_back(segment.id, 0);
+                share = shares.end() - 1;
+            }
+            share->second += segment.end - segment.begin;
+        }
+        std::sort(shares.begin(), shares.end(),
+            [](const std::pair<std::uint32_t, std::uint64_t>& a,
+               const std::pair<std::uint32_t, std::uint64_t>& b) { return a.second > b.second; });
+
+        out << "critical, " << rank << ", " << interval.begin - trace.begin << ", " << duration
+            << ", " << threads.size() << std::endl;
+        for (const auto& share : shares) {
+            out << "critical_share, " << rank << ", " << name(trace, share.first) << ", "
+                << share.second << ", "
+                << static_cast<double>(share.second) / static_cast<double>(duration) << std::endl;
+        }
+        if (options.segments) {
+            for (const auto& segment : segments) {
+                out << "critical_path, " << rank << ", " << thread_name(trace, segment.thread)
+                    << ", " << segment.begin - trace.begin << ", " << segment.end - trace.begin
+                    << ", " << name(trace, segment.id) << std::endl;
+            }
+        }
+    }
+}
+
+// Print the usage.
+int usage()
+{
+    std::cerr << "usage: minprof-analyze [-j jobs] [-i interval_ms] [-r request [-n slowest] [-s]]"
+                 " file.trace" << std::endl;
+    return EXIT_FAILURE;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const auto arg = argv[i];
+        const auto has_value = i + 1 < argc;
+        if (std::strcmp(arg, "-j") == 0 && has_value) {
+            options.jobs = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(arg, "-i") == 0 && has_value) {
+            options.interval = std::max(1ul, std::strtoul(argv[++i], nullptr, 10)) * 1000000;
+        } else if (std::strcmp(arg, "-r") == 0 && has_value) {
+            options.request = argv[++i];
+        } else if (std::strcmp(arg, "-n") == 0 && has_value) {
+            options.slowest = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "-s") == 0) {
+            options.segments = true;
+        } else if (arg[0] != '-' && !options.file) {
+            options.file = arg;
+        } else {
+            return usage();
+        }
+    }
+    if (!options.file) {
+        return usage();
+    }
+
+    const format::Mapping file{options.file};
+    if (!file.data()) {
+        std::cerr << "minprof-analyze: cannot read " << options.file << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Trace trace;
+    if (!load(file, options.jobs, trace)) {
+        return EXIT_FAILURE;
+    }
+    parallel_for(options.jobs, trace.threads.size(), [&](std::size_t idx) {
+        analyze(trace.threads[idx], trace, options.interval, options.request != nullptr);
+    });
+
+    auto& out = std::cout;
+    const auto span = trace.end - trace.begin;
+    for (std::uint32_t id = 0; id < trace.threads.size(); ++id) {
+        const auto& target = trace.threads[id];
+        if (target.events.empty()) {
+            continue;
+        }
+        out << "thread, " << id << ", " << thread_name(trace, id) << ", " << target.events.size()
+            << ", " << target.dropped << ", "
+            << (span ? static_cast<double>(target.busy_total) / static_cast<double>(span) : 0.0)
+            << std::endl;
+    }
+
+    out << "utilization, thread";
+    const auto intervals = span / options.interval + 1;
+    for (std::uint64_t idx = 0; idx < intervals; ++idx) {
+        out << ", " << idx * options.interval / 1000000;
+    }
+    out << std::endl;
+    for (std::uint32_t id = 0; id < trace.threads.size(); ++id) {
+        const auto& target = trace.threads[id];
+        if (target.events.empty()) {
+            continue;
+        }
+        out << "utilization, " << thread_name(trace, id);
+        for (const auto busy : target.busy) {
+            out << ", " << static_cast<double>(busy) / static_cast<double>(options.interval);
+        }
+        out << std::endl;
+    }
+
+    for (const auto& latency : latencies(trace, options.jobs)) {
+        out << "latency, " << name(trace, latency.id) << ", " << latency.count
+            << ", " << latency.total << ", " << latency.min << ", " << latency.p50 << ", "
+            << latency.p90 << ", " << latency.p99 << ", " << latency.max << std::endl;
+    }
+
+    if (options.request) {
+        print_critical(trace, options, out);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,494 @@
+/** \brief Online selection among code variants for the minimal profiler.
+ *
+ * \file    minprof/autotune.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_AUTOTUNE_HH_
+#define MINPROF_AUTOTUNE_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Counter
+// minprof::Timer
+// minprof::Stopwatch
+// minprof::StaticCounterRegistry
+#include "heatmap.hh"
+// minprof::Histogram
+#include "sampler.hh"
+// minprof::Sampler
+
+#include <algorithm>
+// std::max
+// std::nth_element
+#include <cmath>
+// std::sqrt
+#include <cstdint>
+// std::uint64_t
+#include <limits>
+// std::numeric_limits
+#include <memory>
+// std::unique_ptr
+#include <ostream>
+// std::ostream
+// std::endl
+#include <string>
+// std::string
+#include <utility>
+// std::forward
+#include <vector>
+// std::vector
+
+namespace minprof {
+
+template<typename Name, typename Signature>
+class Autotune;
+
+/** \brief Dispatches calls to the fastest of several registered variants of a function.
+ *
+ * Every variant ("arm") is a plain function pointer. Calls go through a single atomic function
+ * pointer, which initially points to an exploring trampoline: it picks an arm by a lower confidence
+ * bound on its mean duration, times the call and records it. Every arm is tried warmup times first.
+ * Once the round's budget of calls is spent, the arm with the lowest median duration wins and the
+ * dispatch pointer is set to it directly, so that a converged call costs one indirect call.
+ *
+ * The median is exact, taken over a uniform reservoir of every arm's durations, so that arms
+ * within the same power of two are still told apart. The log2 duration histograms are only kept
+ * for dump().
+ *
+ * A round of exploration is started again by reexplore(), which the Sampler calls periodically
+ * while it is running, so that a change of host or data is picked up.
+ *
+ * Every arm counts its timed calls as the Section <name>.<label>, i.e. the counters
+ * <name>.<label>|C and <name>.<label>|T, which only advance while exploring.
+ *
+ * There is only one Autotune per name, which is controlled through the static interface.
+ *
+ * \tparam  Name    typestring of the Autotune's name.
+ * \tparam  R       Return type of the variants.
+ * \tparam  Args    Argument types of the variants.
+ */
+template<typename Name, typename R, typename... Args>
+class Autotune<Name, R(Args...)> {
+public:
+    // Assert that a typestring was passed.
+    static_assert(irqus::is_typestring<Name>::value, "Name must be a typestring!");
+
+    /** \brief Type alias for a variant. */
+    using Function = R(*)(Args...);
+
+    /** \brief Exploration settings. */
+    struct Options {
+        /** \brief Number of calls every arm gets at the start of a round, at least 1. */
+        unsigned                    warmup      = 16;
+        /** \brief Number of calls of a round, including the warmup. */
+        unsigned                    budget      = 512;
+        /** \brief Width of the confidence bound in standard errors. */
+        double                      confidence  = 2.0;
+        /** \brief Number of durations every arm keeps for the median. */
+        unsigned                    reservoir   = 64;
+        /** \brief Time after convergence until the next round, 0 to never re-explore. */
+        std::chrono::milliseconds   period      = std::chrono::milliseconds{30000};
+    };
+
+public:
+    // No copy constructor.
+    Autotune(const Autotune&) = delete;
+    // No copy assignment operator.
+    Autotune& operator=(const Autotune&) = delete;
+    // No move constructor.
+    Autotune(Autotune&&) = delete;
+    // No move assignment operator.
+    Autotune& operator=(Autotune&&) = delete;
+
+    /** \brief Register a variant and start a new round of exploration.
+     *
+     * Registers the arm's counters, so add all variants at startup.
+     *
+     * \param   [in]    label   Label of the variant.
+     * \param   [in]    fn      Variant.
+     */
+    static void add(const char* label, Function fn)
+    {
+        auto& self = instance();
+        bool hook = false;
+        {
+            std::lock_guard<std::mutex> lock{self.m_lock};
+
+            std::unique_ptr<Arm> arm{new Arm{}};
+            arm->fn = fn;
+            arm->label = label;
+            arm->count_name = std::string{Name::data()} + "." + label + "|C";
+            arm->time_name = std::string{Name::data()} + "." + label + "|T";
+            StaticCounterRegistry::register_counter(arm->count_name.c_str(), arm->counter);
+            StaticCounterRegistry::register_counter(arm->time_name.c_str(), arm->timer);
+            self.m_arms.push_back(std::move(arm));
+
+            hook = !self.m_hooked;
+            self.m_hooked = true;
+        }
+
+        // Not under m_lock, see Sampler::Hook::set().
+        if (hook) {
+            self.m_hook.set([&self](Stopwatch::time_point now) { self.tick(now); });
+        }
+        reexplore();
+    }
+    /** \brief Change the exploration settings, effective from the next round.
+     *
+     * \param   [in]    options Exploration settings.
+     */
+    static void configure(Options options)
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        self.m_options = options;
+    }
+
+    /** \brief Call the selected variant.
+     *
+     * \param   [in]    args    Arguments to forward.
+     * \return  Result of the variant.
+     */
+    template<typename... A>
+    ALWAYS_INLINE static R call(A&&... args)
+    {
+        return dispatch().load(std::memory_order_acquire)(std::forward<A>(args)...);
+    }
+
+    /** \brief Start a new round of exploration, forgetting the statistics of the last one. */
+    static void reexplore()
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        for (auto& arm : self.m_arms) {
+            arm->reset();
+        }
+        self.m_trials = 0;
+        self.m_winner = nullptr;
+        dispatch().store(&explore, std::memory_order_release);
+    }
+
+    /** \brief Get the label of the winning variant.
+     *
+     * \return  Label of the winner, nullptr while exploring.
+     */
+    static const char* winner()
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        return self.m_winner ? self.m_winner->label : nullptr;
+    }
+    /** \brief Dump the statistics of the current round to the specified stream as CSV.
+     *
+     * Quantiles are from the log2 duration histograms, so only accurate to a factor of 2.
+     *
+     * CSV format is:
+     * <label>, <trials>, <mean ns>, <median ns>, <p99 ns>, <winner: 0|1> <endl>
+     *
+     * \param   [in,out]    out     Output stream.
+     */
+    static void dump(std::ostream& out)
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        for (const auto& arm : self.m_arms) {
+            out << arm->label << ", " << arm->trials << ", "
+                << (arm->trials > 0 ? arm->sum / static_cast<double>(arm->trials) : 0.0) << ", "
+                << Histogram::quantile(arm->buckets, 0.5) << ", "
+                << Histogram::quantile(arm->buckets, 0.99) << ", "
+                << (arm.get() == self.m_winner ? 1 : 0) << std::endl;
+        }
+    }
+
+    /** \brief Get the number of rounds that converged so far.
+     *
+     * \return  Number of rounds.
+     */
+    static unsigned rounds()
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        return self.m_rounds;
+    }
+
+private:
+    // Registered variant and its statistics of the current round.
+    struct Arm {
+        // Variant.
+        Function        fn;
+        // Label of the variant.
+        const char*     label;
+        // Counter name.
+        std::string     count_name;
+        // Timer name.
+        std::string     time_name;
+        // Number of timed calls.
+        Counter         counter;
+        // Time spent in timed calls.
+        Timer           timer;
+        // Number of calls this round.
+        std::uint64_t   trials;
+        // Sum of durations this round in ns.
+        double          sum;
+        // Sum of squared durations this round in ns^2.
+        double          sum_squares;
+        // Duration histogram of this round, for dump().
+        std::uint64_t   buckets[Histogram::bucket_count];
+        // Uniform sample of the durations of this round in ns.
+        std::vector<std::uint64_t>  samples;
+
+        void reset() noexcept
+        {
+            trials = 0;
+            sum = 0.0;
+            sum_squares = 0.0;
+            for (auto& bucket : buckets) {
+                bucket = 0;
+            }
+            samples.clear();
+        }
+
+        // Exact median of the sampled durations, the maximum if there are none.
+        std::uint64_t median() const
+        {
+            if (samples.empty()) {
+                return std::numeric_limits<std::uint64_t>::max();
+            }
+
+            std::vector<std::uint64_t> sorted{samples};
+            const auto middle = sorted.begin() + sorted.size() / 2;
+            std::nth_element(sorted.begin(), middle, sorted.end());
+            return *middle;
+        }
+    };
+
+    // Times a call of an arm while exploring, recording it on destruction.
+    class Trial {
+    public:
+        explicit Trial(Arm& arm) noexcept
+        : m_arm{arm}, m_start{Stopwatch::Clock::now()}
+        {}
+        ~Trial()
+        {
+            const auto dur = std::chrono::duration_cast<Timer::duration>(
+                Stopwatch::Clock::now() - m_start
+            );
+
+            ++m_arm.counter;
+            m_arm.timer += dur;
+            instance().record(m_arm, dur);
+        }
+
+        // No copy constructor.
+        Trial(const Trial&) = delete;
+        // No copy assignment operator.
+        Trial& operator=(const Trial&) = delete;
+
+    private:
+        // Timed arm.
+        Arm&                    m_arm;
+        // Time of entry.
+        Stopwatch::time_point   m_start;
+    };
+
+    Autotune()
+    : m_lock{}, m_options{}, m_arms{}, m_trials{0}, m_winner{nullptr}, m_converged{},
+      m_rounds{0}, m_hooked{false}, m_random{0x9E3779B97F4A7C15u}, m_hook{}
+    {}
+
+    static Autotune& instance()
+    {
+        static Autotune instance;
+        return instance;
+    }
+
+    // Dispatch pointer, constant-initialized so that call() never goes through a guard.
+    ALWAYS_INLINE static std::atomic<Function>& dispatch() noexcept
+    {
+        static std::atomic<Function> fn{&explore};
+        return fn;
+    }
+
+    // Dispatch target while exploring.
+    static R explore(Args... args)
+    {
+        auto& arm = instance().choose();
+        const Trial trial{arm};
+        return arm.fn(std::forward<Args>(args)...);
+    }
+
+    // Pick the arm to try next.
+    Arm& choose()
+    {
+        std::lock_guard<std::mutex> lock{m_lock};
+
+        // CONTRACT: At least one variant was added.
+        assert(!m_arms.empty());
+
+        // Every arm gets its warmup calls before the statistics are trusted. At least one, as the
+        // bounds below are undefined without trials.
+        const auto warmup = std::max(1u, m_options.warmup);
+        Arm* best = nullptr;
+        for (const auto& arm : m_arms) {
+            if (arm->trials < warmup && (!best || arm->trials < best->trials)) {
+                best = arm.get();
+            }
+        }
+        if (best) {
+            return *best;
+        }
+
+        // The duration is to be minimized, so being optimistic means using the lower bound.
+        auto best_bound = std::numeric_limits<double>::infinity();
+        for (const auto& arm : m_arms) {
+            const auto n = static_cast<double>(arm->trials);
+            const auto mean = arm->sum / n;
+            const auto variance = arm->sum_squares / n - mean * mean;
+            const auto error = std::sqrt(variance > 0.0 ? variance / n : 0.0);
+            const auto bound = mean - m_options.confidence * error;
+            if (bound < best_bound) {
+                best_bound = bound;
+                best = arm.get();
+            }
+        }
+        return *best;
+    }
+
+    // Record a timed call, converging once the round's budget is spent.
+    void record(Arm& arm, Timer::duration dur)
+    {
+        std::lock_guard<std::mutex> lock{m_lock};
+
+        // Calls that were already dispatched when the round converged are not recorded.
+        if (m_winner) {
+            return;
+        }
+
+        const auto ns = static_cast<double>(dur.count());
+        ++arm.trials;
+        arm.sum += ns;
+        arm.sum_squares += ns * ns;
+        ++arm.buckets[Histogram::bucket(static_cast<std::uint64_t>(dur.count()))];
+
+        // Reservoir sampling keeps every duration of the round with the same probability.
+        const auto reservoir = std::max(1u, m_options.reservoir);
+        if (arm.samples.size() < reservoir) {
+            arm.samples.push_back(static_cast<std::uint64_t>(dur.count()));
+        } else {
+            const auto slot = random() % arm.trials;
+            if (slot < reservoir) {
+                arm.samples[slot] = static_cast<std::uint64_t>(dur.count());
+            }
+        }
+
+        if (++m_trials < m_options.budget) {
+            return;
+        }
+        const auto warmup = std::max(1u, m_options.warmup);
+        for (const auto& other : m_arms) {
+            if (other->trials < warmup) {
+                return;
+            }
+        }
+
+        // Ties go to the arm with the lower mean.
+        auto best_median = std::numeric_limits<std::uint64_t>::max();
+        auto best_mean = std::numeric_limits<double>::infinity();
+        for (const auto& other : m_arms) {
+            const auto median = other->median();
+            const auto mean = other->sum / static_cast<double>(other->trials);
+            if (median < best_median || (median == best_median && mean < best_mean)) {
+                best_median = median;
+                best_mean = mean;
+                m_winner = other.get();
+            }
+        }
+
+        m_converged = Stopwatch::Clock::now();
+        ++m_rounds;
+        dispatch().store(m_winner->fn, std::memory_order_release);
+    }
+
+    // Next number of a xorshift64 generator.
+    std::uint64_t random() noexcept
+    {
+        m_random ^= m_random << 13;
+        m_random ^= m_random >> 7;
+        m_random ^= m_random << 17;
+        return m_random;
+    }
+
+    // Sampler hook, re-exploring once the period after convergence passed.
+    void tick(Stopwatch::time_point now)
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_lock};
+            if (!m_winner || m_options.period.count() == 0
+                || now - m_converged < m_options.period) {
+                return;
+            }
+        }
+
+        reexplore();
+    }
+
+    // Guards everything but the dispatch pointer.
+    std::mutex                          m_lock;
+    // Exploration settings.
+    Options                             m_options;
+    // Registered variants.
+    std::vector<std::unique_ptr<Arm>>   m_arms;
+    // Number of calls recorded this round.
+    unsigned                            m_trials;
+    // Winner of the last round, nullptr while exploring.
+    Arm*                                m_winner;
+    // Time the last round converged.
+    Stopwatch::time_point               m_converged;
+    // Number of rounds that converged.
+    unsigned                            m_rounds;
+    // True once the Sampler hook was added.
+    bool                                m_hooked;
+    // State of the reservoir sampling generator.
+    std::uint64_t                       m_random;
+    // Sampler hook, constructs the Sampler so that it outlives this.
+    Sampler::Hook                       m_hook;
+};
+
+/** \brief Get the Autotune of a name.
+ *
+ * \param   name        Name string literal of the Autotune.
+ * \param   signature   Function type of the variants.
+ */
+#define MINPROF_AUTOTUNE(name, signature) ::minprof::Autotune<typestring_is(name), signature>
+
+}
+
+/* Exemplary usage:
+ *
+ * Register the variants at startup:
+ *
+ * using Sum = MINPROF_AUTOTUNE("sum", float(const float*, std::size_t));
+ * Sum::add("scalar", &sum_scalar);
+ * Sum::add("avx2", &sum_avx2);
+ *
+ * Call the fastest one:
+ *
+ * const auto total = Sum::call(data, size);
+ *
+ * See how the variants did in the current round:
+ *
+ * Sum::dump(std::cout);
+ *
+ * And let the Sampler start a new round every 30s:
+ *
+ * minprof::Sampler::start();
+ *
+ */
+
+#endif
@@ -0,0 +1,466 @@
+/** \brief Per-section concurrency profiles for the minimal profiler.
+ *
+ * \file    minprof/concurrency.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_CONCURRENCY_HH_
+#define MINPROF_CONCURRENCY_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Counter
+// minprof::Timer
+// minprof::Section
+// minprof::StaticCounter
+// minprof::StaticCounterRegistry
+#include "sampler.hh"
+// minprof::Sampler
+
+#include <cstdint>
+// std::int64_t
+// std::uint64_t
+
+#include <ostream>
+// std::ostream
+// std::endl
+#include <string>
+// std::string
+
+namespace minprof {
+
+/** \brief Number of threads inside a section, at present and at peak.
+ *
+ * The threads inside the section are counted in the thread-local slots of a gauge, named
+ * "minprof.inflight.<section>|G", which every thread only increments on entering and decrements
+ * on leaving. The hot path thus never writes a shared cache line; it only reads the time of the
+ * first entry, which is written once.
+ *
+ * The average concurrency follows from Little's law as the time spent in the section divided by
+ * the wall time since it was first entered. Everything else, including the peak, is sampled by the
+ * ConcurrencyRegistry, which sums up the slots of the gauge.
+ */
+class Concurrency {
+public:
+    /** \brief Initialize a new Concurrency. */
+    constexpr Concurrency() noexcept
+    : m_inflight{0}, m_max{0}, m_first{0}, m_samples{0}, m_busy{0}, m_alone{0}, m_sum{0}
+    {}
+
+    // No copy constructor.
+    Concurrency(const Concurrency&) = delete;
+    // No copy assignment operator.
+    Concurrency& operator=(const Concurrency&) = delete;
+    // No move constructor.
+    Concurrency(Concurrency&&) = delete;
+    // No move assignment operator.
+    Concurrency& operator=(Concurrency&&) = delete;
+
+    /** \brief Count the calling thread entering the section.
+     *
+     * \param   [in,out]    slot    The calling thread's slot of the section's gauge.
+     */
+    ALWAYS_INLINE void enter(Counter& slot) noexcept
+    {
+        ++slot;
+        if (m_first.load(std::memory_order_relaxed) == 0) {
+            start();
+        }
+    }
+    /** \brief Count the calling thread leaving the section.
+     *
+     * \param   [in,out]    slot    The calling thread's slot of the section's gauge.
+     */
+    ALWAYS_INLINE void leave(Counter& slot) noexcept
+    {
+        // The slot wraps around to its value before enter().
+        slot += static_cast<Counter::value_type>(-1);
+    }
+
+    /** \brief Get the number of threads inside the section at the last sample.
+     *
+     * \return  Sampled in-flight count.
+     */
+    std::uint64_t inflight() const noexcept
+    {
+        return m_inflight.load(std::memory_order_relaxed);
+    }
+    /** \brief Get the largest number of threads that were sampled inside the section at once.
+     *
+     * \return  Sampled peak in-flight count.
+     */
+    std::uint64_t max() const noexcept
+    {
+        return m_max.load(std::memory_order_relaxed);
+    }
+    /** \brief Get the time the section was first entered.
+     *
+     * \return  Nanoseconds since the Stopwatch::Clock epoch, 0 if never entered.
+     */
+    std::int64_t first() const noexcept
+    {
+        return m_first.load(std::memory_order_relaxed);
+    }
+
+    /** \brief Take a sample of the in-flight count.
+     *
+     * Must not be called concurrently, see ConcurrencyRegistry::sample().
+     *
+     * \param   [in]    inflight    Sum of the slots of the section's gauge.
+     */
+    void sample(std::uint64_t inflight) noexcept
+    {
+        m_inflight.store(inflight, std::memory_order_relaxed);
+        if (inflight > m_max.load(std::memory_order_relaxed)) {
+            m_max.store(inflight, std::memory_order_relaxed);
+        }
+
+        m_samples.store(m_samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (inflight > 0) {
+            m_busy.store(m_busy.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            m_sum.store(m_sum.load(std::memory_order_relaxed) + inflight,
+                        std::memory_order_relaxed);
+        }
+        if (inflight == 1) {
+            m_alone.store(m_alone.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+    /** \brief Get the number of samples taken.
+     *
+     * \return  Number of samples.
+     */
+    std::uint64_t samples() const noexcept
+    {
+        return m_samples.load(std::memory_order_relaxed);
+    }
+    /** \brief Get the number of samples with at least one thread inside the section.
+     *
+     * \return  Number of busy samples.
+     */
+    std::uint64_t busy() const noexcept
+    {
+        return m_busy.load(std::memory_order_relaxed);
+    }
+    /** \brief Get the number of samples with exactly one thread inside the section.
+     *
+     * \return  Number of samples the section ran alone.
+     */
+    std::uint64_t alone() const noexcept
+    {
+        return m_alone.load(std::memory_order_relaxed);
+    }
+    /** \brief Get the sum of the in-flight counts of all samples.
+     *
+     * \return  Sum of in-flight counts.
+     */
+    std::uint64_t sum() const noexcept
+    {
+        return m_sum.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Note the first entry.
+    void start() noexcept
+    {
+        std::int64_t none = 0;
+        const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Stopwatch::Clock::now().time_since_epoch()
+        ).count();
+        m_first.compare_exchange_strong(none, now, std::memory_order_relaxed);
+    }
+
+    // Number of threads inside the section at the last sample.
+    std::atomic<std::uint64_t>  m_inflight;
+    // Peak number of threads inside the section over all samples.
+    std::atomic<std::uint64_t>  m_max;
+    // Time of the first entry.
+    std::atomic<std::int64_t>   m_first;
+    // Number of samples.
+    std::atomic<std::uint64_t>  m_samples;
+    // Number of samples with the section in use.
+    std::atomic<std::uint64_t>  m_busy;
+    // Number of samples with a single thread inside the section.
+    std::atomic<std::uint64_t>  m_alone;
+    // Sum of in-flight counts over all samples.
+    std::atomic<std::uint64_t>  m_sum;
+};
+
+/** \brief Static container for the global Concurrency of a section.
+ *
+ * Like StaticCounter, instanciating this template creates and registers a global Concurrency.
+ *
+ * \tparam  Name    typestring of the section's Timer name, i.e. ending in "|T".
+ * \tparam  Gauge   typestring of the section's in-flight gauge, i.e. ending in "|G".
+ */
+template<typename Name, typename Gauge>
+class StaticConcurrency {
+public:
+    // Assert that a typestring was passed.
+    static_assert(irqus::is_typestring<Name>::value, "Name must be a typestring!");
+    // Assert that a typestring was passed.
+    static_assert(irqus::is_typestring<Gauge>::value, "Gauge must be a typestring!");
+
+    /** \brief Index of the concurrency in the static registration vector. */
+    static const unsigned index;
+
+public:
+    // No (default) constructor.
+    StaticConcurrency() = delete;
+
+    /** \brief Get the global Concurrency instance.
+     *
+     * \return  Global Concurrency instance.
+     */
+    ALWAYS_INLINE static Concurrency& get() noexcept
+    {
+        static Concurrency instance;
+
+        // Force the registration, see StaticCounter::get().
+        (void)index;
+
+        return instance;
+    }
+    /** \brief Get the calling thread's slot of the in-flight gauge.
+     *
+     * \return  Thread-local Counter instance.
+     */
+    ALWAYS_INLINE static Counter& local()
+    {
+        return StaticCounter<Gauge>::local();
+    }
+};
+
+/** \brief Static registry for the StaticConcurrency types instanciated.
+ *
+ * Once started, every Sampler snapshot sums up the in-flight gauge of every section.
+ */
+class ConcurrencyRegistry {
+public:
+    // No copy constructor.
+    ConcurrencyRegistry(const ConcurrencyRegistry&) = delete;
+    // No copy assignment operator.
+    ConcurrencyRegistry& operator=(const ConcurrencyRegistry&) = delete;
+    // No move constructor.
+    ConcurrencyRegistry(ConcurrencyRegistry&&) = delete;
+    // No move assignment operator.
+    ConcurrencyRegistry& operator=(ConcurrencyRegistry&&) = delete;
+
+    /** \brief Register a StaticConcurrency.
+     *
+     * \tparam  typestring Name of the section's Timer.
+     * \tparam  typestring Name of the section's in-flight gauge.
+     *
+     * \return  Index within the static registry.
+     */
+    template<typename Name, typename Gauge>
+    static unsigned register_concurrency()
+    {
+        auto& self = instance();
+
+        self.m_names.push_back(Name::data());
+        // The indices may not be initialized yet, as static initialization order is unspecified.
+        self.m_timers.push_back(&StaticCounter<Name>::index);
+        self.m_gauges.push_back(&StaticCounter<Gauge>::index);
+        self.m_instances.push_back(&StaticConcurrency<Name, Gauge>::get());
+
+        return self.m_instances.size() - 1;
+    }
+
+    /** \brief Sample all sections after every Sampler snapshot.
+     *
+     * Does nothing if already started.
+     */
+    static void start()
+    {
+        auto& self = instance();
+        if (self.m_started.exchange(true)) {
+            return;
+        }
+
+        self.m_hook.set([](Stopwatch::time_point) { sample(); });
+    }
+    /** \brief Sample the in-flight count of all sections now.
+     *
+     * Called by the Sampler once started, but may also be called directly. Must not be called
+     * concurrently.
+     */
+    static void sample()
+    {
+        const auto& self = instance();
+
+        for (unsigned idx = 0; idx < self.m_instances.size(); ++idx) {
+            self.m_instances[idx]->sample(StaticCounterRegistry::total(*self.m_gauges[idx]));
+        }
+    }
+
+    /** \brief Dump the concurrency profile of all sections to the specified stream as CSV.
+     *
+     * CSV format is:
+     * <name>, <average>, <busy average>, <max>, <alone>, <busy> <endl>
+     *
+     * - average: Mean number of threads inside the section since it was first entered.
+     * - busy average: Mean number of threads inside the section while it was in use (sampled).
+     * - max: Peak number of threads inside the section (sampled).
+     * - alone: Share of the in-use time the section ran on a single thread (sampled).
+     * - busy: Share of the time the section was in use at all (sampled).
+     *
+     * A section that is busy most of the time but runs alone, although called from many threads,
+     * is effectively serialized, and thus limits the speedup of the whole program.
+     *
+     * \param   [in,out]    out     Output stream.
+     */
+    static void dump(std::ostream& out)
+    {
+        StaticCounterRegistry::flush();
+        const auto& self = instance();
+        const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Stopwatch::Clock::now().time_since_epoch()
+        ).count();
+
+        for (unsigned idx = 0; idx < self.m_instances.size(); ++idx) {
+            const auto& concurrency = *self.m_instances[idx];
+            const auto first = concurrency.first();
+            if (first == 0) {
+                continue;
+            }
+
+            const auto timer = *self.m_timers[idx];
+            const auto time = static_cast<double>(StaticCounterRegistry::total(timer));
+            const auto wall = static_cast<double>(now - first);
+            const auto busy = static_cast<double>(concurrency.busy());
+            const auto samples = static_cast<double>(concurrency.samples());
+
+            // Strip the "|T" suffix.
+            const std::string name{self.m_names[idx]};
+            out << name.substr(0, name.size() - 2) << ", " << (wall > 0.0 ? time / wall : 0.0)
+                << ", " << (busy > 0.0 ? static_cast<double>(concurrency.sum()) / busy : 0.0)
+                << ", " << concurrency.max()
+                << ", " << (busy > 0.0 ? static_cast<double>(concurrency.alone()) / busy : 0.0)
+                << ", " << (samples > 0.0 ? busy / samples : 0.0) << std::endl;
+        }
+    }
+
+private:
+    ConcurrencyRegistry()
+    : m_started{false}, m_names{}, m_timers{}, m_gauges{}, m_instances{}, m_hook{}
+    {}
+
+    static ConcurrencyRegistry& instance() noexcept
+    {
+        static ConcurrencyRegistry instance;
+        return instance;
+    }
+
+    // True once the Sampler hook was added.
+    std::atomic<bool>            m_started;
+    // Vector of registered Timer names.
+    std::vector<const char*>     m_names;
+    // Vector of registered Timer indices.
+    std::vector<const unsigned*> m_timers;
+    // Vector of registered in-flight gauge indices.
+    std::vector<const unsigned*> m_gauges;
+    // Vector of registered concurrencies.
+    std::vector<Concurrency*>    m_instances;
+    // Sampler hook, constructs the Sampler so that it outlives this.
+    Sampler::Hook                m_hook;
+};
+
+template<typename Name, typename Gauge>
+const unsigned StaticConcurrency<Name, Gauge>::index =
+    ConcurrencyRegistry::register_concurrency<Name, Gauge>();
+
+/** \brief Section tracker that also counts the threads inside it. */
+class ConcurrencySection : private Section {
+public:
+    /** \brief Initialize, trigger, time and enter a new ConcurrencySection.
+     *
+     * \param   [in,out]    c       Counter for section.
+     * \param   [in,out]    t       Timer for section.
+     * \param   [in,out]    k       Concurrency for section.
+     * \param   [in,out]    g       The calling thread's slot of the section's in-flight gauge.
+     * \param   [in]        name    Name of the section, must outlive it.
+     */
+    ConcurrencySection(Counter& c, Timer& t, Concurrency& k, Counter& g,
+                       const char* name = nullptr) noexcept
+    : Section{c, t, name}, m_concurrency{k}, m_slot{g}
+    {
+        m_concurrency.enter(m_slot);
+    }
+    /** \brief Leave, stop, retire and destroy a ConcurrencySection. */
+    ~ConcurrencySection()
+    {
+        m_concurrency.leave(m_slot);
+    }
+
+    // No copy constructor.
+    ConcurrencySection(const ConcurrencySection&) = delete;
+    // No copy assignment.
+    ConcurrencySection& operator=(const ConcurrencySection&) = delete;
+
+    // No move constructor.
+    ConcurrencySection(ConcurrencySection&&) = delete;
+    // No move assignment.
+    ConcurrencySection& operator=(ConcurrencySection&&) = delete;
+
+    // Hack to make use of if-condition initialization scoping.
+    operator bool() const noexcept
+    {
+        return true;
+    }
+
+private:
+    // Backing Concurrency.
+    Concurrency&    m_concurrency;
+    // The calling thread's slot of the in-flight gauge.
+    Counter&        m_slot;
+};
+
+/** \brief StaticConcurrency type of a section.
+ *
+ * As the in-flight gauge prefixes the name, section names are limited to 45 characters here.
+ *
+ * \param   name    Name string literal of the section.
+ */
+#define MINPROF_STATIC_CONCURRENCY(name)\
+::minprof::StaticConcurrency<typestring_is(name "|T"), typestring_is("minprof.inflight." name "|G")>
+
+/** \brief Get the global Concurrency of a section.
+ *
+ * \param   name    Name string literal of the section.
+ */
+#define MINPROF_CONCURRENCY(name)   MINPROF_STATIC_CONCURRENCY(name)::get()
+
+/** \brief Dump the concurrency profiles of all sections. */
+#define MINPROF_DUMP_CONCURRENCY    ::minprof::ConcurrencyRegistry::dump
+
+/** \brief Profile the following statement (-block), including its concurrency.
+ *
+ * Like MINPROF_SECTION, but also tracks how many threads are inside the section at once.
+ *
+ * \param   name    Name string literal of the section.
+ */
+#define MINPROF_CONCURRENT_SECTION(name)\
+if (::minprof::ConcurrencySection __concurrency_ ## __LINE__ {MINPROF_COUNTER(name "|C"),\
+    MINPROF_TIMER(name "|T"), MINPROF_CONCURRENCY(name), MINPROF_STATIC_CONCURRENCY(name)::local(),\
+    name})
+
+}
+
+/* Exemplary usage:
+ *
+ * Track the concurrency of a section:
+ *
+ * MINPROF_CONCURRENT_SECTION("mySection") {
+ *      doStuff();
+ * }
+ *
+ * Sample the in-flight counts for the busy and alone shares, and dump the profile:
+ *
+ * minprof::ConcurrencyRegistry::start();
+ * minprof::Sampler::start();
+ * ...
+ * MINPROF_DUMP_CONCURRENCY(std::cout);
+ *
+ */
+
+#endif
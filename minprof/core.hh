@@ -0,0 +1,2160 @@
+/** \brief Core of the minimal profiler: counters, timers, sections and their registry.
+ *
+ * Everything needed to count and time, without the stream headers pulled in by reporting. Include
+ * this instead of minprof.hh in translation units that only instrument code or dump. The dumps are
+ * compiled by the one translation unit of the program that defines MINPROF_IMPLEMENTATION before
+ * including minprof.hh (or minprof/report.hh).
+ *
+ * Requires the typestring header.
+ *
+ * \file    minprof/core.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_CORE_HH_
+#define MINPROF_CORE_HH_
+#pragma once
+
+// Uses the typestring header to provide compile-time constant naming for StaticCounter instances.
+#include "typestring.hh"
+// irqus::typestring
+// typestring_is
+
+#include <cstddef>
+// std::size_t
+#include <cstdint>
+// std::uint64_t
+#include <cassert>
+// assert
+#include <cstring>
+// std::strcmp
+// std::strncmp
+// std::strlen
+// std::strrchr
+// std::memset
+#include <cstdlib>
+// std::getenv
+// std::strtoul
+#include <cstdio>
+// std::fopen
+// std::fscanf
+// std::fclose
+#include <new>
+// placement new
+
+#include <type_traits>
+// std::enable_if
+// std::is_same
+// std::is_convertible
+
+#include <atomic>
+// std::atomic
+#include <mutex>
+// std::mutex
+// std::lock_guard
+
+#include <ratio>
+// std::nano
+#include <chrono>
+// std::chrono::duration
+// std::chrono::duration_cast
+// std::chrono::high_resolution_clock
+
+#include <vector>
+// std::vector
+#include <iosfwd>
+// std::ostream
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <pthread.h>
+// pthread_self
+// pthread_getname_np
+#define MINPROF_HAS_THREAD_NAMES
+#endif
+
+#if defined(__linux__)
+#include <unistd.h>
+// syscall
+#include <sys/syscall.h>
+// SYS_getcpu
+// SYS_mbind
+#include <sys/mman.h>
+// mmap
+#define MINPROF_HAS_NUMA
+#endif
+
+#if defined(__ELF__) && (defined(__GNUC__) || defined(__clang__))
+/** \brief Get the calling thread's active section slot of the LD_PRELOAD shim.
+ *
+ * Only defined if libminprof-preload.so is loaded (see minprof/preload.cc), otherwise the weak
+ * reference resolves to nullptr.
+ *
+ * \return  Thread-local slot holding the name of the innermost active section.
+ */
+extern "C" const char** minprof_preload_active() __attribute__((weak));
+#define MINPROF_HAS_PRELOAD_HOOK
+#endif
+
+/* Compiler-independent inlining attributes:
+ *
+ * Correct operation of this library requires certain functions to be inlined at all costs in order
+ * to remain branch-free and without any calls during the profiled paths. The macros here provide a
+ * standardized way to achieve this.
+ */
+#if defined(__GNUC__)
+// G++ supports attribute.
+#define ALWAYS_INLINE   inline __attribute__((always_inline))
+#elif defined(__clang__)
+// Clang supports attribute.
+#define ALWAYS_INLINE   inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+// MSVC supports intrinsic.
+#define ALWAYS_INLINE   __forceinline
+#endif
+
+namespace irqus {
+
+/* Trait for using typestrings:
+ *
+ * To write more concise code, this trait checks that a provided type is a typestring instanciation.
+ */
+
+template<typename T>
+struct is_typestring : std::integral_constant<bool, false> {};
+
+template<char... C>
+struct is_typestring<typestring<C...>> : std::integral_constant<bool, true> {};
+
+}
+
+/** \brief Minimal profiler namespace.
+ *
+ * The minimal profiler aims to provide a standard and easy way to conduct minimal profiling in a
+ * thread-safe and global manner throught an application. It's main focuses are lightweight timing
+ * and ease of use.
+ *
+ * The profiler exploits static lifetimes to provide global counters based on atomic 64-bit integers
+ * that can usually be efficiently incremented on modern architectures. The static registry uses the
+ * statically initialized counter types to effortlessly keep track of all instances used throught
+ * the application without the need for calling anything or providing an entry-point. All counters
+ * are registered on static init time and are therefore presents right from the start of the
+ * application.
+ *
+ * Some defined macros make the use of this library easier by wrapping boilerplate without actually
+ * modifying control flow or register use at the target site.
+ */
+namespace minprof {
+
+/** \brief Atomic 64-bit counter used by the minimal profiler.
+ *
+ * Provides a simple wrapper around an atomic unsigned 64-bit integer useful for profiling.
+ *
+ * The interface of this class limits it's use to monotonic behaviour, meaning that the value can
+ * only ever be increased.
+ */
+class Counter {
+public:
+    /** \brief Type that can hold the value of the Counter. */
+    using value_type    = std::uint64_t;
+    /** \brief Type that allows for atomic operations on the value. */
+    using atomic_type   = std::atomic<value_type>;
+
+public:
+    /** \brief Initialize a new Counter at 0.
+     *
+     * Because of the constexpr modifier, this type becomes eligible for constant initialization.
+     */
+    constexpr Counter() noexcept
+    : Counter{0}
+    {}
+    /** \brief Initialize a new Counter.
+     *
+     * \param   [in]    init    Initial value.
+     */
+    constexpr Counter(value_type init) noexcept
+    : m_value{init}
+    {}
+    /** \brief Copy a Counter.
+     *
+     * \param   [in]    copy    Counter to copy.
+     */
+    Counter(const Counter& copy) noexcept
+    : Counter{copy.value()}
+    {}
+    // No move constructor.
+    Counter(Counter&&) = delete;
+
+public:
+    /** \brief Copy a Counter.
+     *
+     * \param   [in]    copy    Counter to copy.
+     * \return  *this.
+     */
+    Counter& operator=(const Counter& copy) noexcept
+    {
+        m_value = copy;
+        return *this;
+    }
+    // No move assignment operator.
+    Counter& operator=(Counter&&) = delete;
+
+    /** \brief Get the current value of this Counter.
+     *
+     * \return  Current Counter value.
+     */
+    value_type value() const noexcept
+    {
+        return m_value;
+    }
+    /** \brief Implicitly get the current Counter value.
+     *
+     * \return  Current Counter value.
+     */
+    operator value_type() const noexcept
+    {
+        return value();
+    }
+
+    /** \brief Increment the Counter by 1.
+     *
+     * \return  Counter value before increment.
+     */
+    value_type operator++(int) noexcept
+    {
+        return m_value.fetch_add(1);
+    }
+    /** \brief Increment the Counter by 1 and get it's previous value.
+     *
+     * \return  *this.
+     */
+    Counter& operator++() noexcept
+    {
+        ++m_value;
+        return *this;
+    }
+
+    /** \brief Increment the Counter by a specified amount.
+     *
+     * \param   [in]    amount  Amount to increment by.
+     * \return  *this.
+     */
+    Counter& operator+=(value_type amount) noexcept
+    {
+        m_value += amount;
+        return *this;
+    }
+
+protected:
+    /** \brief Overwrite the value, for derived types that are not monotonic.
+     *
+     * \param   [in]    value   New value.
+     */
+    void store(value_type value) noexcept
+    {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+
+private:
+    // Internal counter value.
+    atomic_type     m_value;
+};
+
+/** \brief Atomic 64-bit nanosecond timer used by the minimal profiler.
+ *
+ * Timers are specialized Counters that do not add any more data, but have a timing-oriented
+ * interface. They use the backing Counter to store nanosecond durations that can only monotonously
+ * increase in value.
+ *
+ * The Timer interface includes overloads for use with the chrono library accepting any durations,
+ * but will perform rounding to nanosecond durations. As only positive values can be stored, wrap
+ * around occurs on negative values.
+ */
+class Timer : public Counter {
+public:
+    /** \brief Interval precision of the Timer. */
+    using period    = std::nano;
+    /** \brief Duration type used by the Timer. */
+    using duration  = std::chrono::duration<value_type, period>;
+
+public:
+    /** \brief Initialize a new Timer at 0ns elapsed.
+     *
+     * Because of the constexpr modifier, this type becomes eligible for constant initialization.
+     */
+    constexpr Timer() noexcept
+    : Timer{duration::zero()}
+    {}
+    /** \brief Initialize a new Timer.
+     *
+     * \param   [in]    init    Initial value.
+     */
+    constexpr Timer(duration init) noexcept
+    : Counter{init.count()}
+    {}
+    /** \brief Initialize a new Timer.
+     *
+     * If \p init is negative, the behaviour is undefined.
+     * Might include possible loss of precision and/or rounding.
+     *
+     * Does not partake in overload resolution when the duration type is compatible to the native
+     * type, i.e. implicitly convertible to duration.
+     *
+     * \param   [in]    init    Initial value.
+     */
+    template<
+        typename Rep,
+        typename Period,
+        typename = typename std::enable_if<
+            !std::is_convertible<std::chrono::duration<Rep, Period>, duration>::value
+        >::type
+    >
+    Timer(std::chrono::duration<Rep, Period> init)
+    : Timer{std::chrono::duration_cast<duration>(init)}
+    {
+        // CONTRACT: Verify that the value is in fact positive.
+        assert(init.count() > 0);
+    }
+    /** \brief Copy a Timer.
+     *
+     * \param   [in]    copy    Timer to copy.
+     */
+    Timer(const Timer& copy) noexcept
+    : Counter{copy}
+    {}
+    // No move constructor.
+    Timer(Timer&&) = delete;
+
+public:
+    /** \brief Copy a Timer.
+     *
+     * \param   [in]    copy    Timer to copy.
+     * \return  *this.
+     */
+    Timer& operator=(const Timer& copy) noexcept
+    {
+        Counter::operator=(copy);
+        return *this;
+    }
+    // No move assignment operator.
+    Timer& operator=(Timer&&) = delete;
+
+    /** \brief Get the current value of this Timer.
+     *
+     * \return  Current Timer value.
+     */
+    duration value() const noexcept
+    {
+        return duration{Counter::value()};
+    }
+    /** \brief Implicitly get the current Timer value.
+     *
+     * \return  Current Timer value.
+     */
+    operator duration() const noexcept
+    {
+        return value();
+    }
+
+    /** \brief Increment this timer.
+     *
+     * \param   [in]    dur     Duration to increment by.
+     * \return  *this.
+     */
+    Timer& operator+=(duration dur) noexcept
+    {
+        Counter::operator+=(dur.count());
+        return *this;
+    }
+    /** \brief Increment this timer.
+     *
+     * If \p dur is negative, the behaviour is undefined.
+     * Might include possible loss of precision and/or rounding.
+     *
+     * Does not partake in overload resolution when the duration type is compatible to the native
+     * type, i.e. implicitly convertible to duration.
+     *
+     * \param   [in]    dur     Duration to increment by.
+     * \return  *this.
+     */
+    template<
+        typename Rep,
+        typename Period,
+        typename = typename std::enable_if<
+            !std::is_convertible<std::chrono::duration<Rep, Period>, duration>::value
+        >::type
+    >
+    Timer& operator+=(std::chrono::duration<Rep, Period> dur)
+    {
+        return *this += std::chrono::duration_cast<duration>(dur);
+    }
+};
+
+/** \brief Atomic 64-bit gauge used by the minimal profiler.
+ *
+ * Gauges are specialized Counters that hold a level rather than a count, such as a memory size,
+ * and may therefore also decrease. As they do not add any data, they can be registered and dumped
+ * like any other Counter. By convention, gauge names end in "|G".
+ *
+ * Gauges are only meaningful as shared Counters; they must not be used with thread-local slots.
+ */
+class Gauge : public Counter {
+public:
+    /** \brief Initialize a new Gauge.
+     *
+     * \param   [in]    init    Initial value.
+     */
+    constexpr Gauge(value_type init = 0) noexcept
+    : Counter{init}
+    {}
+
+    /** \brief Set the value of this Gauge.
+     *
+     * \param   [in]    value   New value.
+     */
+    void set(value_type value) noexcept
+    {
+        store(value);
+    }
+};
+
+/** \brief Unit of the values held by a registered Counter.
+ *
+ * Every StaticCounter is tagged with a unit at compile time, taken from the type suffix of its
+ * name (the part after the last '|'). The StaticCounterRegistry stores the tag and the length of
+ * the name without suffix at registration, so that reports can pair a section's counters and
+ * derive means and rates without looking at names again.
+ */
+enum class Unit : unsigned char {
+    /** \brief No known unit, e.g. gauges ("|G") and names without suffix. */
+    none,
+    /** \brief Number of events or calls, suffix "|C". */
+    count,
+    /** \brief Time in ns, suffix "|T". */
+    ns,
+    /** \brief Bytes, suffix "|B". */
+    bytes,
+    /** \brief Items processed, suffix "|N". */
+    items,
+    /** \brief Operations done, suffix "|O". */
+    ops
+};
+
+/** \brief Number of distinct Unit values. */
+constexpr unsigned unit_count = 6;
+
+/** \brief Get the name of a Unit.
+ *
+ * \param   [in]    unit    Unit.
+ * \return  Lowercase name, e.g. "ns".
+ */
+constexpr const char* unit_name(Unit unit) noexcept
+{
+    return unit == Unit::count ? "count"
+         : unit == Unit::ns ? "ns"
+         : unit == Unit::bytes ? "bytes"
+         : unit == Unit::items ? "items"
+         : unit == Unit::ops ? "ops"
+         : "none";
+}
+
+// Position of the last '|' in name[begin, end), or none if there is none. Splits the range in
+// halves, so that the recursion depth only grows logarithmically with the name length.
+constexpr std::size_t name_last_bar(const char* name, std::size_t begin, std::size_t end,
+                                    std::size_t none) noexcept;
+// Continuation of name_last_bar() with the result for the upper half.
+constexpr std::size_t name_last_bar(const char* name, std::size_t begin, std::size_t mid,
+                                    std::size_t none, std::size_t upper) noexcept
+{
+    return upper != none ? upper : name_last_bar(name, begin, mid, none);
+}
+constexpr std::size_t name_last_bar(const char* name, std::size_t begin, std::size_t end,
+                                    std::size_t none) noexcept
+{
+    return end - begin == 0 ? none
+         : end - begin == 1 ? (name[begin] == '|' ? begin : none)
+         : name_last_bar(name, begin, begin + (end - begin) / 2, none,
+                         name_last_bar(name, begin + (end - begin) / 2, end, none));
+}
+
+/** \brief Get the length of a counter name without its type suffix.
+ *
+ * \param   [in]    name    Counter name.
+ * \param   [in]    length  Length of \p name.
+ * \return  Position of the last '|', or \p length if there is none.
+ */
+constexpr std::size_t name_base_length(const char* name, std::size_t length) noexcept
+{
+    return name_last_bar(name, 0, length, length);
+}
+
+/** \brief Get the Unit of a counter name from its type suffix.
+ *
+ * \param   [in]    name    Counter name.
+ * \param   [in]    length  Length of \p name.
+ * \return  Unit, Unit::none for unknown suffixes.
+ */
+constexpr Unit name_unit(const char* name, std::size_t length) noexcept
+{
+    return name_base_length(name, length) + 2 != length ? Unit::none
+         : name[length - 1] == 'C' ? Unit::count
+         : name[length - 1] == 'T' ? Unit::ns
+         : name[length - 1] == 'B' ? Unit::bytes
+         : name[length - 1] == 'N' ? Unit::items
+         : name[length - 1] == 'O' ? Unit::ops
+         : Unit::none;
+}
+
+/** \brief NUMA topology as seen by the minimal profiler.
+ *
+ * Resolves the NUMA node of the calling thread, which is used to place per-thread storage on the
+ * local node and to aggregate values per node. Machines (or platforms) without NUMA support are
+ * treated as having a single node 0.
+ *
+ * For testing, a fake topology can be installed either through fake() or by setting the
+ * MINPROF_FAKE_NUMA environment variable to a comma-separated list of node numbers, one per CPU
+ * (e.g. "0,0,1,1" for 4 CPUs on 2 nodes). Fake topologies only affect bookkeeping, not placement.
+ */
+class Topology {
+public:
+    // No copy constructor.
+    Topology(const Topology&) = delete;
+    // No copy assignment operator.
+    Topology& operator=(const Topology&) = delete;
+    // No move constructor.
+    Topology(Topology&&) = delete;
+    // No move assignment operator.
+    Topology& operator=(Topology&&) = delete;
+
+    /** \brief Install a fake topology.
+     *
+     * Only affects threads attached after the call.
+     *
+     * \param   [in]    node_of_cpu Node number for every CPU, or empty to restore the real one.
+     */
+    static void fake(std::vector<unsigned> node_of_cpu)
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        self.m_fake = std::move(node_of_cpu);
+    }
+    /** \brief Check whether the current topology is fake.
+     *
+     * \retval  true    Topology is fake.
+     * \retval  false   Topology is real.
+     */
+    static bool is_fake()
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        return !self.m_fake.empty();
+    }
+
+    /** \brief Get the number of NUMA nodes.
+     *
+     * \return  Number of nodes, at least 1.
+     */
+    static unsigned node_count()
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        if (!self.m_fake.empty()) {
+            unsigned max = 0;
+            for (const auto node : self.m_fake) {
+                max = node > max ? node : max;
+            }
+            return max + 1;
+        }
+
+        return self.m_nodes;
+    }
+    /** \brief Get the NUMA node the calling thread currently runs on.
+     *
+     * Threads may migrate at any time, so this is a snapshot only.
+     *
+     * \return  Node number, 0 if unknown.
+     */
+    static unsigned current_node()
+    {
+        unsigned cpu = 0, node = 0;
+#if defined(MINPROF_HAS_NUMA)
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+            cpu = node = 0;
+        }
+#endif
+
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        if (!self.m_fake.empty()) {
+            return self.m_fake[cpu % self.m_fake.size()];
+        }
+
+        return node < self.m_nodes ? node : 0;
+    }
+
+    /** \brief Allocate zeroed memory preferably placed on the specified node.
+     *
+     * Uses fresh anonymous pages bound to \p node via mbind, which the calling thread then touches
+     * first. Falls back to the heap on single-node machines, fake topologies and other platforms.
+     *
+     * \param   [in]    size    Size in bytes.
+     * \param   [in]    node    Preferred NUMA node.
+     *
+     * \return  Pointer to the zeroed memory.
+     */
+    static void* allocate(std::size_t size, unsigned node)
+    {
+#if defined(MINPROF_HAS_NUMA)
+        if (node_count() > 1 && !is_fake()) {
+            const auto mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem != MAP_FAILED) {
+                // MPOL_PREFERRED falls back to other nodes instead of failing when out of memory.
+                // Failure to bind is not fatal, first-touch will usually do the right thing.
+                constexpr int mpol_preferred = 1;
+                unsigned long mask[4] = {};
+                const auto bits = sizeof(mask) * 8;
+                if (node < bits) {
+                    mask[node / (sizeof(*mask) * 8)] = 1ul << (node % (sizeof(*mask) * 8));
+                    (void)syscall(SYS_mbind, mem, size, mpol_preferred, mask, bits, 0);
+                }
+
+                // First touch from the owning thread.
+                std::memset(mem, 0, size);
+                return mem;
+            }
+        }
+#else
+        (void)node;
+#endif
+
+        const auto mem = ::operator new(size);
+        std::memset(mem, 0, size);
+        return mem;
+    }
+
+private:
+    Topology()
+    : m_lock{}, m_nodes{1}, m_fake{}
+    {
+#if defined(MINPROF_HAS_NUMA)
+        // Format is a CPU-list style range, e.g. "0" or "0-1". The highest node wins.
+        if (const auto online = std::fopen("/sys/devices/system/node/online", "r")) {
+            unsigned node = 0;
+            char sep = 0;
+            while (std::fscanf(online, "%u", &node) == 1) {
+                m_nodes = node + 1 > m_nodes ? node + 1 : m_nodes;
+                if (std::fscanf(online, "%c", &sep) != 1) {
+                    break;
+                }
+            }
+            std::fclose(online);
+        }
+#endif
+
+        if (const auto env = std::getenv("MINPROF_FAKE_NUMA")) {
+            for (auto it = env; *it != '\0';) {
+                char* end = nullptr;
+                const auto node = std::strtoul(it, &end, 10);
+                if (end == it) {
+                    break;
+                }
+                m_fake.push_back(static_cast<unsigned>(node));
+                it = *end == ',' ? end + 1 : end;
+            }
+        }
+    }
+
+    static Topology& instance()
+    {
+        static Topology instance;
+        return instance;
+    }
+
+    // Guards all fields.
+    std::mutex              m_lock;
+    // Number of real nodes.
+    unsigned                m_nodes;
+    // Fake node numbers per CPU, empty if real.
+    std::vector<unsigned>   m_fake;
+};
+
+/** \brief Increments buffered by a LocalCounter, published so that dumps can collect them.
+ *
+ * The owning thread publishes its running total with a plain relaxed store. Both the owner and a
+ * collecting dump push the difference to the flushed watermark into the backing Counter, after
+ * advancing the watermark by compare-and-swap, so that no increment is pushed twice.
+ */
+class PendingCount {
+public:
+    /** \brief Initialize a new PendingCount with nothing pending.
+     *
+     * \param   [in,out]    par     Backing Counter.
+     */
+    explicit PendingCount(Counter& par) noexcept
+    : m_par{par}, m_published{0}, m_flushed{0}, m_prev{nullptr}, m_next{nullptr}
+    {}
+
+    // No copy constructor.
+    PendingCount(const PendingCount&) = delete;
+    // No copy assignment operator.
+    PendingCount& operator=(const PendingCount&) = delete;
+
+    /** \brief Publish the running total of the owner.
+     *
+     * \param   [in]    total   Increments since construction.
+     */
+    ALWAYS_INLINE void publish(Counter::value_type total) noexcept
+    {
+        m_published.store(total, std::memory_order_relaxed);
+    }
+    /** \brief Get the running total already pushed into the backing Counter.
+     *
+     * \return  Flushed watermark.
+     */
+    Counter::value_type flushed() const noexcept
+    {
+        return m_flushed.load(std::memory_order_relaxed);
+    }
+
+    /** \brief Push increments up to a running total into the backing Counter.
+     *
+     * \param   [in]    total   Running total to flush up to.
+     */
+    void flush(Counter::value_type total) noexcept
+    {
+        auto flushed = m_flushed.load(std::memory_order_relaxed);
+        while (flushed < total && !m_flushed.compare_exchange_weak(flushed, total)) {
+        }
+        if (flushed < total) {
+            m_par += total - flushed;
+        }
+    }
+    /** \brief Push all published increments into the backing Counter, from any thread. */
+    void collect() noexcept
+    {
+        flush(m_published.load(std::memory_order_relaxed));
+    }
+
+private:
+    friend class ThreadStorage;
+
+    // Backing Counter.
+    Counter&                            m_par;
+    // Running total published by the owner.
+    std::atomic<Counter::value_type>    m_published;
+    // Running total pushed into the backing Counter.
+    std::atomic<Counter::value_type>    m_flushed;
+    // Neighbours in the list of the owning ThreadStorage.
+    PendingCount*                       m_prev;
+    PendingCount*                       m_next;
+};
+
+/** \brief Per-thread Counter storage used by the minimal profiler.
+ *
+ * Every thread that increments a counter locally gets one ThreadStorage instance, which holds a
+ * private Counter slot for every StaticCounter index. Slots are only ever written by the owning
+ * thread, so increments never contend with other threads and never take a lock. Readers (i.e. the
+ * dump) may inspect the slots of any thread at any time.
+ *
+ * Slots are allocated lazily in page-sized chunks, which are found through lazily allocated
+ * page-sized tables, so a thread only pays for the counters it actually touches. Chunks are placed
+ * on the NUMA node the thread was attached on (see Topology), which keeps increments node-local.
+ * ThreadStorage instances are never freed, which keeps the values of exited threads available for
+ * dumping.
+ */
+class ThreadStorage {
+public:
+    /** \brief Number of Counter slots per lazily allocated chunk. */
+    static constexpr unsigned chunk_size    = 4096 / sizeof(Counter);
+    /** \brief Number of chunks per lazily allocated table. */
+    static constexpr unsigned table_size    = 4096 / sizeof(Counter*);
+    /** \brief Maximum number of tables per thread. */
+    static constexpr unsigned table_count   = 16;
+    /** \brief Maximum number of chunks per thread. */
+    static constexpr unsigned chunk_count   = table_size * table_count;
+    /** \brief Maximum number of StaticCounter indices that can be stored per thread.
+     *
+     * Indices beyond fall back to the shared Counter, see slot().
+     */
+    static constexpr unsigned capacity      = chunk_size * chunk_count;
+    /** \brief Maximum length of a thread name, including the terminator. */
+    static constexpr unsigned name_size     = 32;
+
+public:
+    // No copy constructor.
+    ThreadStorage(const ThreadStorage&) = delete;
+    // No copy assignment operator.
+    ThreadStorage& operator=(const ThreadStorage&) = delete;
+    // No move constructor.
+    ThreadStorage(ThreadStorage&&) = delete;
+    // No move assignment operator.
+    ThreadStorage& operator=(ThreadStorage&&) = delete;
+
+    /** \brief Get the ThreadStorage of the calling thread.
+     *
+     * The first call on every thread attaches a new instance to the ThreadRegistry, which is the
+     * only time a lock is taken.
+     *
+     * \return  ThreadStorage of the calling thread.
+     */
+    ALWAYS_INLINE static ThreadStorage& current();
+
+    /** \brief Get the Counter slot for a StaticCounter index.
+     *
+     * Must only be called by the owning thread. Indices beyond capacity, which only a registry of
+     * millions of counters reaches, yield the shared Counter of the index instead. Their values
+     * are still dumped correctly, just not broken down by thread.
+     *
+     * \param   [in]    idx     StaticCounter index.
+     * \return  Counter slot of this thread.
+     */
+    ALWAYS_INLINE Counter& slot(unsigned idx);
+    /** \brief Get the value of a Counter slot from any thread.
+     *
+     * \param   [in]    idx     StaticCounter index.
+     * \return  Current slot value, 0 if this thread never touched the counter.
+     */
+    Counter::value_type value(unsigned idx) const noexcept
+    {
+        if (idx >= capacity) {
+            return 0;
+        }
+
+        const auto table = m_tables[idx / (chunk_size * table_size)].load(
+            std::memory_order_acquire
+        );
+        if (!table) {
+            return 0;
+        }
+
+        const auto chunk = table[idx / chunk_size % table_size].load(std::memory_order_acquire);
+        return chunk ? chunk[idx % chunk_size].value() : 0;
+    }
+
+    /** \brief Link a PendingCount of the owning thread, so that collect() reaches it.
+     *
+     * \param   [in,out]    pending PendingCount, must be unlinked before it is destroyed.
+     */
+    void link(PendingCount& pending)
+    {
+        std::lock_guard<std::mutex> lock{m_pending_lock};
+
+        pending.m_prev = nullptr;
+        pending.m_next = m_pending;
+        if (m_pending) {
+            m_pending->m_prev = &pending;
+        }
+        m_pending = &pending;
+    }
+    /** \brief Unlink a PendingCount linked by link().
+     *
+     * Waits for a concurrent collect(), so the PendingCount may be destroyed afterwards.
+     *
+     * \param   [in,out]    pending PendingCount.
+     */
+    void unlink(PendingCount& pending)
+    {
+        std::lock_guard<std::mutex> lock{m_pending_lock};
+
+        (pending.m_prev ? pending.m_prev->m_next : m_pending) = pending.m_next;
+        if (pending.m_next) {
+            pending.m_next->m_prev = pending.m_prev;
+        }
+    }
+    /** \brief Push the published increments of all linked PendingCounts, from any thread. */
+    void collect()
+    {
+        std::lock_guard<std::mutex> lock{m_pending_lock};
+
+        for (auto pending = m_pending; pending; pending = pending->m_next) {
+            pending->collect();
+        }
+    }
+
+    /** \brief Get the sequential id of this thread within the ThreadRegistry.
+     *
+     * \return  Thread id.
+     */
+    unsigned id() const noexcept
+    {
+        return m_id;
+    }
+    /** \brief Check whether the owning thread is still running.
+     *
+     * \retval  true    Thread is alive.
+     * \retval  false   Thread has exited.
+     */
+    bool alive() const noexcept
+    {
+        return m_alive.load(std::memory_order_acquire);
+    }
+    /** \brief Get the NUMA node this storage is placed on.
+     *
+     * This is the node the thread ran on when it was attached, it may have migrated since.
+     *
+     * \return  NUMA node number.
+     */
+    unsigned node() const noexcept
+    {
+        return m_node;
+    }
+
+private:
+    friend class ThreadRegistry;
+
+    ThreadStorage(unsigned id, unsigned node) noexcept
+    : m_id{id}, m_node{node}, m_alive{true}, m_named{false}, m_name{}, m_tables{},
+      m_pending_lock{}, m_pending{nullptr}
+    {}
+
+    // Allocate the table at the given position on the local node and publish it to readers.
+    std::atomic<Counter*>* allocate_table(unsigned table_idx)
+    {
+        const auto mem = static_cast<std::atomic<Counter*>*>(
+            Topology::allocate(table_size * sizeof(std::atomic<Counter*>), m_node));
+        for (unsigned i = 0; i < table_size; ++i) {
+            new (&mem[i]) std::atomic<Counter*>{nullptr};
+        }
+
+        m_tables[table_idx].store(mem, std::memory_order_release);
+        return mem;
+    }
+    // Allocate the chunk at the given position of a table and publish it to readers.
+    Counter* allocate(std::atomic<Counter*>* table, unsigned chunk_idx)
+    {
+        const auto mem = static_cast<Counter*>(
+            Topology::allocate(chunk_size * sizeof(Counter), m_node));
+        for (unsigned i = 0; i < chunk_size; ++i) {
+            new (&mem[i]) Counter{};
+        }
+
+        table[chunk_idx].store(mem, std::memory_order_release);
+        return mem;
+    }
+    // Shared Counter of an index beyond capacity.
+    static Counter& shared(unsigned idx);
+
+    // Sequential thread id.
+    unsigned                m_id;
+    // NUMA node of the slot chunks.
+    unsigned                m_node;
+    // Cleared when the owning thread exits.
+    std::atomic<bool>       m_alive;
+    // Set when the name was assigned through set_thread_name().
+    bool                    m_named;
+    // Thread name, guarded by the ThreadRegistry lock.
+    char                    m_name[name_size];
+    // Lazily allocated tables of lazily allocated slot chunks.
+    std::atomic<std::atomic<Counter*>*> m_tables[table_count];
+    // Guards the list of live LocalCounters.
+    std::mutex              m_pending_lock;
+    // Live LocalCounters of the owning thread.
+    PendingCount*           m_pending;
+};
+
+/** \brief Static registry for all ThreadStorage instances.
+ *
+ * Keeps track of every thread that ever used local counters, so that dumps can aggregate and break
+ * down their values. All accesses to the registry are serialized by a lock, but none of them happen
+ * on the increment path.
+ */
+class ThreadRegistry {
+public:
+    // No copy constructor.
+    ThreadRegistry(const ThreadRegistry&) = delete;
+    // No copy assignment operator.
+    ThreadRegistry& operator=(const ThreadRegistry&) = delete;
+    // No move constructor.
+    ThreadRegistry(ThreadRegistry&&) = delete;
+    // No move assignment operator.
+    ThreadRegistry& operator=(ThreadRegistry&&) = delete;
+
+    /** \brief Attach a new ThreadStorage for the calling thread.
+     *
+     * Use ThreadStorage::current() instead, which only calls this once per thread.
+     *
+     * \return  New ThreadStorage instance.
+     */
+    static ThreadStorage& attach()
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        const auto storage = new ThreadStorage{
+            static_cast<unsigned>(self.m_threads.size()),
+            Topology::current_node()
+        };
+        self.m_threads.push_back(storage);
+        capture_name(*storage);
+
+        // Marks the storage as dead and captures the final thread name on thread exit.
+        struct Detach {
+            ThreadStorage* storage;
+            ~Detach()
+            {
+                std::lock_guard<std::mutex> lock{instance().m_lock};
+                capture_name(*storage);
+                storage->m_alive.store(false, std::memory_order_release);
+            }
+        };
+        static thread_local Detach detach{storage};
+        (void)detach;
+
+        return *storage;
+    }
+
+    /** \brief Set the name of the calling thread as it appears in dumps.
+     *
+     * Names longer than ThreadStorage::name_size - 1 characters are truncated.
+     *
+     * \param   [in]    name    Thread name.
+     */
+    static void set_name(const char* name)
+    {
+        auto& storage = ThreadStorage::current();
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        std::strncpy(storage.m_name, name, ThreadStorage::name_size - 1);
+        storage.m_name[ThreadStorage::name_size - 1] = '\0';
+        storage.m_named = true;
+    }
+
+    /** \brief Sum up all thread-local values of a StaticCounter index.
+     *
+     * \param   [in]    idx     StaticCounter index.
+     * \return  Sum over all threads.
+     */
+    static Counter::value_type sum(unsigned idx)
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        Counter::value_type result = 0;
+        for (const auto storage : self.m_threads) {
+            result += storage->value(idx);
+        }
+
+        return result;
+    }
+
+    /** \brief Push the pending increments of the live LocalCounters of all threads. */
+    static void collect()
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        for (const auto storage : self.m_threads) {
+            storage->collect();
+        }
+    }
+
+    /** \brief Visit all registered ThreadStorage instances under the registry lock.
+     *
+     * The visitor must not call back into the ThreadRegistry.
+     *
+     * \param   [in]    visitor Callable taking (const ThreadStorage&, const char* name).
+     */
+    template<typename Visitor>
+    static void visit(Visitor&& visitor)
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        for (const auto storage : self.m_threads) {
+            visitor(static_cast<const ThreadStorage&>(*storage),
+                    static_cast<const char*>(storage->m_name));
+        }
+    }
+
+private:
+    ThreadRegistry() = default;
+
+    static ThreadRegistry& instance() noexcept
+    {
+        static ThreadRegistry instance;
+        return instance;
+    }
+
+    // Fill in the OS thread name unless set explicitly. Must be called on the owning thread while
+    // holding the lock.
+    static void capture_name(ThreadStorage& storage) noexcept
+    {
+        if (storage.m_named) {
+            return;
+        }
+
+#if defined(MINPROF_HAS_THREAD_NAMES)
+        if (pthread_getname_np(pthread_self(), storage.m_name, ThreadStorage::name_size) != 0) {
+            storage.m_name[0] = '\0';
+        }
+#endif
+    }
+
+    // Guards m_threads and all thread names.
+    std::mutex                  m_lock;
+    // All ThreadStorage instances ever attached, indexed by their id.
+    std::vector<ThreadStorage*> m_threads;
+};
+
+ALWAYS_INLINE ThreadStorage& ThreadStorage::current()
+{
+    // A trivial thread_local pointer avoids the initialization guard on every access.
+    static thread_local ThreadStorage* storage = nullptr;
+    if (!storage) {
+        storage = &ThreadRegistry::attach();
+    }
+
+    return *storage;
+}
+
+/** \brief Set the name of the calling thread as it appears in per-thread dumps.
+ *
+ * Threads without an explicit name use their OS name (pthread_getname_np) where available, captured
+ * on first counter use and again on thread exit.
+ *
+ * \param   [in]    name    Thread name.
+ */
+inline void set_thread_name(const char* name)
+{
+    ThreadRegistry::set_name(name);
+}
+
+/** \brief Static container for a global Counter.
+ *
+ * By instanciating this template, a global Counter with static storage is created and registered.
+ *
+ * \tparam  Name    typestring of the Counter's name.
+ */
+template<typename Name>
+class StaticCounter {
+public:
+    // Assert that a typestring was passed.
+    static_assert(irqus::is_typestring<Name>::value, "Name must be a typestring!");
+
+    /** \brief Counter name typestring. */
+    using name = Name;
+    /** \brief Index of the counter in the static registration vector. */
+    static const unsigned index;
+    /** \brief Unit of the counter, from the type suffix of its name. */
+    static constexpr Unit unit = name_unit(Name::data(), Name::size());
+
+public:
+    // No (default) constructor.
+    StaticCounter() = delete;
+    // No copy constructor.
+    StaticCounter(const StaticCounter&) = delete;
+    // No copy assignment operator.
+    StaticCounter& operator=(const StaticCounter&) = delete;
+    // No move constructor.
+    StaticCounter(StaticCounter&&) = delete;
+    // No move assignment operator.
+    StaticCounter& operator=(StaticCounter&&) = delete;
+
+    /** \brief Get the global Counter instance.
+     *
+     * Calls to this function shall always be inlinied. Due to havinge thetrivially, constexpr
+     * constructible Counter objects, the compiler will not generate any checks for this scoped
+     * static initialization and instead just allocate a zeroed region in the binary and link all
+     * occurences to there.
+     *
+     * \return  Global Counter instance.
+     */
+    ALWAYS_INLINE static Counter& get() noexcept
+    {
+        static Counter instance;
+
+        // Necessary to force the static index member to be statically initialized, thus registering
+        // the counter in the static registry. (Does not actually happen here.)
+        (void)index;
+
+        return instance;
+    }
+    /** \brief Get the calling thread's Counter slot for this StaticCounter.
+     *
+     * Local slots are private to the calling thread, so incrementing them never contends with other
+     * threads. Their values are only reflected in total(), not in get().
+     *
+     * \return  Thread-local Counter instance.
+     */
+    ALWAYS_INLINE static Counter& local()
+    {
+        return ThreadStorage::current().slot(index);
+    }
+    /** \brief Get the total value of this StaticCounter.
+     *
+     * Sums up the global Counter and all thread-local slots.
+     *
+     * \return  Total Counter value.
+     */
+    static Counter::value_type total()
+    {
+        return get().value() + ThreadRegistry::sum(index);
+    }
+};
+
+/** \brief Static registry for the StaticCounter types instanciated.
+ *
+ * This class handles the task of keeping track of all used counters. It's only interface is static,
+ * and is automatically invoked during static initialization of the StaticCounters themselves.
+ *
+ * The dumps are only declared here and implemented in minprof/report.hh, so that instrumented code
+ * does not compile the stream machinery. Exactly one translation unit of the program defines them,
+ * by defining MINPROF_IMPLEMENTATION before including that header; without it, calling a dump fails
+ * to link.
+ */
+class StaticCounterRegistry {
+public:
+    // No copy constructor.
+    StaticCounterRegistry(const StaticCounterRegistry&) = delete;
+    // No copy assignment operator.
+    StaticCounterRegistry& operator=(const StaticCounterRegistry&) = delete;
+    // No move constructor.
+    StaticCounterRegistry(StaticCounterRegistry&&) = delete;
+    // No move assignment operator.
+    StaticCounterRegistry& operator=(StaticCounterRegistry&&) = delete;
+
+    /** \brief Register a StaticCounter.
+     *
+     * \tparam  typestring Name of the StaticCounter.
+     *
+     * \return  Index within the static registry.
+     */
+    template<typename Name>
+    static unsigned register_counter()
+    {
+        using StaticCounter = StaticCounter<Name>;
+
+        // Shares a single copy of the registration code among all counters of a translation unit.
+        return register_counter(Name::data(), StaticCounter::get(), StaticCounter::unit);
+    }
+    /** \brief Register a Counter created at runtime, e.g. one per registered code variant.
+     *
+     * The Counter is then dumped and sampled like any StaticCounter. As registration does not lock,
+     * it must not race with other registrations, dumps or a running Sampler; register at startup.
+     *
+     * \param   [in]        name    Name of the Counter, must outlive the registry.
+     * \param   [in,out]    counter Counter to register, must outlive the registry.
+     * \param   [in]        unit    Unit of the Counter.
+     *
+     * \return  Index within the static registry.
+     */
+    static unsigned register_counter(const char* name, Counter& counter, Unit unit)
+    {
+        auto& self = instance();
+
+        self.m_names.push_back(name);
+        self.m_instances.push_back(&counter);
+        self.m_units.push_back(unit);
+        // Same as name_base_length(), which would be inlined into every translation unit.
+        const auto bar = name ? std::strrchr(name, '|') : nullptr;
+        self.m_bases.push_back(bar ? static_cast<std::size_t>(bar - name)
+                                   : name ? std::strlen(name) : 0);
+
+        return self.m_instances.size() - 1;
+    }
+    /** \brief Register a Counter created at runtime, taking its unit from the name's suffix.
+     *
+     * \param   [in]        name    Name of the Counter, must outlive the registry.
+     * \param   [in,out]    counter Counter to register, must outlive the registry.
+     *
+     * \return  Index within the static registry.
+     */
+    static unsigned register_counter(const char* name, Counter& counter)
+    {
+        return register_counter(name, counter,
+                                name ? name_unit(name, std::strlen(name)) : Unit::none);
+    }
+
+    /** \brief Get the number of StaticCounters registered.
+     *
+     * \return  Number of registered counters.
+     */
+    ALWAYS_INLINE static unsigned count() noexcept
+    {
+        const auto& self = instance();
+
+        return static_cast<unsigned>(self.m_instances.size());
+    }
+    /** \brief Find a specific registered counter by name.
+     *
+     * During compile-time, prefer using the StaticCounter<Name>::get() directly.
+     *
+     * \param   [in]        name    Name to find.
+     * \param   [in,out]    idx     Index of the counter.
+     *
+     * \retval  true    Counter was found.
+     * \retval  false   Counter not found.
+     */
+    ALWAYS_INLINE static bool find(const char* name, unsigned& idx) noexcept
+    {
+        // TODO: I'd rather have an optional, but that is C++17 or boost.
+        const auto& self = instance();
+
+        for (unsigned i = 0; i < self.m_names.size(); ++i) {
+            if (std::strcmp(self.m_names[i], name) == 0) {
+                idx = i;
+                return true;
+            }
+        }
+
+        return false;
+    }
+    /** \brief Get the name of a registered counter.
+     *
+     * \param   [in]    idx Index of the counter.
+     *
+     * \retval  nullptr \p idx is out of bounds.
+     * \returns Name of the counter.
+     */
+    ALWAYS_INLINE static const char* get_name(unsigned idx)
+    {
+        const auto& self = instance();
+
+        if (idx >= self.m_names.size()) {
+            return nullptr;
+        }
+
+        return self.m_names[idx];
+    }
+    /** \brief Get the unit of a registered counter.
+     *
+     * \param   [in]    idx Index of the counter.
+     *
+     * \retval  Unit::none  \p idx is out of bounds.
+     * \returns Unit the counter was registered with.
+     */
+    ALWAYS_INLINE static Unit get_unit(unsigned idx)
+    {
+        const auto& self = instance();
+
+        if (idx >= self.m_units.size()) {
+            return Unit::none;
+        }
+
+        return self.m_units[idx];
+    }
+    /** \brief Get the length of the name of a registered counter without its type suffix.
+     *
+     * Counters of the same section (e.g. "<name>|C" and "<name>|T") share this prefix.
+     *
+     * \param   [in]    idx Index of the counter.
+     *
+     * \retval  0       \p idx is out of bounds or the counter has no name.
+     * \returns Length of the base name.
+     */
+    ALWAYS_INLINE static std::size_t get_base_length(unsigned idx)
+    {
+        const auto& self = instance();
+
+        if (idx >= self.m_bases.size()) {
+            return 0;
+        }
+
+        return self.m_bases[idx];
+    }
+    /** \brief Get the a registered counter.
+     *
+     * \param   [in]    idx Index of the counter.
+     *
+     * \retval  nullptr \p idx is out of bounds.
+     * \returns Pointer to the Counter.
+     */
+    ALWAYS_INLINE static Counter* get_counter(unsigned idx)
+    {
+        const auto& self = instance();
+
+        if (idx >= self.m_instances.size()) {
+            return nullptr;
+        }
+
+        return self.m_instances[idx];
+    }
+
+    /** \brief Push the pending increments of all live LocalCounters into their backing Counters.
+     *
+     * Returns once done, so values read afterwards include every increment a LocalCounter published
+     * before the call. All dumps and the Sampler flush before reading any values.
+     */
+    static void flush()
+    {
+        ThreadRegistry::collect();
+    }
+
+    /** \brief Check whether a registered counter belongs to minprof itself.
+     *
+     * minprof accounts its own cost and data loss in counters named "minprof.*" (see
+     * minprof/health.hh), which roll up into a single subtree and can be hidden from all dumps.
+     *
+     * \param   [in]    idx Index of the counter.
+     *
+     * \retval  true    Counter is internal.
+     * \retval  false   Counter is a user counter, or \p idx is out of bounds.
+     */
+    static bool is_internal(unsigned idx)
+    {
+        return is_internal(get_name(idx));
+    }
+    /** \brief Check whether a name belongs to minprof itself.
+     *
+     * Applies to the names of other registries (e.g. heatmaps) as well.
+     *
+     * \param   [in]    name    Name, may be nullptr.
+     *
+     * \retval  true    Name is internal.
+     * \retval  false   Name is a user name.
+     */
+    static bool is_internal(const char* name) noexcept
+    {
+        return name && std::strncmp(name, "minprof.", 8) == 0;
+    }
+    /** \brief Hide or show internal counters in all dumps.
+     *
+     * Internal counters are shown by default.
+     *
+     * \param   [in]    hide    If true, dumps skip internal counters.
+     */
+    static void hide_internal(bool hide) noexcept
+    {
+        hiding().store(hide, std::memory_order_relaxed);
+    }
+    /** \brief Check whether dumps skip internal names.
+     *
+     * \return  Flag set by hide_internal().
+     */
+    static bool hides_internal() noexcept
+    {
+        return hiding().load(std::memory_order_relaxed);
+    }
+    /** \brief Set a function to be called with the duration of every dump.
+     *
+     * \param   [in]    hook    Function taking the duration, or nullptr.
+     */
+    static void set_dump_hook(void (*hook)(Timer::duration)) noexcept
+    {
+        dump_hook().store(hook, std::memory_order_release);
+    }
+
+    /** \brief Get the total value of a registered counter.
+     *
+     * Includes the values of all thread-local slots.
+     *
+     * \param   [in]    idx Index of the counter.
+     *
+     * \retval  0       \p idx is out of bounds.
+     * \returns Total value of the counter.
+     */
+    static Counter::value_type total(unsigned idx)
+    {
+        const auto counter = get_counter(idx);
+        if (!counter) {
+            return 0;
+        }
+
+        return counter->value() + ThreadRegistry::sum(idx);
+    }
+
+    /** \brief Dump all StaticCounters to the specified stream as CSV.
+     *
+     * The order in which the counters are dumped is defined by the compiler and linker, but loosely
+     * corresponds to their usage order in code. Values include all thread-local slots.
+     *
+     * CSV format is:
+     * <name>, <value> <endl>
+     *
+     * If a counter has no name (you registered one yourself?) it gets a name made up from
+     * it's index in the registry.
+     *
+     * \param   [in,out]    out     Output stream.
+     */
+    static void dump(std::ostream& out);
+    /** \brief Dump all StaticCounters broken down by thread to the specified stream as CSV.
+     *
+     * For every counter, one row is written per thread that contributed to it, followed by a
+     * summary row holding imbalance statistics. The statistics are over all threads that touched
+     * any dumped counter, including those that did not contribute to this one, so a pool where
+     * one thread does all the work shows up as imbalanced. Increments on the global Counter are
+     * reported as the pseudo-thread "(shared)" and do not partake in the statistics. Counters
+     * nobody incremented are skipped.
+     *
+     * CSV format is:
+     * <name>, <thread>, <value> <endl>
+     * ...
+     * <name>, *, <total>, <min>, <mean>, <max>, <max/mean>, <threads> <endl>
+     *
+     * Threads are named by set_thread_name(), their OS name or "thread_<id>", in that order.
+     *
+     * \param   [in,out]    out     Output stream.
+     */
+    static void dump_threads(std::ostream& out);
+    /** \brief Dump into the file with the specified name.
+     *
+     * Overwrites file contents.
+     *
+     * \param   [in]    file_name   Name of the file.
+     */
+    static void dump(const char* file_name);
+    /** \brief Dump into the "minprof.csv" file. */
+    static void dump()
+    {
+        dump("minprof.csv");
+    }
+
+    /** \brief Dump all StaticCounters rolled up along their hierarchical names as CSV.
+     *
+     * Counter names are split into a path and a type suffix at the last '|', and the path is split
+     * into components at every '.'. Every prefix of a path gets the sum of all counters below it
+     * with the same suffix, e.g. "db.query.select|T" contributes to "db.query|T" and "db|T". The
+     * prefix tree is built by the first rollup dump and only extended by later dumps after new
+     * registrations, so this is usually a single bottom-up summation.
+     *
+     * Rows are written in depth-first order, parents first.
+     *
+     * CSV format is:
+     * <prefix>|<suffix>, <value> <endl>
+     *
+     * \param   [in,out]    out     Output stream.
+     */
+    static void dump_rollup(std::ostream& out);
+    /** \brief Dump all StaticCounters rolled up along their hierarchical names as nested JSON.
+     *
+     * Uses the same prefix tree as dump_rollup(). Every node is an object holding its rolled-up
+     * value per suffix, plus a "children" object keyed by the next path component, if any:
+     *
+     * {
+     *   "db": {
+     *     "T": 1200,
+     *     "children": {
+     *       "query": { "T": 1000 }
+     *     }
+     *   }
+     * }
+     *
+     * Counters without a suffix are reported under the "value" key.
+     *
+     * Nodes also get the means and rates derivable from the units of their values (see Unit):
+     * "ns_per_call", "ns_per_item", "items_per_s", "bytes_per_s" and "ops_per_s".
+     *
+     * \param   [in,out]    out     Output stream.
+     */
+    static void dump_json(std::ostream& out);
+
+    /** \brief Dump all StaticCounters aggregated per NUMA node to the specified stream as CSV.
+     *
+     * Thread-local values are attributed to the node their storage was placed on (see Topology).
+     * Increments on the global Counter are reported as the pseudo-node "(shared)". Every node is
+     * listed, even if it did not contribute, so that locality problems become visible. On
+     * single-node machines, everything ends up in node_0.
+     *
+     * CSV format is:
+     * <name>, node_<node>, <value> <endl>
+     *
+     * \param   [in,out]    out     Output stream.
+     */
+    static void dump_nodes(std::ostream& out);
+
+    /** \brief Dump means and rates derived from the units of all StaticCounters as CSV.
+     *
+     * Counters sharing a name up to their type suffix are reported together, e.g. the "|C", "|T"
+     * and "|N" counters of MINPROF_SECTION_N. Rows are written in name order, and fields that do
+     * not apply (e.g. ns/item without an items counter) are left empty. Rates are per second of
+     * the time counter, i.e. of time spent in the section.
+     *
+     * CSV format is:
+     * <name>, <calls>, <ns>, <ns/call>, <items>, <ns/item>, <items/s>, <bytes>, <bytes/s>, <ops>,
+     * <ops/s> <endl>
+     *
+     * \param   [in,out]    out     Output stream.
+     */
+    static void dump_derived(std::ostream& out);
+
+private:
+    // Helpers shared by the dumps, defined by minprof/report.hh.
+    struct Dumps;
+
+    // Sadly, vectors aren't constexpr.
+    StaticCounterRegistry() = default;
+
+    // Flag set by hide_internal(), constant-initialized.
+    static std::atomic<bool>& hiding() noexcept
+    {
+        static std::atomic<bool> flag{false};
+        return flag;
+    }
+    // Function set by set_dump_hook(), constant-initialized.
+    static std::atomic<void (*)(Timer::duration)>& dump_hook() noexcept
+    {
+        static std::atomic<void (*)(Timer::duration)> hook{nullptr};
+        return hook;
+    }
+    // Check whether a counter is to be skipped by dumps.
+    static bool hidden(unsigned idx)
+    {
+        return hides_internal() && is_internal(idx);
+    }
+
+    ALWAYS_INLINE static StaticCounterRegistry& instance() noexcept
+    {
+        // Typical scoped static initialization for the singleton.
+        // This cannot be implemented branch-free however, since StaticCounterRegistry is neither
+        // eligible for constant nor zero initialization, I believe.
+        static StaticCounterRegistry instance;
+        return instance;
+    }
+
+    // Vector of registered counter's names.
+    std::vector<const char *>   m_names;
+    // Vector of registered counters.
+    std::vector<Counter*>       m_instances;
+    // Vector of registered counter's units.
+    std::vector<Unit>           m_units;
+    // Vector of registered counter's name lengths without suffix.
+    std::vector<std::size_t>    m_bases;
+};
+
+ALWAYS_INLINE Counter& ThreadStorage::slot(unsigned idx)
+{
+    if (idx >= capacity) {
+        return shared(idx);
+    }
+
+    // The owner is the only writer of the tables, so relaxed loads suffice here.
+    auto table = m_tables[idx / (chunk_size * table_size)].load(std::memory_order_relaxed);
+    if (!table) {
+        table = allocate_table(idx / (chunk_size * table_size));
+    }
+    auto chunk = table[idx / chunk_size % table_size].load(std::memory_order_relaxed);
+    if (!chunk) {
+        chunk = allocate(table, idx / chunk_size % table_size);
+    }
+
+    return chunk[idx % chunk_size];
+}
+
+inline Counter& ThreadStorage::shared(unsigned idx)
+{
+    // CONTRACT: Index is registered.
+    assert(StaticCounterRegistry::get_counter(idx));
+
+    return *StaticCounterRegistry::get_counter(idx);
+}
+
+// Initialization of the index field performs the actual static registration.
+template<typename Name>
+const unsigned StaticCounter<Name>::index = StaticCounterRegistry::register_counter<Name>();
+
+// Definition of the unit field, which registration odr-uses.
+template<typename Name>
+constexpr Unit StaticCounter<Name>::unit;
+
+/** \brief Get a StaticCounter by name.
+ *
+ * If MINPROF_PER_THREAD is defined before including this header, this yields the calling thread's
+ * local slot instead of the global Counter. All macros building on this one will then increment
+ * thread-local slots, which makes dump_threads() break their values down by thread. Use
+ * MINPROF_TOTAL to read the value summed up over all threads.
+ *
+ * \param   name    Name string literal of the StaticCounter.
+ */
+#if defined(MINPROF_PER_THREAD)
+#define MINPROF_COUNTER(name)   ::minprof::StaticCounter<typestring_is(name)>::local()
+#else
+#define MINPROF_COUNTER(name)   ::minprof::StaticCounter<typestring_is(name)>::get()
+#endif
+
+/** \brief Get the total value of a StaticCounter over all threads.
+ *
+ * \param   name    Name string literal of the StaticCounter.
+ */
+#define MINPROF_TOTAL(name)     ::minprof::StaticCounter<typestring_is(name)>::total()
+
+/** \brief Trigger an event by name.
+ *
+ * Will increase the StaticCounter called <name>.
+ *
+ * \param   name    Name string literal of the StaticCounter.
+ */
+#define MINPROF_EVENT(name)     do { ++MINPROF_COUNTER(name); } while (0)
+
+/** \brief Get a StaticCounter as a timer.
+ *
+ * \param   name    Name string literal of the StaticCounter.
+ */
+#define MINPROF_TIMER(name)     static_cast<::minprof::Timer&>(MINPROF_COUNTER(name))
+
+/** \brief Dump all Counters.
+ *
+ * Pass a stream, a file name or nothing to write "minprof.csv".
+ */
+#define MINPROF_DUMP            ::minprof::StaticCounterRegistry::dump
+/** \brief Dump all Counters broken down by thread. */
+#define MINPROF_DUMP_THREADS    ::minprof::StaticCounterRegistry::dump_threads
+/** \brief Dump all Counters rolled up along their hierarchical names. */
+#define MINPROF_DUMP_ROLLUP     ::minprof::StaticCounterRegistry::dump_rollup
+/** \brief Dump all Counters rolled up along their hierarchical names as nested JSON. */
+#define MINPROF_DUMP_JSON       ::minprof::StaticCounterRegistry::dump_json
+/** \brief Dump all Counters aggregated per NUMA node. */
+#define MINPROF_DUMP_NODES      ::minprof::StaticCounterRegistry::dump_nodes
+/** \brief Dump means and rates derived from the units of all Counters. */
+#define MINPROF_DUMP_DERIVED    ::minprof::StaticCounterRegistry::dump_derived
+
+/** \brief Get a StaticCounter as a gauge.
+ *
+ * Always refers to the shared Counter, even when counting per thread.
+ *
+ * \param   name    Name string literal of the StaticCounter.
+ */
+#define MINPROF_GAUGE(name)\
+static_cast<::minprof::Gauge&>(::minprof::StaticCounter<typestring_is(name)>::get())
+
+/** \brief Buffered front for a Counter.
+ *
+ * Hot loops that increment the same Counter millions of times per second still pay for a locked
+ * read-modify-write on every increment, even on thread-local slots. A LocalCounter instead counts
+ * in a plain value and publishes it with an ordinary store, and only pushes the increments into the
+ * backing Counter when:
+ *  - it goes out of scope,
+ *  - \p Period increments have been buffered (if \p Period is not 0),
+ *  - flush() is called, or
+ *  - a dump (or the Sampler) calls StaticCounterRegistry::flush(), which collects the published
+ *    increments of all live LocalCounters, idle or not.
+ *
+ * Construction and destruction take an uncontended per-thread lock to link the LocalCounter for
+ * collection, so LocalCounters belong around hot loops, not inside them. They are not threadsafe
+ * and are meant to live on the stack of a single thread.
+ *
+ * \tparam  Period  Number of buffered increments after which to flush, 0 to only flush on demand.
+ */
+template<Counter::value_type Period = 0>
+class LocalCounter {
+public:
+    /** \brief Type that can hold the value of the LocalCounter. */
+    using value_type    = Counter::value_type;
+
+    /** \brief Initialize a new LocalCounter.
+     *
+     * \param   [in,out]    par     Backing Counter.
+     */
+    explicit LocalCounter(Counter& par)
+    : m_storage{ThreadStorage::current()}, m_pending{par}, m_total{0}, m_flushed{0}
+    {
+        m_storage.link(m_pending);
+    }
+    /** \brief Flush and destroy a LocalCounter. */
+    ~LocalCounter()
+    {
+        flush();
+        m_storage.unlink(m_pending);
+    }
+
+    // No copy constructor.
+    LocalCounter(const LocalCounter&) = delete;
+    // No copy assignment.
+    LocalCounter& operator=(const LocalCounter&) = delete;
+    // No move constructor.
+    LocalCounter(LocalCounter&&) = delete;
+    // No move assignment.
+    LocalCounter& operator=(LocalCounter&&) = delete;
+
+    /** \brief Get the number of buffered increments.
+     *
+     * \return  Pending value not yet pushed into the backing Counter.
+     */
+    value_type pending() const noexcept
+    {
+        return m_total - m_pending.flushed();
+    }
+
+    /** \brief Increment the LocalCounter by 1.
+     *
+     * \return  *this.
+     */
+    ALWAYS_INLINE LocalCounter& operator++() noexcept
+    {
+        return *this += 1;
+    }
+    /** \brief Increment the LocalCounter by a specified amount.
+     *
+     * \param   [in]    amount  Amount to increment by.
+     * \return  *this.
+     */
+    ALWAYS_INLINE LocalCounter& operator+=(value_type amount) noexcept
+    {
+        m_total += amount;
+        m_pending.publish(m_total);
+        if (Period != 0 && m_total - m_flushed >= Period) {
+            flush();
+        }
+        return *this;
+    }
+
+    /** \brief Push all buffered increments into the backing Counter. */
+    void flush() noexcept
+    {
+        m_pending.flush(m_total);
+        m_flushed = m_total;
+    }
+
+private:
+    // Storage of the owning thread.
+    ThreadStorage&  m_storage;
+    // Published increments.
+    PendingCount    m_pending;
+    // Increments since construction.
+    value_type      m_total;
+    // Increments since construction at the last flush by the owner.
+    value_type      m_flushed;
+};
+
+/** \brief Stopwatch for manually timing on Timers.
+ *
+ * Stopwatches are adapters for Timers that allow the user to perform measurements and accumulate
+ * them in the backing Timer.
+ *
+ * The interface of the Stopwatch is not safe in all scenarios, as the user has to watch out for
+ * unstarted stopwatches when performing retiring operations. Those can yield in extremely large
+ * duration values due to the clock epoch being used as a reference point. Always use the Scopewatch
+ * if possible.
+ *
+ * Stopwatches are not threadsafe, but Timers are. Therefore, if you plan to measure from multiple
+ * threads, each thread should get it's own Stopwatch instance referencing the same Timer.
+ *
+ * The Stopwatch is using the std::chrono::high_resolution_clock, but converting from the native
+ * duration to the unsigned 64-bit integer nanosecond durations used by the Timer. This might mean
+ * loss of precision or rounding (both very unlikely) and is responsible for the missing noexcept
+ * guarantee. However, this does not affect the qualitative correctness as conversions are performed
+ * by std::chrono::duration_cast just like with the Timer.
+ */
+class Stopwatch {
+public:
+    /** \brief Clock used by all Stopwatch instances. */
+    struct Clock : std::chrono::high_resolution_clock {};
+    /** \brief Type alias for the duration type. */
+    using duration      = Timer::duration;
+    /** \brief Type alias for the Clock's time point type. */
+    using time_point    = Clock::time_point;
+
+    /** \brief Initialize a new Stopwatch.
+     *
+     * \param   [in,out]    par     Backing Timer.
+     * \param   [in]        started If \c true, starts the Stopwatch.
+     */
+    Stopwatch(Timer& par, bool started = false) noexcept
+    : m_par{par}, m_start{}
+    {
+        if (started) {
+            start();
+        }
+    }
+
+    /** \brief Copy a Stopwatch.
+     *
+     * \param   [in]    copy    Stopwatch to copy.
+     */
+    Stopwatch(const Stopwatch& copy) noexcept
+    : m_par{copy.m_par}, m_start{copy.m_start}
+    {}
+
+    /** \brief Copy a Stopwatch.
+     *
+     * \param   [in]    copy    Stopwatch to copy.
+     * \returns *this.
+     */
+    Stopwatch& operator=(const Stopwatch& copy) noexcept
+    {
+        m_par = copy.m_par;
+        m_start = copy.m_start;
+        return *this;
+    }
+
+    // No move constructor.
+    Stopwatch(Stopwatch&&) = delete;
+    // No move assignment.
+    Stopwatch& operator=(Stopwatch&&) = delete;
+
+    /** \brief Start the Stopwatch.
+     *
+     * If the Stopwatch is already running, the current measurement is abandoned.
+     */
+    ALWAYS_INLINE void start() noexcept
+    {
+        m_start = Clock::now();
+
+        // DEBUG: Default-constructed time_point is unique.
+        assert(m_start.time_since_epoch().count() > 0);
+    }
+    /** \brief Split the Stopwatch time.
+     *
+     * Measures the elapsed duration, retires that to the backing Timer and continues from here
+     * without loss of time.
+     *
+     * Behaviour is undefined if the Stopwatch was not started.
+     *
+     * \return  Time elapsed since last start() or split() command.
+     */
+    ALWAYS_INLINE duration split()
+    {
+        // CONTRACT: Stopwatch is running.
+        assert(m_start.time_since_epoch().count() > 0);
+
+        const auto end = Clock::now();
+        const auto native_dur = end - m_start;
+        const auto dur = std::chrono::duration_cast<duration>(native_dur);
+
+        m_par += dur;
+        m_start = end;
+
+        return dur;
+    }
+    /** \brief Stop the Stopwatch.
+     *
+     * Measures the elapsed duration and retires that to the backing Timer.
+     *
+     * Behaviour is undefined if the Stopwatch was not started.
+     *
+     * \return  Time elapsed since last start() or split() command.
+     */
+    ALWAYS_INLINE duration stop()
+    {
+        const auto dur = split();
+
+        m_start = time_point{};
+        return dur;
+    }
+
+private:
+    // Backing Timer.
+    Timer&      m_par;
+    // Time of last start() or split() command.
+    time_point  m_start;
+};
+
+/** \brief Scoped Stopwatch for safe use with the minimal profiler.
+ *
+ * Scopwatches start and stop automatically on construct/destruct and therefore automate the timing
+ * by design. Also, there interface prevents incorrect use of the Stopwatch since no invalid
+ * operations can be performed by the user.
+ *
+ * Due to their nature, Scopewatches can neither be copied nor moved as to not introduce incorrect
+ * timing behaviour.
+ */
+class Scopewatch : private Stopwatch {
+public:
+    /** \brief Initialize and start a new Scopewatch.
+     *
+     * \param   [in,out]    par     Backing Timer.
+     */
+    Scopewatch(Timer& par) noexcept
+    : Stopwatch{par, true}
+    {}
+    /** \brief Stop, retire and destroy a Scopewatch. */
+    ~Scopewatch()
+    {
+        stop();
+    }
+
+    // No copy constructor.
+    Scopewatch(const Scopewatch&) = delete;
+    // No copy assignment.
+    Scopewatch& operator=(const Scopewatch&) = delete;
+
+    // No move constructor.
+    Scopewatch(Scopewatch&&) = delete;
+    // No move assignment.
+    Scopewatch& operator=(Scopewatch&&) = delete;
+
+    // Hack to make use of if-condition initialization scoping.
+    operator bool() const noexcept
+    {
+        return true;
+    }
+};
+
+/** \brief Time the following statement (-block).
+ *
+ * May cause unexpected parsing when used inside a then-block of an if-statement without curly
+ * braces that is followed by an else.
+ *
+ * \param   name    Name string literal of the StaticCounter.
+ */
+#define MINPROF_TIMED(name)\
+if (::minprof::Scopewatch __scopewatch_ ## __LINE__ {MINPROF_TIMER(name)})
+
+/** \brief Section tracker for use with the minimal profiler.
+ *
+ * Section instances behave like Scopewatches that also increment a Counter on construct, thus
+ * keeping track of both the number of times a section was entered as well as the time spent in it
+ * in total.
+ *
+ * Named sections are published as the thread's active section while the LD_PRELOAD shim is loaded,
+ * so that it can attribute intercepted calls to them. Otherwise this costs a single branch.
+ */
+class Section : private Scopewatch {
+public:
+    /** \brief Initialize, trigger and time a new Section.
+     *
+     * \param   [in,out]    c       Counter for section.
+     * \param   [in,out]    t       Timer for section.
+     * \param   [in]        name    Name of the section, must outlive it.
+     */
+    Section(Counter& c, Timer& t, const char* name = nullptr) noexcept
+    : Scopewatch{t}, m_active{nullptr}, m_outer{nullptr}
+    {
+        ++c;
+
+#if defined(MINPROF_HAS_PRELOAD_HOOK)
+        if (name && minprof_preload_active) {
+            m_active = minprof_preload_active();
+            m_outer = *m_active;
+            *m_active = name;
+        }
+#else
+        (void)name;
+#endif
+    }
+    /** \brief Stop, retire and destroy a Section. */
+    ~Section()
+    {
+        if (m_active) {
+            *m_active = m_outer;
+        }
+    }
+
+    // No copy constructor.
+    Section(const Section&) = delete;
+    // No copy assignment.
+    Section& operator=(const Section&) = delete;
+
+    // No move constructor.
+    Section(Section&&) = delete;
+    // No move assignment.
+    Section& operator=(Section&&) = delete;
+
+    // Hack to make use of if-condition initialization scoping.
+    operator bool() const noexcept
+    {
+        return true;
+    }
+
+private:
+    // Active section slot of the LD_PRELOAD shim, nullptr if not published.
+    const char**    m_active;
+    // Previously active section.
+    const char*     m_outer;
+};
+
+/** \brief Profile the following statement (-block).
+ *
+ * Will accumulate the number of invocations in <name>|C and the total time in <name>|T.
+ *
+ * May cause unexpected parsing when used inside a then-block of an if-statement without curly
+ * braces that is followed by an else.
+ *
+ * \param   name    Name string literal of the section.
+ */
+#define MINPROF_SECTION(name)\
+if (::minprof::Section __section_ ## __LINE__ {\
+    MINPROF_COUNTER(name "|C"), MINPROF_TIMER(name "|T"), name})
+
+/** \brief Section tracker that also counts the items processed.
+ *
+ * Adds the number of items to a third Counter when entered, so that reports can derive the time per
+ * item and the throughput of the section.
+ */
+class ItemSection : private Section {
+public:
+    /** \brief Initialize, trigger and time a new ItemSection.
+     *
+     * \param   [in,out]    c       Counter for section.
+     * \param   [in,out]    t       Timer for section.
+     * \param   [in,out]    n       Counter for items.
+     * \param   [in]        items   Number of items processed by this run of the section.
+     * \param   [in]        name    Name of the section, must outlive it.
+     */
+    ItemSection(Counter& c, Timer& t, Counter& n, Counter::value_type items,
+                const char* name = nullptr) noexcept
+    : Section{c, t, name}
+    {
+        n += items;
+    }
+
+    // No copy constructor.
+    ItemSection(const ItemSection&) = delete;
+    // No copy assignment.
+    ItemSection& operator=(const ItemSection&) = delete;
+
+    // No move constructor.
+    ItemSection(ItemSection&&) = delete;
+    // No move assignment.
+    ItemSection& operator=(ItemSection&&) = delete;
+
+    // Hack to make use of if-condition initialization scoping.
+    operator bool() const noexcept
+    {
+        return true;
+    }
+};
+
+/** \brief Profile the following statement (-block) along with the items it processes.
+ *
+ * Will accumulate the number of invocations in <name>|C, the total time in <name>|T and the number
+ * of items in <name>|N.
+ *
+ * \param   name    Name string literal of the section.
+ * \param   n       Number of items processed per invocation.
+ */
+#define MINPROF_SECTION_N(name, n)\
+if (::minprof::ItemSection __section_ ## __LINE__ {MINPROF_COUNTER(name "|C"),\
+    MINPROF_TIMER(name "|T"), MINPROF_COUNTER(name "|N"), (n), name})
+
+}
+
+/* Exemplary usage:
+ *
+ * Profile a section like this:
+ *
+ * MINPROF_SECTION("mySection") {
+ *      setup();
+ *      doStuff();
+ *      teardown();
+ * }
+ *
+ * Time a region like this:
+ *
+ * MINPROF_TIMED("myTimer|T") {
+ *      stuff();
+ *      moreStuff();
+ * }
+ *
+ * Also count the items a section processes, to get ns per item and throughput:
+ *
+ * MINPROF_SECTION_N("parse", lines.size()) {
+ *      parse(lines);
+ * }
+ *
+ * Track a level that may also decrease like this:
+ *
+ * MINPROF_GAUGE("queueDepth|G").set(queue.size());
+ *
+ * Buffer increments in really hot loops like this:
+ *
+ * {
+ *      minprof::LocalCounter<> items{MINPROF_COUNTER("items|C")};
+ *      for (auto& job : jobs)
+ *          ++items;
+ * }
+ *
+ * Separate name components with '.' to get subtree totals in the rollup dumps:
+ *
+ * MINPROF_SECTION("db.query.select") { select(); }
+ * MINPROF_SECTION("db.query.insert") { insert(); }
+ *
+ * See minprof/report.hh for getting the results out.
+ *
+ */
+
+#endif
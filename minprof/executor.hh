@@ -0,0 +1,296 @@
+/** \brief Task executor instrumentation for the minimal profiler.
+ *
+ * \file    minprof/executor.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_EXECUTOR_HH_
+#define MINPROF_EXECUTOR_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Counter
+// minprof::Timer
+// minprof::Stopwatch
+// minprof::ThreadStorage
+#include "heatmap.hh"
+// minprof::Heatmap
+
+#include <type_traits>
+// std::decay
+#include <utility>
+// std::declval
+// std::forward
+// std::move
+
+namespace minprof {
+
+/** \brief Registered counters and heatmaps of an instrumented executor.
+ *
+ * All counters are incremented through the calling thread's ThreadStorage slots, so workers never
+ * contend on them, and MINPROF_DUMP_THREADS shows the split per worker:
+ *
+ * - <name>.tasks|C            Number of tasks run.
+ * - <name>.wait|T             Total time tasks spent queued, from wrap() to start.
+ * - <name>.run|T              Total time tasks spent running, i.e. busy time of the worker.
+ * - <name>.idle|T             Total time workers spent idle, see Idle.
+ * - <name>.steal_attempts|C   Number of steal attempts.
+ * - <name>.steals|C           Number of successful steals.
+ *
+ * Additionally, the distributions of queue wait and run time are recorded into the heatmaps
+ * <name>.wait and <name>.run, whose per-thread shards keep the workers apart just as well.
+ *
+ * Use MINPROF_EXECUTOR to create a probe.
+ */
+struct ExecutorProbe {
+    /** \brief StaticCounter index of the task count. */
+    unsigned    tasks;
+    /** \brief StaticCounter index of the queue wait time. */
+    unsigned    wait;
+    /** \brief StaticCounter index of the run time. */
+    unsigned    run;
+    /** \brief StaticCounter index of the idle time. */
+    unsigned    idle_time;
+    /** \brief StaticCounter index of the steal attempts. */
+    unsigned    steal_attempts;
+    /** \brief StaticCounter index of the successful steals. */
+    unsigned    steals;
+    /** \brief Queue wait distribution. */
+    Heatmap*    wait_heatmap;
+    /** \brief Run time distribution. */
+    Heatmap*    run_heatmap;
+
+    /** \brief Scoped measurement of a worker's idle time. */
+    class Idle {
+    public:
+        /** \brief Start measuring idle time.
+         *
+         * \param   [in]    probe   Executor probe.
+         */
+        explicit Idle(const ExecutorProbe& probe)
+        : m_probe{probe}, m_start{Stopwatch::Clock::now()}
+        {}
+        /** \brief Stop measuring idle time. */
+        ~Idle()
+        {
+            const auto dur = std::chrono::duration_cast<Timer::duration>(
+                Stopwatch::Clock::now() - m_start
+            );
+            static_cast<Timer&>(ThreadStorage::current().slot(m_probe.idle_time)) += dur;
+        }
+
+        // No copy constructor.
+        Idle(const Idle&) = delete;
+        // No copy assignment.
+        Idle& operator=(const Idle&) = delete;
+
+        // No move constructor.
+        Idle(Idle&&) = delete;
+        // No move assignment.
+        Idle& operator=(Idle&&) = delete;
+
+        // Hack to make use of if-condition initialization scoping.
+        operator bool() const noexcept
+        {
+            return true;
+        }
+
+    private:
+        // Executor probe.
+        const ExecutorProbe&    m_probe;
+        // Time of entry.
+        Stopwatch::time_point   m_start;
+    };
+
+    /** \brief Callable wrapper that instruments a task.
+     *
+     * \tparam  F   Type of the wrapped callable.
+     */
+    template<typename F>
+    class Task {
+    public:
+        /** \brief Wrap a callable, marking it enqueued now.
+         *
+         * \param   [in]    probe   Executor probe.
+         * \param   [in]    fn      Callable to wrap.
+         */
+        Task(const ExecutorProbe& probe, F fn)
+        : m_probe{&probe}, m_fn(std::move(fn)), m_enqueued{Stopwatch::Clock::now()}
+        {}
+
+        /** \brief Run the task, recording its queue wait and run time.
+         *
+         * \param   [in]    args    Arguments to forward to the callable.
+         * \return  Result of the callable.
+         */
+        template<typename... Args>
+        auto operator()(Args&&... args) -> decltype(std::declval<F&>()(std::forward<Args>(args)...))
+        {
+            const Run run{*m_probe, m_enqueued};
+            return m_fn(std::forward<Args>(args)...);
+        }
+
+    private:
+        // Records a run on destruction, so that exceptions are accounted for.
+        class Run {
+        public:
+            Run(const ExecutorProbe& probe, Stopwatch::time_point enqueued)
+            : m_probe{probe}, m_start{Stopwatch::Clock::now()}
+            {
+                const auto wait = std::chrono::duration_cast<Timer::duration>(m_start - enqueued);
+
+                auto& storage = ThreadStorage::current();
+                ++storage.slot(m_probe.tasks);
+                static_cast<Timer&>(storage.slot(m_probe.wait)) += wait;
+                m_probe.wait_heatmap->record(wait, m_start);
+            }
+            ~Run()
+            {
+                const auto end = Stopwatch::Clock::now();
+                const auto dur = std::chrono::duration_cast<Timer::duration>(end - m_start);
+
+                static_cast<Timer&>(ThreadStorage::current().slot(m_probe.run)) += dur;
+                m_probe.run_heatmap->record(dur, end);
+            }
+
+        private:
+            // Executor probe.
+            const ExecutorProbe&    m_probe;
+            // Time the task started running.
+            Stopwatch::time_point   m_start;
+        };
+
+        // Executor probe.
+        const ExecutorProbe*    m_probe;
+        // Wrapped callable.
+        F                       m_fn;
+        // Time the task was wrapped.
+        Stopwatch::time_point   m_enqueued;
+    };
+
+    /** \brief Wrap a task before enqueueing it.
+     *
+     * \param   [in]    fn  Callable to wrap.
+     * \return  Instrumented callable.
+     */
+    template<typename F>
+    Task<typename std::decay<F>::type> wrap(F&& fn) const
+    {
+        return Task<typename std::decay<F>::type>{*this, std::forward<F>(fn)};
+    }
+
+    /** \brief Record a steal attempt of the calling worker.
+     *
+     * \param   [in]    success True if a task was stolen.
+     */
+    void steal(bool success) const
+    {
+        auto& storage = ThreadStorage::current();
+        ++storage.slot(steal_attempts);
+        if (success) {
+            ++storage.slot(steals);
+        }
+    }
+};
+
+/** \brief Adapter that instruments all tasks submitted to an executor.
+ *
+ * Works with any executor whose submit() accepts a callable, forwarding the result.
+ *
+ * \tparam  Executor    Type of the wrapped executor.
+ */
+template<typename Executor>
+class InstrumentedExecutor {
+public:
+    /** \brief Initialize a new InstrumentedExecutor.
+     *
+     * \param   [in,out]    executor    Executor to submit to.
+     * \param   [in]        probe       Executor probe.
+     */
+    InstrumentedExecutor(Executor& executor, const ExecutorProbe& probe) noexcept
+    : m_executor{executor}, m_probe{probe}
+    {}
+
+    /** \brief Submit an instrumented task.
+     *
+     * \param   [in]    fn  Callable to submit.
+     * \return  Result of the executor's submit().
+     */
+    template<typename F>
+    auto submit(F&& fn) -> decltype(std::declval<Executor&>().submit(
+        std::declval<ExecutorProbe::Task<typename std::decay<F>::type>>()
+    ))
+    {
+        return m_executor.submit(m_probe.wrap(std::forward<F>(fn)));
+    }
+
+    /** \brief Get the wrapped executor.
+     *
+     * \return  Wrapped executor.
+     */
+    Executor& executor() const noexcept
+    {
+        return m_executor;
+    }
+    /** \brief Get the executor probe.
+     *
+     * \return  Executor probe.
+     */
+    const ExecutorProbe& probe() const noexcept
+    {
+        return m_probe;
+    }
+
+private:
+    // Wrapped executor.
+    Executor&               m_executor;
+    // Executor probe.
+    const ExecutorProbe&    m_probe;
+};
+
+/** \brief Create the ExecutorProbe for an executor.
+ *
+ * Best stored in a static variable, as the probe only holds indices and pointers.
+ *
+ * \param   name    Name string literal of the executor.
+ */
+#define MINPROF_EXECUTOR(name) ::minprof::ExecutorProbe{\
+    ::minprof::StaticCounter<typestring_is(name ".tasks|C")>::index,\
+    ::minprof::StaticCounter<typestring_is(name ".wait|T")>::index,\
+    ::minprof::StaticCounter<typestring_is(name ".run|T")>::index,\
+    ::minprof::StaticCounter<typestring_is(name ".idle|T")>::index,\
+    ::minprof::StaticCounter<typestring_is(name ".steal_attempts|C")>::index,\
+    ::minprof::StaticCounter<typestring_is(name ".steals|C")>::index,\
+    &MINPROF_HEATMAP(name ".wait"), &MINPROF_HEATMAP(name ".run")}
+
+/** \brief Measure the following statement (-block) as idle time of the calling worker.
+ *
+ * \param   probe   ExecutorProbe of the executor.
+ */
+#define MINPROF_EXECUTOR_IDLE(probe)\
+if (::minprof::ExecutorProbe::Idle __idle_ ## __LINE__ {probe})
+
+}
+
+/* Exemplary usage:
+ *
+ * Wrap tasks when enqueueing them, and mark the time a worker waits for work:
+ *
+ * static const auto probe = MINPROF_EXECUTOR("pool");
+ *
+ * queue.push(probe.wrap([]() { work(); }));
+ *
+ * for (;;) {
+ *      std::function<void()> task;
+ *      MINPROF_EXECUTOR_IDLE(probe) { task = queue.pop(); }
+ *      task();
+ * }
+ *
+ * Or let an adapter wrap every submitted task:
+ *
+ * minprof::InstrumentedExecutor<ThreadPool> executor{pool, probe};
+ * executor.submit([]() { work(); });
+ *
+ */
+
+#endif
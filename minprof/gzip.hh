@@ -0,0 +1,251 @@
+/** \brief Self-contained gzip compression for the minimal profiler's exporters.
+ *
+ * Implements just enough of RFC 1951 and RFC 1952 to produce valid gzip streams without linking
+ * zlib: greedy LZ77 matching over a single hash table, encoded with the fixed Huffman codes. This
+ * trades some ratio for speed and simplicity, which suits the highly repetitive profiler output.
+ *
+ * \file    minprof/gzip.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_GZIP_HH_
+#define MINPROF_GZIP_HH_
+#pragma once
+
+#include <cstddef>
+// std::size_t
+#include <cstdint>
+// std::uint8_t
+// std::uint32_t
+// std::uint64_t
+
+#include <vector>
+// std::vector
+
+namespace minprof {
+namespace gzip {
+
+/** \brief Compute the CRC-32 (ISO 3309) of some data.
+ *
+ * \param   [in]    data    Data to checksum.
+ * \param   [in]    size    Number of bytes.
+ * \param   [in]    crc     CRC of the preceding data, for incremental use.
+ *
+ * \return  CRC-32 value.
+ */
+inline std::uint32_t crc32(const std::uint8_t* data, std::size_t size, std::uint32_t crc = 0)
+{
+    struct Table {
+        std::uint32_t entries[256];
+
+        Table()
+        {
+            for (std::uint32_t n = 0; n < 256; ++n) {
+                auto c = n;
+                for (int k = 0; k < 8; ++k) {
+                    c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                entries[n] = c;
+            }
+        }
+    };
+    static const Table table;
+
+    crc = ~crc;
+    for (std::size_t i = 0; i < size; ++i) {
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/** \brief LSB-first bit writer as required by deflate. */
+class BitWriter {
+public:
+    /** \brief Initialize a new BitWriter appending to a buffer.
+     *
+     * \param   [in,out]    out     Output buffer.
+     */
+    explicit BitWriter(std::vector<std::uint8_t>& out) noexcept
+    : m_out{out}, m_bits{0}, m_count{0}
+    {}
+
+    /** \brief Append bits, least significant first.
+     *
+     * \param   [in]    value   Bits to append.
+     * \param   [in]    count   Number of bits, at most 32.
+     */
+    void put(std::uint32_t value, unsigned count)
+    {
+        m_bits |= static_cast<std::uint64_t>(value) << m_count;
+        m_count += count;
+        while (m_count >= 8) {
+            m_out.push_back(static_cast<std::uint8_t>(m_bits));
+            m_bits >>= 8;
+            m_count -= 8;
+        }
+    }
+    /** \brief Append a Huffman code, most significant first.
+     *
+     * \param   [in]    code    Code to append.
+     * \param   [in]    count   Length of the code in bits.
+     */
+    void put_code(std::uint32_t code, unsigned count)
+    {
+        std::uint32_t reversed = 0;
+        for (unsigned i = 0; i < count; ++i) {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        put(reversed, count);
+    }
+    /** \brief Pad to the next byte boundary with zeros. */
+    void flush()
+    {
+        if (m_count > 0) {
+            put(0, 8 - m_count);
+        }
+    }
+
+private:
+    // Output buffer.
+    std::vector<std::uint8_t>&  m_out;
+    // Pending bits.
+    std::uint64_t               m_bits;
+    // Number of pending bits.
+    unsigned                    m_count;
+};
+
+/** \brief Compress data into a raw deflate stream using a single fixed Huffman block.
+ *
+ * \param   [in]        data    Data to compress.
+ * \param   [in]        size    Number of bytes.
+ * \param   [in,out]    out     Output buffer to append to.
+ */
+inline void deflate(const std::uint8_t* data, std::size_t size, std::vector<std::uint8_t>& out)
+{
+    static const std::uint16_t length_base[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const std::uint8_t length_extra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static const std::uint16_t distance_base[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+    };
+    static const std::uint8_t distance_extra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+
+    constexpr std::size_t window = 32768;
+    constexpr unsigned min_match = 3;
+    constexpr unsigned max_match = 258;
+    constexpr unsigned hash_bits = 15;
+
+    BitWriter bits{out};
+    // BFINAL = 1, BTYPE = 01 (fixed Huffman codes).
+    bits.put(1, 1);
+    bits.put(1, 2);
+
+    // Fixed literal/length code, see RFC 1951 section 3.2.6.
+    const auto put_symbol = [&bits](unsigned symbol) {
+        if (symbol < 144) {
+            bits.put_code(0x30 + symbol, 8);
+        } else if (symbol < 256) {
+            bits.put_code(0x190 + symbol - 144, 9);
+        } else if (symbol < 280) {
+            bits.put_code(symbol - 256, 7);
+        } else {
+            bits.put_code(0xC0 + symbol - 280, 8);
+        }
+    };
+    const auto hash = [data](std::size_t pos) {
+        const std::uint32_t v = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16);
+        return (v * 2654435761u) >> (32 - hash_bits);
+    };
+
+    std::vector<std::int64_t> head(std::size_t{1} << hash_bits, -1);
+    std::size_t pos = 0;
+    while (pos < size) {
+        unsigned length = 0;
+        std::size_t distance = 0;
+
+        if (pos + min_match <= size) {
+            const auto h = hash(pos);
+            const auto candidate = head[h];
+            head[h] = static_cast<std::int64_t>(pos);
+
+            if (candidate >= 0 && pos - static_cast<std::size_t>(candidate) <= window) {
+                const auto limit = size - pos < max_match ? size - pos : max_match;
+                const auto match = data + candidate;
+                while (length < limit && match[length] == data[pos + length]) {
+                    ++length;
+                }
+                distance = pos - static_cast<std::size_t>(candidate);
+            }
+        }
+
+        if (length < min_match) {
+            put_symbol(data[pos]);
+            ++pos;
+            continue;
+        }
+
+        unsigned lcode = 0;
+        while (lcode + 1 < 29 && length_base[lcode + 1] <= length) {
+            ++lcode;
+        }
+        put_symbol(257 + lcode);
+        bits.put(length - length_base[lcode], length_extra[lcode]);
+
+        unsigned dcode = 0;
+        while (dcode + 1 < 30 && distance_base[dcode + 1] <= distance) {
+            ++dcode;
+        }
+        bits.put_code(dcode, 5);
+        bits.put(static_cast<std::uint32_t>(distance - distance_base[dcode]),
+                 distance_extra[dcode]);
+
+        // Make the skipped positions findable as well.
+        const auto end = pos + length;
+        for (++pos; pos < end && pos + min_match <= size; ++pos) {
+            head[hash(pos)] = static_cast<std::int64_t>(pos);
+        }
+        pos = end;
+    }
+
+    // End of block.
+    put_symbol(256);
+    bits.flush();
+}
+
+/** \brief Compress data into a gzip stream.
+ *
+ * \param   [in]        data    Data to compress.
+ * \param   [in]        size    Number of bytes.
+ * \param   [in,out]    out     Output buffer to append to.
+ */
+inline void compress(const std::uint8_t* data, std::size_t size, std::vector<std::uint8_t>& out)
+{
+    // ID1, ID2, CM = deflate, FLG = 0, MTIME = 0, XFL = 0, OS = unknown.
+    static const std::uint8_t header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+    out.insert(out.end(), header, header + sizeof(header));
+
+    deflate(data, size, out);
+
+    const auto crc = crc32(data, size);
+    const auto isize = static_cast<std::uint32_t>(size);
+    for (unsigned i = 0; i < 4; ++i) {
+        out.push_back(static_cast<std::uint8_t>(crc >> (8 * i)));
+    }
+    for (unsigned i = 0; i < 4; ++i) {
+        out.push_back(static_cast<std::uint8_t>(isize >> (8 * i)));
+    }
+}
+
+}
+}
+
+#endif
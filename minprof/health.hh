@@ -0,0 +1,181 @@
+/** \brief Self-instrumentation of the minimal profiler.
+ *
+ * \file    minprof/health.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_HEALTH_HH_
+#define MINPROF_HEALTH_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Counter
+// minprof::Timer
+// minprof::Section
+// minprof::Stopwatch
+// minprof::Unit
+// minprof::StaticCounterRegistry
+#include "heatmap.hh"
+// minprof::Heatmap
+#include "sampler.hh"
+// minprof::Sampler
+
+#include <chrono>
+// std::chrono::duration
+#include <mutex>
+// std::mutex
+// std::lock_guard
+
+namespace minprof {
+
+/** \brief Accounts what the profiler itself costs and where it loses data.
+ *
+ * minprof names its own counters and heatmaps "minprof.*", so that they roll up into a single
+ * subtree and can be hidden from all dumps with StaticCounterRegistry::hide_internal(). Each of
+ * them exists as soon as the header maintaining it is used:
+ *
+ * - minprof.dump|C, |T             Dumps of the StaticCounterRegistry and the time spent in them.
+ * - minprof.trace.dropped|C        Trace events dropped because a ring was full, per thread slot.
+ * - minprof.trace.high_water|G     Highest ring fill level the TraceStreamer found, in events.
+ * - minprof.tail.commits|C, drops|C, missed|C  Requests committed, dropped and not sampled by
+ *                                  the TailSampler.
+ * - minprof.stacks.dropped|C       Slow exits that did not fit into the StackProfiler's tables.
+ * - minprof.inflight.<name>|G      Threads inside a MINPROF_CONCURRENT_SECTION, per thread slot.
+ * - minprof.sampler.snapshot       Sampler snapshots, as counter, timer and heatmap.
+ * - minprof.sampler.lateness       Time the Sampler woke up late, as timer and heatmap.
+ *
+ * Once started, every Sampler snapshot additionally refreshes:
+ *
+ * - minprof.dump                   Heatmap of the duration of every dump.
+ * - minprof.overhead.section|G     Calibrated cost of entering and leaving a Section in ns.
+ * - minprof.overhead|T             Estimated time spent in profiling hot paths, i.e. the section
+ *                                  cost times all user "|C" counts. Counters that are not sections
+ *                                  are cheaper, so this is an upper bound.
+ *
+ * There is only one Health, which is controlled through the static interface.
+ */
+class Health {
+public:
+    // No copy constructor.
+    Health(const Health&) = delete;
+    // No copy assignment operator.
+    Health& operator=(const Health&) = delete;
+    // No move constructor.
+    Health(Health&&) = delete;
+    // No move assignment operator.
+    Health& operator=(Health&&) = delete;
+
+    /** \brief Calibrate the section cost and refresh the estimates after every Sampler snapshot.
+     *
+     * Does nothing if already started.
+     */
+    static void start()
+    {
+        auto& self = instance();
+        {
+            std::lock_guard<std::mutex> lock{self.m_lock};
+            if (self.m_started) {
+                return;
+            }
+
+            self.m_started = true;
+            self.m_section_cost = calibrate();
+            MINPROF_GAUGE("minprof.overhead.section|G").set(
+                static_cast<Counter::value_type>(self.m_section_cost + 0.5)
+            );
+        }
+
+        StaticCounterRegistry::set_dump_hook(&record_dump);
+        // Not under m_lock, see Sampler::Hook::set().
+        self.m_hook.set([](Stopwatch::time_point) { sample(); });
+    }
+
+    /** \brief Refresh the overhead estimate now.
+     *
+     * Called by the Sampler once started, but may also be called directly.
+     */
+    static void sample()
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        Counter::value_type sections = 0;
+        const auto count = StaticCounterRegistry::count();
+        for (unsigned idx = 0; idx < count; ++idx) {
+            if (StaticCounterRegistry::get_unit(idx) == Unit::count
+                && !StaticCounterRegistry::is_internal(idx)) {
+                sections += StaticCounterRegistry::total(idx);
+            }
+        }
+
+        MINPROF_GAUGE("minprof.overhead|T").set(
+            static_cast<Counter::value_type>(static_cast<double>(sections) * self.m_section_cost)
+        );
+    }
+
+    /** \brief Measure the cost of entering and leaving a Section.
+     *
+     * Times an uncontended loop of empty Sections, so this is the cost with a warm cache.
+     *
+     * \return  Cost per Section in ns.
+     */
+    static double calibrate()
+    {
+        constexpr unsigned rounds = 1u << 16;
+
+        Counter counter;
+        Timer timer;
+        const auto start = Stopwatch::Clock::now();
+        for (unsigned round = 0; round < rounds; ++round) {
+            const Section section{counter, timer};
+        }
+        const auto end = Stopwatch::Clock::now();
+
+        return std::chrono::duration<double, std::nano>(end - start).count() / rounds;
+    }
+
+private:
+    Health()
+    : m_lock{}, m_started{false}, m_section_cost{0.0}, m_hook{}
+    {}
+
+    static Health& instance()
+    {
+        static Health instance;
+        return instance;
+    }
+
+    // Dump hook, see StaticCounterRegistry::set_dump_hook().
+    static void record_dump(Timer::duration dur)
+    {
+        MINPROF_HEATMAP("minprof.dump").record(dur);
+    }
+
+    // Guards sampling.
+    std::mutex      m_lock;
+    // True once the Sampler hook was added.
+    bool            m_started;
+    // Calibrated cost of a Section in ns.
+    double          m_section_cost;
+    // Sampler hook, constructs the Sampler so that it outlives this.
+    Sampler::Hook   m_hook;
+};
+
+}
+
+/* Exemplary usage:
+ *
+ * Account the profiler's own cost while the Sampler runs. Health constructs the Sampler first, so
+ * that it is destroyed last, and the two may be started in either order:
+ *
+ * minprof::Sampler::start();
+ * minprof::Health::start();
+ *
+ * Keep the internal counters out of a report:
+ *
+ * minprof::StaticCounterRegistry::hide_internal(true);
+ * MINPROF_DUMP(std::cout);
+ *
+ */
+
+#endif
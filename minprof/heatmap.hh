@@ -0,0 +1,803 @@
+/** \brief Time-bucketed latency heatmaps for the minimal profiler.
+ *
+ * \file    minprof/heatmap.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_HEATMAP_HH_
+#define MINPROF_HEATMAP_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Counter
+// minprof::Timer
+// minprof::Stopwatch
+// minprof::StaticCounterRegistry
+// minprof::ThreadStorage
+
+#include <cstddef>
+// std::size_t
+#include <cstdint>
+// std::int64_t
+// std::uint64_t
+
+#include <algorithm>
+// std::copy
+// std::fill
+// std::stable_sort
+#include <array>
+// std::array
+#include <iterator>
+// std::begin
+// std::end
+#include <memory>
+// std::unique_ptr
+#include <ostream>
+// std::ostream
+// std::endl
+#include <thread>
+// std::this_thread::yield
+#include <utility>
+// std::pair
+#include <vector>
+// std::vector
+
+/* Heatmap interval:
+ *
+ * Length of every heatmap interval in milliseconds.
+ */
+#if !defined(MINPROF_HEATMAP_INTERVAL_MS)
+#define MINPROF_HEATMAP_INTERVAL_MS 1000
+#endif
+
+/* Heatmap intervals:
+ *
+ * Number of intervals every heatmap keeps, i.e. the history is INTERVAL_MS * INTERVALS long. Every
+ * heatmap allocates intervals * 520 bytes once, plus 528 bytes for every thread recording into it.
+ */
+#if !defined(MINPROF_HEATMAP_INTERVALS)
+#define MINPROF_HEATMAP_INTERVALS   600
+#endif
+
+namespace minprof {
+
+/** \brief Atomic histogram with logarithmic buckets.
+ *
+ * Bucket 0 holds the value 0, and bucket i > 0 holds the values in [2^(i-1), 2^i). The last bucket
+ * also holds everything above. Recording is a single relaxed increment, so histograms may be
+ * shared between threads just like Counters.
+ */
+class Histogram {
+public:
+    /** \brief Number of buckets. */
+    static constexpr unsigned bucket_count = 64;
+
+public:
+    /** \brief Initialize a new, empty Histogram. */
+    Histogram() noexcept
+    {
+        clear();
+    }
+
+    // No copy constructor.
+    Histogram(const Histogram&) = delete;
+    // No copy assignment operator.
+    Histogram& operator=(const Histogram&) = delete;
+    // No move constructor.
+    Histogram(Histogram&&) = delete;
+    // No move assignment operator.
+    Histogram& operator=(Histogram&&) = delete;
+
+    /** \brief Get the bucket a value falls into.
+     *
+     * \param   [in]    value   Value.
+     * \return  Bucket index.
+     */
+    ALWAYS_INLINE static unsigned bucket(std::uint64_t value) noexcept
+    {
+        if (value == 0) {
+            return 0;
+        }
+
+#if defined(__GNUC__) || defined(__clang__)
+        const unsigned width = 64 - __builtin_clzll(value);
+#else
+        unsigned width = 0;
+        for (; value != 0; value >>= 1) {
+            ++width;
+        }
+#endif
+        return width < bucket_count ? width : bucket_count - 1;
+    }
+    /** \brief Get the smallest value of a bucket.
+     *
+     * \param   [in]    idx     Bucket index.
+     * \return  Lower bound of the bucket.
+     */
+    static std::uint64_t lower_bound(unsigned idx) noexcept
+    {
+        return idx == 0 ? 0 : std::uint64_t{1} << (idx - 1);
+    }
+
+    /** \brief Estimate a quantile from bucket counts.
+     *
+     * Interpolates linearly within the bucket holding the requested rank.
+     *
+     * \param   [in]    counts  Bucket counts.
+     * \param   [in]    q       Quantile in [0, 1].
+     * \return  Estimated value, 0 if there are no values.
+     */
+    static std::uint64_t quantile(const std::uint64_t (&counts)[bucket_count], double q) noexcept
+    {
+        std::uint64_t total = 0;
+        for (const auto count : counts) {
+            total += count;
+        }
+        if (total == 0) {
+            return 0;
+        }
+
+        q = q < 0.0 ? 0.0 : (q > 1.0 ? 1.0 : q);
+        auto rank = static_cast<std::uint64_t>(q * static_cast<double>(total) + 0.5);
+        rank = rank == 0 ? 1 : rank;
+
+        std::uint64_t below = 0;
+        unsigned idx = 0;
+        while (below + counts[idx] < rank) {
+            below += counts[idx++];
+        }
+
+        const auto lo = lower_bound(idx);
+        const auto hi = idx == 0 ? 0 : lo * 2 - 1;
+        const auto frac = static_cast<double>(rank - below) / static_cast<double>(counts[idx]);
+        return lo + static_cast<std::uint64_t>(static_cast<double>(hi - lo) * frac);
+    }
+
+    /** \brief Record a value.
+     *
+     * \param   [in]    value   Value to record.
+     */
+    ALWAYS_INLINE void record(std::uint64_t value) noexcept
+    {
+        m_buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /** \brief Add a number of values to a bucket.
+     *
+     * \param   [in]    idx     Bucket index.
+     * \param   [in]    count   Number of values.
+     */
+    void add(unsigned idx, std::uint64_t count) noexcept
+    {
+        m_buckets[idx].fetch_add(count, std::memory_order_relaxed);
+    }
+
+    /** \brief Get the number of values recorded into a bucket.
+     *
+     * \param   [in]    idx     Bucket index.
+     * \return  Bucket count.
+     */
+    std::uint64_t value(unsigned idx) const noexcept
+    {
+        return m_buckets[idx].load(std::memory_order_relaxed);
+    }
+    /** \brief Reset all buckets to 0.
+     *
+     * Values recorded concurrently may or may not survive.
+     */
+    void clear() noexcept
+    {
+        for (auto& bucket : m_buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    // Bucket counts.
+    std::atomic<std::uint64_t>  m_buckets[bucket_count];
+};
+
+/** \brief Ring of per-interval latency histograms.
+ *
+ * Every interval of wall time gets its own Histogram, and the ring keeps the most recent ones.
+ * Interval n always lives in slot n % count, and the first writer of an interval claims its slot by
+ * a CAS on the slot's interval number, then clears and stamps it. Writers therefore never lock,
+ * and intervals without any recordings are left out of the export.
+ *
+ * Threads do not record into the ring directly, but into a shard of their own that only holds the
+ * current interval, so that the hot path never writes a shared cache line. A thread flushes its
+ * shard into the ring once it records into a later interval, under a sequence lock, so that
+ * readers merge the ring and all shards into a consistent view. Threads beyond shard_count share
+ * the ring directly.
+ */
+class Heatmap {
+public:
+    /** \brief Type alias for the interval duration type. */
+    using duration = std::chrono::milliseconds;
+
+    /** \brief Number of threads, by ThreadStorage id, that record into a shard of their own. */
+    static constexpr unsigned shard_count = 256;
+
+public:
+    /** \brief Initialize a new Heatmap.
+     *
+     * \param   [in]    interval    Length of every interval.
+     * \param   [in]    count       Number of intervals to keep, at least 2.
+     */
+    Heatmap(duration interval = duration{MINPROF_HEATMAP_INTERVAL_MS},
+            unsigned count = MINPROF_HEATMAP_INTERVALS)
+    : m_interval{static_cast<std::int64_t>(
+          std::chrono::duration_cast<Timer::duration>(interval).count()
+      )},
+      m_count{count < 2 ? 2 : count}, m_slots{new Slot[m_count]}, m_origin{origin()}
+    {
+        // CONTRACT: Intervals are not empty.
+        assert(m_interval > 0);
+
+        for (auto& shard : m_shards) {
+            shard.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    /** \brief Destroy a Heatmap, along with the shards of all threads. */
+    ~Heatmap()
+    {
+        for (auto& shard : m_shards) {
+            delete shard.load(std::memory_order_relaxed);
+        }
+    }
+
+    // No copy constructor.
+    Heatmap(const Heatmap&) = delete;
+    // No copy assignment operator.
+    Heatmap& operator=(const Heatmap&) = delete;
+    // No move constructor.
+    Heatmap(Heatmap&&) = delete;
+    // No move assignment operator.
+    Heatmap& operator=(Heatmap&&) = delete;
+
+    /** \brief Get the time all heatmap intervals are aligned to.
+     *
+     * \return  Time of the first call.
+     */
+    static Stopwatch::time_point origin()
+    {
+        static const auto origin = Stopwatch::Clock::now();
+        return origin;
+    }
+
+    /** \brief Record a duration into the interval containing a point in time.
+     *
+     * \param   [in]    dur     Duration to record.
+     * \param   [in]    now     Current time, usually the end of the measurement.
+     */
+    ALWAYS_INLINE void record(Timer::duration dur, Stopwatch::time_point now)
+    {
+        const auto tick = std::chrono::duration_cast<Timer::duration>(now - m_origin).count();
+        const auto start = tick > 0 ? static_cast<std::int64_t>(tick) / m_interval : 0;
+        const auto id = ThreadStorage::current().id();
+
+        // The owner is the only writer of its shard, so a plain load and store suffice.
+        const auto shard = id < shard_count ? m_shards[id].load(std::memory_order_relaxed)
+                                            : nullptr;
+        if (shard && shard->start.load(std::memory_order_relaxed) == start) {
+            auto& bucket = shard->buckets[Histogram::bucket(dur.count())];
+            bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        rotate(dur, start, id);
+    }
+    /** \brief Record a duration into the current interval.
+     *
+     * \param   [in]    dur     Duration to record.
+     */
+    void record(Timer::duration dur)
+    {
+        record(dur, Stopwatch::Clock::now());
+    }
+
+    /** \brief Get the length of every interval.
+     *
+     * \return  Interval length.
+     */
+    Timer::duration interval() const noexcept
+    {
+        return Timer::duration{static_cast<Timer::value_type>(m_interval)};
+    }
+
+    /** \brief Sum up the histograms of all intervals overlapping a recent window of time.
+     *
+     * \param   [in,out]    counts  Bucket counts to add to.
+     * \param   [in]        window  Length of the window.
+     * \param   [in]        now     End of the window.
+     */
+    void accumulate(std::uint64_t (&counts)[Histogram::bucket_count], Timer::duration window,
+                    Stopwatch::time_point now) const
+    {
+        const auto tick = std::chrono::duration_cast<Timer::duration>(now - m_origin).count();
+        const auto since = static_cast<std::int64_t>(tick) - static_cast<std::int64_t>(
+            window.count()
+        );
+
+        std::uint64_t sum[Histogram::bucket_count];
+        read([&]() {
+            std::fill(std::begin(sum), std::end(sum), 0);
+        }, [&](std::int64_t start, unsigned bucket, std::uint64_t count) {
+            if ((start + 1) * m_interval > since) {
+                sum[bucket] += count;
+            }
+        });
+
+        for (unsigned bucket = 0; bucket < Histogram::bucket_count; ++bucket) {
+            counts[bucket] += sum[bucket];
+        }
+    }
+
+    /** \brief Visit all recorded intervals, oldest first.
+     *
+     * \param   [in]    visitor Callable taking (std::int64_t interval, const std::uint64_t
+     *                          (&counts)[Histogram::bucket_count]), where interval is the number
+     *                          of the interval since origin().
+     */
+    template<typename Visitor>
+    void visit(Visitor&& visitor) const
+    {
+        using Row = std::pair<std::int64_t, std::array<std::uint64_t, Histogram::bucket_count>>;
+
+        // Every interval has one row per ring slot or shard holding it, merged after sorting.
+        std::vector<Row> rows;
+        read([&]() {
+            rows.clear();
+        }, [&](std::int64_t start, unsigned bucket, std::uint64_t count) {
+            if (bucket == 0) {
+                rows.emplace_back();
+                rows.back().first = start;
+                rows.back().second.fill(0);
+            }
+            rows.back().second[bucket] = count;
+        });
+
+        std::stable_sort(rows.begin(), rows.end(), [](const Row& lhs, const Row& rhs) {
+            return lhs.first < rhs.first;
+        });
+
+        for (std::size_t idx = 0; idx < rows.size();) {
+            auto& row = rows[idx];
+            for (++idx; idx < rows.size() && rows[idx].first == row.first; ++idx) {
+                for (unsigned bucket = 0; bucket < Histogram::bucket_count; ++bucket) {
+                    row.second[bucket] += rows[idx].second[bucket];
+                }
+            }
+
+            std::uint64_t counts[Histogram::bucket_count];
+            std::copy(row.second.begin(), row.second.end(), std::begin(counts));
+            visitor(row.first, counts);
+        }
+    }
+
+private:
+    // Interval histogram.
+    struct Slot {
+        // Number of the interval since origin(), negative if unused or being claimed.
+        std::atomic<std::int64_t>   start{-1};
+        // Recorded durations.
+        Histogram                   histogram;
+    };
+    // Current interval of a single thread.
+    struct Shard {
+        // Sequence number, odd while the shard is flushed.
+        std::atomic<unsigned>       seq{0};
+        // Number of the interval since origin(), negative if unused.
+        std::atomic<std::int64_t>   start{-1};
+        // Bucket counts, only written by the owning thread.
+        std::atomic<std::uint64_t>  buckets[Histogram::bucket_count];
+    };
+
+    // Interval number of a slot that is being claimed.
+    static constexpr std::int64_t claiming = -2;
+
+    // Record a duration of a thread without a shard, or into a new interval.
+    __attribute__((noinline)) void rotate(Timer::duration dur, std::int64_t start, unsigned id)
+    {
+        if (id >= shard_count) {
+            const auto slot = claim(start);
+            if (slot) {
+                slot->histogram.record(dur.count());
+            }
+            return;
+        }
+
+        auto shard = m_shards[id].load(std::memory_order_relaxed);
+        if (!shard) {
+            shard = new Shard;
+            for (auto& bucket : shard->buckets) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+            m_shards[id].store(shard, std::memory_order_release);
+        }
+
+        if (start < shard->start.load(std::memory_order_relaxed)) {
+            // An earlier interval, e.g. if the caller took the time a while ago.
+            const auto slot = claim(start);
+            if (slot) {
+                slot->histogram.record(dur.count());
+            }
+            return;
+        }
+
+        const auto seq = shard->seq.load(std::memory_order_relaxed);
+        shard->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        const auto slot = claim(shard->start.load(std::memory_order_relaxed));
+        for (unsigned bucket = 0; bucket < Histogram::bucket_count; ++bucket) {
+            const auto count = shard->buckets[bucket].load(std::memory_order_relaxed);
+            if (slot && count != 0) {
+                slot->histogram.add(bucket, count);
+            }
+            shard->buckets[bucket].store(0, std::memory_order_relaxed);
+        }
+        shard->start.store(start, std::memory_order_relaxed);
+        shard->buckets[Histogram::bucket(dur.count())].store(1, std::memory_order_relaxed);
+
+        shard->seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // Claim the slot of an interval, or nullptr if the ring already moved past it.
+    Slot* claim(std::int64_t start)
+    {
+        if (start < 0) {
+            return nullptr;
+        }
+
+        auto& slot = m_slots[static_cast<unsigned>(start % m_count)];
+        auto current = slot.start.load(std::memory_order_acquire);
+        while (current != start) {
+            if (current > start) {
+                return nullptr;
+            }
+            if (current == claiming) {
+                // Another writer clears the slot.
+                std::this_thread::yield();
+                current = slot.start.load(std::memory_order_acquire);
+                continue;
+            }
+            if (slot.start.compare_exchange_weak(current, claiming, std::memory_order_acquire,
+                                                 std::memory_order_acquire)) {
+                // Writers that loaded the slot before still record into it, which only matters if
+                // they stalled for a whole history.
+                slot.histogram.clear();
+                slot.start.store(start, std::memory_order_release);
+                break;
+            }
+        }
+
+        return &slot;
+    }
+
+    // Call add(start, bucket, count) for every bucket of every ring slot and shard in use, after
+    // begin(). Starts over if a shard was flushed meanwhile.
+    template<typename Begin, typename Add>
+    void read(Begin&& begin, Add&& add) const
+    {
+        unsigned seqs[shard_count];
+        for (;;) {
+            begin();
+
+            for (unsigned id = 0; id < shard_count; ++id) {
+                const auto shard = m_shards[id].load(std::memory_order_acquire);
+                seqs[id] = shard ? shard->seq.load(std::memory_order_acquire) : 0;
+            }
+
+            for (unsigned idx = 0; idx < m_count; ++idx) {
+                const auto start = m_slots[idx].start.load(std::memory_order_acquire);
+                if (start < 0) {
+                    continue;
+                }
+                for (unsigned bucket = 0; bucket < Histogram::bucket_count; ++bucket) {
+                    add(start, bucket, m_slots[idx].histogram.value(bucket));
+                }
+            }
+
+            bool flushed = false;
+            for (unsigned id = 0; id < shard_count && !flushed; ++id) {
+                const auto shard = m_shards[id].load(std::memory_order_acquire);
+                if (!shard) {
+                    continue;
+                }
+                flushed = seqs[id] & 1;
+
+                // Shards of threads that stopped recording may hold an interval beyond history.
+                const auto start = shard->start.load(std::memory_order_relaxed);
+                const auto& slot = m_slots[static_cast<unsigned>(start % m_count)];
+                if (flushed || start < 0 || slot.start.load(std::memory_order_relaxed) > start) {
+                    continue;
+                }
+                for (unsigned bucket = 0; bucket < Histogram::bucket_count; ++bucket) {
+                    add(start, bucket, shard->buckets[bucket].load(std::memory_order_relaxed));
+                }
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            for (unsigned id = 0; id < shard_count && !flushed; ++id) {
+                const auto shard = m_shards[id].load(std::memory_order_relaxed);
+                flushed = shard && shard->seq.load(std::memory_order_relaxed) != seqs[id];
+            }
+            if (!flushed) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    // Interval length in nanoseconds.
+    std::int64_t                m_interval;
+    // Number of slots.
+    unsigned                    m_count;
+    // Slot ring.
+    std::unique_ptr<Slot[]>     m_slots;
+    // Cached origin(), which would check its initialization on every call.
+    Stopwatch::time_point       m_origin;
+    // Shards of the threads by ThreadStorage id, allocated by their owners.
+    std::atomic<Shard*>         m_shards[shard_count];
+};
+
+/** \brief Static container for a global Heatmap.
+ *
+ * Like StaticCounter, instanciating this template creates and registers a global Heatmap.
+ *
+ * \tparam  Name    typestring of the Heatmap's name.
+ */
+template<typename Name>
+class StaticHeatmap {
+public:
+    // Assert that a typestring was passed.
+    static_assert(irqus::is_typestring<Name>::value, "Name must be a typestring!");
+
+    /** \brief Index of the heatmap in the static registration vector. */
+    static const unsigned index;
+
+public:
+    // No (default) constructor.
+    StaticHeatmap() = delete;
+
+    /** \brief Get the global Heatmap instance.
+     *
+     * \return  Global Heatmap instance.
+     */
+    ALWAYS_INLINE static Heatmap& get()
+    {
+        static Heatmap instance;
+
+        // Force the registration, see StaticCounter::get().
+        (void)index;
+
+        return instance;
+    }
+};
+
+/** \brief Static registry for the StaticHeatmap types instanciated. */
+class HeatmapRegistry {
+public:
+    // No copy constructor.
+    HeatmapRegistry(const HeatmapRegistry&) = delete;
+    // No copy assignment operator.
+    HeatmapRegistry& operator=(const HeatmapRegistry&) = delete;
+    // No move constructor.
+    HeatmapRegistry(HeatmapRegistry&&) = delete;
+    // No move assignment operator.
+    HeatmapRegistry& operator=(HeatmapRegistry&&) = delete;
+
+    /** \brief Register a StaticHeatmap.
+     *
+     * \tparam  typestring Name of the StaticHeatmap.
+     *
+     * \return  Index within the static registry.
+     */
+    template<typename Name>
+    static unsigned register_heatmap()
+    {
+        auto& self = instance();
+
+        self.m_names.push_back(Name::data());
+        self.m_instances.push_back(&StaticHeatmap<Name>::get());
+
+        return self.m_instances.size() - 1;
+    }
+
+    /** \brief Get the number of registered heatmaps.
+     *
+     * \return  Number of heatmaps.
+     */
+    static unsigned count() noexcept
+    {
+        return instance().m_instances.size();
+    }
+    /** \brief Get the name of a registered heatmap.
+     *
+     * \param   [in]    idx     Heatmap index.
+     * \return  Heatmap name.
+     */
+    static const char* get_name(unsigned idx) noexcept
+    {
+        return instance().m_names[idx];
+    }
+    /** \brief Get a registered heatmap.
+     *
+     * \param   [in]    idx     Heatmap index.
+     * \return  Heatmap instance.
+     */
+    static const Heatmap& get(unsigned idx) noexcept
+    {
+        return *instance().m_instances[idx];
+    }
+
+    /** \brief Dump all heatmaps to the specified stream as CSV matrices.
+     *
+     * Every heatmap is written as a header row with the lower bounds of the histogram buckets in
+     * nanoseconds, followed by one row per recorded interval with its start in milliseconds since
+     * Heatmap::origin() and the number of durations per bucket. Only the range of buckets that is
+     * used by the heatmap is written, so every row of a heatmap has the same number of columns and
+     * can be plotted as is.
+     *
+     * CSV format is:
+     * <name>, ms, <lower bound ns>... <endl>
+     * <name>, <interval start ms>, <count>... <endl>
+     *
+     * \param   [in,out]    out     Output stream.
+     */
+    static void dump(std::ostream& out)
+    {
+        const auto& self = instance();
+
+        for (unsigned idx = 0; idx < self.m_instances.size(); ++idx) {
+            const auto& heatmap = *self.m_instances[idx];
+            const auto name = self.m_names[idx];
+            if (StaticCounterRegistry::hides_internal()
+                && StaticCounterRegistry::is_internal(name)) {
+                continue;
+            }
+
+            // Find the used bucket range.
+            unsigned lo = Histogram::bucket_count;
+            unsigned hi = 0;
+            heatmap.visit([&](std::int64_t,
+                              const std::uint64_t (&counts)[Histogram::bucket_count]) {
+                for (unsigned bucket = 0; bucket < Histogram::bucket_count; ++bucket) {
+                    if (counts[bucket] != 0) {
+                        lo = bucket < lo ? bucket : lo;
+                        hi = bucket > hi ? bucket : hi;
+                    }
+                }
+            });
+            if (lo > hi) {
+                continue;
+            }
+
+            out << name << ", ms";
+            for (auto bucket = lo; bucket <= hi; ++bucket) {
+                out << ", " << Histogram::lower_bound(bucket);
+            }
+            out << std::endl;
+
+            const auto interval = std::chrono::duration_cast<std::chrono::milliseconds>(
+                heatmap.interval()
+            ).count();
+            heatmap.visit([&](std::int64_t start,
+                              const std::uint64_t (&counts)[Histogram::bucket_count]) {
+                out << name << ", " << start * interval;
+                for (auto bucket = lo; bucket <= hi; ++bucket) {
+                    out << ", " << counts[bucket];
+                }
+                out << std::endl;
+            });
+        }
+    }
+
+private:
+    HeatmapRegistry() = default;
+
+    static HeatmapRegistry& instance() noexcept
+    {
+        static HeatmapRegistry instance;
+        return instance;
+    }
+
+    // Vector of registered heatmap names.
+    std::vector<const char*>    m_names;
+    // Vector of registered heatmaps.
+    std::vector<Heatmap*>       m_instances;
+};
+
+template<typename Name>
+const unsigned StaticHeatmap<Name>::index = HeatmapRegistry::register_heatmap<Name>();
+
+/** \brief Section tracker that also records its durations into a Heatmap.
+ *
+ * Counts and times like a Section, while adding every single duration to the current interval of
+ * the Heatmap.
+ */
+class HeatmapSection {
+public:
+    /** \brief Initialize, trigger and time a new HeatmapSection.
+     *
+     * \param   [in,out]    c   Counter for section.
+     * \param   [in,out]    t   Timer for section.
+     * \param   [in,out]    h   Heatmap for section.
+     */
+    HeatmapSection(Counter& c, Timer& t, Heatmap& h)
+    : m_timer{t}, m_heatmap{h}, m_start{Stopwatch::Clock::now()}
+    {
+        ++c;
+    }
+    /** \brief Stop, retire and destroy a HeatmapSection. */
+    ~HeatmapSection()
+    {
+        const auto end = Stopwatch::Clock::now();
+        const auto dur = std::chrono::duration_cast<Timer::duration>(end - m_start);
+
+        m_timer += dur;
+        m_heatmap.record(dur, end);
+    }
+
+    // No copy constructor.
+    HeatmapSection(const HeatmapSection&) = delete;
+    // No copy assignment.
+    HeatmapSection& operator=(const HeatmapSection&) = delete;
+
+    // No move constructor.
+    HeatmapSection(HeatmapSection&&) = delete;
+    // No move assignment.
+    HeatmapSection& operator=(HeatmapSection&&) = delete;
+
+    // Hack to make use of if-condition initialization scoping.
+    operator bool() const noexcept
+    {
+        return true;
+    }
+
+private:
+    // Backing Timer.
+    Timer&                  m_timer;
+    // Backing Heatmap.
+    Heatmap&                m_heatmap;
+    // Time of entry.
+    Stopwatch::time_point   m_start;
+};
+
+/** \brief Get a global Heatmap.
+ *
+ * \param   name    Name string literal of the Heatmap.
+ */
+#define MINPROF_HEATMAP(name)   ::minprof::StaticHeatmap<typestring_is(name)>::get()
+
+/** \brief Dump all Heatmaps. */
+#define MINPROF_DUMP_HEATMAPS   ::minprof::HeatmapRegistry::dump
+
+/** \brief Profile the following statement (-block) into a latency heatmap.
+ *
+ * Like MINPROF_SECTION, but also records every duration into the Heatmap <name>.
+ *
+ * \param   name    Name string literal of the section.
+ */
+#define MINPROF_HEATMAP_SECTION(name)\
+if (::minprof::HeatmapSection __heatmap_ ## __LINE__ {MINPROF_COUNTER(name "|C"),\
+    MINPROF_TIMER(name "|T"), MINPROF_HEATMAP(name)})
+
+}
+
+/* Exemplary usage:
+ *
+ * Record the latency distribution of a section over time:
+ *
+ * MINPROF_HEATMAP_SECTION("request") {
+ *      handle();
+ * }
+ *
+ * Dump one matrix per heatmap, one row per interval and one column per latency bucket:
+ *
+ * MINPROF_DUMP_HEATMAPS(std::cout);
+ *
+ */
+
+#endif
@@ -0,0 +1,995 @@
+/** \brief Self-contained HTML report generator for the minimal profiler.
+ *
+ * Build with "make report" and run as
+ *
+ *      minprof-report [-o report.html] [-t title] [-i interval_ms] file...
+ *
+ * to turn any mix of the following files into a single static HTML page without external
+ * resources:
+ *
+ * - Counter dumps (MINPROF_DUMP, MINPROF_DUMP_ROLLUP): "<name>|<suffix>, <value>" rows.
+ * - Heatmap dumps (MINPROF_DUMP_HEATMAPS), possibly appended to a counter dump.
+ * - Trace files (see minprof/trace.hh), recognized by their magic bytes.
+ *
+ * The page holds:
+ *
+ * - A sortable and filterable section table with calls, time, mean and percentiles. Sections are
+ *   paired from their "|C" and "|T" counters, any other suffix is listed as is. Sections only
+ *   found in a trace are taken from there.
+ * - An icicle view of the call tree, zoomable by clicking. It is built from the nesting of the
+ *   traced sections, or from the '.' separated section names if no trace is given.
+ * - The latency histogram of the selected section, from the trace or its heatmap.
+ * - Time series of the thread utilization in the trace and of every heatmap's rate and median.
+ *
+ * Inputs are read in a single streaming pass, keeping only aggregates in memory: traces are decoded
+ * block by block and folded into per-thread stacks, so their size is not limited by the memory.
+ * The page renders the table one page at a time and the charts into canvases, so it stays
+ * responsive with 100k counters or call tree nodes.
+ *
+ * \file    minprof/html.cc
+ * \author  Karl Friebel
+ */
+
+#include "heatmap.hh"
+// minprof::Histogram
+#include "trace.hh"
+// minprof::TraceEvent
+// minprof::trace_format
+
+#include <cstddef>
+// std::size_t
+#include <cstdint>
+// std::uint8_t
+// std::uint32_t
+// std::uint64_t
+#include <cstdlib>
+// std::strtoul
+// std::strtoull
+// EXIT_FAILURE
+// EXIT_SUCCESS
+#include <cstring>
+// std::memcmp
+// std::strcmp
+
+#include <algorithm>
+// std::max
+// std::min
+#include <fstream>
+// std::ifstream
+// std::ofstream
+#include <iostream>
+// std::cerr
+// std::cout
+#include <limits>
+// std::numeric_limits
+#include <string>
+// std::getline
+// std::string
+// std::to_string
+#include <unordered_map>
+// std::unordered_map
+#include <utility>
+// std::move
+#include <vector>
+// std::vector
+
+namespace {
+
+using minprof::TraceEvent;
+namespace format = minprof::trace_format;
+
+// Command line options.
+struct Options {
+    // Input files.
+    std::vector<const char*>    files;
+    // Output file, nullptr for stdout.
+    const char*                 output      = nullptr;
+    // Page title.
+    std::string                 title       = "minprof report";
+    // Utilization interval in ns.
+    std::uint64_t               interval    = 100000000;
+};
+
+// Row of the section table.
+struct Section {
+    // Section name without suffix.
+    std::string     name;
+    // Calls, from the "|C" counter or the trace.
+    std::uint64_t   calls       = 0;
+    // Total time in ns, from the "|T" counter or the trace.
+    std::uint64_t   time        = 0;
+    // True if calls or time came from a counter dump, which takes precedence over the trace.
+    bool            dumped      = false;
+    // Other suffixes and their values, as "<suffix>=<value> ...".
+    std::string     other;
+    // Index of the latency histogram, -1 if none.
+    long            histogram   = -1;
+};
+
+// Latency histogram of a section, with the buckets of a minprof::Histogram.
+struct Distribution {
+    // Section name.
+    std::string                 name;
+    // Lower bound of every bucket in ns.
+    std::vector<std::uint64_t>  bounds;
+    // Number of durations per bucket.
+    std::vector<std::uint64_t>  counts;
+};
+
+// Time series.
+struct Series {
+    // Series name.
+    std::string             name;
+    // Unit of the values.
+    std::string             unit;
+    // Start of every point in ms.
+    std::vector<double>     times;
+    // Values.
+    std::vector<double>     values;
+};
+
+// Node of the call tree, node 0 is the root.
+struct Node {
+    // Index of the parent node.
+    std::uint32_t   parent;
+    // Section id in the trace, 0 if built from names.
+    std::uint32_t   id;
+    // Display name.
+    std::string     name;
+    // Number of calls.
+    std::uint64_t   calls;
+    // Inclusive time in ns.
+    std::uint64_t   time;
+};
+
+// Open section instance of a traced thread.
+struct Frame {
+    // Section id.
+    std::uint32_t   id;
+    // Time of the BEGIN event.
+    std::uint64_t   begin;
+    // Call tree node.
+    std::uint32_t   node;
+};
+
+// Traced thread.
+struct Thread {
+    // Thread name.
+    std::string                 name;
+    // Open sections.
+    std::vector<Frame>          stack;
+    // Busy time per utilization interval in ns, starting at interval first.
+    std::vector<std::uint64_t>  busy;
+    // Index of the first utilization interval.
+    std::uint64_t               first   = 0;
+};
+
+// Everything collected from all inputs.
+struct Report {
+    // Section table.
+    std::vector<Section>                            sections;
+    // Section table index by name.
+    std::unordered_map<std::string, std::size_t>    index;
+    // Latency histograms.
+    std::vector<Distribution>                       histograms;
+    // Time series.
+    std::vector<Series>                             series;
+    // Call tree, from traces or the section names.
+    std::vector<Node>                               tree;
+    // Number of input rows that were not understood.
+    std::uint64_t                                   skipped = 0;
+};
+
+// Get the table row of a section, creating it if necessary.
+Section& section(Report& report, const std::string& name)
+{
+    const auto found = report.index.find(name);
+    if (found != report.index.end()) {
+        return report.sections[found->second];
+    }
+
+    report.index.emplace(name, report.sections.size());
+    report.sections.emplace_back();
+    report.sections.back().name = name;
+    return report.sections.back();
+}
+
+// Split a CSV line of a dump at ',' and trim the fields.
+void split(const std::string& line, std::vector<std::string>& fields)
+{
+    fields.clear();
+    std::size_t begin = 0;
+    for (;;) {
+        auto end = line.find(',', begin);
+        const auto last = end == std::string::npos;
+        end = last ? line.size() : end;
+
+        auto lo = begin, hi = end;
+        while (lo < hi && (line[lo] == ' ' || line[lo] == '\t')) {
+            ++lo;
+        }
+        while (hi > lo && (line[hi - 1] == ' ' || line[hi - 1] == '\t' || line[hi - 1] == '\r')) {
+            --hi;
+        }
+        fields.emplace_back(line, lo, hi - lo);
+
+        if (last) {
+            break;
+        }
+        begin = end + 1;
+    }
+}
+
+// Parse an unsigned number, returning false if the field is not one.
+bool number(const std::string& field, std::uint64_t& value)
+{
+    if (field.empty() || field[0] < '0' || field[0] > '9') {
+        return false;
+    }
+
+    char* end = nullptr;
+    value = std::strtoull(field.c_str(), &end, 10);
+    return *end == '\0';
+}
+
+// Estimate a quantile from bucket counts, interpolating within the bucket like minprof::Histogram.
+template<typename Count>
+std::uint64_t quantile(const std::vector<std::uint64_t>& bounds, const Count& counts, double q)
+{
+    std::uint64_t total = 0;
+    for (std::size_t bucket = 0; bucket < bounds.size(); ++bucket) {
+        total += counts[bucket];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    auto rank = static_cast<std::uint64_t>(q * static_cast<double>(total) + 0.5);
+    rank = rank == 0 ? 1 : rank;
+
+    std::uint64_t below = 0;
+    std::size_t bucket = 0;
+    while (below + counts[bucket] < rank) {
+        below += counts[bucket++];
+    }
+
+    const auto lo = bounds[bucket];
+    const auto hi = bucket + 1 < bounds.size() ? bounds[bucket + 1] - 1 : lo * 2;
+    const auto frac = static_cast<double>(rank - below) / static_cast<double>(counts[bucket]);
+    return lo + static_cast<std::uint64_t>(static_cast<double>(hi - lo) * frac);
+}
+
+// Add a parsed heatmap to the histograms and series.
+void add_heatmap(Report& report, Distribution& heatmap, Series& rate, Series& median)
+{
+    if (heatmap.bounds.empty()) {
+        return;
+    }
+
+    // Heatmaps are usually recorded by sections of the same name.
+    auto& row = section(report, heatmap.name);
+    if (row.histogram < 0) {
+        row.histogram = static_cast<long>(report.histograms.size());
+    }
+
+    report.histograms.push_back(std::move(heatmap));
+    report.series.push_back(std::move(rate));
+    report.series.push_back(std::move(median));
+    heatmap = Distribution{};
+    rate = Series{};
+    median = Series{};
+}
+
+// Read a counter and/or heatmap dump line by line.
+void read_dump(Report& report, std::istream& in)
+{
+    std::string line;
+    std::vector<std::string> fields;
+
+    // Heatmap being parsed, with its summed histogram and per-interval series.
+    Distribution heatmap;
+    Series rate, median;
+    std::vector<std::uint64_t> counts;
+
+    while (std::getline(in, line)) {
+        split(line, fields);
+        if (fields.size() < 2 || fields[0].empty()) {
+            ++report.skipped;
+            continue;
+        }
+
+        // Heatmap rows follow their header and have one count per bound.
+        std::uint64_t value = 0;
+        if (!heatmap.bounds.empty() && fields[0] == heatmap.name
+            && fields.size() == heatmap.bounds.size() + 2 && number(fields[1], value)) {
+            const auto start = static_cast<double>(value);
+            std::uint64_t total = 0;
+            counts.assign(heatmap.bounds.size(), 0);
+            for (std::size_t bucket = 0; bucket < heatmap.bounds.size(); ++bucket) {
+                number(fields[bucket + 2], counts[bucket]);
+                heatmap.counts[bucket] += counts[bucket];
+                total += counts[bucket];
+            }
+
+            rate.times.push_back(start);
+            rate.values.push_back(static_cast<double>(total));
+            median.times.push_back(start);
+            median.values.push_back(static_cast<double>(quantile(heatmap.bounds, counts, 0.5)));
+            continue;
+        }
+
+        if (fields[1] == "ms") {
+            add_heatmap(report, heatmap, rate, median);
+            heatmap.name = fields[0];
+            for (std::size_t i = 2; i < fields.size(); ++i) {
+                std::uint64_t bound = 0;
+                number(fields[i], bound);
+                heatmap.bounds.push_back(bound);
+            }
+            heatmap.counts.assign(heatmap.bounds.size(), 0);
+            rate.name = heatmap.name + " rate";
+            rate.unit = "per interval";
+            median.name = heatmap.name + " median";
+            median.unit = "ns";
+            continue;
+        }
+
+        if (fields.size() != 2 || !number(fields[1], value)) {
+            ++report.skipped;
+            continue;
+        }
+
+        const auto bar = fields[0].rfind('|');
+        const auto name = fields[0].substr(0, bar);
+        const auto suffix = bar == std::string::npos ? std::string{} : fields[0].substr(bar + 1);
+        auto& row = section(report, name);
+        if (!row.dumped) {
+            row.calls = 0;
+            row.time = 0;
+            row.dumped = true;
+        }
+        if (suffix == "C") {
+            row.calls = value;
+        } else if (suffix == "T") {
+            row.time = value;
+        } else {
+            row.other += (row.other.empty() ? "" : " ") + (suffix.empty() ? "value" : suffix) + "="
+                         + fields[1];
+        }
+    }
+    add_heatmap(report, heatmap, rate, median);
+}
+
+// Get the call tree node of a section below a parent, creating it if necessary.
+std::uint32_t child(Report& report, std::unordered_map<std::uint64_t, std::uint32_t>& children,
+                    std::uint32_t parent, std::uint32_t id)
+{
+    const auto key = static_cast<std::uint64_t>(parent) << 32 | id;
+    const auto found = children.find(key);
+    if (found != children.end()) {
+        return found->second;
+    }
+
+    const auto node = static_cast<std::uint32_t>(report.tree.size());
+    // Names are resolved once all NAMES blocks are read.
+    report.tree.push_back(Node{parent, id, std::string{}, 0, 0});
+    children.emplace(key, node);
+    return node;
+}
+
+// Add a busy period to the utilization intervals of a thread.
+void add_busy(Thread& target, std::uint64_t interval, std::uint64_t begin, std::uint64_t end)
+{
+    // Threads start with their first busy period, but blocks may hold slightly earlier ones.
+    const auto first = begin / interval;
+    if (target.busy.empty()) {
+        target.first = first;
+    } else if (first < target.first) {
+        target.busy.insert(target.busy.begin(), target.first - first, 0);
+        target.first = first;
+    }
+
+    while (begin < end) {
+        const auto idx = begin / interval;
+        const auto next = std::min(end, (idx + 1) * interval);
+        if (idx - target.first >= target.busy.size()) {
+            target.busy.resize(idx - target.first + 1);
+        }
+        target.busy[idx - target.first] += next - begin;
+        begin = next;
+    }
+}
+
+// Stream a trace file into the call tree, the latency histograms and the utilization.
+bool read_trace(Report& report, const format::Mapping& file, const Options& options)
+{
+    auto pos = file.data();
+    const auto end = pos + file.size();
+
+    format::FileHeader header;
+    if (!format::get(pos, end, header) || header.version < format::min_version
+        || header.version > format::version) {
+        std::cerr << "minprof-report: unsupported trace version" << std::endl;
+        return false;
+    }
+
+    if (report.tree.empty()) {
+        report.tree.push_back(Node{0, 0, "all", 0, 0});
+    }
+
+    // Every trace gets its own subtrees, as ids are only unique within a program.
+    const auto first_node = report.tree.size();
+    std::unordered_map<std::uint64_t, std::uint32_t> children;
+    std::unordered_map<std::uint32_t, std::string> names;
+    std::unordered_map<std::uint32_t, std::vector<std::uint64_t>> latencies;
+    std::unordered_map<std::uint32_t, std::pair<std::uint64_t, std::uint64_t>> totals;
+    std::vector<Thread> threads;
+    const auto thread = [&threads](std::uint32_t id) -> Thread& {
+        if (id >= threads.size()) {
+            threads.resize(id + 1u);
+        }
+        return threads[id];
+    };
+
+    while (pos < end) {
+        format::BlockHeader block;
+        if (!format::get(pos, end, block) || static_cast<std::uint64_t>(end - pos) < block.size) {
+            // The streamer may have been killed while writing, so use what is complete.
+            std::cerr << "minprof-report: truncated block, ignoring the rest" << std::endl;
+            break;
+        }
+        const auto payload = pos;
+        const auto payload_end = pos + block.size;
+        pos = payload_end;
+
+        if (block.type == format::EVENTS) {
+            const auto ok = format::unpack_block(block, payload, [&](const TraceEvent& event) {
+                auto& target = thread(event.thread());
+                auto& stack = target.stack;
+                if (event.kind == TraceEvent::BEGIN) {
+                    const auto parent = stack.empty() ? 0 : stack.back().node;
+                    stack.push_back(Frame{event.id, event.time,
+                                         child(report, children, parent, event.id)});
+                    return;
+                }
+                if (event.kind != TraceEvent::END) {
+                    return;
+                }
+
+                // Sections open at the start of a capture have no BEGIN, so their ENDs are
+                // ignored, while missing ENDs are ignored along with everything nested in them.
+                auto depth = stack.size();
+                while (depth > 0 && stack[depth - 1].id != event.id) {
+                    --depth;
+                }
+                if (depth == 0) {
+                    return;
+                }
+                stack.resize(depth);
+
+                const auto frame = stack.back();
+                stack.pop_back();
+                const auto duration = event.time - frame.begin;
+                auto& node = report.tree[frame.node];
+                ++node.calls;
+                node.time += duration;
+
+                auto& histogram = latencies[event.id];
+                histogram.resize(minprof::Histogram::bucket_count);
+                ++histogram[minprof::Histogram::bucket(duration)];
+
+                auto& total = totals[event.id];
+                ++total.first;
+                total.second += duration;
+
+                if (stack.empty()) {
+                    add_busy(target, options.interval, frame.begin, event.time);
+                }
+            });
+            if (!ok) {
+                std::cerr << "minprof-report: corrupt events block, ignoring it" << std::endl;
+            }
+        } else if (block.type == format::NAMES) {
+            // Later blocks supersede earlier ones.
+            auto at = payload;
+            for (std::uint64_t i = 0; i < block.count; ++i) {
+                std::uint32_t id;
+                std::string name;
+                if (!format::get(at, payload_end, id)
+                    || !format::get_string(at, payload_end, name)) {
+                    break;
+                }
+                if (name.size() > 2 && name.compare(name.size() - 2, 2, "|C") == 0) {
+                    name.resize(name.size() - 2);
+                }
+                names[id] = std::move(name);
+            }
+        } else if (block.type == format::THREADS) {
+            auto at = payload;
+            for (std::uint64_t i = 0; i < block.count; ++i) {
+                std::uint32_t id;
+                std::uint64_t dropped;
+                std::string name;
+                if (!format::get(at, payload_end, id) || !format::get(at, payload_end, dropped)
+                    || !format::get_string(at, payload_end, name)) {
+                    break;
+                }
+                thread(id).name = std::move(name);
+            }
+        }
+    }
+
+    const auto name = [&names](std::uint32_t id) {
+        const auto found = names.find(id);
+        return found != names.end() ? found->second : "section_" + std::to_string(id);
+    };
+
+    // Resolve the names of the nodes added by this trace, and sum the top level into the root.
+    for (auto idx = first_node; idx < report.tree.size(); ++idx) {
+        auto& node = report.tree[idx];
+        node.name = name(node.id);
+        if (node.parent == 0) {
+            report.tree[0].calls += node.calls;
+            report.tree[0].time += node.time;
+        }
+    }
+
+    for (const auto& entry : latencies) {
+        auto& row = section(report, name(entry.first));
+        if (!row.dumped) {
+            row.calls += totals[entry.first].first;
+            row.time += totals[entry.first].second;
+        }
+
+        // Traced latencies are exact, so they replace those of a heatmap. Only the used range of
+        // buckets is kept, like in heatmap dumps.
+        const auto& counts = entry.second;
+        unsigned lo = 0, hi = minprof::Histogram::bucket_count - 1;
+        while (counts[lo] == 0) {
+            ++lo;
+        }
+        while (counts[hi] == 0) {
+            --hi;
+        }
+
+        Distribution histogram;
+        histogram.name = row.name;
+        for (auto bucket = lo; bucket <= hi; ++bucket) {
+            histogram.bounds.push_back(minprof::Histogram::lower_bound(bucket));
+            histogram.counts.push_back(counts[bucket]);
+        }
+        row.histogram = static_cast<long>(report.histograms.size());
+        report.histograms.push_back(std::move(histogram));
+    }
+
+    // Times are relative to the first busy interval of any thread.
+    auto origin = std::numeric_limits<std::uint64_t>::max();
+    for (const auto& target : threads) {
+        origin = target.busy.empty() ? origin : std::min(origin, target.first);
+    }
+
+    const auto ms = static_cast<double>(options.interval) / 1e6;
+    for (std::uint32_t id = 0; id < threads.size(); ++id) {
+        const auto& target = threads[id];
+        if (target.busy.empty()) {
+            continue;
+        }
+
+        Series utilization;
+        utilization.name = (target.name.empty() ? "thread_" + std::to_string(id) : target.name)
+                           + " utilization";
+        utilization.unit = "fraction";
+        for (std::size_t idx = 0; idx < target.busy.size(); ++idx) {
+            utilization.times.push_back(static_cast<double>(target.first - origin + idx) * ms);
+            utilization.values.push_back(static_cast<double>(target.busy[idx])
+                                         / static_cast<double>(options.interval));
+        }
+        report.series.push_back(std::move(utilization));
+    }
+
+    return true;
+}
+
+// Build the call tree from the '.' separated section names, for reports without a trace.
+void name_tree(Report& report)
+{
+    report.tree.push_back(Node{0, 0, "all", 0, 0});
+    std::unordered_map<std::string, std::uint32_t> nodes;
+
+    for (const auto& row : report.sections) {
+        if (row.time == 0) {
+            continue;
+        }
+
+        std::uint32_t parent = 0;
+        std::size_t begin = 0;
+        for (;;) {
+            const auto dot = row.name.find('.', begin);
+            const auto path = row.name.substr(0, dot);
+            auto found = nodes.find(path);
+            if (found == nodes.end()) {
+                const auto label = row.name.substr(begin, dot == std::string::npos
+                                                          ? dot : dot - begin);
+                found = nodes.emplace(path, static_cast<std::uint32_t>(report.tree.size())).first;
+                report.tree.push_back(Node{parent, 0, label, 0, 0});
+            }
+            parent = found->second;
+            if (dot == std::string::npos) {
+                break;
+            }
+            begin = dot + 1;
+        }
+
+        // A section's own time is its inclusive time, which its ancestors only get if larger.
+        report.tree[parent].calls = row.calls;
+        report.tree[parent].time = row.time;
+    }
+
+    // Children always follow their parents, so a reverse pass is bottom-up.
+    std::vector<std::uint64_t> sums(report.tree.size(), 0);
+    for (auto node = report.tree.size(); node-- > 1;) {
+        auto& entry = report.tree[node];
+        entry.time = std::max(entry.time, sums[node]);
+        sums[entry.parent] += entry.time;
+    }
+    report.tree[0].time = sums[0];
+}
+
+// Write a string as a quoted and escaped JSON string, safe to embed into a script element.
+void write_string(std::ostream& out, const std::string& value)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    out << '"';
+    for (const auto c : value) {
+        const auto byte = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (byte < 0x20 || c == '<' || c == '>' || c == '&') {
+            out << "\\u00" << hex[byte >> 4] << hex[byte & 0xF];
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+// Write a vector as a JSON array.
+template<typename T>
+void write_array(std::ostream& out, const std::vector<T>& values)
+{
+    out << '[';
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        out << (i ? "," : "") << values[i];
+    }
+    out << ']';
+}
+
+// Page layout and style, followed by the data script.
+const char* const page_head = R"html(<!DOCTYPE html>
+<html><head><meta charset="utf-8"><title>minprof report</title><style>
+body{font:13px sans-serif;margin:16px;color:#222}
+h1{font-size:18px}h2{font-size:15px;margin:20px 0 6px}
+table{border-collapse:collapse;width:100%}
+th,td{padding:2px 8px;text-align:right;white-space:nowrap}
+th{cursor:pointer;background:#eee;position:sticky;top:0}
+td:first-child,th:first-child{text-align:left;max-width:480px;overflow:hidden;
+  text-overflow:ellipsis}
+td:last-child,th:last-child{text-align:left}
+tr.sel{background:#ffe9a8}tbody tr:hover{background:#f4f4f4}
+canvas{border:1px solid #ddd;width:100%;display:block}
+.bar{margin:6px 0}.muted{color:#888}
+</style></head><body>
+<h1 id="title"></h1><div id="summary" class="muted"></div>
+<h2>Sections</h2>
+<div class="bar"><input id="filter" placeholder="filter" size="40">
+<button id="prev">&lt;</button> <span id="page"></span> <button id="next">&gt;</button></div>
+<table><thead><tr id="head"></tr></thead><tbody id="rows"></tbody></table>
+<h2>Call tree</h2><div class="muted">Click to zoom, click the top bar to zoom out.</div>
+<canvas id="icicle" height="360"></canvas>
+<h2>Latency histogram <span id="hname" class="muted"></span></h2>
+<canvas id="histogram" height="200"></canvas>
+<h2>Time series <select id="series"></select></h2>
+<canvas id="timeseries" height="200"></canvas>
+<script>
+)html";
+
+// Viewer, reading the data written before it.
+const char* const page_tail = R"html(
+</script><script>
+(function () {
+"use strict";
+var D = minprof, $ = function (id) { return document.getElementById(id); };
+function max(a) { return a.reduce(function (m, v) { return v > m ? v : m; }, 0); }
+function ns(v) {
+  if (!v) return "";
+  var u = ["ns", "us", "ms", "s"], i = 0;
+  while (v >= 1000 && i < 3) { v /= 1000; ++i; }
+  return (v < 10 ? v.toFixed(2) : v < 100 ? v.toFixed(1) : v.toFixed(0)) + " " + u[i];
+}
+function esc(s) {
+  return String(s).replace(/[&<>"]/g, function (c) { return "&#" + c.charCodeAt(0) + ";"; });
+}
+$("title").textContent = document.title = D.title;
+$("summary").textContent = D.sections.length + " sections, " + D.tree.length + " call tree nodes, "
+  + D.histograms.length + " histograms, " + D.series.length + " time series"
+  + (D.skipped ? ", " + D.skipped + " input rows skipped" : "");
+
+// Section table: rows are [name, calls, time, mean, p50, p99, other, histogram].
+var cols = [["Section", 0, 0], ["Calls", 1, 0], ["Time", 2, 1], ["Mean", 3, 1], ["p50", 4, 1],
+            ["p99", 5, 1], ["Other", 6, 0]];
+var view = D.sections, sortCol = 2, sortDir = -1, page = 0, pageSize = 100, selected = -1;
+$("head").innerHTML = cols.map(function (c, i) {
+  return "<th data-i=\"" + i + "\">" + c[0] + "</th>";
+}).join("");
+function sort() {
+  var k = cols[sortCol][1];
+  view.sort(function (a, b) { return a[k] < b[k] ? -sortDir : a[k] > b[k] ? sortDir : 0; });
+}
+function render() {
+  var pages = Math.max(1, Math.ceil(view.length / pageSize));
+  page = Math.min(page, pages - 1);
+  $("page").textContent = (page + 1) + " / " + pages + " (" + view.length + ")";
+  var html = [], end = Math.min(view.length, (page + 1) * pageSize);
+  for (var r = page * pageSize; r < end; ++r) {
+    var row = view[r];
+    var sel = row[7] === selected && selected >= 0 ? " class=sel" : "";
+    html.push("<tr data-r=\"" + r + "\"" + sel + "><td title=\"" + esc(row[0]) + "\">"
+      + esc(row[0]) + "</td>" + cols.slice(1).map(function (c) {
+        var v = row[c[1]];
+        return "<td>" + (c[2] ? ns(v) : esc(v || "")) + "</td>";
+      }).join("") + "</tr>");
+  }
+  $("rows").innerHTML = html.join("");
+}
+$("head").onclick = function (e) {
+  var i = +e.target.getAttribute("data-i");
+  if (isNaN(i)) return;
+  sortDir = i === sortCol ? -sortDir : -1; sortCol = i; sort(); render();
+};
+$("filter").oninput = function () {
+  var f = this.value.toLowerCase();
+  view = f ? D.sections.filter(function (s) { return s[0].toLowerCase().indexOf(f) >= 0; })
+           : D.sections;
+  page = 0; sort(); render();
+};
+$("prev").onclick = function () { page = Math.max(0, page - 1); render(); };
+$("next").onclick = function () { ++page; render(); };
+$("rows").onclick = function (e) {
+  var tr = e.target.closest("tr");
+  if (!tr) return;
+  var row = view[+tr.getAttribute("data-r")];
+  selected = row[7]; shown = [row[0], row[7]]; render(); histogram(row[0], row[7]);
+};
+
+function canvas(id) {
+  var c = $(id), r = window.devicePixelRatio || 1;
+  c.width = c.clientWidth * r; c.height = c.getAttribute("height") * r;
+  var g = c.getContext("2d"); g.scale(r, r); g.font = "11px sans-serif";
+  return { c: c, g: g, w: c.clientWidth, h: +c.getAttribute("height") };
+}
+
+// Icicle: tree rows are [parent, name, calls, time], node 0 is the root.
+var kids = D.tree.map(function () { return []; });
+D.tree.forEach(function (n, i) { if (i) kids[n[0]].push(i); });
+kids.forEach(function (k) { k.sort(function (a, b) { return D.tree[b][3] - D.tree[a][3]; }); });
+var zoom = 0, boxes = [];
+function icicle() {
+  var v = canvas("icicle"), g = v.g, rowH = 18, top = 0;
+  boxes = [];
+  if (!D.tree.length || !D.tree[zoom][3]) return;
+  var scale = v.w / D.tree[zoom][3];
+  var path = [], n = zoom;
+  while (n) { n = D.tree[n][0]; path.unshift(n); }
+  function box(i, x, y, w, hue) {
+    g.fillStyle = "hsl(" + hue + ",70%," + (i === zoom ? 70 : 80) + "%)";
+    g.fillRect(x, y, w - 1, rowH - 1);
+    boxes.push([x, y, w, i]);
+    if (w > 40) {
+      g.fillStyle = "#222";
+      g.fillText(D.tree[i][1] + " " + ns(D.tree[i][3]), x + 3, y + 13, w - 6);
+    }
+  }
+  path.forEach(function (p) { box(p, 0, top, v.w, 0); top += rowH; });
+  (function draw(i, x, y) {
+    var w = D.tree[i][3] * scale;
+    if (w < 1 || y > v.h) return;
+    box(i, x, y, w, 20 + (D.tree[i][1].length * 37) % 40);
+    kids[i].forEach(function (k) { draw(k, x, y + rowH); x += D.tree[k][3] * scale; });
+  })(zoom, 0, top);
+}
+function hit(e) {
+  var r = $("icicle").getBoundingClientRect(), x = e.clientX - r.left, y = e.clientY - r.top;
+  for (var i = boxes.length; i--;) {
+    var b = boxes[i];
+    if (x >= b[0] && x < b[0] + b[2] && y >= b[1] && y < b[1] + 18) return b[3];
+  }
+  return -1;
+}
+$("icicle").onclick = function (e) {
+  var i = hit(e);
+  if (i >= 0) { zoom = i === zoom ? D.tree[i][0] : i; icicle(); }
+};
+$("icicle").onmousemove = function (e) {
+  var i = hit(e), n = D.tree[i];
+  this.title = i >= 0 ? n[1] + "\n" + n[2] + " calls, " + ns(n[3]) + ", "
+    + (100 * n[3] / D.tree[0][3]).toFixed(1) + "% of all" : "";
+};
+
+// Histograms are [name, bounds, counts].
+function histogram(name, i) {
+  var v = canvas("histogram"), g = v.g;
+  $("hname").textContent = name + (i < 0 ? " (none recorded)" : "");
+  if (i < 0) return;
+  var h = D.histograms[i], lo = h[2].findIndex(function (c) { return c; }), hi = lo;
+  h[2].forEach(function (c, b) { if (c) hi = b; });
+  if (lo < 0) return;
+  var n = hi - lo + 1, w = v.w / n, top = max(h[2]);
+  for (var b = lo; b <= hi; ++b) {
+    var bh = (v.h - 20) * h[2][b] / top, x = (b - lo) * w;
+    g.fillStyle = "#6a9fd8"; g.fillRect(x + 1, v.h - 20 - bh, w - 2, bh);
+    g.fillStyle = "#222";
+    if (w > 36 || (b - lo) % Math.ceil(36 / w) === 0) {
+      g.fillText(ns(h[1][b]) || "0", x + 2, v.h - 6);
+    }
+    if (h[2][b]) g.fillText(h[2][b], x + 2, Math.max(12, v.h - 24 - bh), w - 4);
+  }
+}
+
+// Series are [name, unit, times, values].
+$("series").innerHTML = D.series.map(function (s, i) {
+  return "<option value=\"" + i + "\">" + esc(s[0]) + "</option>";
+}).join("");
+function series() {
+  var v = canvas("timeseries"), g = v.g, s = D.series[+$("series").value];
+  if (!s || !s[2].length) return;
+  var t0 = s[2][0], t1 = Math.max(t0 + 1, s[2][s[2].length - 1]);
+  var top = max(s[3]) || 1, h = v.h - 20;
+  g.strokeStyle = "#c0504d"; g.beginPath();
+  s[2].forEach(function (t, i) {
+    var x = (t - t0) / (t1 - t0) * (v.w - 2) + 1, y = h - s[3][i] / top * (h - 14) + 1;
+    i ? g.lineTo(x, y) : g.moveTo(x, y);
+  });
+  g.stroke(); g.fillStyle = "#222";
+  g.fillText("max " + (s[1] === "ns" ? ns(top) : +top.toPrecision(4) + " " + s[1]), 4, 11);
+  g.fillText(t0 + " ms", 4, v.h - 4);
+  g.fillText(t1 + " ms", v.w - 70, v.h - 4);
+}
+$("series").onchange = series;
+
+sort(); render(); icicle(); series();
+var first = view[0], shown = first ? [first[0], first[7]] : null;
+if (first) { selected = first[7]; render(); histogram(shown[0], shown[1]); }
+window.onresize = function () { icicle(); series(); if (shown) histogram(shown[0], shown[1]); };
+})();
+</script></body></html>
+)html";
+
+// Write the page, streaming the data straight from the report.
+void write_page(std::ostream& out, const Report& report, const Options& options)
+{
+    out << page_head << "var minprof = {\"title\":";
+    write_string(out, options.title);
+    out << ",\"skipped\":" << report.skipped << ",\n\"sections\":[";
+    for (std::size_t i = 0; i < report.sections.size(); ++i) {
+        const auto& row = report.sections[i];
+        std::uint64_t p50 = 0, p99 = 0;
+        if (row.histogram >= 0) {
+            const auto& histogram = report.histograms[static_cast<std::size_t>(row.histogram)];
+            p50 = quantile(histogram.bounds, histogram.counts, 0.5);
+            p99 = quantile(histogram.bounds, histogram.counts, 0.99);
+        }
+
+        out << (i ? ",\n[" : "\n[");
+        write_string(out, row.name);
+        out << ',' << row.calls << ',' << row.time << ','
+            << (row.calls ? row.time / row.calls : 0) << ',' << p50 << ',' << p99 << ',';
+        write_string(out, row.other);
+        out << ',' << row.histogram << ']';
+    }
+
+    out << "],\n\"tree\":[";
+    for (std::size_t i = 0; i < report.tree.size(); ++i) {
+        const auto& node = report.tree[i];
+        out << (i ? ",\n[" : "\n[") << node.parent << ',';
+        write_string(out, node.name);
+        out << ',' << node.calls << ',' << node.time << ']';
+    }
+
+    out << "],\n\"histograms\":[";
+    for (std::size_t i = 0; i < report.histograms.size(); ++i) {
+        const auto& histogram = report.histograms[i];
+        out << (i ? ",\n[" : "\n[");
+        write_string(out, histogram.name);
+        out << ',';
+        write_array(out, histogram.bounds);
+        out << ',';
+        write_array(out, histogram.counts);
+        out << ']';
+    }
+
+    out << "],\n\"series\":[";
+    for (std::size_t i = 0; i < report.series.size(); ++i) {
+        const auto& series = report.series[i];
+        out << (i ? ",\n[" : "\n[");
+        write_string(out, series.name);
+        out << ',';
+        write_string(out, series.unit);
+        out << ',';
+        write_array(out, series.times);
+        out << ',';
+        write_array(out, series.values);
+        out << ']';
+    }
+    out << "]};" << page_tail;
+}
+
+// Print the usage.
+int usage()
+{
+    std::cerr << "usage: minprof-report [-o report.html] [-t title] [-i interval_ms] file..."
+              << std::endl;
+    return EXIT_FAILURE;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const auto arg = argv[i];
+        const auto has_value = i + 1 < argc;
+        if (std::strcmp(arg, "-o") == 0 && has_value) {
+            options.output = argv[++i];
+        } else if (std::strcmp(arg, "-t") == 0 && has_value) {
+            options.title = argv[++i];
+        } else if (std::strcmp(arg, "-i") == 0 && has_value) {
+            options.interval = std::max(1ul, std::strtoul(argv[++i], nullptr, 10)) * 1000000;
+        } else if (arg[0] != '-') {
+            options.files.push_back(arg);
+        } else {
+            return usage();
+        }
+    }
+    if (options.files.empty()) {
+        return usage();
+    }
+
+    Report report;
+    bool traced = false;
+    for (const auto file_name : options.files) {
+        const format::Mapping file{file_name};
+        if (!file.data()) {
+            std::cerr << "minprof-report: cannot read " << file_name << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        if (file.size() >= sizeof(format::magic)
+            && std::memcmp(file.data(), format::magic, sizeof(format::magic)) == 0) {
+            if (!read_trace(report, file, options)) {
+                return EXIT_FAILURE;
+            }
+            traced = true;
+        } else {
+            std::ifstream in{file_name};
+            read_dump(report, in);
+        }
+    }
+    if (!traced) {
+        name_tree(report);
+    }
+
+    if (!options.output) {
+        write_page(std::cout, report, options);
+        return EXIT_SUCCESS;
+    }
+
+    std::ofstream out{options.output};
+    write_page(out, report, options);
+    if (!out) {
+        std::cerr << "minprof-report: cannot write " << options.output << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
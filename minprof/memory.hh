@@ -0,0 +1,265 @@
+/** \brief Process memory gauges for the minimal profiler.
+ *
+ * Requires Linux. Heap statistics additionally require glibc.
+ *
+ * \file    minprof/memory.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_MEMORY_HH_
+#define MINPROF_MEMORY_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Gauge
+// minprof::StaticCounter
+#include "sampler.hh"
+// minprof::Sampler
+
+#include <cerrno>
+// errno
+// EINTR
+#include <cstddef>
+// std::size_t
+#include <cstdint>
+// std::uint64_t
+#include <cstring>
+// std::memcmp
+
+#include <fcntl.h>
+// open
+#include <sys/resource.h>
+// getrusage
+#include <unistd.h>
+// pread
+// close
+// sysconf
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+// mallinfo
+// mallinfo2
+#define MINPROF_HAS_MALLINFO
+#endif
+
+namespace minprof {
+
+/** \brief Publishes process memory statistics as registered gauges.
+ *
+ * Once started, every Sampler snapshot refreshes the following StaticCounters, so that they line
+ * up with all other counters in dumps and can be queried through Sampler::rate():
+ *
+ * - memory.vm|G            Virtual memory size in bytes (/proc/self/statm).
+ * - memory.rss|G           Resident set size in bytes (/proc/self/statm).
+ * - memory.shared|G        Resident file-backed pages in bytes (/proc/self/statm).
+ * - memory.hwm|G           Peak resident set size in bytes (VmHWM of /proc/self/status).
+ * - memory.heap|G          Bytes allocated by malloc (mallinfo2 uordblks + hblkhd).
+ * - memory.heap_free|G     Bytes held free by malloc (mallinfo2 fordblks).
+ * - memory.minor_faults|C  Minor page faults so far (getrusage).
+ * - memory.major_faults|C  Major page faults so far, i.e. faults that required I/O (getrusage).
+ *
+ * The proc files are kept open and re-read with pread into a fixed buffer, and parsing does not
+ * allocate, so sampling every 100ms costs a few microseconds. Note that mallinfo2 briefly locks
+ * every malloc arena.
+ *
+ * There is only one MemoryGauges, which is controlled through the static interface.
+ */
+class MemoryGauges {
+public:
+    // No copy constructor.
+    MemoryGauges(const MemoryGauges&) = delete;
+    // No copy assignment operator.
+    MemoryGauges& operator=(const MemoryGauges&) = delete;
+    // No move constructor.
+    MemoryGauges(MemoryGauges&&) = delete;
+    // No move assignment operator.
+    MemoryGauges& operator=(MemoryGauges&&) = delete;
+
+    /** \brief Refresh the gauges after every Sampler snapshot.
+     *
+     * Does nothing if already started.
+     */
+    static void start()
+    {
+        auto& self = instance();
+        {
+            std::lock_guard<std::mutex> lock{self.m_lock};
+            if (self.m_started) {
+                return;
+            }
+            self.m_started = true;
+        }
+
+        // Not under m_lock, see Sampler::Hook::set().
+        self.m_hook.set([](Stopwatch::time_point) { sample(); });
+    }
+
+    /** \brief Refresh the gauges now.
+     *
+     * Called by the Sampler once started, but may also be called directly.
+     */
+    static void sample()
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        self.sample_statm();
+        self.sample_status();
+        self.sample_heap();
+        self.sample_rusage();
+    }
+
+private:
+    // Size of the read buffer, large enough for /proc/self/status.
+    static constexpr std::size_t buffer_size = 4096;
+
+    MemoryGauges()
+    : m_lock{}, m_started{false}, m_statm{::open("/proc/self/statm", O_RDONLY | O_CLOEXEC)},
+      m_status{::open("/proc/self/status", O_RDONLY | O_CLOEXEC)},
+      m_page_size{static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE))}, m_buffer{}, m_hook{}
+    {}
+    ~MemoryGauges()
+    {
+        m_hook.reset();
+        if (m_statm >= 0) {
+            ::close(m_statm);
+        }
+        if (m_status >= 0) {
+            ::close(m_status);
+        }
+    }
+
+    static MemoryGauges& instance()
+    {
+        static MemoryGauges instance;
+        return instance;
+    }
+
+    // Read a whole proc file into the buffer, returning the number of bytes.
+    std::size_t read(int fd)
+    {
+        if (fd < 0) {
+            return 0;
+        }
+
+        std::size_t size = 0;
+        while (size < buffer_size - 1) {
+            const auto count = ::pread(fd, m_buffer + size, buffer_size - 1 - size,
+                                       static_cast<off_t>(size));
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                break;
+            }
+            size += static_cast<std::size_t>(count);
+        }
+
+        m_buffer[size] = '\0';
+        return size;
+    }
+
+    // Parse the next unsigned decimal number, advancing the position past it.
+    static std::uint64_t parse(const char*& pos) noexcept
+    {
+        while (*pos != '\0' && (*pos < '0' || *pos > '9')) {
+            ++pos;
+        }
+
+        std::uint64_t value = 0;
+        for (; *pos >= '0' && *pos <= '9'; ++pos) {
+            value = value * 10 + static_cast<std::uint64_t>(*pos - '0');
+        }
+        return value;
+    }
+
+    // Sample /proc/self/statm, which is "size resident shared text lib data dt" in pages.
+    void sample_statm()
+    {
+        if (read(m_statm) == 0) {
+            return;
+        }
+
+        const char* pos = m_buffer;
+        const auto size = parse(pos);
+        const auto resident = parse(pos);
+        const auto shared = parse(pos);
+
+        MINPROF_GAUGE("memory.vm|G").set(size * m_page_size);
+        MINPROF_GAUGE("memory.rss|G").set(resident * m_page_size);
+        MINPROF_GAUGE("memory.shared|G").set(shared * m_page_size);
+    }
+
+    // Sample the VmHWM line of /proc/self/status, which is in kB.
+    void sample_status()
+    {
+        static const char key[] = "\nVmHWM:";
+
+        const auto size = read(m_status);
+        for (std::size_t i = 0; i + sizeof(key) - 1 <= size; ++i) {
+            if (std::memcmp(m_buffer + i, key, sizeof(key) - 1) == 0) {
+                const char* pos = m_buffer + i + sizeof(key) - 1;
+                MINPROF_GAUGE("memory.hwm|G").set(parse(pos) * 1024);
+                return;
+            }
+        }
+    }
+
+    // Sample the malloc statistics.
+    void sample_heap()
+    {
+#if defined(MINPROF_HAS_MALLINFO)
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33)
+        const auto info = ::mallinfo2();
+#else
+        // The int fields of mallinfo wrap at 2GiB.
+        const auto info = ::mallinfo();
+#endif
+        MINPROF_GAUGE("memory.heap|G").set(static_cast<std::uint64_t>(info.uordblks)
+                                           + static_cast<std::uint64_t>(info.hblkhd));
+        MINPROF_GAUGE("memory.heap_free|G").set(static_cast<std::uint64_t>(info.fordblks));
+#endif
+    }
+
+    // Sample the page fault counts.
+    void sample_rusage()
+    {
+        rusage usage;
+        if (::getrusage(RUSAGE_SELF, &usage) != 0) {
+            return;
+        }
+
+        MINPROF_GAUGE("memory.minor_faults|C").set(static_cast<std::uint64_t>(usage.ru_minflt));
+        MINPROF_GAUGE("memory.major_faults|C").set(static_cast<std::uint64_t>(usage.ru_majflt));
+    }
+
+    // Guards sampling.
+    std::mutex      m_lock;
+    // True once the Sampler hook was added.
+    bool            m_started;
+    // File descriptor of /proc/self/statm.
+    int             m_statm;
+    // File descriptor of /proc/self/status.
+    int             m_status;
+    // Size of a page in bytes.
+    std::uint64_t   m_page_size;
+    // Read buffer.
+    char            m_buffer[buffer_size];
+    // Sampler hook, constructs the Sampler so that it outlives this.
+    Sampler::Hook   m_hook;
+};
+
+}
+
+/* Exemplary usage:
+ *
+ * Sample memory along with all counters:
+ *
+ * minprof::MemoryGauges::start();
+ * minprof::Sampler::start();
+ * ...
+ * MINPROF_DUMP_ROLLUP(std::cout);
+ *
+ */
+
+#endif
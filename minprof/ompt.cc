@@ -0,0 +1,418 @@
+/** \brief OpenMP tool (OMPT) profiling parallel regions with the minimal profiler.
+ *
+ * Either compile this file into an OpenMP program, where the runtime finds ompt_start_tool on its
+ * own and all events show up in the program's dumps next to its own sections, or build it with
+ * "make ompt" and load it into any (even uninstrumented) binary as
+ *
+ *      OMP_TOOL_LIBRARIES=./libminprof-ompt.so ./binary
+ *
+ * The following events are counted and timed in the calling thread's slots as sections (<name>|C
+ * and <name>|T), and entered into its CallTree below the tree sections active at the time:
+ *  - omp.parallel:         Parallel regions, on the encountering thread.
+ *  - omp.implicit_task:    Implicit tasks, i.e. every thread's share of a parallel region.
+ *  - omp.loop, omp.sections, omp.single, omp.single.other, omp.workshare, omp.distribute,
+ *    omp.taskloop, omp.scope: Worksharing constructs, as reported by the runtime. Loops with a
+ *    static schedule compiled by GCC never call the runtime and are not seen.
+ *  - omp.barrier, omp.taskwait, omp.taskgroup, omp.reduction: Synchronization regions, with the
+ *    time actually spent waiting in a nested <name>.wait section.
+ *  - omp.task:             Explicit tasks, counted and timed whenever they run, but not entered
+ *                          into the CallTree as they may switch threads. As tasks are often run
+ *                          while waiting at a barrier, task time may be part of the wait time.
+ *
+ * At program exit, the tool writes all counters to the file named by MINPROF_OMPT_OUTPUT,
+ * which defaults to "minprof-ompt.csv". Set it to the empty string to skip this when the program
+ * dumps itself. Set MINPROF_OMPT to 0 to disable the tool.
+ *
+ * Requires an OpenMP 5.0 runtime implementing OMPT, such as LLVM's libomp, and its omp-tools.h.
+ *
+ * \file    minprof/ompt.cc
+ * \author  Karl Friebel
+ */
+
+// The tool writes its own dump, so it compiles the dumps.
+#define MINPROF_IMPLEMENTATION
+#include "../minprof.hh"
+// minprof::Counter
+// minprof::Timer
+// minprof::StaticCounter
+// minprof::StaticCounterRegistry
+// minprof::ThreadStorage
+#include "tree.hh"
+// minprof::CallNode
+// minprof::CallTree
+
+#include <atomic>
+// std::atomic
+#include <cstdint>
+// std::uint64_t
+#include <cstdlib>
+// std::getenv
+#include <cstring>
+// std::strcmp
+
+#include <omp-tools.h>
+// ompt_start_tool_result_t
+// ompt_set_callback_t
+// ompt_data_t
+
+/* Tool stack depth:
+ *
+ * Maximum nesting of OpenMP constructs per thread. Deeper constructs are still counted, but not
+ * timed.
+ */
+#if !defined(MINPROF_OMPT_DEPTH)
+#define MINPROF_OMPT_DEPTH  64
+#endif
+
+namespace {
+
+/* Profiled events:
+ *
+ * X(enumerator, name) for every event.
+ */
+#define MINPROF_OMPT_EVENTS(X)\
+    X(PARALLEL, "omp.parallel")\
+    X(IMPLICIT_TASK, "omp.implicit_task")\
+    X(LOOP, "omp.loop")\
+    X(SECTIONS, "omp.sections")\
+    X(SINGLE, "omp.single")\
+    X(SINGLE_OTHER, "omp.single.other")\
+    X(WORKSHARE, "omp.workshare")\
+    X(DISTRIBUTE, "omp.distribute")\
+    X(TASKLOOP, "omp.taskloop")\
+    X(SCOPE, "omp.scope")\
+    X(BARRIER, "omp.barrier")\
+    X(BARRIER_WAIT, "omp.barrier.wait")\
+    X(TASKWAIT, "omp.taskwait")\
+    X(TASKWAIT_WAIT, "omp.taskwait.wait")\
+    X(TASKGROUP, "omp.taskgroup")\
+    X(TASKGROUP_WAIT, "omp.taskgroup.wait")\
+    X(REDUCTION, "omp.reduction")\
+    X(REDUCTION_WAIT, "omp.reduction.wait")\
+    X(TASK, "omp.task")
+
+// Profiled event.
+enum Event : unsigned {
+#define MINPROF_OMPT_ENUM(id, name) id,
+    MINPROF_OMPT_EVENTS(MINPROF_OMPT_ENUM)
+#undef MINPROF_OMPT_ENUM
+    EVENT_COUNT
+};
+
+// StaticCounter indices per event.
+struct Indices {
+    unsigned calls;
+    unsigned time;
+};
+
+const Indices indices[EVENT_COUNT] = {
+#define MINPROF_OMPT_INDICES(id, name) {\
+    ::minprof::StaticCounter<typestring_is(name "|C")>::index,\
+    ::minprof::StaticCounter<typestring_is(name "|T")>::index},
+    MINPROF_OMPT_EVENTS(MINPROF_OMPT_INDICES)
+#undef MINPROF_OMPT_INDICES
+};
+
+// Open event on a thread's stack.
+struct Frame {
+    // Event.
+    Event               event;
+    // Entered CallTree node.
+    minprof::CallNode*  node;
+    // Time of entry in ns.
+    std::uint64_t       start;
+};
+
+// Stack of open events of a thread. OpenMP reports scopes of a thread properly nested, except for
+// the end of the implicit barrier of worker threads, which libomp may report after the end of the
+// implicit task, if at all.
+struct Stack {
+    // Open events.
+    Frame           frames[MINPROF_OMPT_DEPTH];
+    // Number of open events.
+    unsigned        depth;
+    // Number of events entered beyond the maximum depth.
+    unsigned        overflow;
+};
+
+// Open events of the calling thread.
+thread_local Stack stack;
+// Set while the tool is initialized and the registries exist, as the runtime may shut down after
+// they were destroyed.
+std::atomic<bool> active{false};
+
+// Read the clock in ns.
+inline std::uint64_t now() noexcept
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<minprof::Timer::duration>(
+        minprof::Stopwatch::Clock::now().time_since_epoch()
+    ).count());
+}
+
+// Count an event in the calling thread's slots.
+inline void count(Event event) noexcept
+{
+    ++minprof::ThreadStorage::current().slot(indices[event].calls);
+}
+
+// Time an event in the calling thread's slots.
+inline void add_time(Event event, std::uint64_t ns) noexcept
+{
+    static_cast<minprof::Timer&>(minprof::ThreadStorage::current().slot(indices[event].time)) +=
+        minprof::Timer::duration{static_cast<minprof::Timer::value_type>(ns)};
+}
+
+// Enter an event on the calling thread.
+void enter(Event event)
+{
+    if (!active.load(std::memory_order_relaxed)) {
+        return;
+    }
+    count(event);
+
+    if (stack.depth == MINPROF_OMPT_DEPTH) {
+        ++stack.overflow;
+        return;
+    }
+
+    auto& frame = stack.frames[stack.depth++];
+    frame.event = event;
+    frame.node = &minprof::CallTree::current().enter(indices[event].calls);
+    frame.start = now();
+}
+
+// Leave an event on the calling thread, together with all events still open inside of it.
+void leave(Event event)
+{
+    if (!active.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (stack.overflow) {
+        --stack.overflow;
+        return;
+    }
+
+    // Unmatched ends are dropped.
+    auto depth = stack.depth;
+    while (depth && stack.frames[depth - 1].event != event) {
+        --depth;
+    }
+    if (!depth) {
+        return;
+    }
+
+    const auto end = now();
+    auto& tree = minprof::CallTree::current();
+    while (stack.depth >= depth) {
+        const auto& frame = stack.frames[--stack.depth];
+        const auto ns = end - frame.start;
+
+        add_time(frame.event, ns);
+        tree.leave(*frame.node, minprof::Timer::duration{
+            static_cast<minprof::Timer::value_type>(ns)
+        });
+    }
+}
+
+// Enter or leave an event, depending on the endpoint.
+void scope(Event event, ompt_scope_endpoint_t endpoint)
+{
+    if (endpoint == ompt_scope_begin) {
+        enter(event);
+    } else if (endpoint == ompt_scope_end) {
+        leave(event);
+    } else if (active.load(std::memory_order_relaxed)) {
+        count(event);
+    }
+}
+
+// Map a worksharing construct to its event.
+Event work_event(ompt_work_t kind) noexcept
+{
+    switch (kind) {
+    case ompt_work_loop:            return LOOP;
+    case ompt_work_sections:        return SECTIONS;
+    case ompt_work_single_executor: return SINGLE;
+    case ompt_work_single_other:    return SINGLE_OTHER;
+    case ompt_work_workshare:       return WORKSHARE;
+    case ompt_work_distribute:      return DISTRIBUTE;
+    case ompt_work_taskloop:        return TASKLOOP;
+    default:                        return SCOPE;
+    }
+}
+
+// Map a synchronization region to its event.
+Event sync_event(ompt_sync_region_t kind, bool wait) noexcept
+{
+    switch (kind) {
+    case ompt_sync_region_taskwait:     return wait ? TASKWAIT_WAIT : TASKWAIT;
+    case ompt_sync_region_taskgroup:    return wait ? TASKGROUP_WAIT : TASKGROUP;
+    case ompt_sync_region_reduction:    return wait ? REDUCTION_WAIT : REDUCTION;
+    default:                            return wait ? BARRIER_WAIT : BARRIER;
+    }
+}
+
+// Marks explicit tasks that are not running in their task data, running ones hold their start.
+constexpr std::uint64_t task_idle = 1;
+
+void on_parallel_begin(ompt_data_t*, const ompt_frame_t*, ompt_data_t*, unsigned int, int,
+                       const void*)
+{
+    enter(PARALLEL);
+}
+
+void on_parallel_end(ompt_data_t*, ompt_data_t*, int, const void*)
+{
+    leave(PARALLEL);
+}
+
+void on_implicit_task(ompt_scope_endpoint_t endpoint, ompt_data_t*, ompt_data_t*, unsigned int,
+                      unsigned int, int flags)
+{
+    // The initial task spans the whole program.
+    if (flags & ompt_task_initial) {
+        return;
+    }
+
+    scope(IMPLICIT_TASK, endpoint);
+}
+
+void on_work(ompt_work_t kind, ompt_scope_endpoint_t endpoint, ompt_data_t*, ompt_data_t*,
+             uint64_t, const void*)
+{
+    scope(work_event(kind), endpoint);
+}
+
+void on_sync_region(ompt_sync_region_t kind, ompt_scope_endpoint_t endpoint, ompt_data_t*,
+                    ompt_data_t*, const void*)
+{
+    scope(sync_event(kind, false), endpoint);
+}
+
+void on_sync_region_wait(ompt_sync_region_t kind, ompt_scope_endpoint_t endpoint, ompt_data_t*,
+                         ompt_data_t*, const void*)
+{
+    scope(sync_event(kind, true), endpoint);
+}
+
+void on_task_create(ompt_data_t*, const ompt_frame_t*, ompt_data_t* task, int flags, int,
+                    const void*)
+{
+    if (flags & ompt_task_explicit) {
+        task->value = task_idle;
+    }
+}
+
+void on_task_schedule(ompt_data_t* prior, ompt_task_status_t, ompt_data_t* next)
+{
+    if (!active.load(std::memory_order_relaxed)) {
+        return;
+    }
+    const auto time_point = now();
+
+    // Only explicit tasks carry a value, the runtime zeroes all others.
+    if (prior && prior->value > task_idle) {
+        count(TASK);
+        add_time(TASK, time_point - prior->value);
+        prior->value = task_idle;
+    }
+    if (next && next->value == task_idle) {
+        next->value = time_point;
+    }
+}
+
+// Register all callbacks.
+int initialize(ompt_function_lookup_t lookup, int, ompt_data_t*)
+{
+    const auto set_callback = reinterpret_cast<ompt_set_callback_t>(lookup("ompt_set_callback"));
+    if (!set_callback) {
+        return 0;
+    }
+
+    set_callback(ompt_callback_parallel_begin,
+                 reinterpret_cast<ompt_callback_t>(&on_parallel_begin));
+    set_callback(ompt_callback_parallel_end, reinterpret_cast<ompt_callback_t>(&on_parallel_end));
+    set_callback(ompt_callback_implicit_task,
+                 reinterpret_cast<ompt_callback_t>(&on_implicit_task));
+    set_callback(ompt_callback_work, reinterpret_cast<ompt_callback_t>(&on_work));
+    set_callback(ompt_callback_sync_region, reinterpret_cast<ompt_callback_t>(&on_sync_region));
+    set_callback(ompt_callback_sync_region_wait,
+                 reinterpret_cast<ompt_callback_t>(&on_sync_region_wait));
+    set_callback(ompt_callback_task_create, reinterpret_cast<ompt_callback_t>(&on_task_create));
+    set_callback(ompt_callback_task_schedule,
+                 reinterpret_cast<ompt_callback_t>(&on_task_schedule));
+
+    active = true;
+
+    // Keep the tool active.
+    return 1;
+}
+
+// Stop accounting, the runtime is shutting down.
+void finalize(ompt_data_t*)
+{
+    active = false;
+}
+
+// Set once the runtime started the tool.
+std::atomic<bool> started{false};
+
+// Write all counters to the output file, unless disabled.
+void dump()
+{
+    const auto file_name = std::getenv("MINPROF_OMPT_OUTPUT");
+    if (file_name && !*file_name) {
+        return;
+    }
+
+    std::ofstream out{file_name ? file_name : "minprof-ompt.csv"};
+    minprof::StaticCounterRegistry::dump(out);
+}
+
+// Writes the output on exit. The runtime finalizes tools only while unloading, after all static
+// objects were destroyed, so this cannot be done in finalize.
+class Tool {
+public:
+    Tool()
+    {
+        // The registries are destroyed in reverse order of creation, so make sure they exist
+        // before this object and still do when it is destroyed.
+        minprof::ThreadStorage::current();
+    }
+    ~Tool()
+    {
+        active = false;
+        if (started) {
+            dump();
+        }
+    }
+
+    // No copy constructor.
+    Tool(const Tool&) = delete;
+    // No copy assignment operator.
+    Tool& operator=(const Tool&) = delete;
+};
+
+// Defined last, so that it is initialized after all StaticCounters of this file were registered.
+Tool tool;
+
+}
+
+extern "C" {
+
+// Entry point looked up by the OpenMP runtime.
+__attribute__((visibility("default"))) ompt_start_tool_result_t* ompt_start_tool(
+    unsigned int, const char*)
+{
+    static ompt_start_tool_result_t result{&initialize, &finalize, ompt_data_none};
+
+    const auto enabled = std::getenv("MINPROF_OMPT");
+    if (enabled && std::strcmp(enabled, "0") == 0) {
+        return nullptr;
+    }
+
+    started = true;
+    return &result;
+}
+
+}
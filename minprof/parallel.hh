@@ -0,0 +1,468 @@
+/** \brief Fork/join parallel region profiling for the minimal profiler.
+ *
+ * \file    minprof/parallel.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_PARALLEL_HH_
+#define MINPROF_PARALLEL_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Counter
+// minprof::Timer
+// minprof::Section
+// minprof::Stopwatch
+
+#include <algorithm>
+// std::min
+#include <cstdint>
+// std::uint64_t
+#include <memory>
+// std::unique_ptr
+#include <ostream>
+// std::ostream
+// std::endl
+
+/* Parallel region workers:
+ *
+ * Maximum number of workers per run of a parallel region. Chunks of further workers are counted as
+ * overflow instead. Every region allocates workers * 8 bytes once.
+ */
+#if !defined(MINPROF_PARALLEL_WORKERS)
+#define MINPROF_PARALLEL_WORKERS    256
+#endif
+
+namespace minprof {
+
+/** \brief Per-worker busy times of a fork/join region, accumulated over all runs.
+ *
+ * The forking thread marks a run with begin() and end(), which must enclose the join, while every
+ * worker reports the time of each of its chunks with add(). Workers are told apart by the run they
+ * last reported to, which they cache thread-locally (see Worker), so a worker may report any number
+ * of chunks per run. Runs of the same region must not overlap.
+ *
+ * At the end of every run, the busy times of its workers are reduced to min, mean and max, and the
+ * time lost to load imbalance, i.e. the time all workers but the slowest spent waiting at the join:
+ * workers * (max - mean). Any wall time beyond the slowest worker is fork/join overhead, including
+ * the serial part of the region.
+ */
+class ParallelRegion {
+public:
+    /** \brief Maximum number of workers per run. */
+    static constexpr unsigned capacity = MINPROF_PARALLEL_WORKERS;
+
+    /** \brief Thread-local state of a worker. */
+    struct Worker {
+        /** \brief Run the worker last reported to. */
+        std::uint64_t   run;
+        /** \brief Slot of the worker in that run. */
+        unsigned        slot;
+    };
+
+    /** \brief Statistics accumulated over all runs. */
+    struct Totals {
+        /** \brief Number of runs. */
+        std::uint64_t   runs        = 0;
+        /** \brief Number of workers over all runs. */
+        std::uint64_t   workers     = 0;
+        /** \brief Wall time of all runs in ns. */
+        std::uint64_t   wall        = 0;
+        /** \brief Sum of the least busy worker's time per run in ns. */
+        std::uint64_t   min         = 0;
+        /** \brief Sum of the mean worker time per run in ns. */
+        double          mean        = 0.0;
+        /** \brief Sum of the busiest worker's time per run in ns. */
+        std::uint64_t   max         = 0;
+        /** \brief Worker time lost to load imbalance in ns. */
+        double          lost        = 0.0;
+        /** \brief Chunks of workers that did not fit into a run. */
+        std::uint64_t   overflow    = 0;
+    };
+
+public:
+    /** \brief Initialize a new ParallelRegion. */
+    ParallelRegion()
+    : m_run{0}, m_workers{0}, m_overflow{0}, m_start{}, m_busy{new std::atomic<std::uint64_t>[
+        capacity]}, m_lock{}, m_totals{}
+    {}
+
+    // No copy constructor.
+    ParallelRegion(const ParallelRegion&) = delete;
+    // No copy assignment operator.
+    ParallelRegion& operator=(const ParallelRegion&) = delete;
+    // No move constructor.
+    ParallelRegion(ParallelRegion&&) = delete;
+    // No move assignment operator.
+    ParallelRegion& operator=(ParallelRegion&&) = delete;
+
+    /** \brief Begin a run, before forking. */
+    void begin() noexcept
+    {
+        m_workers.store(0, std::memory_order_relaxed);
+        m_overflow.store(0, std::memory_order_relaxed);
+        m_start = Stopwatch::Clock::now();
+
+        // Publishing the new run makes every worker claim a fresh slot.
+        m_run.fetch_add(1, std::memory_order_release);
+    }
+    /** \brief End a run, after joining. */
+    void end()
+    {
+        const auto wall = std::chrono::duration_cast<Timer::duration>(
+            Stopwatch::Clock::now() - m_start
+        ).count();
+
+        const auto workers = std::min<unsigned>(m_workers.load(std::memory_order_acquire),
+                                                capacity);
+        std::uint64_t min = 0;
+        std::uint64_t max = 0;
+        std::uint64_t sum = 0;
+        for (unsigned slot = 0; slot < workers; ++slot) {
+            const auto busy = m_busy[slot].load(std::memory_order_relaxed);
+            min = slot == 0 || busy < min ? busy : min;
+            max = busy > max ? busy : max;
+            sum += busy;
+        }
+        const auto mean = workers ? static_cast<double>(sum) / workers : 0.0;
+
+        std::lock_guard<std::mutex> lock{m_lock};
+        ++m_totals.runs;
+        m_totals.workers += workers;
+        m_totals.wall += static_cast<std::uint64_t>(wall);
+        m_totals.min += min;
+        m_totals.mean += mean;
+        m_totals.max += max;
+        m_totals.lost += workers * (static_cast<double>(max) - mean);
+        m_totals.overflow += m_overflow.load(std::memory_order_relaxed);
+    }
+
+    /** \brief Report the time of a chunk of the calling worker.
+     *
+     * \param   [in,out]    worker  Thread-local state of the calling worker for this region.
+     * \param   [in]        dur     Time spent on the chunk.
+     */
+    void add(Worker& worker, Timer::duration dur) noexcept
+    {
+        const auto run = m_run.load(std::memory_order_acquire);
+        if (worker.run != run) {
+            worker.run = run;
+            worker.slot = m_workers.fetch_add(1, std::memory_order_relaxed);
+            if (worker.slot < capacity) {
+                m_busy[worker.slot].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        if (worker.slot >= capacity) {
+            m_overflow.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        // Only this worker writes its slot during the run.
+        auto& busy = m_busy[worker.slot];
+        busy.store(busy.load(std::memory_order_relaxed) + static_cast<std::uint64_t>(dur.count()),
+                   std::memory_order_relaxed);
+    }
+
+    /** \brief Get the statistics accumulated over all runs.
+     *
+     * \return  Copy of the totals.
+     */
+    Totals totals() const
+    {
+        std::lock_guard<std::mutex> lock{m_lock};
+        return m_totals;
+    }
+
+private:
+    // Current run, incremented by begin().
+    std::atomic<std::uint64_t>                      m_run;
+    // Number of workers that reported to the current run.
+    std::atomic<unsigned>                           m_workers;
+    // Chunks of the current run that did not fit.
+    std::atomic<std::uint64_t>                      m_overflow;
+    // Start of the current run.
+    Stopwatch::time_point                           m_start;
+    // Busy time per worker slot in ns.
+    std::unique_ptr<std::atomic<std::uint64_t>[]>   m_busy;
+    // Guards m_totals.
+    mutable std::mutex                              m_lock;
+    // Statistics over all runs.
+    Totals                                          m_totals;
+};
+
+/** \brief Static container for a global ParallelRegion.
+ *
+ * Like StaticCounter, instanciating this template creates and registers a global ParallelRegion.
+ *
+ * \tparam  Name    typestring of the ParallelRegion's name.
+ */
+template<typename Name>
+class StaticParallelRegion {
+public:
+    // Assert that a typestring was passed.
+    static_assert(irqus::is_typestring<Name>::value, "Name must be a typestring!");
+
+    /** \brief Index of the region in the static registration vector. */
+    static const unsigned index;
+
+public:
+    // No (default) constructor.
+    StaticParallelRegion() = delete;
+
+    /** \brief Get the global ParallelRegion instance.
+     *
+     * \return  Global ParallelRegion instance.
+     */
+    ALWAYS_INLINE static ParallelRegion& get()
+    {
+        static ParallelRegion instance;
+
+        // Force the registration, see StaticCounter::get().
+        (void)index;
+
+        return instance;
+    }
+    /** \brief Get the calling thread's worker state for this region.
+     *
+     * \return  Thread-local worker state.
+     */
+    ALWAYS_INLINE static ParallelRegion::Worker& worker() noexcept
+    {
+        static thread_local ParallelRegion::Worker worker{0, 0};
+        return worker;
+    }
+};
+
+/** \brief Static registry for the StaticParallelRegion types instanciated. */
+class ParallelRegistry {
+public:
+    // No copy constructor.
+    ParallelRegistry(const ParallelRegistry&) = delete;
+    // No copy assignment operator.
+    ParallelRegistry& operator=(const ParallelRegistry&) = delete;
+    // No move constructor.
+    ParallelRegistry(ParallelRegistry&&) = delete;
+    // No move assignment operator.
+    ParallelRegistry& operator=(ParallelRegistry&&) = delete;
+
+    /** \brief Register a StaticParallelRegion.
+     *
+     * \tparam  typestring Name of the StaticParallelRegion.
+     *
+     * \return  Index within the static registry.
+     */
+    template<typename Name>
+    static unsigned register_region()
+    {
+        auto& self = instance();
+
+        self.m_names.push_back(Name::data());
+        self.m_instances.push_back(&StaticParallelRegion<Name>::get());
+
+        return self.m_instances.size() - 1;
+    }
+
+    /** \brief Dump all parallel regions to the specified stream as CSV.
+     *
+     * All times are totals over all runs in nanoseconds, so that they can be compared to the
+     * region's wall time.
+     *
+     * CSV format is:
+     * <name>, <runs>, <wall>, <min>, <mean>, <max>, <imbalance>, <lost>, <overhead>, <workers>
+     * <endl>
+     *
+     * - min, mean, max: Busy time of the least busy, average and busiest worker.
+     * - imbalance: max / mean, 1 for perfectly balanced work.
+     * - lost: Worker time spent waiting for the slowest worker, workers * (max - mean).
+     * - overhead: Wall time beyond the busiest worker, i.e. fork, join and serial parts.
+     * - workers: Average number of workers per run.
+     *
+     * \param   [in,out]    out     Output stream.
+     */
+    static void dump(std::ostream& out)
+    {
+        const auto& self = instance();
+
+        for (unsigned idx = 0; idx < self.m_instances.size(); ++idx) {
+            const auto totals = self.m_instances[idx]->totals();
+            if (totals.runs == 0) {
+                continue;
+            }
+
+            out << self.m_names[idx] << ", " << totals.runs << ", " << totals.wall << ", "
+                << totals.min << ", " << static_cast<std::uint64_t>(totals.mean) << ", "
+                << totals.max << ", "
+                << (totals.mean > 0.0 ? static_cast<double>(totals.max) / totals.mean : 1.0)
+                << ", " << static_cast<std::uint64_t>(totals.lost) << ", "
+                << (totals.wall > totals.max ? totals.wall - totals.max : 0) << ", "
+                << static_cast<double>(totals.workers) / static_cast<double>(totals.runs);
+            if (totals.overflow) {
+                out << ", overflow " << totals.overflow;
+            }
+            out << std::endl;
+        }
+    }
+
+private:
+    ParallelRegistry() = default;
+
+    static ParallelRegistry& instance() noexcept
+    {
+        static ParallelRegistry instance;
+        return instance;
+    }
+
+    // Vector of registered region names.
+    std::vector<const char*>        m_names;
+    // Vector of registered regions.
+    std::vector<ParallelRegion*>    m_instances;
+};
+
+template<typename Name>
+const unsigned StaticParallelRegion<Name>::index = ParallelRegistry::register_region<Name>();
+
+/** \brief Section tracker for a run of a parallel region on the forking thread. */
+class ParallelSection : private Section {
+public:
+    /** \brief Initialize, trigger, time and begin a new ParallelSection.
+     *
+     * \param   [in,out]    c       Counter for section.
+     * \param   [in,out]    t       Timer for section.
+     * \param   [in,out]    region  Parallel region.
+     * \param   [in]        name    Name of the section, must outlive it.
+     */
+    ParallelSection(Counter& c, Timer& t, ParallelRegion& region, const char* name = nullptr)
+    : Section{c, t, name}, m_region{region}
+    {
+        m_region.begin();
+    }
+    /** \brief End, stop, retire and destroy a ParallelSection. */
+    ~ParallelSection()
+    {
+        m_region.end();
+    }
+
+    // No copy constructor.
+    ParallelSection(const ParallelSection&) = delete;
+    // No copy assignment.
+    ParallelSection& operator=(const ParallelSection&) = delete;
+
+    // No move constructor.
+    ParallelSection(ParallelSection&&) = delete;
+    // No move assignment.
+    ParallelSection& operator=(ParallelSection&&) = delete;
+
+    // Hack to make use of if-condition initialization scoping.
+    operator bool() const noexcept
+    {
+        return true;
+    }
+
+private:
+    // Parallel region.
+    ParallelRegion&     m_region;
+};
+
+/** \brief Scoped measurement of a worker's chunk of a parallel region. */
+class ParallelChunk {
+public:
+    /** \brief Start measuring a chunk.
+     *
+     * \param   [in,out]    region  Parallel region.
+     * \param   [in,out]    worker  Thread-local state of the calling worker for the region.
+     */
+    ParallelChunk(ParallelRegion& region, ParallelRegion::Worker& worker) noexcept
+    : m_region{region}, m_worker{worker}, m_start{Stopwatch::Clock::now()}
+    {}
+    /** \brief Report the chunk. */
+    ~ParallelChunk()
+    {
+        m_region.add(m_worker, std::chrono::duration_cast<Timer::duration>(
+            Stopwatch::Clock::now() - m_start
+        ));
+    }
+
+    // No copy constructor.
+    ParallelChunk(const ParallelChunk&) = delete;
+    // No copy assignment.
+    ParallelChunk& operator=(const ParallelChunk&) = delete;
+
+    // No move constructor.
+    ParallelChunk(ParallelChunk&&) = delete;
+    // No move assignment.
+    ParallelChunk& operator=(ParallelChunk&&) = delete;
+
+    // Hack to make use of if-condition initialization scoping.
+    operator bool() const noexcept
+    {
+        return true;
+    }
+
+private:
+    // Parallel region.
+    ParallelRegion&         m_region;
+    // Worker state.
+    ParallelRegion::Worker& m_worker;
+    // Time of entry.
+    Stopwatch::time_point   m_start;
+};
+
+/** \brief Get a global ParallelRegion.
+ *
+ * \param   name    Name string literal of the region.
+ */
+#define MINPROF_PARALLEL(name)  ::minprof::StaticParallelRegion<typestring_is(name)>::get()
+
+/** \brief Dump all parallel regions. */
+#define MINPROF_DUMP_PARALLEL   ::minprof::ParallelRegistry::dump
+
+/** \brief Profile the following statement (-block) as one run of a parallel region.
+ *
+ * Must enclose forking and joining the workers, which report with MINPROF_PARALLEL_CHUNK.
+ *
+ * \param   name    Name string literal of the region.
+ */
+#define MINPROF_PARALLEL_REGION(name)\
+if (::minprof::ParallelSection __parallel_ ## __LINE__ {MINPROF_COUNTER(name "|C"),\
+    MINPROF_TIMER(name "|T"), MINPROF_PARALLEL(name), name})
+
+/** \brief Measure the following statement (-block) as a chunk of the calling worker.
+ *
+ * \param   name    Name string literal of the region.
+ */
+#define MINPROF_PARALLEL_CHUNK(name)\
+if (::minprof::ParallelChunk __chunk_ ## __LINE__ {MINPROF_PARALLEL(name),\
+    ::minprof::StaticParallelRegion<typestring_is(name)>::worker()})
+
+}
+
+/* Exemplary usage:
+ *
+ * Fan out with raw threads:
+ *
+ * MINPROF_PARALLEL_REGION("loop") {
+ *      std::vector<std::thread> workers;
+ *      for (unsigned i = 0; i < n; ++i) {
+ *          workers.emplace_back([i]() {
+ *              MINPROF_PARALLEL_CHUNK("loop") { work(i); }
+ *          });
+ *      }
+ *      for (auto& worker : workers) {
+ *          worker.join();
+ *      }
+ * }
+ *
+ * Or with a thread pool, where every worker may run many chunks per run:
+ *
+ * MINPROF_PARALLEL_REGION("loop") {
+ *      pool.parallel_for(0, size, [](std::size_t i) {
+ *          MINPROF_PARALLEL_CHUNK("loop") { work(i); }
+ *      });
+ * }
+ *
+ * MINPROF_DUMP_PARALLEL(std::cout);
+ *
+ */
+
+#endif
@@ -0,0 +1,501 @@
+/** \brief pprof export for the minimal profiler.
+ *
+ * Writes gzip-compressed profile.proto files as understood by `go tool pprof`, without depending on
+ * libprotobuf or zlib.
+ *
+ * \file    minprof/pprof.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_PPROF_HH_
+#define MINPROF_PPROF_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::StaticCounterRegistry
+// minprof::ThreadRegistry
+#include "gzip.hh"
+// minprof::gzip::compress
+#include "tree.hh"
+// minprof::CallTree
+// minprof::CallTreeRegistry
+
+#include <cstdint>
+// std::int64_t
+// std::uint64_t
+
+#include <fstream>
+// std::ofstream
+#include <string>
+// std::string
+#include <unordered_map>
+// std::unordered_map
+
+namespace minprof {
+namespace pprof {
+
+/** \brief Minimal protobuf wire format encoder.
+ *
+ * Only supports what profile.proto needs: varint and length-delimited fields.
+ */
+class Encoder {
+public:
+    /** \brief Initialize a new Encoder appending to a buffer.
+     *
+     * \param   [in,out]    out     Output buffer.
+     */
+    explicit Encoder(std::vector<std::uint8_t>& out) noexcept
+    : m_out{out}
+    {}
+
+    /** \brief Append a raw varint.
+     *
+     * \param   [in]    value   Value to encode.
+     */
+    void varint(std::uint64_t value)
+    {
+        while (value >= 0x80) {
+            m_out.push_back(static_cast<std::uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        m_out.push_back(static_cast<std::uint8_t>(value));
+    }
+    /** \brief Append a varint field, omitting default values.
+     *
+     * \param   [in]    field   Field number.
+     * \param   [in]    value   Value to encode.
+     */
+    void field(unsigned field, std::uint64_t value)
+    {
+        if (value != 0) {
+            varint(field << 3);
+            varint(value);
+        }
+    }
+    /** \brief Append a length-delimited field.
+     *
+     * \param   [in]    field   Field number.
+     * \param   [in]    data    Payload.
+     * \param   [in]    size    Payload size in bytes.
+     */
+    void bytes(unsigned field, const void* data, std::size_t size)
+    {
+        varint((field << 3) | 2);
+        varint(size);
+
+        const auto begin = static_cast<const std::uint8_t*>(data);
+        m_out.insert(m_out.end(), begin, begin + size);
+    }
+    /** \brief Append a packed repeated varint field.
+     *
+     * \param   [in]        field   Field number.
+     * \param   [in]        values  Values to encode.
+     * \param   [in]        count   Number of values.
+     * \param   [in,out]    scratch Scratch buffer to reuse.
+     */
+    template<typename T>
+    void packed(unsigned field, const T* values, std::size_t count,
+                std::vector<std::uint8_t>& scratch)
+    {
+        scratch.clear();
+        Encoder inner{scratch};
+        for (std::size_t i = 0; i < count; ++i) {
+            inner.varint(static_cast<std::uint64_t>(values[i]));
+        }
+        bytes(field, scratch.data(), scratch.size());
+    }
+
+private:
+    // Output buffer.
+    std::vector<std::uint8_t>& m_out;
+};
+
+/** \brief Builder for a profile.proto message.
+ *
+ * Samples are encoded as they are added, so memory use stays proportional to the encoded size.
+ * Every distinct function name gets one Function. Pseudo-frames get one Location per name, code
+ * addresses one Location per address within the Mapping of their module, so that pprof can show
+ * both functions and addresses (e.g. with -addresses).
+ */
+class Profile {
+public:
+    /** \brief Initialize a new, empty Profile. */
+    Profile()
+    : m_strings{}, m_string_ids{}, m_functions{}, m_function_ids{}, m_locations{}, m_frame_ids{},
+      m_address_ids{}, m_mappings{}, m_mapping_ids{}, m_types{}, m_samples{}, m_scratch{},
+      m_inner{}, m_default_type{0}, m_time{0}
+    {
+        // The string table must start with the empty string.
+        string("");
+    }
+
+    /** \brief Intern a string.
+     *
+     * \param   [in]    value   String to intern.
+     * \return  Index into the string table.
+     */
+    std::int64_t string(const std::string& value)
+    {
+        const auto it = m_string_ids.find(value);
+        if (it != m_string_ids.end()) {
+            return it->second;
+        }
+
+        const auto id = static_cast<std::int64_t>(m_strings.size());
+        m_strings.push_back(value);
+        m_string_ids.emplace(value, id);
+        return id;
+    }
+    /** \brief Get the location id of a pseudo-frame.
+     *
+     * \param   [in]    name    Frame name.
+     * \return  Location id.
+     */
+    std::uint64_t frame(const std::string& name)
+    {
+        const auto it = m_frame_ids.find(name);
+        if (it != m_frame_ids.end()) {
+            return it->second;
+        }
+
+        m_locations.push_back(Location{0, 0, function(name, name)});
+        const auto id = static_cast<std::uint64_t>(m_locations.size());
+        m_frame_ids.emplace(name, id);
+        return id;
+    }
+    /** \brief Get the location id of a code address.
+     *
+     * \param   [in]    address     Code address.
+     * \param   [in]    mapping     Mapping id of the module holding the address, 0 if unknown.
+     * \param   [in]    name        Function name, e.g. the demangled symbol.
+     * \param   [in]    system_name Function name in the symbol table, e.g. the mangled symbol.
+     * \return  Location id.
+     */
+    std::uint64_t location(std::uint64_t address, std::uint64_t mapping, const std::string& name,
+                           const std::string& system_name)
+    {
+        const auto it = m_address_ids.find(address);
+        if (it != m_address_ids.end()) {
+            return it->second;
+        }
+
+        m_locations.push_back(Location{mapping, address, function(name, system_name)});
+        const auto id = static_cast<std::uint64_t>(m_locations.size());
+        m_address_ids.emplace(address, id);
+        return id;
+    }
+    /** \brief Get the mapping id of a module.
+     *
+     * \param   [in]    file    Path of the module, identifies the Mapping.
+     * \param   [in]    start   Address the module is loaded at.
+     * \param   [in]    limit   Address just past the module.
+     * \return  Mapping id.
+     */
+    std::uint64_t mapping(const std::string& file, std::uint64_t start, std::uint64_t limit)
+    {
+        const auto it = m_mapping_ids.find(file);
+        if (it != m_mapping_ids.end()) {
+            return it->second;
+        }
+
+        m_mappings.push_back(Mapping{start, limit, string(file)});
+        const auto id = static_cast<std::uint64_t>(m_mappings.size());
+        m_mapping_ids.emplace(file, id);
+        return id;
+    }
+
+    /** \brief Add a sample type, i.e. a value column.
+     *
+     * \param   [in]    type        Type name, e.g. "calls".
+     * \param   [in]    unit        Unit name, e.g. "nanoseconds".
+     * \param   [in]    is_default  If true, pprof shows this type by default.
+     */
+    void sample_type(const char* type, const char* unit, bool is_default = false)
+    {
+        const auto type_id = string(type);
+        m_inner.clear();
+        Encoder inner{m_inner};
+        inner.field(1, static_cast<std::uint64_t>(type_id));
+        inner.field(2, static_cast<std::uint64_t>(string(unit)));
+
+        Encoder{m_types}.bytes(1, m_inner.data(), m_inner.size());
+        if (is_default) {
+            m_default_type = type_id;
+        }
+    }
+    /** \brief Set the time of collection.
+     *
+     * \param   [in]    nanos   Nanoseconds since the Unix epoch.
+     */
+    void time(std::int64_t nanos) noexcept
+    {
+        m_time = nanos;
+    }
+
+    /** \brief Add a sample.
+     *
+     * \param   [in]    locations   Location ids, leaf first.
+     * \param   [in]    depth       Number of locations.
+     * \param   [in]    values      Values, one per sample type.
+     * \param   [in]    count       Number of values.
+     * \param   [in]    label_key   Name of a string label, or nullptr.
+     * \param   [in]    label_value Value of the string label.
+     */
+    void sample(
+        const std::uint64_t* locations,
+        std::size_t depth,
+        const std::int64_t* values,
+        std::size_t count,
+        const char* label_key = nullptr,
+        const char* label_value = nullptr
+    ) {
+        m_inner.clear();
+        Encoder inner{m_inner};
+        inner.packed(1, locations, depth, m_scratch);
+        inner.packed(2, values, count, m_scratch);
+        if (label_key) {
+            m_scratch.clear();
+            Encoder label{m_scratch};
+            label.field(1, static_cast<std::uint64_t>(string(label_key)));
+            label.field(2, static_cast<std::uint64_t>(string(label_value)));
+            inner.bytes(3, m_scratch.data(), m_scratch.size());
+        }
+
+        Encoder{m_samples}.bytes(2, m_inner.data(), m_inner.size());
+    }
+
+    /** \brief Encode the complete profile.
+     *
+     * \param   [in,out]    out     Output buffer to append to.
+     */
+    void encode(std::vector<std::uint8_t>& out)
+    {
+        Encoder encoder{out};
+
+        out.insert(out.end(), m_types.begin(), m_types.end());
+        out.insert(out.end(), m_samples.begin(), m_samples.end());
+
+        // Functions are named here, so pprof must not symbolize the mappings again.
+        for (std::size_t idx = 0; idx < m_mappings.size(); ++idx) {
+            m_inner.clear();
+            Encoder mapping{m_inner};
+            mapping.field(1, static_cast<std::uint64_t>(idx + 1));
+            mapping.field(2, m_mappings[idx].start);
+            mapping.field(3, m_mappings[idx].limit);
+            mapping.field(5, static_cast<std::uint64_t>(m_mappings[idx].file));
+            mapping.field(7, 1);
+            encoder.bytes(3, m_inner.data(), m_inner.size());
+        }
+
+        // Every Location has a single Line.
+        for (std::size_t idx = 0; idx < m_locations.size(); ++idx) {
+            m_scratch.clear();
+            Encoder line{m_scratch};
+            line.field(1, m_locations[idx].function);
+            m_inner.clear();
+            Encoder location{m_inner};
+            location.field(1, static_cast<std::uint64_t>(idx + 1));
+            location.field(2, m_locations[idx].mapping);
+            location.field(3, m_locations[idx].address);
+            location.bytes(4, m_scratch.data(), m_scratch.size());
+            encoder.bytes(4, m_inner.data(), m_inner.size());
+        }
+
+        for (std::size_t idx = 0; idx < m_functions.size(); ++idx) {
+            m_inner.clear();
+            Encoder function{m_inner};
+            function.field(1, static_cast<std::uint64_t>(idx + 1));
+            function.field(2, static_cast<std::uint64_t>(m_functions[idx].name));
+            function.field(3, static_cast<std::uint64_t>(m_functions[idx].system_name));
+            encoder.bytes(5, m_inner.data(), m_inner.size());
+        }
+
+        for (const auto& value : m_strings) {
+            encoder.bytes(6, value.data(), value.size());
+        }
+
+        encoder.field(9, static_cast<std::uint64_t>(m_time));
+        encoder.field(14, static_cast<std::uint64_t>(m_default_type));
+    }
+    /** \brief Encode the complete profile and compress it with gzip.
+     *
+     * \param   [in,out]    out     Output buffer to append to.
+     */
+    void encode_gzip(std::vector<std::uint8_t>& out)
+    {
+        std::vector<std::uint8_t> raw;
+        encode(raw);
+        gzip::compress(raw.data(), raw.size(), out);
+    }
+
+private:
+    // Function table entry.
+    struct Function {
+        // String id of the name.
+        std::int64_t    name;
+        // String id of the system name.
+        std::int64_t    system_name;
+    };
+    // Location table entry.
+    struct Location {
+        // Mapping id, 0 if none.
+        std::uint64_t   mapping;
+        // Code address, 0 for pseudo-frames.
+        std::uint64_t   address;
+        // Function id.
+        std::uint64_t   function;
+    };
+    // Mapping table entry.
+    struct Mapping {
+        // Load address.
+        std::uint64_t   start;
+        // End address.
+        std::uint64_t   limit;
+        // String id of the file name.
+        std::int64_t    file;
+    };
+
+    // Get the function id of a name, the system name of its first use sticks.
+    std::uint64_t function(const std::string& name, const std::string& system_name)
+    {
+        const auto it = m_function_ids.find(name);
+        if (it != m_function_ids.end()) {
+            return it->second;
+        }
+
+        m_functions.push_back(Function{string(name), string(system_name)});
+        const auto id = static_cast<std::uint64_t>(m_functions.size());
+        m_function_ids.emplace(name, id);
+        return id;
+    }
+
+    // String table.
+    std::vector<std::string>                            m_strings;
+    // String table lookup.
+    std::unordered_map<std::string, std::int64_t>       m_string_ids;
+    // Functions, indexed by function id - 1.
+    std::vector<Function>                               m_functions;
+    // Function lookup by name.
+    std::unordered_map<std::string, std::uint64_t>      m_function_ids;
+    // Locations, indexed by location id - 1.
+    std::vector<Location>                               m_locations;
+    // Pseudo-frame lookup by name.
+    std::unordered_map<std::string, std::uint64_t>      m_frame_ids;
+    // Code location lookup by address.
+    std::unordered_map<std::uint64_t, std::uint64_t>    m_address_ids;
+    // Mappings, indexed by mapping id - 1.
+    std::vector<Mapping>                                m_mappings;
+    // Mapping lookup by file name.
+    std::unordered_map<std::string, std::uint64_t>      m_mapping_ids;
+    // Encoded sample_type fields.
+    std::vector<std::uint8_t>                           m_types;
+    // Encoded sample fields.
+    std::vector<std::uint8_t>                           m_samples;
+    // Scratch buffers for nested messages.
+    std::vector<std::uint8_t>                           m_scratch, m_inner;
+    // String id of the default sample type.
+    std::int64_t                                        m_default_type;
+    // Time of collection.
+    std::int64_t                                        m_time;
+};
+
+/** \brief Add the section call trees of all threads to a Profile.
+ *
+ * Every tree node becomes one sample whose stack consists of the section pseudo-frames from the
+ * node up to the root, labelled with the thread name. The values are calls, inclusive and exclusive
+ * nanoseconds, which must be the first three sample types of the Profile.
+ *
+ * Since pprof sums samples to compute cumulative values, "exclusive" is the type to look at in
+ * flame graphs and top lists. The "inclusive" type is only meaningful per node (e.g. with -traces).
+ *
+ * \param   [in,out]    profile Profile to add to.
+ */
+inline void add_call_trees(Profile& profile)
+{
+    // Map section ids to location ids, named by their counter names without suffix.
+    std::vector<std::uint64_t> frames(StaticCounterRegistry::count(), 0);
+    const auto frame = [&](std::uint32_t id) -> std::uint64_t {
+        if (id >= frames.size()) {
+            frames.resize(id + 1u, 0);
+        }
+        if (frames[id] == 0) {
+            const auto name = StaticCounterRegistry::get_name(id);
+            const auto section = name
+                ? std::string{name, StaticCounterRegistry::get_base_length(id)}
+                : "section_" + std::to_string(id);
+            frames[id] = profile.frame(section);
+        }
+        return frames[id];
+    };
+
+    std::vector<std::string> threads;
+    ThreadRegistry::visit([&](const ThreadStorage& storage, const char* name) {
+        threads.push_back(name[0] != '\0' ? name : "thread_" + std::to_string(storage.id()));
+    });
+
+    std::vector<const CallTree*> trees;
+    CallTreeRegistry::trees(trees);
+
+    std::vector<std::uint64_t> locations;
+    for (const auto tree : trees) {
+        const auto thread = tree->thread() < threads.size()
+                          ? threads[tree->thread()]
+                          : "thread_" + std::to_string(tree->thread());
+
+        CallTreeRegistry::walk(*tree, [&](const CallNode& node, const std::uint32_t* path,
+                                          unsigned depth) {
+            locations.resize(depth);
+            for (unsigned i = 0; i < depth; ++i) {
+                locations[i] = frame(path[depth - 1 - i]);
+            }
+
+            const std::int64_t values[3] = {
+                static_cast<std::int64_t>(node.calls.value()),
+                static_cast<std::int64_t>(node.inclusive.value().count()),
+                static_cast<std::int64_t>(node.exclusive().count())
+            };
+            profile.sample(locations.data(), depth, values, 3, "thread", thread.c_str());
+        });
+    }
+}
+
+}
+
+/** \brief Dump the section call trees as a gzip-compressed pprof profile.
+ *
+ * The result can be inspected using `go tool pprof -http=: <file>`.
+ *
+ * \param   [in,out]    out     Output stream, should be opened in binary mode.
+ */
+inline void dump_pprof(std::ostream& out)
+{
+    pprof::Profile profile;
+    profile.sample_type("calls", "count");
+    profile.sample_type("inclusive", "nanoseconds");
+    profile.sample_type("exclusive", "nanoseconds", true);
+    profile.time(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count());
+
+    pprof::add_call_trees(profile);
+
+    std::vector<std::uint8_t> data;
+    profile.encode_gzip(data);
+    out.write(reinterpret_cast<const char*>(data.data()),
+              static_cast<std::streamsize>(data.size()));
+}
+/** \brief Dump the section call trees into a pprof file with the specified name.
+ *
+ * Overwrites file contents.
+ *
+ * \param   [in]    file_name   Name of the file.
+ */
+inline void dump_pprof(const char* file_name)
+{
+    std::ofstream out{file_name, std::ios::binary};
+    dump_pprof(out);
+}
+
+}
+
+#endif
@@ -0,0 +1,792 @@
+/** \brief Reporting half of the minimal profiler: dumps of the StaticCounterRegistry.
+ *
+ * Implements the dumps of minprof/core.hh, along with the stream operators of the Counter types.
+ * The dumps are only compiled where MINPROF_IMPLEMENTATION is defined before including this header
+ * (or minprof.hh), which exactly one translation unit of the program must do. Every translation
+ * unit may then dump through minprof/core.hh.
+ *
+ * \file    minprof/report.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_REPORT_HH_
+#define MINPROF_REPORT_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Counter
+// minprof::Timer
+// minprof::Topology
+// minprof::ThreadStorage
+// minprof::ThreadRegistry
+// minprof::StaticCounter
+// minprof::StaticCounterRegistry
+
+#include <algorithm>
+// std::fill
+// std::min
+// std::none_of
+// std::stable_sort
+#include <cstring>
+// std::strncmp
+#include <iterator>
+// std::begin
+// std::end
+#include <mutex>
+// std::mutex
+// std::lock_guard
+#include <vector>
+// std::vector
+#include <string>
+// std::string
+#include <ostream>
+// std::ostream
+// std::endl
+#include <fstream>
+// std::ofstream
+
+namespace minprof {
+
+/** \brief Write the value of a Counter to a stream.
+ *
+ * \param   [in,out]    out     Output stream.
+ * \param   [in]        c       Counter instance.
+ * \return  out.
+ */
+inline std::ostream& operator<<(std::ostream& out, const Counter& c)
+{
+    return out << c.value();
+}
+
+/** \brief Write the value of a Timer to a stream.
+ *
+ * \param   [in,out]    out     Output stream.
+ * \param   [in]        t       Timer instance.
+ * \return  out.
+ */
+inline std::ostream& operator<<(std::ostream& out, const Timer& t)
+{
+    // C++20 will support writing duration suffixes to stream.
+    // In the meantime, let's just let the default stream op get the count value.
+    return out << t.value();
+}
+
+/** \brief Prefix tree of the hierarchical counter names, shared by the rollup dumps.
+ *
+ * Counter names are split into a path and a type suffix at the last '|', and the path is split
+ * into components at every '.'. Nothing is built at registration: the tree is built lazily by the
+ * first rollup dump, and extended by every later one that finds new counters, which keeps
+ * std::string out of static initialization.
+ *
+ * Only used by the rollup dumps of the StaticCounterRegistry, which hold m_lock, the rollup's own
+ * lock, while updating and reading the tree.
+ */
+class CounterRollup {
+    friend class StaticCounterRegistry;
+
+public:
+    // No copy constructor.
+    CounterRollup(const CounterRollup&) = delete;
+    // No copy assignment operator.
+    CounterRollup& operator=(const CounterRollup&) = delete;
+    // No move constructor.
+    CounterRollup(CounterRollup&&) = delete;
+    // No move assignment operator.
+    CounterRollup& operator=(CounterRollup&&) = delete;
+
+private:
+    CounterRollup() = default;
+
+    static CounterRollup& instance()
+    {
+        static CounterRollup instance;
+        return instance;
+    }
+
+    // Insert all counters registered since the last call.
+    void update()
+    {
+        const auto count = StaticCounterRegistry::count();
+        for (auto idx = static_cast<unsigned>(m_node.size()); idx < count; ++idx) {
+            add(idx);
+        }
+    }
+
+    // Node in the prefix tree.
+    struct Node {
+        // Path component.
+        std::string label;
+        // Length of the parent's full path.
+        std::size_t offset;
+        // Index of the parent node.
+        unsigned    parent;
+        // Index of the first child node, 0 if none.
+        unsigned    child;
+        // Index of the next sibling node, 0 if none.
+        unsigned    sibling;
+    };
+
+    // Insert a counter into the prefix tree.
+    void add(unsigned idx)
+    {
+        const auto name = StaticCounterRegistry::get_name(idx);
+        if (m_nodes.empty()) {
+            m_nodes.push_back(Node{"", 0, 0, 0, 0});
+        }
+
+        const std::string full{name ? name : ""};
+        const auto bar = full.rfind('|');
+        const auto path = full.substr(0, bar);
+        const auto suffix = bar == std::string::npos ? std::string{} : full.substr(bar + 1);
+
+        // Find or add the suffix.
+        unsigned suffix_idx = 0;
+        while (suffix_idx < m_suffixes.size() && m_suffixes[suffix_idx] != suffix) {
+            ++suffix_idx;
+        }
+        if (suffix_idx == m_suffixes.size()) {
+            m_suffixes.push_back(suffix);
+            m_units.push_back(StaticCounterRegistry::get_unit(idx));
+        }
+
+        // Find or add the nodes along the path. Children are always appended after their parent.
+        unsigned node = 0;
+        std::size_t begin = 0;
+        for (;;) {
+            const auto dot = path.find('.', begin);
+            const auto label = path.substr(begin, dot == std::string::npos ? dot : dot - begin);
+
+            auto child = m_nodes[node].child;
+            auto last = 0u;
+            while (child != 0 && m_nodes[child].label != label) {
+                last = child;
+                child = m_nodes[child].sibling;
+            }
+            if (child == 0) {
+                child = static_cast<unsigned>(m_nodes.size());
+                const auto offset = node == 0 ? 0 : begin - 1;
+                m_nodes.push_back(Node{label, offset, node, 0, 0});
+                (last == 0 ? m_nodes[node].child : m_nodes[last].sibling) = child;
+            }
+
+            node = child;
+            if (dot == std::string::npos) {
+                break;
+            }
+            begin = dot + 1;
+        }
+
+        m_node.push_back(node);
+        m_suffix.push_back(suffix_idx);
+    }
+
+    // Sum all counters up the prefix tree, into a node * suffix matrix.
+    void sum(std::vector<Counter::value_type>& values, std::vector<bool>& present) const
+    {
+        const auto width = m_suffixes.size();
+        values.assign(m_nodes.size() * width, 0);
+        present.assign(m_nodes.size() * width, false);
+
+        for (unsigned idx = 0; idx < m_node.size(); ++idx) {
+            if (StaticCounterRegistry::hides_internal()
+                && StaticCounterRegistry::is_internal(idx)) {
+                continue;
+            }
+
+            const auto cell = m_node[idx] * width + m_suffix[idx];
+            values[cell] += StaticCounterRegistry::total(idx);
+            present[cell] = true;
+        }
+
+        // Parents always precede their children, so a reverse pass is bottom-up.
+        for (auto node = m_nodes.size(); node-- > 1;) {
+            const auto parent = m_nodes[node].parent;
+            for (std::size_t suffix = 0; suffix < width; ++suffix) {
+                values[parent * width + suffix] += values[node * width + suffix];
+                if (present[node * width + suffix]) {
+                    present[parent * width + suffix] = true;
+                }
+            }
+        }
+    }
+
+    // Walk the prefix tree depth-first, calling visitor(node, depth, enter) on entry and exit.
+    template<typename Visitor>
+    void walk(Visitor&& visitor) const
+    {
+        if (m_nodes.empty()) {
+            return;
+        }
+
+        unsigned depth = 1;
+        auto node = m_nodes[0].child;
+        while (node != 0) {
+            visitor(node, depth, true);
+            if (m_nodes[node].child != 0) {
+                node = m_nodes[node].child;
+                ++depth;
+                continue;
+            }
+
+            // Leave nodes until one has a sibling.
+            while (node != 0) {
+                visitor(node, depth, false);
+                if (m_nodes[node].sibling != 0) {
+                    node = m_nodes[node].sibling;
+                    break;
+                }
+                node = m_nodes[node].parent;
+                --depth;
+            }
+        }
+    }
+
+    // Guards all fields.
+    std::mutex                  m_lock;
+    // Prefix tree of counter names, node 0 is the root.
+    std::vector<Node>           m_nodes;
+    // Distinct counter name suffixes.
+    std::vector<std::string>    m_suffixes;
+    // Unit of every suffix, as registered by its first counter.
+    std::vector<Unit>           m_units;
+    // Prefix tree node of every registered counter.
+    std::vector<unsigned>       m_node;
+    // Suffix index of every registered counter.
+    std::vector<unsigned>       m_suffix;
+};
+
+/** \brief Registered counters sharing a name up to their type suffix, at most one per Unit.
+ *
+ * A section registers "<name>|C" and "<name>|T", and possibly "|N", "|B" or "|O" counters. Grouping
+ * relies on the units and base name lengths stored at registration, so no names are parsed here.
+ * Counters without a unit, such as gauges, are not part of any group.
+ */
+class CounterGroup {
+public:
+    /** \brief Visit all groups in name order.
+     *
+     * Internal counters are skipped while hidden (see StaticCounterRegistry::hide_internal()). If
+     * several counters of a group have the same unit, the first registered one is used.
+     *
+     * \param   [in]    visitor     Callable taking a const CounterGroup&.
+     */
+    template<typename Visitor>
+    static void visit(Visitor&& visitor)
+    {
+        std::vector<unsigned> order;
+        const auto count = StaticCounterRegistry::count();
+        for (unsigned idx = 0; idx < count; ++idx) {
+            if (StaticCounterRegistry::get_unit(idx) == Unit::none
+                || !StaticCounterRegistry::get_name(idx)
+                || (StaticCounterRegistry::hides_internal()
+                    && StaticCounterRegistry::is_internal(idx))) {
+                continue;
+            }
+            order.push_back(idx);
+        }
+        std::stable_sort(order.begin(), order.end(), [](unsigned lhs, unsigned rhs) {
+            return compare(lhs, rhs) < 0;
+        });
+
+        CounterGroup group;
+        for (auto it = order.begin(); it != order.end();) {
+            const auto first = *it;
+            group.m_name = StaticCounterRegistry::get_name(first);
+            group.m_length = StaticCounterRegistry::get_base_length(first);
+            std::fill(std::begin(group.m_members), std::end(group.m_members), 0u);
+
+            for (; it != order.end() && compare(*it, first) == 0; ++it) {
+                auto& member = group.m_members[static_cast<unsigned>(
+                    StaticCounterRegistry::get_unit(*it)
+                )];
+                member = member == 0 ? *it + 1 : member;
+            }
+
+            visitor(static_cast<const CounterGroup&>(group));
+        }
+    }
+
+    /** \brief Get the name of the group, i.e. the counter names without suffix.
+     *
+     * \return  Group name.
+     */
+    std::string name() const
+    {
+        return std::string{m_name, m_length};
+    }
+    /** \brief Check whether the group has a counter of a unit.
+     *
+     * \param   [in]    unit    Unit.
+     *
+     * \retval  true    Counter present.
+     * \retval  false   No counter of \p unit.
+     */
+    bool has(Unit unit) const noexcept
+    {
+        return m_members[static_cast<unsigned>(unit)] != 0;
+    }
+    /** \brief Get the total value of the counter of a unit.
+     *
+     * \param   [in]    unit    Unit.
+     *
+     * \retval  0       No counter of \p unit.
+     * \returns Total value of the counter, over all threads.
+     */
+    Counter::value_type total(Unit unit) const
+    {
+        const auto member = m_members[static_cast<unsigned>(unit)];
+        return member != 0 ? StaticCounterRegistry::total(member - 1) : 0;
+    }
+
+private:
+    CounterGroup() = default;
+
+    // Compare the base names of two counters like std::strcmp.
+    static int compare(unsigned lhs, unsigned rhs)
+    {
+        const auto lhs_length = StaticCounterRegistry::get_base_length(lhs);
+        const auto rhs_length = StaticCounterRegistry::get_base_length(rhs);
+        const auto result = std::strncmp(StaticCounterRegistry::get_name(lhs),
+                                         StaticCounterRegistry::get_name(rhs),
+                                         std::min(lhs_length, rhs_length));
+        if (result != 0) {
+            return result;
+        }
+        return lhs_length < rhs_length ? -1 : lhs_length > rhs_length ? 1 : 0;
+    }
+
+    // Name of the first counter of the group.
+    const char*     m_name;
+    // Length of the group name.
+    std::size_t     m_length;
+    // Registry index + 1 of the counter per unit, 0 if none.
+    unsigned        m_members[unit_count];
+};
+
+/** \brief Helpers shared by the StaticCounterRegistry dumps.
+ *
+ * Nested in the registry for access to its internals.
+ */
+struct StaticCounterRegistry::Dumps {
+    /** \brief Times a dump into minprof.dump|C and minprof.dump|T, and reports it to the hook. */
+    class Timer {
+    public:
+        Timer() noexcept
+        : m_start{std::chrono::high_resolution_clock::now()}
+        {}
+        ~Timer()
+        {
+            const auto dur = std::chrono::duration_cast<minprof::Timer::duration>(
+                std::chrono::high_resolution_clock::now() - m_start
+            );
+
+            ++StaticCounter<typestring_is("minprof.dump|C")>::get();
+            static_cast<minprof::Timer&>(StaticCounter<typestring_is("minprof.dump|T")>::get())
+                += dur;
+            if (const auto hook = dump_hook().load(std::memory_order_acquire)) {
+                hook(dur);
+            }
+        }
+
+        // No copy constructor.
+        Timer(const Timer&) = delete;
+        // No copy assignment operator.
+        Timer& operator=(const Timer&) = delete;
+
+    private:
+        // Start of the dump.
+        std::chrono::high_resolution_clock::time_point  m_start;
+    };
+
+    /** \brief Write a string as a quoted and escaped JSON string.
+     *
+     * \param   [in,out]    out     Output stream.
+     * \param   [in]        value   Null-terminated string.
+     */
+    static void write_json_string(std::ostream& out, const char* value);
+    /** \brief Write the name of a counter, or a substitute made up from it's index.
+     *
+     * \param   [in,out]    out     Output stream.
+     * \param   [in]        idx     Index of the counter.
+     */
+    static void write_name(std::ostream& out, unsigned idx);
+};
+
+inline void StaticCounterRegistry::Dumps::write_json_string(std::ostream& out, const char* value)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    out << '"';
+    for (auto it = value; *it != '\0'; ++it) {
+        const auto c = static_cast<unsigned char>(*it);
+        if (c == '"' || c == '\\') {
+            out << '\\' << *it;
+        } else if (c < 0x20) {
+            out << "\\u00" << hex[c >> 4] << hex[c & 0xF];
+        } else {
+            out << *it;
+        }
+    }
+    out << '"';
+}
+
+inline void StaticCounterRegistry::Dumps::write_name(std::ostream& out, unsigned idx)
+{
+    const auto name = instance().m_names[idx];
+    if (name) {
+        out << name;
+    } else {
+        out << "counter_" << idx;
+    }
+}
+
+#if defined(MINPROF_IMPLEMENTATION)
+
+// Defined out of line by the implementation translation unit only, so that no other one compiles
+// the dumps or runs an initializer for them.
+
+void StaticCounterRegistry::dump(std::ostream& out)
+{
+    const Dumps::Timer timer;
+    flush();
+    const auto& self = instance();
+
+    for (unsigned idx = 0; idx < self.m_instances.size(); ++idx) {
+        if (hidden(idx)) {
+            continue;
+        }
+
+        Dumps::write_name(out, idx);
+        out << ", " << total(idx) << std::endl;
+    }
+}
+
+void StaticCounterRegistry::dump_threads(std::ostream& out)
+{
+    const Dumps::Timer timer;
+    flush();
+    const auto& self = instance();
+
+    // Threads that touched any dumped counter take part in the statistics of every counter, so
+    // that idle threads show up as imbalance.
+    std::vector<bool> active;
+    ThreadRegistry::visit([&](const ThreadStorage& storage, const char*) {
+        bool touched = false;
+        for (unsigned idx = 0; idx < self.m_instances.size() && !touched; ++idx) {
+            touched = !hidden(idx) && storage.value(idx) != 0;
+        }
+        active.push_back(touched);
+    });
+
+    for (unsigned idx = 0; idx < self.m_instances.size(); ++idx) {
+        if (hidden(idx)) {
+            continue;
+        }
+
+        const auto& counter = *self.m_instances[idx];
+        const auto shared = counter.value();
+        if (shared > 0) {
+            Dumps::write_name(out, idx);
+            out << ", (shared), " << counter << std::endl;
+        }
+
+        Counter::value_type sum = 0, min = 0, max = 0;
+        unsigned threads = 0, thread = 0;
+        ThreadRegistry::visit([&](const ThreadStorage& storage, const char* name) {
+            // Threads attached after the first pass did not take part.
+            if (thread >= active.size() || !active[thread++]) {
+                return;
+            }
+
+            const auto value = storage.value(idx);
+            min = threads == 0 || value < min ? value : min;
+            max = value > max ? value : max;
+            sum += value;
+            ++threads;
+            if (value == 0) {
+                return;
+            }
+
+            Dumps::write_name(out, idx);
+            out << ", ";
+            if (name[0] != '\0') {
+                out << name;
+            } else {
+                out << "thread_" << storage.id();
+            }
+            out << ", " << value << std::endl;
+        });
+
+        if (shared + sum == 0) {
+            continue;
+        }
+
+        const auto mean = threads > 0 ? static_cast<double>(sum) / threads : 0.0;
+        Dumps::write_name(out, idx);
+        out << ", *, " << shared + sum << ", " << min << ", " << mean << ", " << max << ", "
+            << (mean > 0.0 ? max / mean : 0.0) << ", " << threads << std::endl;
+    }
+}
+
+void StaticCounterRegistry::dump(const char* file_name)
+{
+    std::ofstream csv{file_name};
+    dump(csv);
+}
+
+void StaticCounterRegistry::dump_rollup(std::ostream& out)
+{
+    const Dumps::Timer timer;
+    flush();
+    auto& rollup = CounterRollup::instance();
+    std::lock_guard<std::mutex> lock{rollup.m_lock};
+    rollup.update();
+
+    std::vector<Counter::value_type> values;
+    std::vector<bool> present;
+    rollup.sum(values, present);
+
+    std::string path;
+    rollup.walk([&](unsigned node, unsigned depth, bool enter) {
+        if (!enter) {
+            return;
+        }
+
+        const auto& label = rollup.m_nodes[node].label;
+        path.resize(rollup.m_nodes[node].offset);
+        path += depth > 1 ? "." + label : label;
+        for (unsigned suffix = 0; suffix < rollup.m_suffixes.size(); ++suffix) {
+            const auto cell = node * rollup.m_suffixes.size() + suffix;
+            if (!present[cell]) {
+                continue;
+            }
+
+            out << path;
+            if (!rollup.m_suffixes[suffix].empty()) {
+                out << '|' << rollup.m_suffixes[suffix];
+            }
+            out << ", " << values[cell] << std::endl;
+        }
+    });
+}
+
+void StaticCounterRegistry::dump_json(std::ostream& out)
+{
+    const Dumps::Timer timer;
+    flush();
+    auto& rollup = CounterRollup::instance();
+    std::lock_guard<std::mutex> lock{rollup.m_lock};
+    rollup.update();
+
+    std::vector<Counter::value_type> values;
+    std::vector<bool> present;
+    rollup.sum(values, present);
+
+    const auto indent = [&out](unsigned depth) {
+        for (unsigned i = 0; i < depth; ++i) {
+            out << "  ";
+        }
+    };
+
+    // Subtrees without any shown counter are skipped, which can only be the internal one.
+    unsigned skip = 0;
+    // True if the next node is the first in its object.
+    bool fresh = true;
+
+    out << "{";
+    rollup.walk([&](unsigned node, unsigned depth, bool enter) {
+        const auto& entry = rollup.m_nodes[node];
+        // Objects nest twice per level, the node itself and its "children".
+        const auto level = 2 * depth - 1;
+
+        if (skip != 0) {
+            skip = !enter && depth == skip ? 0 : skip;
+            return;
+        }
+        if (enter && std::none_of(present.begin() + node * rollup.m_suffixes.size(),
+                                  present.begin() + (node + 1) * rollup.m_suffixes.size(),
+                                  [](bool cell) { return cell; })) {
+            skip = depth;
+            return;
+        }
+
+        if (!enter) {
+            fresh = false;
+            if (entry.child != 0) {
+                out << std::endl;
+                indent(level + 1);
+                out << "}";
+            }
+            out << std::endl;
+            indent(level);
+            out << "}";
+            return;
+        }
+
+        out << (fresh ? "" : ",") << std::endl;
+        fresh = false;
+        indent(level);
+        Dumps::write_json_string(out, entry.label.c_str());
+        out << ": {";
+
+        bool first = true;
+        for (unsigned suffix = 0; suffix < rollup.m_suffixes.size(); ++suffix) {
+            const auto cell = node * rollup.m_suffixes.size() + suffix;
+            if (!present[cell]) {
+                continue;
+            }
+
+            out << (first ? "" : ",") << std::endl;
+            indent(level + 1);
+            const auto& name = rollup.m_suffixes[suffix];
+            Dumps::write_json_string(out, name.empty() ? "value" : name.c_str());
+            out << ": " << values[cell];
+            first = false;
+        }
+
+        // Derived values, from the units of the rolled-up counters rather than their names.
+        Counter::value_type totals[unit_count] = {};
+        bool have[unit_count] = {};
+        for (unsigned suffix = 0; suffix < rollup.m_suffixes.size(); ++suffix) {
+            const auto unit = static_cast<unsigned>(rollup.m_units[suffix]);
+            const auto cell = node * rollup.m_suffixes.size() + suffix;
+            if (unit != 0 && present[cell] && !have[unit]) {
+                totals[unit] = values[cell];
+                have[unit] = true;
+            }
+        }
+        const auto derive = [&](const char* key, Unit num, Unit den, double scale) {
+            const auto n = static_cast<unsigned>(num), d = static_cast<unsigned>(den);
+            if (!have[n] || !have[d] || totals[d] == 0) {
+                return;
+            }
+
+            out << (first ? "" : ",") << std::endl;
+            indent(level + 1);
+            Dumps::write_json_string(out, key);
+            out << ": " << scale * static_cast<double>(totals[n]) / static_cast<double>(totals[d]);
+            first = false;
+        };
+        derive("ns_per_call", Unit::ns, Unit::count, 1.0);
+        derive("ns_per_item", Unit::ns, Unit::items, 1.0);
+        derive("items_per_s", Unit::items, Unit::ns, 1e9);
+        derive("bytes_per_s", Unit::bytes, Unit::ns, 1e9);
+        derive("ops_per_s", Unit::ops, Unit::ns, 1e9);
+
+        if (entry.child != 0) {
+            out << (first ? "" : ",") << std::endl;
+            indent(level + 1);
+            out << "\"children\": {";
+            fresh = true;
+        }
+    });
+    out << std::endl << "}" << std::endl;
+}
+
+void StaticCounterRegistry::dump_nodes(std::ostream& out)
+{
+    const Dumps::Timer timer;
+    flush();
+    const auto& self = instance();
+
+    unsigned nodes = Topology::node_count();
+    ThreadRegistry::visit([&](const ThreadStorage& storage, const char*) {
+        nodes = storage.node() + 1 > nodes ? storage.node() + 1 : nodes;
+    });
+
+    std::vector<Counter::value_type> subtotals(nodes);
+    for (unsigned idx = 0; idx < self.m_instances.size(); ++idx) {
+        if (hidden(idx)) {
+            continue;
+        }
+
+        const auto& counter = *self.m_instances[idx];
+        if (counter.value() > 0) {
+            Dumps::write_name(out, idx);
+            out << ", (shared), " << counter << std::endl;
+        }
+
+        std::fill(subtotals.begin(), subtotals.end(), 0);
+        ThreadRegistry::visit([&](const ThreadStorage& storage, const char*) {
+            subtotals[storage.node()] += storage.value(idx);
+        });
+
+        for (unsigned node = 0; node < nodes; ++node) {
+            Dumps::write_name(out, idx);
+            out << ", node_" << node << ", " << subtotals[node] << std::endl;
+        }
+    }
+}
+
+void StaticCounterRegistry::dump_derived(std::ostream& out)
+{
+    const Dumps::Timer timer;
+    flush();
+
+    CounterGroup::visit([&out](const CounterGroup& group) {
+        // Write a total, or leave the field empty.
+        const auto value = [&](Unit unit) {
+            out << ", ";
+            if (group.has(unit)) {
+                out << group.total(unit);
+            }
+        };
+        // Write a scaled ratio of two totals, or leave the field empty.
+        const auto ratio = [&](Unit num, Unit den, double scale) {
+            out << ", ";
+            if (group.has(num) && group.total(den) > 0) {
+                out << scale * static_cast<double>(group.total(num))
+                              / static_cast<double>(group.total(den));
+            }
+        };
+
+        out << group.name();
+        value(Unit::count);
+        value(Unit::ns);
+        ratio(Unit::ns, Unit::count, 1.0);
+        value(Unit::items);
+        ratio(Unit::ns, Unit::items, 1.0);
+        ratio(Unit::items, Unit::ns, 1e9);
+        value(Unit::bytes);
+        ratio(Unit::bytes, Unit::ns, 1e9);
+        value(Unit::ops);
+        ratio(Unit::ops, Unit::ns, 1e9);
+        out << std::endl;
+    });
+}
+
+#endif
+
+}
+
+/* Exemplary usage:
+ *
+ * Compile the dumps in exactly one translation unit, e.g. the one holding main():
+ *
+ * #define MINPROF_IMPLEMENTATION
+ * #include "minprof.hh"
+ *
+ * Dump you results to a stream, file or default file like so:
+ *
+ * MINPROF_DUMP();
+ * MINPROF_DUMP("myfile.csv");
+ * MINPROF_DUMP(std::cout);
+ *
+ * Compile with MINPROF_PER_THREAD defined to count per thread, name your threads and see how the
+ * work was spread:
+ *
+ * minprof::set_thread_name("worker_0");
+ * MINPROF_DUMP_THREADS(std::cout);
+ *
+ * Get subtree totals of hierarchical names, e.g. "db" and "db.query" for "db.query.select":
+ *
+ * MINPROF_DUMP_ROLLUP(std::cout);
+ * MINPROF_DUMP_JSON(std::cout);
+ *
+ * Get the mean time per call and item, and the throughput of every section:
+ *
+ * MINPROF_DUMP_DERIVED(std::cout);
+ *
+ */
+
+#endif
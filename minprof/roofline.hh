@@ -0,0 +1,553 @@
+/** \brief Work sections and machine-calibrated efficiency for the minimal profiler.
+ *
+ * \file    minprof/roofline.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_ROOFLINE_HH_
+#define MINPROF_ROOFLINE_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Counter
+// minprof::Timer
+// minprof::Section
+// minprof::Unit
+// minprof::Topology
+// minprof::StaticCounterRegistry
+#include "report.hh"
+// minprof::CounterGroup
+
+#include <algorithm>
+// std::max
+// std::min
+#include <cstddef>
+// std::size_t
+#include <cstdint>
+// std::uint64_t
+
+#include <atomic>
+// std::atomic
+#include <chrono>
+// std::chrono::duration
+// std::chrono::steady_clock
+#include <memory>
+// std::unique_ptr
+#include <mutex>
+// std::mutex
+// std::lock_guard
+#include <ostream>
+// std::ostream
+// std::endl
+#include <thread>
+// std::thread
+// std::this_thread::yield
+#include <vector>
+// std::vector
+
+#if defined(__unix__)
+#include <unistd.h>
+// sysconf
+#endif
+
+namespace minprof {
+
+/** \brief Peak throughput of this machine, and the roofline of all work sections against it.
+ *
+ * calibrate() measures three peaks once, first on a single thread and then on as many threads as
+ * the hardware has:
+ *
+ * - bandwidth: a sum over an array of 4 times the size of the last-level caches, but at least
+ *   32 MiB and at most 256 MiB, counting 8 bytes per element. The kernel only reads, so there is
+ *   no write-allocate traffic the count would miss. Machines with more than 64 MiB of last-level
+ *   cache should set Options::array_size for an exact measurement.
+ * - scalar: 8 independent chains of multiply-adds on scalars, counting 2 operations each.
+ * - vector: 24 independent chains of multiply-adds, which the compiler keeps in vector registers
+ *   and contracts into fused multiply-adds where the instruction set has them.
+ *
+ * Every repetition starts all threads at a barrier and is timed from the first thread starting to
+ * the last one finishing, so that the work of all threads is divided by the time they took
+ * together; the best repetition counts. The kernels are compiled with the flags of the translation
+ * unit that includes this header, so the vector peak only reflects the optimizations and
+ * instruction sets enabled there (e.g. -O3 -march=native). Calibration takes about a second and
+ * temporarily allocates an array per thread; set_peak() skips it for known hardware.
+ *
+ * dump() then puts every section profiled by MINPROF_SECTION_WORK against the single-thread peaks.
+ * Section time is summed over all threads that ran the section, so its rates are per thread, and a
+ * thread can at most reach what a single thread reached alone. Sections running on many threads
+ * at once fall short of that when they share a saturated resource; the machine peaks, which are
+ * dumped as well, tell by how much.
+ *
+ * A section's roofline efficiency is the time it would take at peak, either moving its bytes at
+ * peak bandwidth or doing its operations at peak vector throughput, whichever is longer, divided
+ * by the time it took. The longer of the two also tells whether the section is memory or compute
+ * bound.
+ *
+ * There is only one Roofline, which is controlled through the static interface.
+ */
+class Roofline {
+public:
+    /** \brief Calibration configuration. */
+    struct Options {
+        /** \brief Number of doubles of the bandwidth array, 0 for 4 times the last-level caches. */
+        std::size_t array_size  = 0;
+        /** \brief Number of repetitions of every kernel. */
+        unsigned    repeats     = 5;
+        /** \brief Number of threads of the machine peaks, 0 for all hardware threads. */
+        unsigned    threads     = 0;
+    };
+
+    /** \brief Peak throughput, to be set as { bandwidth, scalar, vector }. */
+    struct Peak {
+        /** \brief Memory bandwidth in bytes per second. */
+        double  bandwidth;
+        /** \brief Scalar operations per second. */
+        double  scalar;
+        /** \brief Vectorized operations per second. */
+        double  vector;
+    };
+
+public:
+    // No copy constructor.
+    Roofline(const Roofline&) = delete;
+    // No copy assignment operator.
+    Roofline& operator=(const Roofline&) = delete;
+    // No move constructor.
+    Roofline(Roofline&&) = delete;
+    // No move assignment operator.
+    Roofline& operator=(Roofline&&) = delete;
+
+    /** \brief Calibrate with the default configuration, unless already done. */
+    static Peak calibrate()
+    {
+        return calibrate(Options{});
+    }
+    /** \brief Calibrate, unless already done.
+     *
+     * Best called at startup or right before dumping, while the machine is otherwise idle.
+     *
+     * \param   [in]    options     Calibration configuration.
+     * \return  Single-thread peak throughput.
+     */
+    static Peak calibrate(Options options)
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+        if (self.m_calibrated) {
+            return self.m_thread;
+        }
+
+        const auto threads = options.threads != 0
+            ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+        const auto repeats = std::max(1u, options.repeats);
+        const auto elements = options.array_size != 0 ? options.array_size
+            : std::min<std::size_t>(std::max<std::size_t>(std::size_t{1} << 22,
+                                                          4 * cache_size() / sizeof(double)),
+                                    std::size_t{1} << 25);
+
+        // Even the single thread streams through arrays of the full size.
+        self.m_thread = measure(1, elements, repeats);
+        self.m_machine = threads > 1 ? measure(threads, elements / threads, repeats)
+                                     : self.m_thread;
+        self.m_calibrated = true;
+        return self.m_thread;
+    }
+    /** \brief Set the peaks, e.g. from a data sheet, instead of calibrating.
+     *
+     * \param   [in]    thread  Peak throughput of a single thread.
+     * \param   [in]    machine Peak throughput of all threads together.
+     */
+    static void set_peak(const Peak& thread, const Peak& machine)
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+        self.m_thread = thread;
+        self.m_machine = machine;
+        self.m_calibrated = true;
+    }
+    /** \brief Get the peak throughput of all threads together.
+     *
+     * \return  Machine peak throughput, calibrating first if needed.
+     */
+    static Peak machine()
+    {
+        calibrate();
+
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+        return self.m_machine;
+    }
+
+    /** \brief Dump the roofline of all work sections to the specified stream as CSV.
+     *
+     * Calibrates first if neither calibrate() nor set_peak() was called. Rates are per second of
+     * section time summed over threads, i.e. per thread-second, and shares are fractions of the
+     * respective single-thread peak.
+     *
+     * CSV format is:
+     * thread peak, <bytes/s>, <scalar ops/s>, <vector ops/s> <endl>
+     * machine peak, <bytes/s>, <scalar ops/s>, <vector ops/s> <endl>
+     * <name>, <calls>, <bytes/thread-s>, <bandwidth share>, <ops/thread-s>, <vector share>,
+     * <ops/byte>, <memory|compute>, <roofline efficiency> <endl>
+     *
+     * \param   [in,out]    out     Output stream.
+     */
+    static void dump(std::ostream& out)
+    {
+        const auto peak = calibrate();
+        const auto total = machine();
+        StaticCounterRegistry::flush();
+
+        out << "thread peak, " << peak.bandwidth << ", " << peak.scalar << ", " << peak.vector
+            << std::endl;
+        out << "machine peak, " << total.bandwidth << ", " << total.scalar << ", "
+            << total.vector << std::endl;
+
+        // Work sections are the groups counting bytes or operations.
+        CounterGroup::visit([&](const CounterGroup& group) {
+            if (!group.has(Unit::bytes) && !group.has(Unit::ops)) {
+                return;
+            }
+            const auto bytes = static_cast<double>(group.total(Unit::bytes));
+            const auto ops = static_cast<double>(group.total(Unit::ops));
+            const auto seconds = static_cast<double>(group.total(Unit::ns)) / 1e9;
+            if (seconds <= 0.0) {
+                return;
+            }
+
+            const auto memory_time = peak.bandwidth > 0.0 ? bytes / peak.bandwidth : 0.0;
+            const auto compute_time = peak.vector > 0.0 ? ops / peak.vector : 0.0;
+            const auto bound = memory_time >= compute_time ? memory_time : compute_time;
+
+            out << group.name() << ", " << group.total(Unit::count) << ", " << bytes / seconds
+                << ", " << share(bytes / seconds, peak.bandwidth) << ", " << ops / seconds << ", "
+                << share(ops / seconds, peak.vector) << ", " << (bytes > 0.0 ? ops / bytes : 0.0)
+                << ", " << (memory_time >= compute_time ? "memory" : "compute") << ", "
+                << bound / seconds << std::endl;
+        });
+    }
+
+private:
+    Roofline()
+    : m_lock{}, m_calibrated{false}, m_thread{}, m_machine{}
+    {}
+
+    static Roofline& instance()
+    {
+        static Roofline instance;
+        return instance;
+    }
+
+    // Size of the last-level caches of the machine in bytes, 0 if unknown.
+    static std::size_t cache_size()
+    {
+        long size = 0;
+#if defined(_SC_LEVEL4_CACHE_SIZE)
+        size = sysconf(_SC_LEVEL4_CACHE_SIZE);
+#endif
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+        size = size > 0 ? size : sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+        size = size > 0 ? size : sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+        // The reported cache is per node on multi-socket machines.
+        return size > 0 ? static_cast<std::size_t>(size) * Topology::node_count() : 0;
+    }
+
+    // Measure all peaks on a number of threads at once.
+    static Peak measure(unsigned threads, std::size_t elements, unsigned repeats)
+    {
+        Peak peak;
+        peak.bandwidth = run<Bandwidth>(threads, repeats, elements);
+        peak.scalar = run<Scalar>(threads, repeats, 0);
+        peak.vector = run<Vector>(threads, repeats, 0);
+        return peak;
+    }
+
+    // Fraction of a peak, 0 if the peak is unknown.
+    static double share(double value, double peak)
+    {
+        return peak > 0.0 ? value / peak : 0.0;
+    }
+
+    // Spinning barrier, reusable for any number of rounds.
+    class Barrier {
+    public:
+        explicit Barrier(unsigned count)
+        : m_count{count}, m_waiting{0}, m_round{0}
+        {}
+
+        // Wait until all threads arrived.
+        void wait()
+        {
+            const auto round = m_round.load();
+            if (++m_waiting == m_count) {
+                m_waiting = 0;
+                ++m_round;
+                return;
+            }
+            while (m_round.load() == round) {
+                std::this_thread::yield();
+            }
+        }
+
+    private:
+        // Number of threads.
+        const unsigned          m_count;
+        // Number of threads waiting in this round.
+        std::atomic<unsigned>   m_waiting;
+        // Number of completed rounds.
+        std::atomic<unsigned>   m_round;
+    };
+
+    // Run a kernel on all threads at once, returning the best aggregate rate in units per second.
+    // Every thread constructs its own Kernel from size, and every call of it does one repetition,
+    // returning the units done.
+    template<typename Kernel>
+    static double run(unsigned threads, unsigned repeats, std::size_t size)
+    {
+        using clock = std::chrono::steady_clock;
+
+        Barrier barrier{threads};
+        std::vector<clock::time_point> starts(threads * repeats), ends(threads * repeats);
+        std::vector<double> units(threads * repeats, 0.0);
+        std::vector<std::thread> workers;
+        for (unsigned id = 0; id < threads; ++id) {
+            workers.emplace_back([&, id]() {
+                // Constructed by the thread itself, so that its pages are local to it.
+                Kernel kernel{size};
+                for (unsigned repeat = 0; repeat < repeats; ++repeat) {
+                    // Start together, so that the threads compete like in real use.
+                    barrier.wait();
+                    starts[repeat * threads + id] = clock::now();
+                    units[repeat * threads + id] = kernel();
+                    ends[repeat * threads + id] = clock::now();
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        double best = 0.0;
+        for (unsigned repeat = 0; repeat < repeats; ++repeat) {
+            const auto first = repeat * threads;
+            auto start = starts[first];
+            auto end = ends[first];
+            double total = 0.0;
+            for (auto idx = first; idx < first + threads; ++idx) {
+                start = std::min(start, starts[idx]);
+                end = std::max(end, ends[idx]);
+                total += units[idx];
+            }
+
+            const auto seconds = std::chrono::duration<double>(end - start).count();
+            const auto rate = seconds > 0.0 ? total / seconds : 0.0;
+            best = rate > best ? rate : best;
+        }
+        return best;
+    }
+
+    // Sum over a large array, returning the bytes read.
+    class Bandwidth {
+    public:
+        explicit Bandwidth(std::size_t elements)
+        : m_elements{elements}, m_data{new double[elements]}
+        {
+            for (std::size_t i = 0; i < m_elements; ++i) {
+                m_data[i] = 1.0;
+            }
+        }
+
+        double operator()() const
+        {
+            // Independent partial sums, so that the adds keep up with the loads.
+            double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0, s4 = 0.0, s5 = 0.0, s6 = 0.0, s7 = 0.0;
+            const auto data = m_data.get();
+            std::size_t i = 0;
+            for (; i + 8 <= m_elements; i += 8) {
+                s0 += data[i];
+                s1 += data[i + 1];
+                s2 += data[i + 2];
+                s3 += data[i + 3];
+                s4 += data[i + 4];
+                s5 += data[i + 5];
+                s6 += data[i + 6];
+                s7 += data[i + 7];
+            }
+            for (; i < m_elements; ++i) {
+                s0 += data[i];
+            }
+            sink(s0 + s1 + s2 + s3 + s4 + s5 + s6 + s7);
+
+            return static_cast<double>(sizeof(double) * m_elements);
+        }
+
+    private:
+        // Number of elements.
+        std::size_t                 m_elements;
+        // Array read by every repetition.
+        std::unique_ptr<double[]>   m_data;
+    };
+
+    // Independent scalar multiply-add chains, returning the operations done.
+    class Scalar {
+    public:
+        explicit Scalar(std::size_t)
+        {}
+
+        double operator()() const
+        {
+            constexpr std::size_t steps = std::size_t{1} << 22;
+
+            const volatile double factor = 0.999999, offset = 1e-9;
+            const double m = factor, c = offset;
+            double a0 = 1.0, a1 = 2.0, a2 = 3.0, a3 = 4.0, a4 = 5.0, a5 = 6.0, a6 = 7.0, a7 = 8.0;
+            for (std::size_t i = 0; i < steps; ++i) {
+                a0 = a0 * m + c;
+                a1 = a1 * m + c;
+                a2 = a2 * m + c;
+                a3 = a3 * m + c;
+                a4 = a4 * m + c;
+                a5 = a5 * m + c;
+                a6 = a6 * m + c;
+                a7 = a7 * m + c;
+            }
+            sink(a0 + a1 + a2 + a3 + a4 + a5 + a6 + a7);
+
+            return 2.0 * 8.0 * static_cast<double>(steps);
+        }
+    };
+
+    // Independent multiply-add chains the compiler can vectorize, returning the operations done.
+    class Vector {
+    public:
+        explicit Vector(std::size_t)
+        {}
+
+        double operator()() const
+        {
+            // Enough chains to hide the latency of the multiply-adds on two ports, yet few enough
+            // to stay in registers along with m and c, e.g. 6 AVX or 12 of the 16 SSE registers.
+            constexpr std::size_t chains = 24;
+            constexpr std::size_t steps = std::size_t{1} << 20;
+
+            const volatile double factor = 0.999999, offset = 1e-9;
+            const double m = factor, c = offset;
+            double a[chains];
+            for (std::size_t j = 0; j < chains; ++j) {
+                a[j] = static_cast<double>(j);
+            }
+            for (std::size_t i = 0; i < steps; ++i) {
+                for (std::size_t j = 0; j < chains; ++j) {
+                    a[j] = a[j] * m + c;
+                }
+            }
+            double sum = 0.0;
+            for (std::size_t j = 0; j < chains; ++j) {
+                sum += a[j];
+            }
+            sink(sum);
+
+            return 2.0 * static_cast<double>(chains * steps);
+        }
+    };
+
+    // Keep a kernel's result alive.
+    static void sink(double value)
+    {
+        static volatile double target;
+        target = value;
+        static_cast<void>(target);
+    }
+
+    // Guards all fields.
+    std::mutex  m_lock;
+    // True once calibrated or set.
+    bool        m_calibrated;
+    // Peak throughput of a single thread.
+    Peak        m_thread;
+    // Peak throughput of all threads together.
+    Peak        m_machine;
+};
+
+/** \brief Scoped measurement of a section that processes a known amount of work.
+ *
+ * Adds the bytes moved and operations done to two more Counters when entered, so that the
+ * Roofline can relate the section's time to the machine's peaks.
+ */
+class WorkSection : private Section {
+public:
+    /** \brief Initialize, count, time and account the work of a new WorkSection.
+     *
+     * \param   [in,out]    c       Counter for section.
+     * \param   [in,out]    t       Timer for section.
+     * \param   [in,out]    b       Counter for bytes.
+     * \param   [in,out]    o       Counter for operations.
+     * \param   [in]        bytes   Bytes moved from or to memory by this run of the section.
+     * \param   [in]        ops     Operations done by this run of the section.
+     * \param   [in]        name    Name of the section, must outlive it.
+     */
+    WorkSection(Counter& c, Timer& t, Counter& b, Counter& o, std::uint64_t bytes,
+                std::uint64_t ops, const char* name = nullptr) noexcept
+    : Section{c, t, name}
+    {
+        b += bytes;
+        o += ops;
+    }
+
+    // No copy constructor.
+    WorkSection(const WorkSection&) = delete;
+    // No copy assignment.
+    WorkSection& operator=(const WorkSection&) = delete;
+
+    // No move constructor.
+    WorkSection(WorkSection&&) = delete;
+    // No move assignment.
+    WorkSection& operator=(WorkSection&&) = delete;
+
+    // Hack to make use of if-condition initialization scoping.
+    operator bool() const noexcept
+    {
+        return true;
+    }
+};
+
+/** \brief Dump the roofline of all work sections. */
+#define MINPROF_DUMP_ROOFLINE   ::minprof::Roofline::dump
+
+/** \brief Profile the following statement (-block) along with the work it does.
+ *
+ * Will accumulate the number of invocations in <name>|C, the total time in <name>|T, the bytes in
+ * <name>|B and the operations in <name>|O.
+ *
+ * \param   name    Name string literal of the section.
+ * \param   bytes   Bytes moved from or to memory per invocation.
+ * \param   ops     Operations (e.g. flops) per invocation.
+ */
+#define MINPROF_SECTION_WORK(name, bytes, ops)\
+if (::minprof::WorkSection __section_ ## __LINE__ {MINPROF_COUNTER(name "|C"),\
+    MINPROF_TIMER(name "|T"), MINPROF_COUNTER(name "|B"), MINPROF_COUNTER(name "|O"), (bytes),\
+    (ops), name})
+
+}
+
+/* Exemplary usage:
+ *
+ * Describe the work of a kernel, here a dot product of two double vectors:
+ *
+ * MINPROF_SECTION_WORK("dot", 2 * n * sizeof(double), 2 * n) {
+ *      for (std::size_t i = 0; i < n; ++i)
+ *          sum += x[i] * y[i];
+ * }
+ *
+ * Calibrate while the machine is idle, and see how close the kernels get to the peaks:
+ *
+ * minprof::Roofline::calibrate();
+ * ...
+ * MINPROF_DUMP_ROOFLINE(std::cout);
+ *
+ */
+
+#endif
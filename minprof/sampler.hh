@@ -0,0 +1,531 @@
+/** \brief Background sampler and rate/percentile queries for the minimal profiler.
+ *
+ * \file    minprof/sampler.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_SAMPLER_HH_
+#define MINPROF_SAMPLER_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Counter
+// minprof::StaticCounterRegistry
+// minprof::ThreadStorage
+#include "heatmap.hh"
+// minprof::Histogram
+// minprof::Heatmap
+// minprof::HeatmapRegistry
+
+#include <cmath>
+// std::exp
+#include <cstdint>
+// std::uint64_t
+
+#include <condition_variable>
+// std::condition_variable
+#include <functional>
+// std::function
+#include <thread>
+// std::thread
+#include <utility>
+// std::pair
+// std::move
+#include <vector>
+// std::vector
+
+namespace minprof {
+
+/** \brief Periodic sampler of all registered counters and heatmaps.
+ *
+ * A background thread takes a snapshot of every StaticCounter and Heatmap once per period, and
+ * publishes derived statistics for cheap queries by the application itself:
+ *
+ * - rate() is an exponentially weighted moving average of a counter's increase per second.
+ * - percentile() is a quantile of a heatmap's durations over a sliding window of intervals.
+ *
+ * Queries only read the published snapshots, never the counters themselves, so they neither
+ * perturb the writers nor depend on the number of threads. A percentile query is O(buckets).
+ *
+ * The sampler accounts its own health in internal counters and heatmaps: the duration of every
+ * snapshot (minprof.sampler.snapshot) and how late the thread woke up for it
+ * (minprof.sampler.lateness).
+ *
+ * There is only one Sampler, which is controlled through the static interface.
+ */
+class Sampler {
+public:
+    /** \brief Sampler configuration. */
+    struct Options {
+        /** \brief Time between two snapshots. */
+        std::chrono::milliseconds   period          = std::chrono::milliseconds{100};
+        /** \brief Time constant of the rate averages. */
+        std::chrono::milliseconds   rate_window     = std::chrono::milliseconds{1000};
+        /** \brief Length of the percentile window. */
+        std::chrono::milliseconds   latency_window  = std::chrono::milliseconds{10000};
+    };
+
+public:
+    // No copy constructor.
+    Sampler(const Sampler&) = delete;
+    // No copy assignment operator.
+    Sampler& operator=(const Sampler&) = delete;
+    // No move constructor.
+    Sampler(Sampler&&) = delete;
+    // No move assignment operator.
+    Sampler& operator=(Sampler&&) = delete;
+
+    /** \brief Start the sampler thread with the default configuration. */
+    static void start()
+    {
+        start(Options{});
+    }
+    /** \brief Start the sampler thread.
+     *
+     * Does nothing if it is already running.
+     *
+     * \param   [in]    options     Sampler configuration.
+     */
+    static void start(Options options)
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+        if (self.m_running) {
+            return;
+        }
+
+        self.m_options = options;
+        self.m_running = true;
+        self.m_thread = std::thread{[&self]() { self.run(); }};
+    }
+    /** \brief Stop the sampler thread.
+     *
+     * The last snapshot remains available for queries.
+     */
+    static void stop()
+    {
+        auto& self = instance();
+        {
+            std::lock_guard<std::mutex> lock{self.m_lock};
+            if (!self.m_running) {
+                return;
+            }
+            self.m_running = false;
+        }
+
+        self.m_wakeup.notify_all();
+        self.m_thread.join();
+    }
+
+    /** \brief Take a snapshot now.
+     *
+     * Called periodically by the sampler thread, but may also be called directly by applications
+     * that do not want a background thread. Must not be called concurrently.
+     */
+    static void sample()
+    {
+        instance().snapshot(Stopwatch::Clock::now());
+    }
+
+    /** \brief Add a function to be called after every snapshot.
+     *
+     * Hooks run on the sampler thread (or whoever calls sample()), after all statistics were
+     * published, so they may use the query functions to evaluate them. Whatever a hook uses must
+     * outlive it, see Hook.
+     *
+     * \param   [in]    hook    Callable taking the time of the snapshot.
+     * \return  Id of the hook, for remove_hook().
+     */
+    static unsigned add_hook(std::function<void(Stopwatch::time_point)> hook)
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_hooks_lock};
+
+        self.m_hooks.emplace_back(++self.m_hook_id, std::move(hook));
+        return self.m_hook_id;
+    }
+    /** \brief Remove a hook.
+     *
+     * Waits for the hook to return if it is running, so it is not called anymore once this returns.
+     * Must not be called by a hook.
+     *
+     * \param   [in]    id      Id returned by add_hook().
+     */
+    static void remove_hook(unsigned id)
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_hooks_lock};
+
+        for (auto it = self.m_hooks.begin(); it != self.m_hooks.end(); ++it) {
+            if (it->first == id) {
+                self.m_hooks.erase(it);
+                return;
+            }
+        }
+    }
+
+    /** \brief Hook owned by an object whose state it uses, removed along with it.
+     *
+     * Meant as a member of the singletons that hook into the Sampler. Constructing a Hook
+     * constructs the Sampler, which is thus destroyed after the singleton; destroying the Hook
+     * removes the hook before the singleton's other members are gone. Destructors that tear down
+     * state the hook uses before that call reset() first.
+     */
+    class Hook {
+    public:
+        /** \brief Construct the Sampler, without adding a hook yet. */
+        Hook()
+        : m_id{0}
+        {
+            instance();
+        }
+        /** \brief Remove the hook. */
+        ~Hook()
+        {
+            reset();
+        }
+
+        // No copy constructor.
+        Hook(const Hook&) = delete;
+        // No copy assignment operator.
+        Hook& operator=(const Hook&) = delete;
+        // No move constructor.
+        Hook(Hook&&) = delete;
+        // No move assignment operator.
+        Hook& operator=(Hook&&) = delete;
+
+        /** \brief Add the hook, replacing a previous one.
+         *
+         * Must not be called by a hook, nor while holding a lock that a hook takes, as the Sampler
+         * holds the lock guarding its hooks while calling them.
+         *
+         * \param   [in]    hook    Callable taking the time of the snapshot.
+         */
+        void set(std::function<void(Stopwatch::time_point)> hook)
+        {
+            reset();
+            m_id = add_hook(std::move(hook));
+        }
+        /** \brief Remove the hook, waiting for it to return if it is running.
+         *
+         * Must not be called by the hook itself, nor while holding a lock it takes.
+         */
+        void reset()
+        {
+            if (m_id != 0) {
+                remove_hook(m_id);
+                m_id = 0;
+            }
+        }
+
+    private:
+        // Id of the added hook, 0 if none.
+        unsigned    m_id;
+    };
+
+    /** \brief Get the recent rate of a registered counter.
+     *
+     * \param   [in]    idx     Index of the counter.
+     * \return  Average increase per second, 0 if not sampled yet.
+     */
+    static double rate(unsigned idx) noexcept
+    {
+        const auto entry = instance().find_rate(idx);
+        return entry ? entry->rate.load(std::memory_order_relaxed) : 0.0;
+    }
+    /** \brief Get the recent duration percentile of a registered heatmap.
+     *
+     * \param   [in]    idx     Index of the heatmap.
+     * \param   [in]    q       Quantile in [0, 1], e.g. 0.99.
+     * \return  Estimated duration, 0 if not sampled yet.
+     */
+    static Timer::duration percentile(unsigned idx, double q) noexcept
+    {
+        std::uint64_t counts[Histogram::bucket_count];
+        if (!instance().read_window(idx, counts)) {
+            return Timer::duration::zero();
+        }
+
+        return Timer::duration{Histogram::quantile(counts, q)};
+    }
+
+private:
+    // Number of rate entries per chunk.
+    static constexpr unsigned chunk_size = ThreadStorage::chunk_size;
+    // Number of window histograms per chunk, about 32 KiB.
+    static constexpr unsigned window_chunk_size = 64;
+    // Maximum number of window histogram chunks.
+    static constexpr unsigned window_chunk_count = 1024;
+    // Number of heatmaps that get a window histogram, later ones report no percentiles.
+    static constexpr unsigned window_capacity = window_chunk_size * window_chunk_count;
+
+    // Sampled state of a counter.
+    struct Rate {
+        // Counter total at the last snapshot, only accessed by the sampler.
+        Counter::value_type last    = 0;
+        // True after the first snapshot, only accessed by the sampler.
+        bool                primed  = false;
+        // Published average rate.
+        std::atomic<double> rate{0.0};
+    };
+
+    // Published sliding window histogram of a heatmap.
+    struct Window {
+        // Sequence lock, odd while the counts are being written.
+        std::atomic<unsigned>       seq{0};
+        // Bucket counts.
+        std::atomic<std::uint64_t>  counts[Histogram::bucket_count];
+    };
+
+    Sampler()
+    : m_lock{}, m_wakeup{}, m_running{false}, m_thread{}, m_options{}, m_last{}, m_rates{},
+      m_windows{}, m_window_count{0}, m_hooks_lock{}, m_hooks{}, m_hook_id{0}
+    {
+        for (auto& chunk : m_rates) {
+            chunk.store(nullptr, std::memory_order_relaxed);
+        }
+        for (auto& chunk : m_windows) {
+            chunk.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    ~Sampler()
+    {
+        stop();
+
+        for (auto& chunk : m_rates) {
+            delete[] chunk.load(std::memory_order_relaxed);
+        }
+        for (auto& chunk : m_windows) {
+            delete[] chunk.load(std::memory_order_relaxed);
+        }
+    }
+
+    static Sampler& instance()
+    {
+        static Sampler instance;
+        return instance;
+    }
+
+    // Sampler thread main loop.
+    void run()
+    {
+        std::unique_lock<std::mutex> lock{m_lock};
+        auto due = Stopwatch::Clock::now();
+        while (m_running) {
+            lock.unlock();
+
+            // Waking up late delays every query result and rate, so the sampler accounts it.
+            const auto now = Stopwatch::Clock::now();
+            if (now > due) {
+                const auto lateness = std::chrono::duration_cast<Timer::duration>(now - due);
+                MINPROF_TIMER("minprof.sampler.lateness|T") += lateness;
+                MINPROF_HEATMAP("minprof.sampler.lateness").record(lateness, now);
+            }
+            snapshot(now);
+
+            lock.lock();
+            due = Stopwatch::Clock::now() + m_options.period;
+            m_wakeup.wait_for(lock, m_options.period, [this]() { return !m_running; });
+        }
+    }
+
+    // Take a snapshot of all counters and heatmaps, accounting its own duration.
+    void snapshot(Stopwatch::time_point now)
+    {
+        take(now);
+
+        const auto end = Stopwatch::Clock::now();
+        const auto dur = std::chrono::duration_cast<Timer::duration>(end - now);
+        ++MINPROF_COUNTER("minprof.sampler.snapshot|C");
+        MINPROF_TIMER("minprof.sampler.snapshot|T") += dur;
+        MINPROF_HEATMAP("minprof.sampler.snapshot").record(dur, end);
+    }
+
+    // Take a snapshot of all counters and heatmaps.
+    void take(Stopwatch::time_point now)
+    {
+        const auto dt = std::chrono::duration<double>(now - m_last).count();
+        const auto primed = m_last != Stopwatch::time_point{};
+        m_last = now;
+
+        // Smoothing factor for irregular sampling intervals.
+        const auto tau = std::chrono::duration<double>(m_options.rate_window).count();
+        const auto alpha = primed && tau > 0.0 ? 1.0 - std::exp(-dt / tau) : 1.0;
+
+        StaticCounterRegistry::flush();
+        const auto count = StaticCounterRegistry::count();
+        for (unsigned idx = 0; idx < count && idx < ThreadStorage::capacity; ++idx) {
+            auto& entry = rate_entry(idx);
+            const auto value = StaticCounterRegistry::total(idx);
+
+            if (entry.primed && dt > 0.0) {
+                // Gauges may decrease.
+                const auto instant = (static_cast<double>(value)
+                                      - static_cast<double>(entry.last)) / dt;
+                const auto rate = entry.rate.load(std::memory_order_relaxed);
+                entry.rate.store(rate + alpha * (instant - rate), std::memory_order_relaxed);
+            }
+            entry.last = value;
+            entry.primed = true;
+        }
+
+        sample_windows(now);
+
+        std::lock_guard<std::mutex> lock{m_hooks_lock};
+        for (const auto& hook : m_hooks) {
+            hook.second(now);
+        }
+    }
+
+    // Publish the sliding window histograms of all heatmaps.
+    void sample_windows(Stopwatch::time_point now)
+    {
+        // Heatmaps of libraries loaded later register after the sampler started, so the windows
+        // grow along with the registry.
+        const auto registered = HeatmapRegistry::count();
+        const auto count = registered < window_capacity ? registered : window_capacity;
+
+        const auto window = std::chrono::duration_cast<Timer::duration>(m_options.latency_window);
+        for (unsigned idx = 0; idx < count; ++idx) {
+            std::uint64_t counts[Histogram::bucket_count] = {};
+            HeatmapRegistry::get(idx).accumulate(counts, window, now);
+
+            auto& entry = window_entry(idx);
+            const auto seq = entry.seq.load(std::memory_order_relaxed);
+            entry.seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (unsigned bucket = 0; bucket < Histogram::bucket_count; ++bucket) {
+                entry.counts[bucket].store(counts[bucket], std::memory_order_relaxed);
+            }
+            entry.seq.store(seq + 2, std::memory_order_release);
+        }
+        m_window_count.store(count, std::memory_order_release);
+    }
+
+    // Get the rate entry of a counter, allocating it if necessary. Sampler only.
+    Rate& rate_entry(unsigned idx)
+    {
+        auto& chunk = m_rates[idx / chunk_size];
+        auto rates = chunk.load(std::memory_order_relaxed);
+        if (!rates) {
+            rates = new Rate[chunk_size];
+            chunk.store(rates, std::memory_order_release);
+        }
+
+        return rates[idx % chunk_size];
+    }
+    // Get the window histogram of a heatmap, allocating it if necessary. Sampler only.
+    Window& window_entry(unsigned idx)
+    {
+        auto& chunk = m_windows[idx / window_chunk_size];
+        auto windows = chunk.load(std::memory_order_relaxed);
+        if (!windows) {
+            windows = new Window[window_chunk_size];
+            chunk.store(windows, std::memory_order_release);
+        }
+
+        return windows[idx % window_chunk_size];
+    }
+    // Find the rate entry of a counter.
+    const Rate* find_rate(unsigned idx) const noexcept
+    {
+        if (idx >= ThreadStorage::capacity) {
+            return nullptr;
+        }
+
+        const auto rates = m_rates[idx / chunk_size].load(std::memory_order_acquire);
+        return rates ? &rates[idx % chunk_size] : nullptr;
+    }
+    // Read a consistent copy of a window histogram.
+    bool read_window(unsigned idx, std::uint64_t (&counts)[Histogram::bucket_count]) const noexcept
+    {
+        if (idx >= m_window_count.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        // Published along with the count.
+        const auto& entry = m_windows[idx / window_chunk_size].load(std::memory_order_relaxed)
+                            [idx % window_chunk_size];
+        for (;;) {
+            const auto seq = entry.seq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            for (unsigned bucket = 0; bucket < Histogram::bucket_count; ++bucket) {
+                counts[bucket] = entry.counts[bucket].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (entry.seq.load(std::memory_order_relaxed) == seq) {
+                return seq != 0;
+            }
+        }
+    }
+
+    // Guards m_running and m_options.
+    std::mutex                  m_lock;
+    // Wakes the sampler thread up early on stop().
+    std::condition_variable     m_wakeup;
+    // True while the sampler thread shall run.
+    bool                        m_running;
+    // Sampler thread.
+    std::thread                 m_thread;
+    // Sampler configuration.
+    Options                     m_options;
+    // Time of the last snapshot.
+    Stopwatch::time_point       m_last;
+    // Rate entries, allocated in chunks as counters are sampled.
+    std::atomic<Rate*>          m_rates[ThreadStorage::chunk_count];
+    // Window histograms, one per heatmap, allocated in chunks as heatmaps are registered.
+    std::atomic<Window*>        m_windows[window_chunk_count];
+    // Number of published window histograms.
+    std::atomic<unsigned>       m_window_count;
+    // Guards m_hooks and m_hook_id.
+    std::mutex                  m_hooks_lock;
+    // Functions called after every snapshot, along with their ids.
+    std::vector<std::pair<unsigned, std::function<void(Stopwatch::time_point)>>> m_hooks;
+    // Id of the last added hook.
+    unsigned                    m_hook_id;
+};
+
+/** \brief Get the recent rate of a global Counter in increments per second.
+ *
+ * Requires the Sampler to be running, see Sampler::start().
+ *
+ * \param   name    Name string literal of the StaticCounter.
+ */
+#define MINPROF_RATE(name)\
+::minprof::Sampler::rate(::minprof::StaticCounter<typestring_is(name)>::index)
+
+/** \brief Get a recent duration percentile of a global Heatmap.
+ *
+ * Requires the Sampler to be running, see Sampler::start().
+ *
+ * \param   name    Name string literal of the Heatmap.
+ * \param   q       Quantile in [0, 1].
+ */
+#define MINPROF_PERCENTILE(name, q)\
+::minprof::Sampler::percentile(::minprof::StaticHeatmap<typestring_is(name)>::index, q)
+
+}
+
+/* Exemplary usage:
+ *
+ * Start the sampler once, then let the application adapt to its own load:
+ *
+ * minprof::Sampler::start();
+ *
+ * MINPROF_HEATMAP_SECTION("request") {
+ *      handle();
+ * }
+ *
+ * if (MINPROF_RATE("request|C") > 10000.0
+ *     || MINPROF_PERCENTILE("request", 0.99) > std::chrono::milliseconds{50}) {
+ *      shed_load();
+ * }
+ *
+ */
+
+#endif
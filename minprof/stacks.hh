@@ -0,0 +1,640 @@
+/** \brief Call stacks of slow sections for the minimal profiler.
+ *
+ * Stacks are captured by walking the frame pointer chain, so build with -fno-omit-frame-pointer,
+ * otherwise stacks end early at the first function without a frame pointer. Symbolization uses
+ * dladdr, so link executables with -rdynamic to resolve their own functions. Requires Linux and
+ * glibc.
+ *
+ * \file    minprof/stacks.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_STACKS_HH_
+#define MINPROF_STACKS_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Counter
+// minprof::Timer
+// minprof::Stopwatch
+// minprof::StaticCounter
+// minprof::StaticCounterRegistry
+#include "pprof.hh"
+// minprof::pprof::Profile
+
+#include <cstddef>
+// std::size_t
+#include <cstdint>
+// std::uint32_t
+// std::uint64_t
+// std::uintptr_t
+#include <cstdlib>
+// std::free
+
+#include <algorithm>
+// std::max
+// std::sort
+#include <memory>
+// std::unique_ptr
+#include <sstream>
+// std::ostringstream
+#include <string>
+// std::string
+#include <unordered_map>
+// std::unordered_map
+
+#include <cxxabi.h>
+// abi::__cxa_demangle
+#include <dlfcn.h>
+// dladdr
+#include <link.h>
+// dl_iterate_phdr
+#include <pthread.h>
+// pthread_getattr_np
+// pthread_attr_getstack
+
+/* Stack depth:
+ *
+ * Maximum number of frames captured per stack.
+ */
+#if !defined(MINPROF_STACKS_DEPTH)
+#define MINPROF_STACKS_DEPTH    32
+#endif
+
+/* Stack table capacity:
+ *
+ * Number of unique stacks, and of unique (section, stack) pairs, that can be stored. Must be a
+ * power of two. Slow exits beyond that are counted in minprof.stacks.dropped|C. The tables
+ * allocate capacity * (depth + 5) * 8 bytes on first use.
+ */
+#if !defined(MINPROF_STACKS_CAPACITY)
+#define MINPROF_STACKS_CAPACITY 4096
+#endif
+
+namespace minprof {
+
+/** \brief Lock-free tables of the call stacks slow sections were left from.
+ *
+ * Stacks are deduplicated by a 64bit hash of their frames in an open-addressed table, so that
+ * every unique stack is stored once and identified by its index. A second table counts and times
+ * the slow exits per (section, stack) pair. Entries are claimed by a single CAS and never removed,
+ * so capturing neither locks nor allocates. Stacks are only symbolized when dumped.
+ *
+ * There is only one StackProfiler, which is controlled through the static interface.
+ */
+class StackProfiler {
+public:
+    /** \brief Maximum number of frames per stack. */
+    static constexpr unsigned depth = MINPROF_STACKS_DEPTH;
+    /** \brief Number of entries per table. */
+    static constexpr std::size_t capacity = MINPROF_STACKS_CAPACITY;
+
+    static_assert((capacity & (capacity - 1)) == 0, "Capacity must be a power of two!");
+
+    /** \brief A unique stack. */
+    struct Stack {
+        /** \brief Hash of the frames, 0 while unused. */
+        std::atomic<std::uint64_t>  hash;
+        /** \brief Number of frames, 0 until they were published. */
+        std::atomic<unsigned>       size;
+        /** \brief Return addresses, innermost first. */
+        std::uintptr_t              frames[depth];
+    };
+
+    /** \brief Slow exits of a section from a stack. */
+    struct Site {
+        /** \brief Section id << 32 | stack index + 1, 0 while unused. */
+        std::atomic<std::uint64_t>  key;
+        /** \brief Number of slow exits. */
+        Counter                     count;
+        /** \brief Time spent in slow exits. */
+        Timer                       time;
+    };
+
+public:
+    // No copy constructor.
+    StackProfiler(const StackProfiler&) = delete;
+    // No copy assignment operator.
+    StackProfiler& operator=(const StackProfiler&) = delete;
+    // No move constructor.
+    StackProfiler(StackProfiler&&) = delete;
+    // No move assignment operator.
+    StackProfiler& operator=(StackProfiler&&) = delete;
+
+    /** \brief Set the duration from which on section exits capture their stack.
+     *
+     * \param   [in]    threshold   Minimum duration of a slow exit.
+     */
+    static void set_threshold(Timer::duration threshold) noexcept
+    {
+        instance().m_threshold.store(threshold.count(), std::memory_order_relaxed);
+    }
+    /** \brief Get the duration from which on section exits capture their stack.
+     *
+     * \return  Minimum duration of a slow exit.
+     */
+    ALWAYS_INLINE static Timer::duration threshold() noexcept
+    {
+        return Timer::duration{instance().m_threshold.load(std::memory_order_relaxed)};
+    }
+
+    /** \brief Capture the calling thread's stack and account a slow exit to it.
+     *
+     * Not inlined, so that the innermost frame is the function containing the section.
+     *
+     * \param   [in]    id      Section id.
+     * \param   [in]    dur     Duration of the section.
+     */
+    __attribute__((noinline)) static void record(std::uint32_t id, Timer::duration dur) noexcept
+    {
+        std::uintptr_t frames[depth];
+        const auto size = capture(frames);
+
+        auto& self = instance();
+        const auto stack = self.insert(frames, size);
+        if (stack == capacity) {
+            ++dropped_counter();
+            return;
+        }
+
+        const auto site = self.site((std::uint64_t{id} << 32) | (stack + 1));
+        if (!site) {
+            ++dropped_counter();
+            return;
+        }
+
+        ++site->count;
+        site->time += dur;
+    }
+
+    /** \brief Get the number of slow exits that did not fit into the tables.
+     *
+     * \return  Number of dropped exits.
+     */
+    static Counter::value_type dropped() noexcept
+    {
+        return dropped_counter().value();
+    }
+
+    /** \brief Dump the slowest stacks of every section to the specified stream.
+     *
+     * Sites are ordered by section and the time spent in slow exits, descending. Every site is
+     * followed by its symbolized frames, innermost first, indented by four spaces.
+     *
+     * Format is:
+     * <section>, <stack index>, <slow exits>, <time> <endl>
+     *     <address> <symbol>+<offset> (<module>) <endl>
+     *
+     * \param   [in,out]    out     Output stream.
+     * \param   [in]        top     Maximum number of stacks per section.
+     */
+    static void dump(std::ostream& out, unsigned top = 5)
+    {
+        std::vector<const Site*> sites;
+        instance().collect(sites);
+
+        unsigned rank = 0;
+        for (std::size_t idx = 0; idx < sites.size(); ++idx) {
+            const auto key = sites[idx]->key.load(std::memory_order_relaxed);
+            rank = idx && key >> 32 == sites[idx - 1]->key.load(std::memory_order_relaxed) >> 32
+                 ? rank + 1 : 0;
+            if (rank >= top) {
+                continue;
+            }
+
+            const auto& stack = instance().m_stacks[(key & 0xFFFFFFFF) - 1];
+            out << section(static_cast<std::uint32_t>(key >> 32)) << ", " << (key & 0xFFFFFFFF) - 1
+                << ", " << sites[idx]->count << ", " << sites[idx]->time.value().count()
+                << std::endl;
+
+            const auto size = stack.size.load(std::memory_order_acquire);
+            for (unsigned frame = 0; frame < size; ++frame) {
+                out << "    0x" << std::hex << stack.frames[frame] << std::dec << " "
+                    << symbolize(stack.frames[frame]) << std::endl;
+            }
+        }
+    }
+
+    /** \brief Add the slow stacks of all sections to a Profile.
+     *
+     * Every site becomes one sample whose stack consists of the section pseudo-frame below the
+     * frames. Frames are located by their return address within the Mapping of their module and
+     * named by their demangled symbol. The values are slow exits and their nanoseconds, which must
+     * be the first two sample types of the Profile.
+     *
+     * \param   [in,out]    profile Profile to add to.
+     */
+    static void add_to(pprof::Profile& profile)
+    {
+        std::vector<const Site*> sites;
+        instance().collect(sites);
+
+        // Every address and module is only looked up once.
+        std::unordered_map<std::uintptr_t, std::uint64_t> ids;
+        std::unordered_map<std::string, std::uint64_t> mappings;
+        const auto location = [&](std::uintptr_t addr) {
+            auto& id = ids[addr];
+            if (id == 0) {
+                const auto symbol = resolve(addr);
+                auto& mapping = mappings[symbol.module];
+                if (mapping == 0 && !symbol.module.empty()) {
+                    mapping = profile.mapping(symbol.module, symbol.base, symbol.limit);
+                }
+                id = profile.location(addr, mapping, symbol.name.empty() ? "??" : symbol.name,
+                                      symbol.system_name);
+            }
+            return id;
+        };
+
+        std::vector<std::uint64_t> locations;
+        for (const auto site : sites) {
+            const auto key = site->key.load(std::memory_order_relaxed);
+            const auto& stack = instance().m_stacks[(key & 0xFFFFFFFF) - 1];
+            const auto size = stack.size.load(std::memory_order_acquire);
+
+            locations.clear();
+            locations.push_back(profile.frame(section(static_cast<std::uint32_t>(key >> 32))));
+            for (unsigned frame = 0; frame < size; ++frame) {
+                locations.push_back(location(stack.frames[frame]));
+            }
+
+            const std::int64_t values[2] = {
+                static_cast<std::int64_t>(site->count.value()),
+                static_cast<std::int64_t>(site->time.value().count())
+            };
+            profile.sample(locations.data(), locations.size(), values, 2);
+        }
+    }
+
+private:
+    // Bounds of a thread's stack.
+    struct Bounds {
+        std::uintptr_t  low;
+        std::uintptr_t  high;
+    };
+
+    // Symbol of a return address.
+    struct Symbol {
+        // Demangled name of the function, empty if unknown.
+        std::string     name;
+        // Name of the function in the symbol table, empty if unknown.
+        std::string     system_name;
+        // Offset of the address within the function, or within the module if unknown.
+        std::uintptr_t  offset;
+        // Path of the module, empty if unknown.
+        std::string     module;
+        // Address the module is loaded at.
+        std::uintptr_t  base;
+        // Address just past the module's segments, base if unknown.
+        std::uintptr_t  limit;
+    };
+
+    StackProfiler()
+    : m_threshold{std::chrono::duration_cast<Timer::duration>(
+        std::chrono::milliseconds{1}
+      ).count()},
+      m_stacks{new Stack[capacity]}, m_sites{new Site[capacity]}
+    {
+        for (std::size_t idx = 0; idx < capacity; ++idx) {
+            m_stacks[idx].hash.store(0, std::memory_order_relaxed);
+            m_stacks[idx].size.store(0, std::memory_order_relaxed);
+            m_sites[idx].key.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Slow exits that did not fit, an internal counter.
+    static Counter& dropped_counter() noexcept
+    {
+        return StaticCounter<typestring_is("minprof.stacks.dropped|C")>::get();
+    }
+
+    static StackProfiler& instance()
+    {
+        static StackProfiler instance;
+        return instance;
+    }
+
+    // Get the bounds of the calling thread's stack, determined on first use.
+    static const Bounds& bounds() noexcept
+    {
+        static thread_local Bounds bounds{0, 0};
+
+        if (bounds.high == 0) {
+            pthread_attr_t attr;
+            void* addr = nullptr;
+            std::size_t size = 0;
+            if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+                pthread_attr_getstack(&attr, &addr, &size);
+                pthread_attr_destroy(&attr);
+            }
+            bounds.low = reinterpret_cast<std::uintptr_t>(addr);
+            bounds.high = bounds.low + size;
+        }
+
+        return bounds;
+    }
+
+    // Walk the frame pointer chain starting at the caller, stopping at the first frame that is not
+    // within the stack or not above its callee.
+    ALWAYS_INLINE static unsigned capture(std::uintptr_t* frames) noexcept
+    {
+        const auto& stack = bounds();
+
+        auto fp = static_cast<const std::uintptr_t*>(__builtin_frame_address(0));
+        unsigned size = 0;
+        while (size < depth) {
+            const auto addr = reinterpret_cast<std::uintptr_t>(fp);
+            if (addr < stack.low || addr + 2 * sizeof(std::uintptr_t) > stack.high
+                || addr % sizeof(std::uintptr_t) != 0 || fp[1] == 0) {
+                break;
+            }
+
+            frames[size++] = fp[1];
+
+            const auto next = reinterpret_cast<const std::uintptr_t*>(fp[0]);
+            if (next <= fp) {
+                break;
+            }
+            fp = next;
+        }
+
+        return size;
+    }
+
+    // Find or insert a stack, returning its index or capacity if the table is full.
+    std::size_t insert(const std::uintptr_t* frames, unsigned size) noexcept
+    {
+        std::uint64_t hash = size;
+        for (unsigned frame = 0; frame < size; ++frame) {
+            hash = (hash ^ frames[frame]) * 0x9E3779B97F4A7C15ull;
+            hash ^= hash >> 29;
+        }
+        hash = hash ? hash : 1;
+
+        auto pos = static_cast<std::size_t>(hash) & (capacity - 1);
+        for (std::size_t probe = 0; probe < capacity; ++probe) {
+            auto& stack = m_stacks[pos];
+            auto current = stack.hash.load(std::memory_order_acquire);
+            if (!current && stack.hash.compare_exchange_strong(current, hash)) {
+                std::copy(frames, frames + size, stack.frames);
+                stack.size.store(size, std::memory_order_release);
+                return pos;
+            }
+            // Stacks are told apart by their hash only, collisions merge them.
+            if (current == hash) {
+                return pos;
+            }
+
+            pos = (pos + 1) & (capacity - 1);
+        }
+
+        return capacity;
+    }
+
+    // Find or claim a site, nullptr if the table is full.
+    Site* site(std::uint64_t key) noexcept
+    {
+        auto pos = static_cast<std::size_t>((key ^ key >> 32) * 0x9E3779B97F4A7C15ull >> 20)
+                 & (capacity - 1);
+        for (std::size_t probe = 0; probe < capacity; ++probe) {
+            auto& site = m_sites[pos];
+            auto current = site.key.load(std::memory_order_acquire);
+            if (!current && site.key.compare_exchange_strong(current, key)) {
+                return &site;
+            }
+            if (current == key) {
+                return &site;
+            }
+
+            pos = (pos + 1) & (capacity - 1);
+        }
+
+        return nullptr;
+    }
+
+    // Collect all used sites, ordered by section and time descending.
+    void collect(std::vector<const Site*>& sites) const
+    {
+        for (std::size_t idx = 0; idx < capacity; ++idx) {
+            if (m_sites[idx].key.load(std::memory_order_acquire)) {
+                sites.push_back(&m_sites[idx]);
+            }
+        }
+
+        std::sort(sites.begin(), sites.end(), [](const Site* lhs, const Site* rhs) {
+            const auto lhs_id = lhs->key.load(std::memory_order_relaxed) >> 32;
+            const auto rhs_id = rhs->key.load(std::memory_order_relaxed) >> 32;
+            return lhs_id != rhs_id ? lhs_id < rhs_id : lhs->time.value() > rhs->time.value();
+        });
+    }
+
+    // Get a section name, i.e. the name of its counter without suffix.
+    static std::string section(std::uint32_t id)
+    {
+        const auto name = StaticCounterRegistry::get_name(id);
+        return name ? std::string{name, StaticCounterRegistry::get_base_length(id)}
+                    : "section_" + std::to_string(id);
+    }
+
+    // Look up the symbol and module of a return address.
+    static Symbol resolve(std::uintptr_t addr)
+    {
+        Symbol symbol{std::string{}, std::string{}, 0, std::string{}, 0, 0};
+
+        // Look up the call instruction, the return address may already belong to the next symbol.
+        Dl_info info;
+        if (!dladdr(reinterpret_cast<void*>(addr - 1), &info)) {
+            return symbol;
+        }
+
+        symbol.base = reinterpret_cast<std::uintptr_t>(info.dli_fbase);
+        symbol.limit = limit(addr - 1, symbol.base);
+        if (info.dli_fname) {
+            symbol.module = info.dli_fname;
+        }
+        if (info.dli_sname) {
+            int status = 0;
+            const auto demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            symbol.name = status == 0 && demangled ? demangled : info.dli_sname;
+            symbol.system_name = info.dli_sname;
+            symbol.offset = addr - reinterpret_cast<std::uintptr_t>(info.dli_saddr);
+            std::free(demangled);
+        } else {
+            symbol.offset = addr - symbol.base;
+        }
+
+        return symbol;
+    }
+
+    // Get the end of the loaded segments of the module containing an address, base if unknown.
+    static std::uintptr_t limit(std::uintptr_t addr, std::uintptr_t base)
+    {
+        struct Search {
+            std::uintptr_t  addr;
+            std::uintptr_t  limit;
+        } search{addr, base};
+
+        dl_iterate_phdr([](dl_phdr_info* info, std::size_t, void* data) -> int {
+            auto& search = *static_cast<Search*>(data);
+
+            bool contains = false;
+            std::uintptr_t end = 0;
+            for (unsigned idx = 0; idx < info->dlpi_phnum; ++idx) {
+                const auto& phdr = info->dlpi_phdr[idx];
+                if (phdr.p_type != PT_LOAD) {
+                    continue;
+                }
+
+                const auto low = info->dlpi_addr + phdr.p_vaddr;
+                const auto high = low + phdr.p_memsz;
+                contains = contains || (search.addr >= low && search.addr < high);
+                end = std::max<std::uintptr_t>(end, high);
+            }
+            if (!contains) {
+                return 0;
+            }
+
+            search.limit = end;
+            return 1;
+        }, &search);
+
+        return search.limit;
+    }
+
+    // Symbolize a return address as "<symbol>+<offset> (<module>)".
+    static std::string symbolize(std::uintptr_t addr)
+    {
+        const auto symbol = resolve(addr);
+        if (symbol.base == 0) {
+            return "??";
+        }
+
+        std::ostringstream out;
+        out << (symbol.name.empty() ? "??" : symbol.name) << "+0x" << std::hex << symbol.offset
+            << std::dec;
+        if (!symbol.module.empty()) {
+            out << " (" << symbol.module.substr(symbol.module.find_last_of('/') + 1) << ")";
+        }
+
+        return out.str();
+    }
+
+    // Duration of a slow exit in ns.
+    std::atomic<Timer::value_type>  m_threshold;
+    // Unique stacks.
+    std::unique_ptr<Stack[]>        m_stacks;
+    // Slow exits per (section, stack).
+    std::unique_ptr<Site[]>         m_sites;
+};
+
+/** \brief Section tracker that captures the call stack of slow exits.
+ *
+ * Counts and times like a Section. Exits that took at least StackProfiler::threshold() are
+ * accounted to the calling thread's current stack.
+ */
+class StackSection {
+public:
+    /** \brief Initialize, trigger and time a new StackSection.
+     *
+     * \param   [in,out]    c   Counter for section.
+     * \param   [in,out]    t   Timer for section.
+     * \param   [in]        id  Section id, i.e. the StaticCounter index of \p c.
+     */
+    StackSection(Counter& c, Timer& t, std::uint32_t id) noexcept
+    : m_timer{t}, m_id{id}, m_start{Stopwatch::Clock::now()}
+    {
+        ++c;
+    }
+    /** \brief Stop, capture if slow, and destroy a StackSection. */
+    ~StackSection()
+    {
+        const auto dur = std::chrono::duration_cast<Timer::duration>(
+            Stopwatch::Clock::now() - m_start
+        );
+
+        // Recording first keeps the call out of tail position, which would drop the caller's frame.
+        if (dur >= StackProfiler::threshold()) {
+            StackProfiler::record(m_id, dur);
+        }
+        m_timer += dur;
+    }
+
+    // No copy constructor.
+    StackSection(const StackSection&) = delete;
+    // No copy assignment.
+    StackSection& operator=(const StackSection&) = delete;
+
+    // No move constructor.
+    StackSection(StackSection&&) = delete;
+    // No move assignment.
+    StackSection& operator=(StackSection&&) = delete;
+
+    // Hack to make use of if-condition initialization scoping.
+    operator bool() const noexcept
+    {
+        return true;
+    }
+
+private:
+    // Backing Timer.
+    Timer&                  m_timer;
+    // Section id.
+    std::uint32_t           m_id;
+    // Time of entry.
+    Stopwatch::time_point   m_start;
+};
+
+/** \brief Profile the following statement (-block), capturing the call stack of slow exits.
+ *
+ * Like MINPROF_SECTION, but exits taking at least StackProfiler::threshold() are accounted to the
+ * call stack they happened on.
+ *
+ * \param   name    Name string literal of the section.
+ */
+#define MINPROF_STACK_SECTION(name)\
+if (::minprof::StackSection __stack_ ## __LINE__ {MINPROF_COUNTER(name "|C"),\
+    MINPROF_TIMER(name "|T"), ::minprof::StaticCounter<typestring_is(name "|C")>::index})
+
+/** \brief Dump the slowest stacks of every section. */
+#define MINPROF_DUMP_STACKS     ::minprof::StackProfiler::dump
+
+/** \brief Dump the slow stacks of all sections as a gzip-compressed pprof profile.
+ *
+ * The result can be inspected using `go tool pprof -http=: <file>`.
+ *
+ * \param   [in,out]    out     Output stream, should be opened in binary mode.
+ */
+inline void dump_stacks_pprof(std::ostream& out)
+{
+    pprof::Profile profile;
+    profile.sample_type("slow_calls", "count");
+    profile.sample_type("slow_time", "nanoseconds", true);
+    profile.time(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count());
+
+    StackProfiler::add_to(profile);
+
+    std::vector<std::uint8_t> data;
+    profile.encode_gzip(data);
+    out.write(reinterpret_cast<const char*>(data.data()),
+              static_cast<std::streamsize>(data.size()));
+}
+
+}
+
+/* Exemplary usage:
+ *
+ * Capture the callers of lookups taking more than 200us:
+ *
+ * minprof::StackProfiler::set_threshold(std::chrono::microseconds{200});
+ *
+ * MINPROF_STACK_SECTION("lookup") {
+ *      lookup(key);
+ * }
+ *
+ * MINPROF_DUMP_STACKS(std::cout);
+ *
+ */
+
+#endif
@@ -0,0 +1,466 @@
+/** \brief Tail-based trace sampling for the minimal profiler.
+ *
+ * Requires a POSIX platform.
+ *
+ * \file    minprof/tail.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_TAIL_HH_
+#define MINPROF_TAIL_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Counter
+// minprof::Timer
+// minprof::Section
+// minprof::StaticCounter
+// minprof::ThreadStorage
+#include "trace.hh"
+// minprof::TraceClock
+// minprof::TraceEvent
+// minprof::TraceRing
+
+#include <cstdint>
+// std::uint32_t
+// std::uint64_t
+
+#include <memory>
+// std::unique_ptr
+
+/* Tail buffer events:
+ *
+ * Number of events a single request can record. Events beyond that are discarded, and the request
+ * is committed truncated.
+ */
+#if !defined(MINPROF_TAIL_EVENTS)
+#define MINPROF_TAIL_EVENTS     256
+#endif
+
+/* Tail buffers:
+ *
+ * Number of preallocated request buffers, i.e. the maximum number of requests in flight that can
+ * be sampled. The pool allocates buffers * events * 16 bytes on first use.
+ */
+#if !defined(MINPROF_TAIL_BUFFERS)
+#define MINPROF_TAIL_BUFFERS    1024
+#endif
+
+namespace minprof {
+
+/** \brief Trace buffer of a single request. */
+struct TailBuffer {
+    /** \brief Number of events in a buffer. */
+    static constexpr std::uint32_t capacity = MINPROF_TAIL_EVENTS;
+
+    /** \brief Recorded events. */
+    TraceEvent                  events[capacity];
+    /** \brief Number of recorded events. */
+    std::uint32_t               count;
+    /** \brief Pool index of the next free buffer, only used while in the pool. */
+    std::atomic<std::uint32_t>  next;
+    /** \brief True if the request failed. */
+    bool                        failed;
+
+    /** \brief Record an event, if there is room.
+     *
+     * \param   [in]    kind    Event kind.
+     * \param   [in]    id      Section id.
+     * \param   [in]    thread  ThreadStorage id of the recording thread.
+     */
+    ALWAYS_INLINE void push(TraceEvent::Kind kind, std::uint32_t id, std::uint32_t thread) noexcept
+    {
+        if (count < capacity) {
+            events[count++] = TraceEvent::make(TraceClock::ticks(), id, thread, kind);
+        }
+    }
+};
+
+/** \brief Lock-free pool of TailBuffers and the tail sampling policy.
+ *
+ * Free buffers form a Treiber stack whose head packs the index of the top buffer with a tag that is
+ * incremented on every change, which rules out ABA. Acquiring and releasing a buffer is thus a
+ * single successful CAS, and request threads never block. If the pool is exhausted, the request is
+ * simply not sampled and counted as missed.
+ *
+ * Commits, drops and misses are counted in the internal counters minprof.tail.commits|C,
+ * minprof.tail.drops|C and minprof.tail.missed|C.
+ *
+ * There is only one TailSampler, which is controlled through the static interface.
+ */
+class TailSampler {
+public:
+    /** \brief Number of buffers in the pool. */
+    static constexpr std::uint32_t buffer_count = MINPROF_TAIL_BUFFERS;
+
+    /** \brief Decides which requests are committed. */
+    struct Policy {
+        /** \brief Commit requests taking at least this long. */
+        Timer::duration latency = std::chrono::duration_cast<Timer::duration>(
+            std::chrono::milliseconds{100}
+        );
+        /** \brief Commit failed requests regardless of their latency. */
+        bool            errors  = true;
+    };
+
+public:
+    // No copy constructor.
+    TailSampler(const TailSampler&) = delete;
+    // No copy assignment operator.
+    TailSampler& operator=(const TailSampler&) = delete;
+    // No move constructor.
+    TailSampler(TailSampler&&) = delete;
+    // No move assignment operator.
+    TailSampler& operator=(TailSampler&&) = delete;
+
+    /** \brief Set the commit policy.
+     *
+     * \param   [in]    policy  New policy.
+     */
+    static void set_policy(const Policy& policy) noexcept
+    {
+        auto& self = instance();
+        self.m_latency.store(policy.latency.count(), std::memory_order_relaxed);
+        self.m_errors.store(policy.errors, std::memory_order_relaxed);
+    }
+
+    /** \brief Take a buffer from the pool.
+     *
+     * \return  Empty buffer, nullptr if the pool is exhausted.
+     */
+    static TailBuffer* acquire() noexcept
+    {
+        auto& self = instance();
+
+        auto head = self.m_head.load(std::memory_order_acquire);
+        for (;;) {
+            const auto idx = static_cast<std::uint32_t>(head);
+            if (idx == none) {
+                ++missed_counter();
+                return nullptr;
+            }
+
+            // A stale next is harmless, the tag makes the CAS fail if the top changed meanwhile.
+            const auto next = self.m_buffers[idx].next.load(std::memory_order_relaxed);
+            if (self.m_head.compare_exchange_weak(head, pack(next, head),
+                                                  std::memory_order_acquire)) {
+                auto& buffer = self.m_buffers[idx];
+                buffer.count = 0;
+                buffer.failed = false;
+                return &buffer;
+            }
+        }
+    }
+    /** \brief Finish a request, committing or dropping its events, and return the buffer.
+     *
+     * Committed events are pushed into the calling thread's TraceRing, where they are picked up
+     * by a TraceStreamer or the FlightRecorder like any other traced section.
+     *
+     * \param   [in,out]    buffer  Buffer returned by acquire().
+     * \param   [in]        latency Latency of the request.
+     *
+     * \retval  true    Events were committed.
+     * \retval  false   Events were dropped.
+     */
+    static bool finish(TailBuffer& buffer, Timer::duration latency) noexcept
+    {
+        auto& self = instance();
+
+        const auto commit = latency.count() >= self.m_latency.load(std::memory_order_relaxed)
+                            || (buffer.failed && self.m_errors.load(std::memory_order_relaxed));
+        if (commit) {
+            auto& ring = TraceRing::current();
+            for (std::uint32_t i = 0; i < buffer.count; ++i) {
+                ring.push(buffer.events[i]);
+            }
+            ++commits_counter();
+        } else {
+            ++drops_counter();
+        }
+
+        release(buffer);
+        return commit;
+    }
+
+    /** \brief Get the number of committed requests.
+     *
+     * \return  Number of commits.
+     */
+    static std::uint64_t commits() noexcept
+    {
+        return commits_counter().value();
+    }
+    /** \brief Get the number of dropped requests.
+     *
+     * \return  Number of drops.
+     */
+    static std::uint64_t drops() noexcept
+    {
+        return drops_counter().value();
+    }
+    /** \brief Get the number of requests that were not sampled because the pool was exhausted.
+     *
+     * \return  Number of missed requests.
+     */
+    static std::uint64_t missed() noexcept
+    {
+        return missed_counter().value();
+    }
+
+private:
+    // Index marking the end of the free list.
+    static constexpr std::uint32_t none = ~std::uint32_t{0};
+
+    TailSampler()
+    : m_head{0}, m_buffers{new TailBuffer[buffer_count]}, m_latency{Policy{}.latency.count()},
+      m_errors{Policy{}.errors}
+    {
+        for (std::uint32_t idx = 0; idx < buffer_count; ++idx) {
+            m_buffers[idx].next.store(idx + 1 < buffer_count ? idx + 1 : none,
+                                      std::memory_order_relaxed);
+        }
+    }
+
+    static TailSampler& instance()
+    {
+        static TailSampler instance;
+        return instance;
+    }
+
+    // Number of committed requests.
+    ALWAYS_INLINE static Counter& commits_counter() noexcept
+    {
+        return StaticCounter<typestring_is("minprof.tail.commits|C")>::get();
+    }
+    // Number of dropped requests.
+    ALWAYS_INLINE static Counter& drops_counter() noexcept
+    {
+        return StaticCounter<typestring_is("minprof.tail.drops|C")>::get();
+    }
+    // Number of requests missed due to exhaustion.
+    ALWAYS_INLINE static Counter& missed_counter() noexcept
+    {
+        return StaticCounter<typestring_is("minprof.tail.missed|C")>::get();
+    }
+
+    // Pack a new top index with the incremented tag of the old head.
+    static std::uint64_t pack(std::uint32_t idx, std::uint64_t old) noexcept
+    {
+        return ((old >> 32) + 1) << 32 | idx;
+    }
+
+    // Push a buffer back onto the free list.
+    static void release(TailBuffer& buffer) noexcept
+    {
+        auto& self = instance();
+        const auto idx = static_cast<std::uint32_t>(&buffer - self.m_buffers.get());
+
+        auto head = self.m_head.load(std::memory_order_relaxed);
+        do {
+            buffer.next.store(static_cast<std::uint32_t>(head), std::memory_order_relaxed);
+        } while (!self.m_head.compare_exchange_weak(head, pack(idx, head),
+                                                    std::memory_order_release,
+                                                    std::memory_order_relaxed));
+    }
+
+    // Tag and index of the top free buffer.
+    std::atomic<std::uint64_t>              m_head;
+    // Buffer storage.
+    std::unique_ptr<TailBuffer[]>           m_buffers;
+    // Policy latency threshold in nanoseconds.
+    std::atomic<Timer::value_type>          m_latency;
+    // Policy error flag.
+    std::atomic<bool>                       m_errors;
+};
+
+/** \brief Section tracker for a whole request that is traced tail-based.
+ *
+ * Counts and times like a Section, and makes its TailBuffer the current one of the calling thread,
+ * so that nested TailSections record into it. On destruction the buffer is committed or dropped
+ * according to the TailSampler policy. Requests may nest, in which case the innermost one is
+ * recorded.
+ */
+class TailRequest {
+public:
+    /** \brief Initialize, trigger and time a new TailRequest.
+     *
+     * \param   [in,out]    c   Counter for section.
+     * \param   [in,out]    t   Timer for section.
+     * \param   [in]        id  Section id, i.e. the StaticCounter index of \p c.
+     */
+    TailRequest(Counter& c, Timer& t, std::uint32_t id)
+    : m_timer{t}, m_id{id}, m_thread{ThreadStorage::current().id()},
+      m_buffer{TailSampler::acquire()}, m_outer{current()}, m_start{Stopwatch::Clock::now()}
+    {
+        ++c;
+        if (m_buffer) {
+            m_buffer->push(TraceEvent::BEGIN, m_id, m_thread);
+        }
+        current() = m_buffer;
+    }
+    /** \brief Stop the request, commit or drop it and destroy the TailRequest. */
+    ~TailRequest()
+    {
+        const auto dur = std::chrono::duration_cast<Timer::duration>(
+            Stopwatch::Clock::now() - m_start
+        );
+
+        m_timer += dur;
+        current() = m_outer;
+        if (m_buffer) {
+            m_buffer->push(TraceEvent::END, m_id, m_thread);
+            TailSampler::finish(*m_buffer, dur);
+        }
+    }
+
+    // No copy constructor.
+    TailRequest(const TailRequest&) = delete;
+    // No copy assignment.
+    TailRequest& operator=(const TailRequest&) = delete;
+
+    // No move constructor.
+    TailRequest(TailRequest&&) = delete;
+    // No move assignment.
+    TailRequest& operator=(TailRequest&&) = delete;
+
+    /** \brief Get the buffer of the calling thread's current request.
+     *
+     * \return  Current buffer, nullptr if there is none or it is not sampled.
+     */
+    ALWAYS_INLINE static TailBuffer*& current() noexcept
+    {
+        static thread_local TailBuffer* buffer = nullptr;
+        return buffer;
+    }
+
+    /** \brief Mark the calling thread's current request as failed. */
+    static void fail() noexcept
+    {
+        if (current()) {
+            current()->failed = true;
+        }
+    }
+
+    // Hack to make use of if-condition initialization scoping.
+    operator bool() const noexcept
+    {
+        return true;
+    }
+
+private:
+    // Backing Timer.
+    Timer&                  m_timer;
+    // Section id.
+    std::uint32_t           m_id;
+    // ThreadStorage id of the calling thread.
+    std::uint32_t           m_thread;
+    // Buffer, nullptr if not sampled.
+    TailBuffer*             m_buffer;
+    // Buffer of the enclosing request.
+    TailBuffer*             m_outer;
+    // Time of entry.
+    Stopwatch::time_point   m_start;
+};
+
+/** \brief Section tracker that records into the current TailRequest.
+ *
+ * Behaves like a Section, and additionally records BEGIN and END events into the calling thread's
+ * current TailBuffer, if any.
+ */
+class TailSection : private Section {
+public:
+    /** \brief Initialize, trigger, time and record a new TailSection.
+     *
+     * \param   [in,out]    c   Counter for section.
+     * \param   [in,out]    t   Timer for section.
+     * \param   [in]        id  Section id, i.e. the StaticCounter index of \p c.
+     */
+    TailSection(Counter& c, Timer& t, std::uint32_t id)
+    : Section{c, t}, m_buffer{TailRequest::current()}, m_id{id}
+    {
+        if (m_buffer) {
+            m_buffer->push(TraceEvent::BEGIN, m_id, thread());
+        }
+    }
+    /** \brief Record, stop and destroy a TailSection. */
+    ~TailSection()
+    {
+        if (m_buffer) {
+            m_buffer->push(TraceEvent::END, m_id, thread());
+        }
+    }
+
+    // No copy constructor.
+    TailSection(const TailSection&) = delete;
+    // No copy assignment.
+    TailSection& operator=(const TailSection&) = delete;
+
+    // No move constructor.
+    TailSection(TailSection&&) = delete;
+    // No move assignment.
+    TailSection& operator=(TailSection&&) = delete;
+
+    // Hack to make use of if-condition initialization scoping.
+    operator bool() const noexcept
+    {
+        return true;
+    }
+
+private:
+    // ThreadStorage id of the calling thread.
+    static std::uint32_t thread()
+    {
+        return ThreadStorage::current().id();
+    }
+
+    // Buffer of the current request.
+    TailBuffer*     m_buffer;
+    // Section id.
+    std::uint32_t   m_id;
+};
+
+/** \brief Profile the following statement (-block) as a tail-sampled request.
+ *
+ * Like MINPROF_SECTION, but also records the request and all nested MINPROF_TAIL_SECTIONs into a
+ * buffer that is only committed to the trace if the request matches the TailSampler policy.
+ *
+ * \param   name    Name string literal of the request section.
+ */
+#define MINPROF_TAIL_REQUEST(name)\
+if (::minprof::TailRequest __tail_ ## __LINE__ {MINPROF_COUNTER(name "|C"),\
+    MINPROF_TIMER(name "|T"), ::minprof::StaticCounter<typestring_is(name "|C")>::index})
+
+/** \brief Profile the following statement (-block) as part of the current tail-sampled request.
+ *
+ * \param   name    Name string literal of the section.
+ */
+#define MINPROF_TAIL_SECTION(name)\
+if (::minprof::TailSection __tail_ ## __LINE__ {MINPROF_COUNTER(name "|C"),\
+    MINPROF_TIMER(name "|T"), ::minprof::StaticCounter<typestring_is(name "|C")>::index})
+
+/** \brief Mark the current tail-sampled request as failed. */
+#define MINPROF_TAIL_FAIL()     ::minprof::TailRequest::fail()
+
+}
+
+/* Exemplary usage:
+ *
+ * Only keep the timelines of slow or failed requests:
+ *
+ * minprof::TailSampler::Policy policy;
+ * policy.latency = std::chrono::milliseconds{50};
+ * minprof::TailSampler::set_policy(policy);
+ *
+ * MINPROF_TAIL_REQUEST("request") {
+ *      MINPROF_TAIL_SECTION("parse") { parse(); }
+ *      MINPROF_TAIL_SECTION("execute") {
+ *          if (!execute())
+ *              MINPROF_TAIL_FAIL();
+ *      }
+ * }
+ *
+ * Committed requests end up in the TraceRings, so stream them with a TraceStreamer.
+ *
+ */
+
+#endif
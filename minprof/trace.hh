@@ -0,0 +1,1306 @@
+/** \brief Section tracing for the minimal profiler.
+ *
+ * Requires a POSIX platform.
+ *
+ * \file    minprof/trace.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_TRACE_HH_
+#define MINPROF_TRACE_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Section
+// minprof::StaticCounter
+// minprof::StaticCounterRegistry
+// minprof::ThreadStorage
+// minprof::ThreadRegistry
+#include "writer.hh"
+// minprof::Writer
+
+#include <cerrno>
+// errno
+// EINTR
+#include <cstddef>
+// std::size_t
+#include <cstdint>
+// std::uint8_t
+// std::uint16_t
+// std::uint32_t
+// std::uint64_t
+// std::uintptr_t
+#include <cstring>
+// std::memcpy
+
+#include <atomic>
+// std::atomic
+// std::atomic_signal_fence
+// std::atomic_thread_fence
+#include <memory>
+// std::unique_ptr
+#include <string>
+// std::string
+#include <thread>
+// std::thread
+// std::this_thread::sleep_for
+// std::this_thread::yield
+
+#include <fcntl.h>
+// open
+#include <sys/mman.h>
+// mmap
+// munmap
+#include <sys/stat.h>
+// fstat
+#include <sys/uio.h>
+// pwritev
+#include <unistd.h>
+// close
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/membarrier.h>)
+#include <linux/membarrier.h>
+// MEMBARRIER_CMD_PRIVATE_EXPEDITED
+// MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED
+#include <sys/syscall.h>
+// syscall
+// __NR_membarrier
+#define MINPROF_HAS_MEMBARRIER
+#endif
+#endif
+
+/* Trace ring capacity:
+ *
+ * Number of events each thread can buffer before the streamer drains them. Must be a power of two.
+ * Every thread that traces allocates capacity * 16 bytes once.
+ */
+#if !defined(MINPROF_TRACE_CAPACITY)
+#define MINPROF_TRACE_CAPACITY  (1u << 16)
+#endif
+
+namespace minprof {
+
+/** \brief Monotonic clock used for all trace timestamps. */
+struct TraceClock : std::chrono::steady_clock {
+    /** \brief Get the current time in nanoseconds since the clock epoch.
+     *
+     * \return  Current timestamp.
+     */
+    ALWAYS_INLINE static std::uint64_t ticks() noexcept
+    {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now().time_since_epoch()).count()
+        );
+    }
+};
+
+/** \brief Single trace event as stored in a TraceRing.
+ *
+ * Events identify sections by the StaticCounter index of their "|C" counter, which is resolved to
+ * a name using the names block of the trace file. SIGNAL and WAKE events instead carry a link key
+ * chosen by the application, which connects them across threads.
+ */
+struct TraceEvent {
+    /** \brief Kind of the event. */
+    enum Kind : std::uint8_t {
+        /** \brief Section was entered. */
+        BEGIN   = 0,
+        /** \brief Section was left. */
+        END     = 1,
+        /** \brief Instantaneous event. */
+        MARK    = 2,
+        /** \brief Another thread may proceed, e.g. a lock was released or an item enqueued. */
+        SIGNAL  = 3,
+        /** \brief Proceeding after a SIGNAL, e.g. a lock was acquired or an item dequeued. */
+        WAKE    = 4
+    };
+
+    /** \brief Largest ThreadStorage id an event can carry, ids are 24 bits wide. */
+    static constexpr std::uint32_t max_thread = 0xffffff;
+
+    /** \brief Create an event.
+     *
+     * \param   [in]    time    Timestamp in nanoseconds.
+     * \param   [in]    id      Section id or link key.
+     * \param   [in]    thread  ThreadStorage id of the emitting thread, only the low 24 bits are
+     *                          kept.
+     * \param   [in]    kind    Event kind.
+     *
+     * \return  New event.
+     */
+    ALWAYS_INLINE static TraceEvent make(std::uint64_t time, std::uint32_t id,
+                                         std::uint32_t thread, std::uint8_t kind) noexcept
+    {
+        return TraceEvent{time, id, static_cast<std::uint16_t>(thread), kind,
+                          static_cast<std::uint8_t>(thread >> 16)};
+    }
+
+    /** \brief Get the ThreadStorage id of the emitting thread.
+     *
+     * \return  Thread id.
+     */
+    std::uint32_t thread() const noexcept
+    {
+        return thread_low | static_cast<std::uint32_t>(thread_high) << 16;
+    }
+
+    /** \brief Timestamp in nanoseconds (see TraceClock). */
+    std::uint64_t   time;
+    /** \brief StaticCounter index identifying the section, or link key. */
+    std::uint32_t   id;
+    /** \brief Low 16 bits of the ThreadStorage id of the emitting thread. */
+    std::uint16_t   thread_low;
+    /** \brief Event kind. */
+    std::uint8_t    kind;
+    /** \brief High 8 bits of the ThreadStorage id, always 0 in version 1 files. */
+    std::uint8_t    thread_high;
+};
+
+static_assert(sizeof(TraceEvent) == 16, "TraceEvent must be packed into 16 bytes!");
+
+/** \brief Per-thread single-producer single-consumer ring of trace events.
+ *
+ * Every tracing thread owns exactly one TraceRing, which only it pushes to. While no TraceStreamer
+ * is running, the ring acts as a flight recorder that overwrites its oldest events, so it always
+ * holds the recent past, until it is frozen to preserve that past (see frozen()). While streaming,
+ * the TraceStreamer is the single consumer and events that do not fit are dropped and counted
+ * instead of blocking the producer.
+ */
+class TraceRing {
+public:
+    /** \brief Number of events in the ring. */
+    static constexpr std::uint64_t capacity = MINPROF_TRACE_CAPACITY;
+
+    // Assert that the capacity allows masking instead of modulo.
+    static_assert((capacity & (capacity - 1)) == 0, "Trace capacity must be a power of two!");
+
+public:
+    // No copy constructor.
+    TraceRing(const TraceRing&) = delete;
+    // No copy assignment operator.
+    TraceRing& operator=(const TraceRing&) = delete;
+    // No move constructor.
+    TraceRing(TraceRing&&) = delete;
+    // No move assignment operator.
+    TraceRing& operator=(TraceRing&&) = delete;
+
+    /** \brief Get the TraceRing of the calling thread.
+     *
+     * The first call on every thread attaches a new ring to the TraceRegistry.
+     *
+     * \return  TraceRing of the calling thread.
+     */
+    ALWAYS_INLINE static TraceRing& current();
+
+    /** \brief Check whether a TraceStreamer is consuming the rings.
+     *
+     * \return  Global streaming flag.
+     */
+    ALWAYS_INLINE static std::atomic<bool>& streaming() noexcept
+    {
+        static std::atomic<bool> flag{false};
+        return flag;
+    }
+
+    /** \brief Check whether the flight recorders are frozen.
+     *
+     * While frozen and not streaming, all pushes are discarded so that the rings keep their
+     * contents for snapshot(). Use TraceRegistry::freeze() and thaw() to set it.
+     *
+     * \return  Global freeze flag.
+     */
+    ALWAYS_INLINE static std::atomic<bool>& frozen() noexcept
+    {
+        static std::atomic<bool> flag{false};
+        return flag;
+    }
+
+    /** \brief Push an event timestamped now.
+     *
+     * Must only be called by the owning thread.
+     *
+     * \param   [in]    kind    Event kind.
+     * \param   [in]    id      Section id.
+     *
+     * \retval  true    Event was stored.
+     * \retval  false   Event was dropped.
+     */
+    ALWAYS_INLINE bool push(TraceEvent::Kind kind, std::uint32_t id) noexcept
+    {
+        return push(TraceEvent::make(TraceClock::ticks(), id, m_thread, kind));
+    }
+    /** \brief Push an event.
+     *
+     * Must only be called by the owning thread.
+     *
+     * \param   [in]    event   Event to store.
+     *
+     * \retval  true    Event was stored.
+     * \retval  false   Event was dropped.
+     */
+    ALWAYS_INLINE bool push(const TraceEvent& event) noexcept
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        if (streaming().load(std::memory_order_relaxed)
+            && head - m_tail.load(std::memory_order_acquire) >= capacity) {
+            drop();
+            return false;
+        }
+
+        // Announce the push before checking the flag, so that TraceRegistry::freeze() either
+        // waits for it or this sees the flag.
+        m_pushing.store(true, std::memory_order_relaxed);
+        if (m_membarrier) {
+            // The freezing thread's membarrier orders the processors.
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        } else {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        if (frozen().load(std::memory_order_relaxed)) {
+            m_pushing.store(false, std::memory_order_relaxed);
+            return false;
+        }
+
+        m_events[head & (capacity - 1)] = event;
+        m_head.store(head + 1, std::memory_order_release);
+        m_pushing.store(false, std::memory_order_release);
+        return true;
+    }
+
+    /** \brief Move all unconsumed events into a buffer.
+     *
+     * Must only be called by the single consumer while streaming.
+     *
+     * \param   [in,out]    out     Destination buffer.
+     * \param   [in]        max     Maximum number of events to consume.
+     *
+     * \return  Number of events consumed.
+     */
+    std::size_t consume(TraceEvent* out, std::size_t max) noexcept
+    {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        const auto head = m_head.load(std::memory_order_acquire);
+        const auto count = head - tail < max ? head - tail : max;
+
+        for (std::uint64_t i = 0; i < count; ++i) {
+            out[i] = m_events[(tail + i) & (capacity - 1)];
+        }
+
+        m_tail.store(tail + count, std::memory_order_release);
+        return static_cast<std::size_t>(count);
+    }
+    /** \brief Get the number of events not consumed yet.
+     *
+     * \return  Fill level of the ring.
+     */
+    std::uint64_t pending() const noexcept
+    {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_relaxed);
+    }
+    /** \brief Skip all events pushed so far, making the consumer start at the present.
+     *
+     * Must only be called by the single consumer after the streaming flag was set.
+     */
+    void skip() noexcept
+    {
+        m_tail.store(m_head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    /** \brief Copy all events retained by the flight recorder.
+     *
+     * Must only be called between TraceRegistry::freeze() and thaw(), and not while streaming.
+     *
+     * \param   [in,out]    out     Vector to append the events to, oldest first.
+     */
+    void snapshot(std::vector<TraceEvent>& out) const
+    {
+        const auto head = m_head.load(std::memory_order_acquire);
+        const auto begin = head > capacity ? head - capacity : 0;
+
+        for (auto pos = begin; pos < head; ++pos) {
+            out.push_back(m_events[pos & (capacity - 1)]);
+        }
+    }
+
+    /** \brief Get the ThreadStorage id of the owning thread.
+     *
+     * \return  Thread id.
+     */
+    std::uint32_t thread() const noexcept
+    {
+        return m_thread;
+    }
+    /** \brief Get the number of events dropped because the ring was full.
+     *
+     * \return  Number of dropped events.
+     */
+    std::uint64_t dropped() const noexcept
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class TraceRegistry;
+
+    TraceRing(std::uint32_t thread, bool membarrier)
+    : m_head{0}, m_pad_head{}, m_tail{0}, m_pad_tail{}, m_dropped{0}, m_pushing{false},
+      m_membarrier{membarrier}, m_thread{thread}, m_events{new TraceEvent[capacity]}
+    {}
+
+    // Count a dropped event, also in the owner's minprof.trace.dropped|C slot.
+    __attribute__((noinline)) void drop() noexcept
+    {
+        // Only the owner writes this, so no read-modify-write is required.
+        m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        ++ThreadStorage::current().slot(
+            StaticCounter<typestring_is("minprof.trace.dropped|C")>::index
+        );
+    }
+
+    // Over-aligned new is C++17, so the positions are kept on separate cache lines by padding.
+    using padding = char[64 - sizeof(std::atomic<std::uint64_t>)];
+
+    // Producer position, only written by the owner.
+    std::atomic<std::uint64_t>              m_head;
+    padding                                 m_pad_head;
+    // Consumer position, only written by the consumer.
+    std::atomic<std::uint64_t>              m_tail;
+    padding                                 m_pad_tail;
+    // Dropped events, only written by the owner.
+    std::atomic<std::uint64_t>              m_dropped;
+    // True while the owner is in push() past the streaming check, only written by the owner.
+    std::atomic<bool>                       m_pushing;
+    // True if freezing uses a membarrier, so that pushes only need a compiler barrier.
+    const bool                              m_membarrier;
+    // ThreadStorage id of the owner.
+    std::uint32_t                           m_thread;
+    // Event storage.
+    std::unique_ptr<TraceEvent[]>           m_events;
+};
+
+/** \brief Static registry for all TraceRing instances.
+ *
+ * Like the ThreadRegistry, rings are never freed so that the events of exited threads can still be
+ * consumed. The registry lock is only taken when attaching and when the consumer looks for rings.
+ */
+class TraceRegistry {
+public:
+    // No copy constructor.
+    TraceRegistry(const TraceRegistry&) = delete;
+    // No copy assignment operator.
+    TraceRegistry& operator=(const TraceRegistry&) = delete;
+    // No move constructor.
+    TraceRegistry(TraceRegistry&&) = delete;
+    // No move assignment operator.
+    TraceRegistry& operator=(TraceRegistry&&) = delete;
+
+    /** \brief Attach a new TraceRing for the calling thread.
+     *
+     * Use TraceRing::current() instead, which only calls this once per thread.
+     *
+     * \return  New TraceRing instance.
+     */
+    static TraceRing& attach()
+    {
+        const auto thread = ThreadStorage::current().id();
+
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        self.m_rings.push_back(new TraceRing{thread, self.m_membarrier});
+        return *self.m_rings.back();
+    }
+
+    /** \brief Get a snapshot of all attached rings.
+     *
+     * \param   [in,out]    out     Vector to fill with the ring pointers.
+     */
+    static void rings(std::vector<TraceRing*>& out)
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        out.assign(self.m_rings.begin(), self.m_rings.end());
+    }
+
+    /** \brief Freeze all rings for TraceRing::snapshot().
+     *
+     * Sets TraceRing::frozen() and waits until no push that missed the flag is still writing, so
+     * that the rings hold still once this returns. Pushes pay a compiler barrier for this where
+     * the kernel supports expedited membarriers, otherwise a full fence.
+     */
+    static void freeze()
+    {
+        TraceRing::frozen().store(true);
+
+        // Rings attached from here on see the flag through the lock.
+        std::vector<TraceRing*> all;
+        rings(all);
+
+#if defined(MINPROF_HAS_MEMBARRIER)
+        if (instance().m_membarrier) {
+            (void)syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+        }
+#endif
+        for (const auto ring : all) {
+            while (ring->m_pushing.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    /** \brief Let pushes store events again after freeze(). */
+    static void thaw()
+    {
+        TraceRing::frozen().store(false);
+    }
+
+private:
+    TraceRegistry()
+    : m_lock{}, m_rings{}, m_membarrier{false}
+    {
+#if defined(MINPROF_HAS_MEMBARRIER)
+        m_membarrier = syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+#endif
+    }
+
+    static TraceRegistry& instance() noexcept
+    {
+        static TraceRegistry instance;
+        return instance;
+    }
+
+    // Guards m_rings.
+    std::mutex                  m_lock;
+    // All rings ever attached.
+    std::vector<TraceRing*>     m_rings;
+    // True if registered for expedited membarriers, passed on to the rings.
+    bool                        m_membarrier;
+};
+
+ALWAYS_INLINE TraceRing& TraceRing::current()
+{
+    // A trivial thread_local pointer avoids the initialization guard on every access.
+    static thread_local TraceRing* ring = nullptr;
+    if (!ring) {
+        ring = &TraceRegistry::attach();
+    }
+
+    return *ring;
+}
+
+/** \brief Traced Section for use with the minimal profiler.
+ *
+ * Behaves like a Section, but additionally pushes BEGIN and END events into the calling thread's
+ * TraceRing.
+ */
+class TraceSection : private Section {
+public:
+    /** \brief Initialize, trigger, time and trace a new TraceSection.
+     *
+     * \param   [in,out]    c   Counter for section.
+     * \param   [in,out]    t   Timer for section.
+     * \param   [in]        id  Section id, i.e. the StaticCounter index of \p c.
+     */
+    TraceSection(Counter& c, Timer& t, std::uint32_t id)
+    : Section{c, t}, m_ring{TraceRing::current()}, m_id{id}
+    {
+        m_ring.push(TraceEvent::BEGIN, m_id);
+    }
+    /** \brief Trace, stop and destroy a TraceSection. */
+    ~TraceSection()
+    {
+        m_ring.push(TraceEvent::END, m_id);
+    }
+
+    // No copy constructor.
+    TraceSection(const TraceSection&) = delete;
+    // No copy assignment.
+    TraceSection& operator=(const TraceSection&) = delete;
+
+    // No move constructor.
+    TraceSection(TraceSection&&) = delete;
+    // No move assignment.
+    TraceSection& operator=(TraceSection&&) = delete;
+
+    // Hack to make use of if-condition initialization scoping.
+    operator bool() const noexcept
+    {
+        return true;
+    }
+
+private:
+    // Ring of the calling thread.
+    TraceRing&      m_ring;
+    // Section id.
+    std::uint32_t   m_id;
+};
+
+/** \brief Profile and trace the following statement (-block).
+ *
+ * Like MINPROF_SECTION, but also records BEGIN and END events into the thread's TraceRing.
+ *
+ * \param   name    Name string literal of the section.
+ */
+#define MINPROF_TRACE(name)\
+if (::minprof::TraceSection __trace_ ## __LINE__ {MINPROF_COUNTER(name "|C"), MINPROF_TIMER(name "|T"),\
+    ::minprof::StaticCounter<typestring_is(name "|C")>::index})
+
+/** \brief Get the link key of an object, e.g. a mutex or queue item.
+ *
+ * \param   [in]    object  Address of the object.
+ * \return  Link key.
+ */
+inline std::uint32_t trace_key(const void* object) noexcept
+{
+    // Fold the address, so that objects a multiple of 4GiB apart still differ.
+    const auto value = reinterpret_cast<std::uintptr_t>(object);
+    return static_cast<std::uint32_t>(value ^ (static_cast<std::uint64_t>(value) >> 32));
+}
+
+/** \brief Trace that another thread may proceed, e.g. right before releasing a lock.
+ *
+ * Together with MINPROF_TRACE_WAKE, this lets minprof-analyze follow the critical path of a
+ * request across threads.
+ *
+ * \param   key     Link key, e.g. trace_key(&mutex) or a queue item's sequence number.
+ */
+#define MINPROF_TRACE_SIGNAL(key)\
+    ::minprof::TraceRing::current().push(::minprof::TraceEvent::SIGNAL, key)
+
+/** \brief Trace proceeding after a MINPROF_TRACE_SIGNAL, e.g. right after acquiring a lock.
+ *
+ * \param   key     Link key, must match the one of the SIGNAL.
+ */
+#define MINPROF_TRACE_WAKE(key)\
+    ::minprof::TraceRing::current().push(::minprof::TraceEvent::WAKE, key)
+
+/** \brief Trace file format definitions.
+ *
+ * A trace file starts with a FileHeader, followed by any number of blocks. Every block consists of
+ * a BlockHeader followed by BlockHeader::size bytes of payload. All integers are host byte order.
+ *
+ * Payloads are:
+ *  - EVENTS, RAW:      BlockHeader::count TraceEvent structs.
+ *  - EVENTS, PACKED:   Runs of <thread> <count> <time> followed by count times <kind> <id> <delta>,
+ *                      where kind is a byte, and all other values are LEB128 varints. Delta is the
+ *                      zigzag encoded time difference to the previous event in the run, or to time
+ *                      for the first one.
+ *  - NAMES:            BlockHeader::count times <u32 id> <u32 length> <name bytes>.
+ *  - THREADS:          BlockHeader::count times <u32 id> <u64 dropped> <u32 length> <name bytes>.
+ *
+ * Names and threads are written on start and stop; readers should use the last ones.
+ */
+namespace trace_format {
+
+/** \brief Magic bytes at the start of every trace file. */
+static constexpr char magic[8] = {'M', 'P', 'T', 'R', 'A', 'C', 'E', '\0'};
+/** \brief Current format version. Version 2 widened TraceEvent thread ids to 24 bits. */
+static constexpr std::uint32_t version = 2;
+/** \brief Oldest format version readers accept, as its files only differ in always 0 bits. */
+static constexpr std::uint32_t min_version = 1;
+
+/** \brief Trace file header. */
+struct FileHeader {
+    /** \brief Magic bytes. */
+    char            magic[8];
+    /** \brief Format version. */
+    std::uint32_t   version;
+    /** \brief Reserved, always 0. */
+    std::uint32_t   reserved;
+};
+
+/** \brief Block type. */
+enum Type : std::uint32_t {
+    /** \brief Block of trace events. */
+    EVENTS  = 1,
+    /** \brief Section names. */
+    NAMES   = 2,
+    /** \brief Thread names and drop counts. */
+    THREADS = 3
+};
+
+/** \brief Encoding of EVENTS blocks. */
+enum Encoding : std::uint32_t {
+    /** \brief Array of TraceEvent. */
+    RAW     = 0,
+    /** \brief Delta and varint packed runs. */
+    PACKED  = 1
+};
+
+/** \brief Block header. */
+struct BlockHeader {
+    /** \brief Block type. */
+    std::uint32_t   type;
+    /** \brief Payload encoding. */
+    std::uint32_t   encoding;
+    /** \brief Size of the payload in bytes. */
+    std::uint64_t   size;
+    /** \brief Number of records in the payload. */
+    std::uint64_t   count;
+};
+
+/** \brief Append an unsigned LEB128 varint.
+ *
+ * \param   [in,out]    out     Output buffer.
+ * \param   [in]        value   Value to encode.
+ */
+inline void put_varint(std::vector<std::uint8_t>& out, std::uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<std::uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<std::uint8_t>(value));
+}
+
+/** \brief Append raw bytes.
+ *
+ * \param   [in,out]    out     Output buffer.
+ * \param   [in]        data    Data to append.
+ * \param   [in]        size    Number of bytes.
+ */
+inline void put_bytes(std::vector<std::uint8_t>& out, const void* data, std::size_t size)
+{
+    const auto bytes = static_cast<const std::uint8_t*>(data);
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+/** \brief Pack a run of events from a single thread.
+ *
+ * \param   [in,out]    out     Output buffer.
+ * \param   [in]        events  Events of one thread, in push order.
+ * \param   [in]        count   Number of events.
+ */
+inline void pack_run(std::vector<std::uint8_t>& out, const TraceEvent* events, std::size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    put_varint(out, events[0].thread());
+    put_varint(out, count);
+
+    auto prev = events[0].time;
+    put_varint(out, prev);
+    for (std::size_t i = 0; i < count; ++i) {
+        const auto delta = static_cast<std::int64_t>(events[i].time - prev);
+        out.push_back(events[i].kind);
+        put_varint(out, events[i].id);
+        put_varint(out, (static_cast<std::uint64_t>(delta) << 1)
+                        ^ static_cast<std::uint64_t>(delta >> 63));
+        prev = events[i].time;
+    }
+}
+
+/** \brief Read a value of trivial type.
+ *
+ * \param   [in,out]    pos     Read position, advanced past the value.
+ * \param   [in]        end     End of the buffer.
+ * \param   [out]       value   Value read.
+ *
+ * \retval  true    Value was read.
+ * \retval  false   Buffer is truncated.
+ */
+template<typename T>
+bool get(const std::uint8_t*& pos, const std::uint8_t* end, T& value) noexcept
+{
+    if (static_cast<std::size_t>(end - pos) < sizeof(T)) {
+        return false;
+    }
+
+    std::memcpy(&value, pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+/** \brief Read an unsigned LEB128 varint.
+ *
+ * \param   [in,out]    pos     Read position, advanced past the varint.
+ * \param   [in]        end     End of the buffer.
+ * \param   [out]       value   Value read.
+ *
+ * \retval  true    Value was read.
+ * \retval  false   Buffer is truncated.
+ */
+inline bool get_varint(const std::uint8_t*& pos, const std::uint8_t* end,
+                       std::uint64_t& value) noexcept
+{
+    value = 0;
+    for (unsigned shift = 0; pos < end && shift < 64; shift += 7) {
+        const auto byte = *pos++;
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** \brief Read a length-prefixed string, as written to NAMES and THREADS blocks.
+ *
+ * \param   [in,out]    pos     Read position, advanced past the string.
+ * \param   [in]        end     End of the buffer.
+ * \param   [out]       value   String read.
+ *
+ * \retval  true    String was read.
+ * \retval  false   Buffer is truncated.
+ */
+inline bool get_string(const std::uint8_t*& pos, const std::uint8_t* end, std::string& value)
+{
+    std::uint32_t length;
+    if (!get(pos, end, length) || static_cast<std::size_t>(end - pos) < length) {
+        return false;
+    }
+
+    value.assign(reinterpret_cast<const char*>(pos), length);
+    pos += length;
+    return true;
+}
+
+/** \brief Decode the payload of an EVENTS block in either encoding.
+ *
+ * \param   [in]    header  Block header.
+ * \param   [in]    payload Block payload of header.size bytes.
+ * \param   [in]    emit    Called with every TraceEvent in order.
+ *
+ * \retval  true    Block was decoded.
+ * \retval  false   Block is corrupt, some events may have been emitted already.
+ */
+template<typename F>
+bool unpack_block(const BlockHeader& header, const std::uint8_t* payload, F&& emit)
+{
+    const auto end = payload + header.size;
+
+    if (header.encoding == RAW) {
+        if (header.size != header.count * sizeof(TraceEvent)) {
+            return false;
+        }
+
+        auto pos = payload;
+        for (std::uint64_t i = 0; i < header.count; ++i) {
+            TraceEvent event;
+            std::memcpy(&event, pos, sizeof(event));
+            pos += sizeof(event);
+            emit(event);
+        }
+        return true;
+    }
+
+    std::uint64_t total = 0;
+    auto pos = payload;
+    while (pos < end) {
+        std::uint64_t thread, count, time;
+        if (!get_varint(pos, end, thread) || !get_varint(pos, end, count)
+            || !get_varint(pos, end, time) || thread > TraceEvent::max_thread) {
+            return false;
+        }
+
+        for (std::uint64_t i = 0; i < count; ++i) {
+            std::uint64_t id, delta;
+            if (pos == end) {
+                return false;
+            }
+            const auto kind = *pos++;
+            if (!get_varint(pos, end, id) || !get_varint(pos, end, delta)) {
+                return false;
+            }
+
+            // Undo the zigzag encoding.
+            time += (delta >> 1) ^ (~(delta & 1) + 1);
+            emit(TraceEvent::make(time, static_cast<std::uint32_t>(id),
+                                  static_cast<std::uint32_t>(thread), kind));
+        }
+        total += count;
+    }
+
+    return total == header.count;
+}
+
+/** \brief Read-only memory mapping of a trace file, for the offline readers. */
+class Mapping {
+public:
+    /** \brief Map a file.
+     *
+     * Use data() to check for errors.
+     *
+     * \param   [in]    file_name   Name of the file.
+     */
+    explicit Mapping(const char* file_name)
+    : m_data{nullptr}, m_size{0}
+    {
+        const auto fd = ::open(file_name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            const auto data = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ,
+                                     MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                m_data = static_cast<const std::uint8_t*>(data);
+                m_size = static_cast<std::size_t>(info.st_size);
+            }
+        }
+        ::close(fd);
+    }
+    /** \brief Unmap the file. */
+    ~Mapping()
+    {
+        if (m_data) {
+            ::munmap(const_cast<std::uint8_t*>(m_data), m_size);
+        }
+    }
+
+    // No copy constructor.
+    Mapping(const Mapping&) = delete;
+    // No copy assignment operator.
+    Mapping& operator=(const Mapping&) = delete;
+
+    /** \brief Get the mapped contents.
+     *
+     * \retval  nullptr The file could not be opened or mapped, or is empty.
+     * \return  First byte of the file.
+     */
+    const std::uint8_t* data() const noexcept
+    {
+        return m_data;
+    }
+    /** \brief Get the size of the mapped file.
+     *
+     * \return  Size in bytes.
+     */
+    std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+private:
+    // Mapped file, nullptr on error.
+    const std::uint8_t* m_data;
+    // Size of the file.
+    std::size_t         m_size;
+};
+
+}
+
+/** \brief Background writer streaming all TraceRings to a file.
+ *
+ * A single writer thread drains the per-thread rings, batches the events into large blocks,
+ * optionally packs them and writes them with pwritev, or hands them to an asynchronous Writer if
+ * Options::async is set (see minprof/writer.hh). Producers never block: events that do not fit into
+ * a ring are dropped and counted. Memory use is bounded by the ring capacity per thread plus two
+ * blocks (and the Writer's buffers).
+ *
+ * Only one TraceStreamer may run at a time.
+ */
+class TraceStreamer {
+public:
+    /** \brief Streamer configuration. */
+    struct Options {
+        /** \brief Number of events per block. */
+        std::size_t                 block_events    = 1u << 16;
+        /** \brief If true, pack event blocks (typically 3-4x smaller). */
+        bool                        pack            = true;
+        /** \brief Maximum time events may sit in the block buffer. */
+        std::chrono::milliseconds   flush_interval  = std::chrono::milliseconds{100};
+        /** \brief Sleep time when there is nothing to drain. */
+        std::chrono::microseconds   poll_interval   = std::chrono::microseconds{500};
+        /** \brief If true, hand blocks to an asynchronous Writer instead of calling pwritev. */
+        bool                        async           = false;
+        /** \brief Writer backend to use if async is set. */
+        Writer::Backend             backend         = Writer::AUTO;
+    };
+
+public:
+    /** \brief Open a trace file for streaming with the default configuration.
+     *
+     * Truncates the file. Use good() to check for errors.
+     *
+     * \param   [in]    file_name   Name of the file.
+     */
+    explicit TraceStreamer(const char* file_name)
+    : TraceStreamer{file_name, Options{}}
+    {}
+    /** \brief Open a trace file for streaming.
+     *
+     * Truncates the file. Use good() to check for errors.
+     *
+     * \param   [in]    file_name   Name of the file.
+     * \param   [in]    options     Streamer configuration.
+     */
+    TraceStreamer(const char* file_name, Options options)
+    : m_options(options), m_fd{::open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644)},
+      m_offset{0}, m_good{m_fd >= 0}, m_running{false}, m_events{0}, m_thread{}, m_rings{},
+      m_block(options.block_events), m_fill{0}, m_packed{}, m_writer{}
+    {
+        if (m_good && m_options.async) {
+            m_writer = Writer::create(m_fd, m_options.backend, 4,
+                                      m_options.block_events * sizeof(TraceEvent));
+        }
+
+        trace_format::FileHeader header{{}, trace_format::version, 0};
+        std::memcpy(header.magic, trace_format::magic, sizeof(header.magic));
+        write(&header, sizeof(header), nullptr, 0);
+    }
+    /** \brief Stop streaming and close the file. */
+    ~TraceStreamer()
+    {
+        stop();
+        m_writer.reset();
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+    }
+
+    // No copy constructor.
+    TraceStreamer(const TraceStreamer&) = delete;
+    // No copy assignment.
+    TraceStreamer& operator=(const TraceStreamer&) = delete;
+    // No move constructor.
+    TraceStreamer(TraceStreamer&&) = delete;
+    // No move assignment.
+    TraceStreamer& operator=(TraceStreamer&&) = delete;
+
+    /** \brief Start the writer thread.
+     *
+     * Events pushed before this call are not streamed.
+     */
+    void start()
+    {
+        if (m_running.exchange(true)) {
+            return;
+        }
+
+        write_names();
+        // Producers may drop a few events until their ring was skipped, see TraceRing::skip().
+        TraceRing::streaming().store(true);
+        TraceRegistry::rings(m_rings);
+        for (const auto ring : m_rings) {
+            ring->skip();
+        }
+
+        m_thread = std::thread{[this]() { run(); }};
+    }
+    /** \brief Drain all rings, write the remaining blocks and stop the writer thread. */
+    void stop()
+    {
+        if (!m_running.exchange(false)) {
+            return;
+        }
+
+        m_thread.join();
+        TraceRing::streaming().store(false);
+        write_names();
+
+        if (m_writer) {
+            m_writer->sync();
+            m_writer->wait();
+        }
+    }
+
+    /** \brief Write a set of events that were captured elsewhere, e.g. by TraceRing::snapshot().
+     *
+     * The events are written in blocks, followed by the names and threads. Must not be called while
+     * the writer thread is running.
+     *
+     * \param   [in]    events  Events to write, grouped by thread for best packing.
+     * \param   [in]    count   Number of events.
+     */
+    void save(const TraceEvent* events, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i) {
+            m_block[m_fill++] = events[i];
+            if (m_fill == m_block.size()) {
+                flush();
+            }
+        }
+
+        flush();
+        write_names();
+
+        if (m_writer) {
+            m_writer->sync();
+            m_writer->wait();
+        }
+    }
+
+    /** \brief Check whether all writes succeeded so far.
+     *
+     * \retval  true    No errors.
+     * \retval  false   The file could not be opened or written.
+     */
+    bool good() const noexcept
+    {
+        return m_good.load() && (!m_writer || m_writer->good());
+    }
+    /** \brief Get the number of events written so far.
+     *
+     * \return  Number of events.
+     */
+    std::uint64_t events() const noexcept
+    {
+        return m_events.load();
+    }
+    /** \brief Get the total number of events dropped by all rings.
+     *
+     * \return  Number of dropped events.
+     */
+    static std::uint64_t dropped()
+    {
+        std::vector<TraceRing*> rings;
+        TraceRegistry::rings(rings);
+
+        std::uint64_t result = 0;
+        for (const auto ring : rings) {
+            result += ring->dropped();
+        }
+        return result;
+    }
+
+private:
+    // Writer thread main loop.
+    void run()
+    {
+        auto last_flush = TraceClock::now();
+        auto last_scan = last_flush;
+        for (;;) {
+            const auto running = m_running.load();
+
+            // Rings of threads started after start() are picked up periodically, and on stop().
+            const auto now = TraceClock::now();
+            if (!running || now - last_scan >= m_options.flush_interval) {
+                TraceRegistry::rings(m_rings);
+                last_scan = now;
+            }
+
+            std::size_t drained = 0;
+            for (const auto ring : m_rings) {
+                drained += drain(*ring);
+            }
+
+            if (m_fill > 0 && (!running || now - last_flush >= m_options.flush_interval)) {
+                flush();
+                last_flush = now;
+            }
+
+            if (!running && drained == 0) {
+                break;
+            }
+            if (drained == 0) {
+                std::this_thread::sleep_for(m_options.poll_interval);
+            }
+        }
+    }
+
+    // Drain a ring into the block buffer, flushing whenever it is full.
+    std::size_t drain(TraceRing& ring)
+    {
+        // The fill level peaks right before draining.
+        auto& high_water = MINPROF_GAUGE("minprof.trace.high_water|G");
+        const auto pending = ring.pending();
+        if (pending > high_water.value()) {
+            high_water.set(pending);
+        }
+
+        std::size_t total = 0;
+        for (;;) {
+            const auto count = ring.consume(&m_block[m_fill], m_block.size() - m_fill);
+            m_fill += count;
+            total += count;
+
+            if (m_fill < m_block.size()) {
+                return total;
+            }
+            flush();
+        }
+    }
+
+    // Write the buffered events as one block.
+    void flush()
+    {
+        if (m_fill == 0) {
+            return;
+        }
+
+        trace_format::BlockHeader header{trace_format::EVENTS, trace_format::RAW, 0, m_fill};
+        if (m_options.pack) {
+            // Consecutive events from the same ring form a run.
+            m_packed.clear();
+            std::size_t begin = 0;
+            for (std::size_t i = 1; i <= m_fill; ++i) {
+                if (i == m_fill || m_block[i].thread() != m_block[begin].thread()) {
+                    trace_format::pack_run(m_packed, &m_block[begin], i - begin);
+                    begin = i;
+                }
+            }
+
+            header.encoding = trace_format::PACKED;
+            header.size = m_packed.size();
+            write(&header, sizeof(header), m_packed.data(), m_packed.size());
+        } else {
+            header.size = m_fill * sizeof(TraceEvent);
+            write(&header, sizeof(header), m_block.data(), header.size);
+        }
+
+        m_events += m_fill;
+        m_fill = 0;
+    }
+
+    // Write the names and threads blocks.
+    void write_names()
+    {
+        m_packed.clear();
+        const auto count = StaticCounterRegistry::count();
+        for (unsigned idx = 0; idx < count; ++idx) {
+            const auto name = StaticCounterRegistry::get_name(idx);
+            const std::uint32_t length = name ? static_cast<std::uint32_t>(std::strlen(name)) : 0;
+            trace_format::put_bytes(m_packed, &idx, sizeof(std::uint32_t));
+            trace_format::put_bytes(m_packed, &length, sizeof(length));
+            trace_format::put_bytes(m_packed, name, length);
+        }
+
+        trace_format::BlockHeader names{trace_format::NAMES, trace_format::RAW, m_packed.size(),
+                                        count};
+        write(&names, sizeof(names), m_packed.data(), m_packed.size());
+
+        // Drop counts are per ring, names per thread.
+        std::vector<TraceRing*> rings;
+        TraceRegistry::rings(rings);
+        std::vector<std::uint64_t> dropped;
+        for (const auto ring : rings) {
+            if (ring->thread() >= dropped.size()) {
+                dropped.resize(ring->thread() + 1u);
+            }
+            dropped[ring->thread()] += ring->dropped();
+        }
+
+        m_packed.clear();
+        std::uint64_t threads = 0;
+        ThreadRegistry::visit([&](const ThreadStorage& storage, const char* name) {
+            const std::uint32_t id = storage.id();
+            const std::uint64_t drops = id < dropped.size() ? dropped[id] : 0;
+            const std::uint32_t length = static_cast<std::uint32_t>(std::strlen(name));
+            trace_format::put_bytes(m_packed, &id, sizeof(id));
+            trace_format::put_bytes(m_packed, &drops, sizeof(drops));
+            trace_format::put_bytes(m_packed, &length, sizeof(length));
+            trace_format::put_bytes(m_packed, name, length);
+            ++threads;
+        });
+
+        trace_format::BlockHeader header{trace_format::THREADS, trace_format::RAW, m_packed.size(),
+                                         threads};
+        write(&header, sizeof(header), m_packed.data(), m_packed.size());
+    }
+
+    // Write a header and payload at the end of the file using a single pwritev, or the Writer.
+    void write(const void* header, std::size_t header_size, const void* payload, std::size_t size)
+    {
+        if (!m_good.load()) {
+            return;
+        }
+
+        if (m_writer) {
+            auto buffer = m_writer->acquire();
+            if (header_size + size <= buffer.capacity) {
+                // Usual case: the whole block fits into a single buffer.
+                std::memcpy(buffer.data, header, header_size);
+                std::memcpy(buffer.data + header_size, payload, size);
+                m_writer->submit(buffer, header_size + size, m_offset);
+            } else {
+                std::memcpy(buffer.data, header, header_size);
+                m_writer->submit(buffer, header_size, m_offset);
+                m_writer->write(payload, size, m_offset + header_size);
+            }
+
+            m_offset += header_size + size;
+            return;
+        }
+
+        iovec iov[2] = {
+            {const_cast<void*>(header), header_size},
+            {const_cast<void*>(payload), size}
+        };
+        int iov_count = size > 0 ? 2 : 1;
+        auto vec = iov;
+
+        while (iov_count > 0) {
+            const auto written = ::pwritev(m_fd, vec, iov_count, static_cast<off_t>(m_offset));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                m_good.store(false);
+                return;
+            }
+
+            // Advance past partial writes.
+            m_offset += static_cast<std::uint64_t>(written);
+            auto left = static_cast<std::size_t>(written);
+            while (iov_count > 0 && left >= vec->iov_len) {
+                left -= vec->iov_len;
+                ++vec;
+                --iov_count;
+            }
+            if (iov_count > 0) {
+                vec->iov_base = static_cast<char*>(vec->iov_base) + left;
+                vec->iov_len -= left;
+            }
+        }
+    }
+
+    // Configuration.
+    Options                     m_options;
+    // Output file descriptor.
+    int                         m_fd;
+    // Current end of the file.
+    std::uint64_t               m_offset;
+    // Cleared on the first error.
+    std::atomic<bool>           m_good;
+    // Set while the writer thread should run.
+    std::atomic<bool>           m_running;
+    // Number of events written.
+    std::atomic<std::uint64_t>  m_events;
+    // Writer thread.
+    std::thread                 m_thread;
+    // Rings being drained.
+    std::vector<TraceRing*>     m_rings;
+    // Block buffer.
+    std::vector<TraceEvent>     m_block;
+    // Number of events in the block buffer.
+    std::size_t                 m_fill;
+    // Packing buffer.
+    std::vector<std::uint8_t>   m_packed;
+    // Asynchronous writer, if enabled.
+    std::unique_ptr<Writer>     m_writer;
+};
+
+}
+
+/* Exemplary usage:
+ *
+ * Trace a section like this:
+ *
+ * MINPROF_TRACE("mySection") {
+ *      doStuff();
+ * }
+ *
+ * Stream all traced sections to a file for as long as you like:
+ *
+ * minprof::TraceStreamer streamer{"minprof.trace"};
+ * streamer.start();
+ * ...
+ * streamer.stop();
+ *
+ * Link threads that hand work or locks to each other, for minprof-analyze:
+ *
+ * MINPROF_TRACE_SIGNAL(minprof::trace_key(&mutex));
+ * mutex.unlock();
+ * ...
+ * mutex.lock();
+ * MINPROF_TRACE_WAKE(minprof::trace_key(&mutex));
+ *
+ */
+
+#endif
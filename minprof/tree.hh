@@ -0,0 +1,379 @@
+/** \brief Section call trees for the minimal profiler.
+ *
+ * \file    minprof/tree.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_TREE_HH_
+#define MINPROF_TREE_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::Counter
+// minprof::Timer
+// minprof::Stopwatch
+// minprof::ThreadStorage
+
+#include <cstdint>
+// std::uint32_t
+
+#include <memory>
+// std::unique_ptr
+
+namespace minprof {
+
+/** \brief Node of a per-thread section call tree.
+ *
+ * Every node represents one section reached through a unique path of enclosing sections. Nodes are
+ * only ever written by the owning thread, but may be read by any thread at any time.
+ */
+struct CallNode {
+    /** \brief Section id of the root node. */
+    static constexpr std::uint32_t root_id = ~std::uint32_t{0};
+
+    /** \brief Section id, i.e. the StaticCounter index of the section's "|C" counter. */
+    std::uint32_t           id;
+    /** \brief Enclosing node, nullptr for the root. */
+    CallNode*               parent;
+    /** \brief First child node. */
+    std::atomic<CallNode*>  child;
+    /** \brief Next sibling node. */
+    std::atomic<CallNode*>  sibling;
+    /** \brief Number of times this node was entered. */
+    Counter                 calls;
+    /** \brief Total time spent in this node, including children. */
+    Timer                   inclusive;
+    /** \brief Total time spent in children of this node. */
+    Timer                   children;
+
+    /** \brief Get the time spent in this node, excluding children.
+     *
+     * \return  Exclusive time.
+     */
+    Timer::duration exclusive() const noexcept
+    {
+        // Both values are read at different times, so they may be slightly off.
+        const auto incl = inclusive.value();
+        const auto excl = children.value();
+        return incl > excl ? incl - excl : Timer::duration::zero();
+    }
+};
+
+/** \brief Per-thread call tree of sections.
+ *
+ * Entering and leaving tree sections moves the thread's cursor down and up the tree, creating nodes
+ * on first use. Nodes are allocated from a per-thread arena and never freed, so readers may walk
+ * the tree without any locking.
+ */
+class CallTree {
+public:
+    /** \brief Number of nodes per arena chunk. */
+    static constexpr unsigned chunk_size = 1024;
+
+public:
+    // No copy constructor.
+    CallTree(const CallTree&) = delete;
+    // No copy assignment operator.
+    CallTree& operator=(const CallTree&) = delete;
+    // No move constructor.
+    CallTree(CallTree&&) = delete;
+    // No move assignment operator.
+    CallTree& operator=(CallTree&&) = delete;
+
+    /** \brief Get the CallTree of the calling thread.
+     *
+     * The first call on every thread attaches a new tree to the CallTreeRegistry.
+     *
+     * \return  CallTree of the calling thread.
+     */
+    ALWAYS_INLINE static CallTree& current();
+
+    /** \brief Enter a section below the current node.
+     *
+     * Must only be called by the owning thread.
+     *
+     * \param   [in]    id  Section id.
+     * \return  Node that was entered.
+     */
+    ALWAYS_INLINE CallNode& enter(std::uint32_t id)
+    {
+        auto node = m_current->child.load(std::memory_order_relaxed);
+        while (node && node->id != id) {
+            node = node->sibling.load(std::memory_order_relaxed);
+        }
+        if (!node) {
+            node = &create(id);
+        }
+
+        ++node->calls;
+        m_current = node;
+        return *node;
+    }
+    /** \brief Leave the current node.
+     *
+     * Must only be called by the owning thread, with the node returned by the matching enter().
+     *
+     * \param   [in,out]    node    Node that is left.
+     * \param   [in]        dur     Time spent in the node.
+     */
+    ALWAYS_INLINE void leave(CallNode& node, Timer::duration dur) noexcept
+    {
+        node.inclusive += dur;
+        node.parent->children += dur;
+        m_current = node.parent;
+    }
+
+    /** \brief Get the node the owning thread currently is in.
+     *
+     * Must only be called by the owning thread.
+     *
+     * \return  Current node, the root if outside of all tree sections.
+     */
+    const CallNode& cursor() const noexcept
+    {
+        return *m_current;
+    }
+    /** \brief Get the root node.
+     *
+     * \return  Root node.
+     */
+    const CallNode& root() const noexcept
+    {
+        return m_root;
+    }
+    /** \brief Get the ThreadStorage id of the owning thread.
+     *
+     * \return  Thread id.
+     */
+    unsigned thread() const noexcept
+    {
+        return m_thread;
+    }
+
+private:
+    friend class CallTreeRegistry;
+
+    explicit CallTree(unsigned thread)
+    : m_thread{thread}, m_root{CallNode::root_id, nullptr, {nullptr}, {nullptr}, {}, {}, {}},
+      m_current{&m_root}, m_chunks{}, m_fill{chunk_size}
+    {}
+
+    // Allocate and publish a new child of the current node.
+    CallNode& create(std::uint32_t id)
+    {
+        if (m_fill == chunk_size) {
+            m_chunks.emplace_back(new CallNode[chunk_size]);
+            m_fill = 0;
+        }
+
+        auto& node = m_chunks.back()[m_fill++];
+        node.id = id;
+        node.parent = m_current;
+        node.child.store(nullptr, std::memory_order_relaxed);
+        node.sibling.store(m_current->child.load(std::memory_order_relaxed),
+                           std::memory_order_relaxed);
+        m_current->child.store(&node, std::memory_order_release);
+        return node;
+    }
+
+    // ThreadStorage id of the owner.
+    unsigned                                    m_thread;
+    // Root node.
+    CallNode                                    m_root;
+    // Current node of the owner.
+    CallNode*                                   m_current;
+    // Node arena, only accessed by the owner.
+    std::vector<std::unique_ptr<CallNode[]>>    m_chunks;
+    // Number of used nodes in the last chunk.
+    unsigned                                    m_fill;
+};
+
+/** \brief Static registry for all CallTree instances.
+ *
+ * Like the ThreadRegistry, trees are never freed so that exited threads remain part of exports.
+ */
+class CallTreeRegistry {
+public:
+    // No copy constructor.
+    CallTreeRegistry(const CallTreeRegistry&) = delete;
+    // No copy assignment operator.
+    CallTreeRegistry& operator=(const CallTreeRegistry&) = delete;
+    // No move constructor.
+    CallTreeRegistry(CallTreeRegistry&&) = delete;
+    // No move assignment operator.
+    CallTreeRegistry& operator=(CallTreeRegistry&&) = delete;
+
+    /** \brief Attach a new CallTree for the calling thread.
+     *
+     * Use CallTree::current() instead, which only calls this once per thread.
+     *
+     * \return  New CallTree instance.
+     */
+    static CallTree& attach()
+    {
+        const auto thread = ThreadStorage::current().id();
+
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        self.m_trees.push_back(new CallTree{thread});
+        return *self.m_trees.back();
+    }
+
+    /** \brief Get a snapshot of all attached trees.
+     *
+     * \param   [in,out]    out     Vector to fill with the tree pointers.
+     */
+    static void trees(std::vector<const CallTree*>& out)
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        out.assign(self.m_trees.begin(), self.m_trees.end());
+    }
+
+    /** \brief Visit all nodes of a tree in depth-first order.
+     *
+     * The root node is not visited.
+     *
+     * \param   [in]    tree    Tree to walk.
+     * \param   [in]    visitor Callable taking (const CallNode&, const std::uint32_t* path,
+     *                          unsigned depth), where path holds the section ids from the root
+     *                          down to and including the visited node.
+     */
+    template<typename Visitor>
+    static void walk(const CallTree& tree, Visitor&& visitor)
+    {
+        std::vector<std::uint32_t> path;
+        std::vector<const CallNode*> stack;
+
+        auto node = tree.root().child.load(std::memory_order_acquire);
+        while (node) {
+            path.push_back(node->id);
+            visitor(*node, path.data(), static_cast<unsigned>(path.size()));
+
+            // Descend first, then continue with the next sibling of the closest ancestor.
+            const auto child = node->child.load(std::memory_order_acquire);
+            if (child) {
+                stack.push_back(node);
+                node = child;
+                continue;
+            }
+
+            path.pop_back();
+            node = node->sibling.load(std::memory_order_acquire);
+            while (!node && !stack.empty()) {
+                node = stack.back()->sibling.load(std::memory_order_acquire);
+                stack.pop_back();
+                path.pop_back();
+            }
+        }
+    }
+
+private:
+    CallTreeRegistry() = default;
+
+    static CallTreeRegistry& instance() noexcept
+    {
+        static CallTreeRegistry instance;
+        return instance;
+    }
+
+    // Guards m_trees.
+    std::mutex              m_lock;
+    // All trees ever attached.
+    std::vector<CallTree*>  m_trees;
+};
+
+ALWAYS_INLINE CallTree& CallTree::current()
+{
+    // A trivial thread_local pointer avoids the initialization guard on every access.
+    static thread_local CallTree* tree = nullptr;
+    if (!tree) {
+        tree = &CallTreeRegistry::attach();
+    }
+
+    return *tree;
+}
+
+/** \brief Section tracker that also maintains the thread's call tree.
+ *
+ * Counts and times like a Section, while attributing the time to the node of the calling thread's
+ * CallTree that corresponds to the current nesting of tree sections.
+ */
+class TreeSection {
+public:
+    /** \brief Initialize, trigger and time a new TreeSection.
+     *
+     * \param   [in,out]    c   Counter for section.
+     * \param   [in,out]    t   Timer for section.
+     * \param   [in]        id  Section id, i.e. the StaticCounter index of \p c.
+     */
+    TreeSection(Counter& c, Timer& t, std::uint32_t id)
+    : m_timer{t}, m_tree{CallTree::current()}, m_node{m_tree.enter(id)},
+      m_start{Stopwatch::Clock::now()}
+    {
+        ++c;
+    }
+    /** \brief Stop, retire and destroy a TreeSection. */
+    ~TreeSection()
+    {
+        const auto dur = std::chrono::duration_cast<Timer::duration>(
+            Stopwatch::Clock::now() - m_start
+        );
+
+        m_timer += dur;
+        m_tree.leave(m_node, dur);
+    }
+
+    // No copy constructor.
+    TreeSection(const TreeSection&) = delete;
+    // No copy assignment.
+    TreeSection& operator=(const TreeSection&) = delete;
+
+    // No move constructor.
+    TreeSection(TreeSection&&) = delete;
+    // No move assignment.
+    TreeSection& operator=(TreeSection&&) = delete;
+
+    // Hack to make use of if-condition initialization scoping.
+    operator bool() const noexcept
+    {
+        return true;
+    }
+
+private:
+    // Backing Timer.
+    Timer&                  m_timer;
+    // Tree of the calling thread.
+    CallTree&               m_tree;
+    // Entered node.
+    CallNode&               m_node;
+    // Time of entry.
+    Stopwatch::time_point   m_start;
+};
+
+/** \brief Profile the following statement (-block) as part of the call tree.
+ *
+ * Like MINPROF_SECTION, but also attributes calls and time to the calling thread's CallTree.
+ *
+ * \param   name    Name string literal of the section.
+ */
+#define MINPROF_TREE(name)\
+if (::minprof::TreeSection __tree_ ## __LINE__ {MINPROF_COUNTER(name "|C"), MINPROF_TIMER(name "|T"),\
+    ::minprof::StaticCounter<typestring_is(name "|C")>::index})
+
+}
+
+/* Exemplary usage:
+ *
+ * Nest tree sections to build up a call tree:
+ *
+ * MINPROF_TREE("request") {
+ *      MINPROF_TREE("parse") { parse(); }
+ *      MINPROF_TREE("execute") { execute(); }
+ * }
+ *
+ */
+
+#endif
@@ -0,0 +1,477 @@
+/** \brief Threshold triggers that capture the trace flight recorder on anomalies.
+ *
+ * Requires a POSIX platform.
+ *
+ * \file    minprof/trigger.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_TRIGGER_HH_
+#define MINPROF_TRIGGER_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::StaticCounter
+// minprof::ThreadStorage
+#include "sampler.hh"
+// minprof::Sampler
+// minprof::StaticHeatmap
+#include "trace.hh"
+// minprof::TraceEvent
+// minprof::TraceRing
+// minprof::TraceRegistry
+// minprof::TraceStreamer
+
+#include <cmath>
+// std::exp
+#include <cstdint>
+// std::uint32_t
+// std::uint64_t
+
+#include <condition_variable>
+// std::condition_variable
+#include <string>
+// std::string
+// std::to_string
+#include <thread>
+// std::thread
+#include <utility>
+// std::move
+
+namespace minprof {
+
+/** \brief Rule that fires on an anomaly in the sampled statistics. */
+struct Trigger {
+    /** \brief Kind of rule. */
+    enum Kind {
+        /** \brief Counter rate exceeds a threshold. */
+        RATE_ABOVE,
+        /** \brief Counter rate exceeds a multiple of its long-term average. */
+        RATE_SPIKE,
+        /** \brief Heatmap percentile exceeds a threshold. */
+        PERCENTILE_ABOVE
+    };
+
+    /** \brief Kind of rule. */
+    Kind            kind;
+    /** \brief Index of the StaticCounter or StaticHeatmap. */
+    unsigned        idx;
+    /** \brief Quantile for PERCENTILE_ABOVE. */
+    double          q;
+    /** \brief Threshold in 1/s, nanoseconds, or as a factor for RATE_SPIKE. */
+    double          threshold;
+    /** \brief Minimum rate for RATE_SPIKE, so that noise around 0 does not fire. */
+    double          floor;
+
+    /** \brief Create a rule that fires when a counter's rate exceeds a threshold.
+     *
+     * \param   [in]    counter StaticCounter index.
+     * \param   [in]    rate    Threshold in increments per second.
+     * \return  New rule.
+     */
+    static Trigger rate_above(unsigned counter, double rate) noexcept
+    {
+        return Trigger{RATE_ABOVE, counter, 0.0, rate, 0.0};
+    }
+    /** \brief Create a rule that fires when a counter's rate exceeds its long-term average.
+     *
+     * \param   [in]    counter StaticCounter index.
+     * \param   [in]    factor  Threshold as a multiple of the long-term average.
+     * \param   [in]    floor   Minimum rate in increments per second.
+     * \return  New rule.
+     */
+    static Trigger rate_spike(unsigned counter, double factor, double floor = 1.0) noexcept
+    {
+        return Trigger{RATE_SPIKE, counter, 0.0, factor, floor};
+    }
+    /** \brief Create a rule that fires when a heatmap's percentile exceeds a threshold.
+     *
+     * \param   [in]    heatmap     StaticHeatmap index.
+     * \param   [in]    q           Quantile in [0, 1].
+     * \param   [in]    duration    Threshold.
+     * \return  New rule.
+     */
+    static Trigger percentile_above(unsigned heatmap, double q, Timer::duration duration) noexcept
+    {
+        return Trigger{PERCENTILE_ABOVE, heatmap, q, static_cast<double>(duration.count()), 0.0};
+    }
+};
+
+/** \brief Trace capture driven by Triggers.
+ *
+ * The rules are evaluated by the Sampler after every snapshot, so they cost nothing on the hot
+ * path. While idle, the TraceRings act as flight recorders holding the recent past. When a rule
+ * fires, the recorder keeps recording for Options::post, then freezes all rings, copies the events
+ * from Options::pre before to Options::post after the trigger and resumes. A background thread
+ * writes the copy into a new trace file, so the Sampler never waits for the disk. A MARK event with
+ * the id of the rule's counter (or heatmap_mark for heatmap rules) marks the trigger time.
+ *
+ * How far back a capture reaches is bounded by the ring capacity, see MINPROF_TRACE_CAPACITY.
+ * Nothing is captured while a TraceStreamer is running, as that already persists all events.
+ *
+ * There is only one FlightRecorder, which is controlled through the static interface.
+ */
+class FlightRecorder {
+public:
+    /** \brief Capture configuration. */
+    struct Options {
+        /** \brief Time before the trigger to capture. */
+        std::chrono::milliseconds   pre             = std::chrono::milliseconds{1000};
+        /** \brief Time after the trigger to capture. */
+        std::chrono::milliseconds   post            = std::chrono::milliseconds{1000};
+        /** \brief Minimum time between the end of a capture and the next trigger. */
+        std::chrono::milliseconds   cooldown        = std::chrono::milliseconds{60000};
+        /** \brief Time constant of the long-term averages of RATE_SPIKE rules. */
+        std::chrono::milliseconds   baseline_window = std::chrono::milliseconds{60000};
+        /** \brief Maximum number of captures, 0 for unlimited. */
+        unsigned                    max_captures    = 8;
+        /** \brief Captures are written to <prefix>.<n>.trace. */
+        std::string                 file_prefix     = "minprof.trigger";
+    };
+
+    /** \brief MARK id of captures fired by heatmap rules, which is never a counter index. */
+    static constexpr std::uint32_t heatmap_mark = ~std::uint32_t{0};
+
+public:
+    // No copy constructor.
+    FlightRecorder(const FlightRecorder&) = delete;
+    // No copy assignment operator.
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+    // No move constructor.
+    FlightRecorder(FlightRecorder&&) = delete;
+    // No move assignment operator.
+    FlightRecorder& operator=(FlightRecorder&&) = delete;
+
+    /** \brief Arm the recorder with the default configuration. */
+    static void arm()
+    {
+        arm(Options{});
+    }
+    /** \brief Arm the recorder.
+     *
+     * Rules are only evaluated while the Sampler is running.
+     *
+     * \param   [in]    options     Capture configuration.
+     */
+    static void arm(Options options)
+    {
+        auto& self = instance();
+        bool hook = false;
+        {
+            std::lock_guard<std::mutex> lock{self.m_lock};
+
+            self.m_options = std::move(options);
+            hook = !self.m_hooked;
+            self.m_hooked = true;
+            self.m_armed = true;
+        }
+
+        // Not under m_lock, see Sampler::Hook::set().
+        if (hook) {
+            self.m_hook.set([&self](Stopwatch::time_point now) { self.evaluate(now); });
+        }
+    }
+    /** \brief Disarm the recorder, abandoning a pending capture. */
+    static void disarm()
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        self.m_armed = false;
+        self.m_pending = false;
+    }
+
+    /** \brief Add a rule.
+     *
+     * \param   [in]    trigger     Rule to add.
+     */
+    static void add(const Trigger& trigger)
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        self.m_triggers.push_back(trigger);
+        self.m_baselines.push_back(-1.0);
+    }
+
+    /** \brief Get the number of captures written so far, excluding one still being written.
+     *
+     * \return  Number of captures.
+     */
+    static unsigned captures()
+    {
+        auto& self = instance();
+        std::lock_guard<std::mutex> lock{self.m_lock};
+
+        return self.m_captures;
+    }
+
+private:
+    FlightRecorder()
+    : m_lock{}, m_options{}, m_hooked{false}, m_armed{false}, m_pending{false}, m_captures{0},
+      m_started{0}, m_triggers{}, m_baselines{}, m_last{}, m_fire_time{0}, m_fire_id{0},
+      m_deadline{}, m_resume{}, m_saving{false}, m_stop{false}, m_queued{}, m_queued_file{},
+      m_wakeup{}, m_saver{}, m_hook{}
+    {}
+    // Write a capture still queued and stop the saver thread.
+    ~FlightRecorder()
+    {
+        // No capture may start while the saver thread is stopped.
+        m_hook.reset();
+        {
+            std::lock_guard<std::mutex> lock{m_lock};
+            m_stop = true;
+        }
+        m_wakeup.notify_all();
+        if (m_saver.joinable()) {
+            m_saver.join();
+        }
+    }
+
+    static FlightRecorder& instance()
+    {
+        static FlightRecorder instance;
+        return instance;
+    }
+
+    // Sampler hook, evaluates all rules and drives a pending capture.
+    void evaluate(Stopwatch::time_point now)
+    {
+        std::unique_lock<std::mutex> lock{m_lock};
+
+        const auto dt = m_last == Stopwatch::time_point{} ? 0.0
+                        : std::chrono::duration<double>(now - m_last).count();
+        m_last = now;
+
+        // Baselines are maintained even while disarmed, so they are warm when armed.
+        const auto tau = std::chrono::duration<double>(m_options.baseline_window).count();
+        const auto alpha = tau > 0.0 ? 1.0 - std::exp(-dt / tau) : 1.0;
+
+        bool fired = false;
+        for (std::size_t i = 0; i < m_triggers.size(); ++i) {
+            const auto& trigger = m_triggers[i];
+            if (trigger.kind == Trigger::PERCENTILE_ABOVE) {
+                const auto value = Sampler::percentile(trigger.idx, trigger.q).count();
+                if (!fired && static_cast<double>(value) > trigger.threshold) {
+                    fired = fire(heatmap_mark);
+                }
+                continue;
+            }
+
+            const auto rate = Sampler::rate(trigger.idx);
+            if (trigger.kind == Trigger::RATE_ABOVE) {
+                if (!fired && rate > trigger.threshold) {
+                    fired = fire(trigger.idx);
+                }
+                continue;
+            }
+
+            auto& baseline = m_baselines[i];
+            if (baseline < 0.0) {
+                baseline = rate;
+                continue;
+            }
+            if (!fired && rate > trigger.floor && rate > trigger.threshold * baseline) {
+                fired = fire(trigger.idx);
+            }
+            baseline += alpha * (rate - baseline);
+        }
+
+        if (m_pending && now >= m_deadline) {
+            const auto pre = static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(m_options.pre).count()
+            );
+            const auto post = static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(m_options.post).count()
+            );
+            const auto begin = m_fire_time > pre ? m_fire_time - pre : 0;
+            const auto end = m_fire_time + post;
+
+            // Pending keeps other captures out, so the lock can be left to the saver thread and
+            // the configuration calls meanwhile.
+            lock.unlock();
+            auto window = capture(begin, end);
+            lock.lock();
+
+            // Unless disarmed meanwhile.
+            if (m_pending) {
+                queue(std::move(window));
+            }
+            m_pending = false;
+            m_resume = Stopwatch::Clock::now() + m_options.cooldown;
+        }
+    }
+
+    // Start a capture if allowed.
+    bool fire(std::uint32_t id)
+    {
+        if (!m_armed || m_pending || m_saving || Stopwatch::Clock::now() < m_resume
+            || (m_options.max_captures != 0 && m_started >= m_options.max_captures)
+            || TraceRing::streaming().load()) {
+            return false;
+        }
+
+        m_pending = true;
+        m_fire_time = TraceClock::ticks();
+        m_fire_id = id;
+        m_deadline = Stopwatch::Clock::now() + m_options.post;
+        return true;
+    }
+
+    // Freeze all rings and copy the events within a window of trace time.
+    static std::vector<TraceEvent> capture(std::uint64_t begin, std::uint64_t end)
+    {
+        TraceRegistry::freeze();
+
+        std::vector<TraceRing*> rings;
+        TraceRegistry::rings(rings);
+
+        std::vector<TraceEvent> events;
+        std::vector<TraceEvent> window;
+        for (const auto ring : rings) {
+            events.clear();
+            ring->snapshot(events);
+            for (const auto& event : events) {
+                if (event.time >= begin && event.time <= end) {
+                    window.push_back(event);
+                }
+            }
+        }
+
+        TraceRegistry::thaw();
+        return window;
+    }
+
+    // Hand a captured window to the saver thread.
+    void queue(std::vector<TraceEvent> window)
+    {
+        const auto thread = ThreadStorage::current().id();
+        window.push_back(TraceEvent::make(m_fire_time, m_fire_id, thread, TraceEvent::MARK));
+
+        m_queued = std::move(window);
+        m_queued_file = m_options.file_prefix + "." + std::to_string(m_started++) + ".trace";
+        m_saving = true;
+        if (!m_saver.joinable()) {
+            m_saver = std::thread{[this]() { save(); }};
+        }
+        m_wakeup.notify_all();
+    }
+
+    // Saver thread main loop, writes queued captures.
+    void save()
+    {
+        std::unique_lock<std::mutex> lock{m_lock};
+        for (;;) {
+            m_wakeup.wait(lock, [this]() { return m_stop || !m_queued.empty(); });
+            if (m_queued.empty()) {
+                return;
+            }
+
+            const auto events = std::move(m_queued);
+            const auto file = std::move(m_queued_file);
+            m_queued.clear();
+            lock.unlock();
+
+            {
+                TraceStreamer out{file.c_str()};
+                out.save(events.data(), events.size());
+            }
+
+            lock.lock();
+            ++m_captures;
+            m_saving = false;
+        }
+    }
+
+    // Guards all members.
+    std::mutex                  m_lock;
+    // Capture configuration.
+    Options                     m_options;
+    // True once the Sampler hook was added.
+    bool                        m_hooked;
+    // True while captures may be triggered.
+    bool                        m_armed;
+    // True while waiting for the end of a capture window.
+    bool                        m_pending;
+    // Number of captures written.
+    unsigned                    m_captures;
+    // Number of captures started, names the next file.
+    unsigned                    m_started;
+    // Rules.
+    std::vector<Trigger>        m_triggers;
+    // Long-term rate averages of RATE_SPIKE rules, negative until sampled.
+    std::vector<double>         m_baselines;
+    // Time of the last evaluation.
+    Stopwatch::time_point       m_last;
+    // Trace time of the pending trigger.
+    std::uint64_t               m_fire_time;
+    // Id of the MARK event for the pending trigger.
+    std::uint32_t               m_fire_id;
+    // End of the pending capture window.
+    Stopwatch::time_point       m_deadline;
+    // End of the cooldown.
+    Stopwatch::time_point       m_resume;
+    // True from the end of a capture window until its file was written.
+    bool                        m_saving;
+    // Set to stop the saver thread once nothing is queued.
+    bool                        m_stop;
+    // Captured events waiting for the saver thread.
+    std::vector<TraceEvent>     m_queued;
+    // File name of the queued capture.
+    std::string                 m_queued_file;
+    // Wakes the saver thread up.
+    std::condition_variable     m_wakeup;
+    // Saver thread, started by the first capture.
+    std::thread                 m_saver;
+    // Sampler hook evaluating the rules, constructs the Sampler so that it outlives this.
+    Sampler::Hook               m_hook;
+};
+
+/** \brief Capture traces when the rate of a global Counter exceeds a threshold.
+ *
+ * \param   name    Name string literal of the StaticCounter.
+ * \param   rate    Threshold in increments per second.
+ */
+#define MINPROF_TRIGGER_RATE(name, rate)\
+::minprof::FlightRecorder::add(::minprof::Trigger::rate_above(\
+    ::minprof::StaticCounter<typestring_is(name)>::index, rate))
+
+/** \brief Capture traces when the rate of a global Counter spikes above its long-term average.
+ *
+ * \param   name    Name string literal of the StaticCounter.
+ * \param   factor  Threshold as a multiple of the long-term average.
+ */
+#define MINPROF_TRIGGER_SPIKE(name, factor)\
+::minprof::FlightRecorder::add(::minprof::Trigger::rate_spike(\
+    ::minprof::StaticCounter<typestring_is(name)>::index, factor))
+
+/** \brief Capture traces when a percentile of a global Heatmap exceeds a threshold.
+ *
+ * \param   name        Name string literal of the Heatmap.
+ * \param   q           Quantile in [0, 1].
+ * \param   threshold   Threshold as a std::chrono::duration.
+ */
+#define MINPROF_TRIGGER_PERCENTILE(name, q, threshold)\
+::minprof::FlightRecorder::add(::minprof::Trigger::percentile_above(\
+    ::minprof::StaticHeatmap<typestring_is(name)>::index, q,\
+    std::chrono::duration_cast<::minprof::Timer::duration>(threshold)))
+
+}
+
+/* Exemplary usage:
+ *
+ * Trace continuously into the in-memory flight recorder, and only persist it on anomalies:
+ *
+ * MINPROF_TRIGGER_PERCENTILE("rpc", 0.99, std::chrono::milliseconds{20});
+ * MINPROF_TRIGGER_SPIKE("errors|C", 10.0);
+ * minprof::FlightRecorder::arm();
+ * minprof::Sampler::start();
+ *
+ * MINPROF_HEATMAP_SECTION("rpc") {
+ *      MINPROF_TRACE("rpc.send") { send(); }
+ *      MINPROF_TRACE("rpc.wait") { wait(); }
+ * }
+ *
+ */
+
+#endif
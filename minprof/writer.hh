@@ -0,0 +1,935 @@
+/** \brief Asynchronous file writers for the minimal profiler.
+ *
+ * Requires a POSIX platform, io_uring support additionally requires Linux 5.1 and above.
+ *
+ * \file    minprof/writer.hh
+ * \author  Karl Friebel
+ */
+
+#ifndef MINPROF_WRITER_HH_
+#define MINPROF_WRITER_HH_
+#pragma once
+
+#include "core.hh"
+// minprof::StaticCounterRegistry
+
+#include <cerrno>
+// errno
+// EINTR
+#include <cstdio>
+// std::rename
+#include <cstddef>
+// std::size_t
+#include <cstdint>
+// std::uint8_t
+// std::uint64_t
+
+#include <condition_variable>
+// std::condition_variable
+#include <deque>
+// std::deque
+#include <memory>
+// std::unique_ptr
+#include <sstream>
+// std::ostringstream
+#include <string>
+// std::string
+#include <thread>
+// std::thread
+
+#include <fcntl.h>
+// open
+#include <unistd.h>
+// pwrite
+// fdatasync
+// close
+// unlink
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// io_uring_params
+// io_uring_sqe
+// io_uring_cqe
+#include <sys/mman.h>
+// mmap
+// munmap
+#include <sys/syscall.h>
+// syscall
+// __NR_io_uring_setup
+// __NR_io_uring_enter
+// __NR_io_uring_register
+#include <sys/uio.h>
+// iovec
+#define MINPROF_HAS_URING
+#endif
+#endif
+
+namespace minprof {
+
+/** \brief Asynchronous writer backend.
+ *
+ * Writers own a fixed pool of equally sized buffers. A client acquires a buffer, fills it and
+ * submits it to be written at an explicit file offset, after which the buffer returns to the pool
+ * once the write completed. This way, the client (e.g. the trace streamer or a periodic dump) never
+ * blocks on write(2) or fsync(2), unless it runs out of buffers.
+ *
+ * Writers are not threadsafe, every client should have its own.
+ */
+class Writer {
+public:
+    /** \brief Writer implementation to use. */
+    enum Backend {
+        /** \brief Use io_uring if available, the thread otherwise. */
+        AUTO,
+        /** \brief Use io_uring with registered buffers and files, fall back if unavailable. */
+        URING,
+        /** \brief Use a background thread performing pwrite calls. */
+        THREAD
+    };
+
+    /** \brief Buffer handed out by a Writer. */
+    struct Buffer {
+        /** \brief Buffer memory. */
+        std::uint8_t*   data;
+        /** \brief Size of the buffer memory in bytes. */
+        std::size_t     capacity;
+        /** \brief Index within the pool. */
+        unsigned        index;
+    };
+
+public:
+    /** \brief Create a Writer for a file descriptor.
+     *
+     * The file descriptor remains owned by the caller and must stay open until the Writer is
+     * destroyed or retargeted.
+     *
+     * \param   [in]    fd          File descriptor opened for writing.
+     * \param   [in]    backend     Backend to use.
+     * \param   [in]    buffers     Number of buffers in the pool.
+     * \param   [in]    size        Size of each buffer in bytes.
+     *
+     * \return  New Writer instance.
+     */
+    static std::unique_ptr<Writer> create(
+        int fd,
+        Backend backend,
+        unsigned buffers = 4,
+        std::size_t size = 1u << 20
+    );
+
+    /** \brief Wait for all outstanding writes and destroy the Writer. */
+    virtual ~Writer() = default;
+
+    /** \brief Get the name of the backend in use.
+     *
+     * \return  Backend name.
+     */
+    virtual const char* name() const noexcept = 0;
+    /** \brief Check whether all writes succeeded so far.
+     *
+     * \retval  true    No errors.
+     * \retval  false   At least one write failed.
+     */
+    virtual bool good() const noexcept = 0;
+
+    /** \brief Acquire a free buffer, waiting for completions if there is none.
+     *
+     * \return  Free buffer.
+     */
+    virtual Buffer acquire() = 0;
+    /** \brief Submit a buffer for writing.
+     *
+     * \param   [in]    buffer  Buffer obtained from acquire().
+     * \param   [in]    size    Number of bytes to write.
+     * \param   [in]    offset  File offset to write at.
+     */
+    virtual void submit(const Buffer& buffer, std::size_t size, std::uint64_t offset) = 0;
+    /** \brief Submit an fdatasync ordered after all previously submitted writes. */
+    virtual void sync() = 0;
+    /** \brief Wait for all outstanding operations to complete. */
+    virtual void wait() = 0;
+    /** \brief Check without blocking whether all outstanding operations completed.
+     *
+     * \retval  true    Nothing is in flight.
+     * \retval  false   Some operations are still outstanding.
+     */
+    virtual bool idle() = 0;
+    /** \brief Write to another file from now on, keeping the buffer pool.
+     *
+     * Must only be called while idle().
+     *
+     * \param   [in]    fd      File descriptor opened for writing.
+     */
+    virtual void retarget(int fd) = 0;
+
+    /** \brief Write arbitrary data through the buffer pool.
+     *
+     * Splits the data into buffer-sized chunks, copies and submits them.
+     *
+     * \param   [in]    data    Data to write.
+     * \param   [in]    size    Number of bytes.
+     * \param   [in]    offset  File offset to write at.
+     */
+    void write(const void* data, std::size_t size, std::uint64_t offset)
+    {
+        auto bytes = static_cast<const std::uint8_t*>(data);
+        while (size > 0) {
+            const auto buffer = acquire();
+            const auto chunk = size < buffer.capacity ? size : buffer.capacity;
+
+            std::memcpy(buffer.data, bytes, chunk);
+            submit(buffer, chunk, offset);
+
+            bytes += chunk;
+            size -= chunk;
+            offset += chunk;
+        }
+    }
+
+protected:
+    Writer() = default;
+
+    // No copy constructor.
+    Writer(const Writer&) = delete;
+    // No copy assignment.
+    Writer& operator=(const Writer&) = delete;
+    // No move constructor.
+    Writer(Writer&&) = delete;
+    // No move assignment.
+    Writer& operator=(Writer&&) = delete;
+};
+
+/** \brief Writer backed by a background thread performing pwrite calls.
+ *
+ * This is the portable fallback. Submissions are queued under a lock that is only shared with the
+ * writer thread, never with profiled code.
+ */
+class ThreadWriter : public Writer {
+public:
+    /** \brief Initialize a new ThreadWriter and start its thread.
+     *
+     * \param   [in]    fd          File descriptor opened for writing.
+     * \param   [in]    buffers     Number of buffers in the pool.
+     * \param   [in]    size        Size of each buffer in bytes.
+     */
+    ThreadWriter(int fd, unsigned buffers, std::size_t size)
+    : m_fd{fd}, m_size{size}, m_memory{new std::uint8_t[buffers * size]}, m_free{}, m_queue{},
+      m_lock{}, m_changed{}, m_busy{false}, m_stop{false}, m_good{true}, m_thread{}
+    {
+        for (unsigned idx = 0; idx < buffers; ++idx) {
+            m_free.push_back(idx);
+        }
+
+        m_thread = std::thread{[this]() { run(); }};
+    }
+    /** \brief Wait for all outstanding writes, stop the thread and destroy the ThreadWriter. */
+    ~ThreadWriter() override
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_lock};
+            m_stop = true;
+        }
+        m_changed.notify_all();
+        m_thread.join();
+    }
+
+    const char* name() const noexcept override
+    {
+        return "thread";
+    }
+    bool good() const noexcept override
+    {
+        return m_good.load();
+    }
+
+    Buffer acquire() override
+    {
+        std::unique_lock<std::mutex> lock{m_lock};
+        m_changed.wait(lock, [this]() { return !m_free.empty(); });
+
+        const auto idx = m_free.front();
+        m_free.pop_front();
+        return Buffer{&m_memory[idx * m_size], m_size, idx};
+    }
+    void submit(const Buffer& buffer, std::size_t size, std::uint64_t offset) override
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_lock};
+            m_queue.push_back(Request{buffer.index, size, offset, false});
+        }
+        m_changed.notify_all();
+    }
+    void sync() override
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_lock};
+            m_queue.push_back(Request{0, 0, 0, true});
+        }
+        m_changed.notify_all();
+    }
+    void wait() override
+    {
+        std::unique_lock<std::mutex> lock{m_lock};
+        m_changed.wait(lock, [this]() { return m_queue.empty() && !m_busy; });
+    }
+    bool idle() override
+    {
+        std::lock_guard<std::mutex> lock{m_lock};
+        return m_queue.empty() && !m_busy;
+    }
+    void retarget(int fd) override
+    {
+        // The thread reads the descriptor after taking the lock for its next request.
+        std::lock_guard<std::mutex> lock{m_lock};
+        m_fd = fd;
+    }
+
+private:
+    // Queued operation.
+    struct Request {
+        // Buffer index.
+        unsigned        index;
+        // Number of bytes to write.
+        std::size_t     size;
+        // File offset.
+        std::uint64_t   offset;
+        // If true, this is an fdatasync.
+        bool            sync;
+    };
+
+    // Writer thread main loop.
+    void run()
+    {
+        std::unique_lock<std::mutex> lock{m_lock};
+        for (;;) {
+            m_changed.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+            if (m_queue.empty()) {
+                return;
+            }
+
+            const auto request = m_queue.front();
+            m_queue.pop_front();
+            m_busy = true;
+            lock.unlock();
+
+            if (request.sync) {
+                if (::fdatasync(m_fd) != 0) {
+                    m_good.store(false);
+                }
+            } else {
+                perform(request);
+            }
+
+            lock.lock();
+            if (!request.sync) {
+                m_free.push_back(request.index);
+            }
+            m_busy = false;
+            m_changed.notify_all();
+        }
+    }
+
+    // Write a request, retrying partial writes.
+    void perform(const Request& request) noexcept
+    {
+        auto data = &m_memory[request.index * m_size];
+        auto left = request.size;
+        auto offset = request.offset;
+
+        while (left > 0) {
+            const auto written = ::pwrite(m_fd, data, left, static_cast<off_t>(offset));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                m_good.store(false);
+                return;
+            }
+
+            data += written;
+            left -= static_cast<std::size_t>(written);
+            offset += static_cast<std::uint64_t>(written);
+        }
+    }
+
+    // Target file.
+    int                             m_fd;
+    // Size of each buffer.
+    std::size_t                     m_size;
+    // Memory of all buffers.
+    std::unique_ptr<std::uint8_t[]> m_memory;
+    // Indices of free buffers.
+    std::deque<unsigned>            m_free;
+    // Pending operations.
+    std::deque<Request>             m_queue;
+    // Guards m_fd, m_free, m_queue, m_busy and m_stop.
+    std::mutex                      m_lock;
+    // Signalled whenever the state changes.
+    std::condition_variable         m_changed;
+    // Set while the thread performs an operation.
+    bool                            m_busy;
+    // Set to stop the thread once the queue is empty.
+    bool                            m_stop;
+    // Cleared on the first error.
+    std::atomic<bool>               m_good;
+    // Writer thread.
+    std::thread                     m_thread;
+};
+
+#if defined(MINPROF_HAS_URING)
+
+/** \brief Writer submitting through io_uring.
+ *
+ * The buffer pool and the file descriptor are registered with the ring once, so every write is an
+ * IORING_OP_WRITE_FIXED on a fixed file, which saves the kernel from mapping the buffer and looking
+ * up the file on every call. retarget() swaps the fixed file in place. Uses raw system calls, so
+ * liburing is not required.
+ */
+class UringWriter : public Writer {
+public:
+    /** \brief Try to create a new UringWriter.
+     *
+     * \param   [in]    fd          File descriptor opened for writing.
+     * \param   [in]    buffers     Number of buffers in the pool.
+     * \param   [in]    size        Size of each buffer in bytes.
+     *
+     * \retval  nullptr io_uring is not available.
+     * \return  New UringWriter instance.
+     */
+    static std::unique_ptr<UringWriter> create(int fd, unsigned buffers, std::size_t size)
+    {
+        std::unique_ptr<UringWriter> writer{new UringWriter{fd, buffers, size}};
+        if (!writer->setup()) {
+            return nullptr;
+        }
+
+        return writer;
+    }
+    /** \brief Wait for all outstanding writes, unregister and destroy the UringWriter. */
+    ~UringWriter() override
+    {
+        if (m_ring_fd >= 0) {
+            wait();
+        }
+        if (m_sq_ring != MAP_FAILED) {
+            ::munmap(m_sq_ring, m_sq_ring_size);
+        }
+        if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) {
+            ::munmap(m_cq_ring, m_cq_ring_size);
+        }
+        if (m_sqes != MAP_FAILED) {
+            ::munmap(m_sqes, m_sqes_size);
+        }
+        if (m_ring_fd >= 0) {
+            ::close(m_ring_fd);
+        }
+    }
+
+    const char* name() const noexcept override
+    {
+        return "io_uring";
+    }
+    bool good() const noexcept override
+    {
+        return m_good;
+    }
+
+    Buffer acquire() override
+    {
+        while (m_free.empty()) {
+            reap(true);
+        }
+
+        const auto idx = m_free.back();
+        m_free.pop_back();
+        return Buffer{&m_memory[idx * m_size], m_size, idx};
+    }
+    void submit(const Buffer& buffer, std::size_t size, std::uint64_t offset) override
+    {
+        m_pending[buffer.index] = Pending{size, 0, offset};
+        push_write(buffer.index);
+    }
+    void sync() override
+    {
+        auto& sqe = next_sqe();
+        sqe.opcode = IORING_OP_FSYNC;
+        sqe.flags = IOSQE_FIXED_FILE | IOSQE_IO_DRAIN;
+        sqe.fd = 0;
+        sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe.user_data = sync_tag;
+        enter(1, 0);
+    }
+    void wait() override
+    {
+        while (m_in_flight > 0) {
+            reap(true);
+        }
+    }
+    bool idle() override
+    {
+        if (m_in_flight > 0) {
+            reap(false);
+        }
+        return m_in_flight == 0;
+    }
+    void retarget(int fd) override
+    {
+        m_fd = fd;
+
+        // Replace the fixed file in place, or register it anew before Linux 5.5.
+        io_uring_files_update update{};
+        update.offset = 0;
+        update.fds = reinterpret_cast<std::uint64_t>(&m_fd);
+        if (::syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1)
+            == 1) {
+            return;
+        }
+        if (::syscall(__NR_io_uring_register, m_ring_fd, IORING_UNREGISTER_FILES, nullptr, 0) != 0
+            || ::syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_FILES, &m_fd, 1) != 0) {
+            m_good = false;
+        }
+    }
+
+private:
+    // User data of sync operations.
+    static constexpr std::uint64_t sync_tag = ~std::uint64_t{0};
+
+    // Progress of a submitted buffer.
+    struct Pending {
+        // Number of bytes to write.
+        std::size_t     size;
+        // Number of bytes written.
+        std::size_t     done;
+        // File offset.
+        std::uint64_t   offset;
+    };
+
+    UringWriter(int fd, unsigned buffers, std::size_t size)
+    : m_fd{fd}, m_buffers{buffers}, m_size{size}, m_memory{new std::uint8_t[buffers * size]},
+      m_free{}, m_pending(buffers), m_ring_fd{-1}, m_sq_ring{MAP_FAILED}, m_cq_ring{MAP_FAILED},
+      m_sqes{MAP_FAILED}, m_sq_ring_size{0}, m_cq_ring_size{0}, m_sqes_size{0}, m_params{},
+      m_in_flight{0}, m_good{true}
+    {
+        for (unsigned idx = 0; idx < buffers; ++idx) {
+            m_free.push_back(idx);
+        }
+    }
+
+    // Set up the ring and register the buffers and the file.
+    bool setup() noexcept
+    {
+        // One write per buffer plus syncs.
+        const auto entries = 2 * m_buffers;
+        m_ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &m_params));
+        if (m_ring_fd < 0) {
+            return false;
+        }
+
+        m_sq_ring_size = m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned);
+        m_cq_ring_size = m_params.cq_off.cqes + m_params.cq_entries * sizeof(io_uring_cqe);
+        const auto single = (m_params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single && m_cq_ring_size > m_sq_ring_size) {
+            m_sq_ring_size = m_cq_ring_size;
+        }
+
+        m_sq_ring = ::mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+        if (m_sq_ring == MAP_FAILED) {
+            return false;
+        }
+        m_cq_ring = single ? m_sq_ring : ::mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_POPULATE, m_ring_fd,
+                                                IORING_OFF_CQ_RING);
+        if (m_cq_ring == MAP_FAILED) {
+            return false;
+        }
+        m_sqes_size = m_params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = ::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        m_ring_fd, IORING_OFF_SQES);
+        if (m_sqes == MAP_FAILED) {
+            return false;
+        }
+
+        std::vector<iovec> iovecs(m_buffers);
+        for (unsigned idx = 0; idx < m_buffers; ++idx) {
+            iovecs[idx].iov_base = &m_memory[idx * m_size];
+            iovecs[idx].iov_len = m_size;
+        }
+        if (::syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_BUFFERS,
+                      iovecs.data(), m_buffers) != 0) {
+            return false;
+        }
+        if (::syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_FILES, &m_fd, 1) != 0) {
+            return false;
+        }
+
+        return true;
+    }
+
+    // Access a field of a ring mapping by offset.
+    static unsigned* field(void* ring, unsigned offset) noexcept
+    {
+        return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset);
+    }
+
+    // Get the next free submission entry, reaping completions if the queue is full.
+    io_uring_sqe& next_sqe()
+    {
+        while (m_in_flight >= m_params.sq_entries) {
+            reap(true);
+        }
+
+        const auto tail = *field(m_sq_ring, m_params.sq_off.tail);
+        const auto idx = tail & *field(m_sq_ring, m_params.sq_off.ring_mask);
+
+        auto& sqe = static_cast<io_uring_sqe*>(m_sqes)[idx];
+        std::memset(&sqe, 0, sizeof(sqe));
+        field(m_sq_ring, m_params.sq_off.array)[idx] = idx;
+
+        // Published to the kernel by enter().
+        __atomic_store_n(field(m_sq_ring, m_params.sq_off.tail), tail + 1, __ATOMIC_RELEASE);
+        ++m_in_flight;
+        return sqe;
+    }
+
+    // Queue the remaining part of a pending buffer.
+    void push_write(unsigned idx)
+    {
+        const auto& pending = m_pending[idx];
+
+        auto& sqe = next_sqe();
+        sqe.opcode = IORING_OP_WRITE_FIXED;
+        sqe.flags = IOSQE_FIXED_FILE;
+        sqe.fd = 0;
+        sqe.addr = reinterpret_cast<std::uint64_t>(&m_memory[idx * m_size + pending.done]);
+        sqe.len = static_cast<std::uint32_t>(pending.size - pending.done);
+        sqe.off = pending.offset + pending.done;
+        sqe.buf_index = static_cast<std::uint16_t>(idx);
+        sqe.user_data = idx;
+        enter(1, 0);
+    }
+
+    // Submit queued entries and optionally wait for completions.
+    void enter(unsigned submit, unsigned min_complete) noexcept
+    {
+        const unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+        while (::syscall(__NR_io_uring_enter, m_ring_fd, submit, min_complete, flags, nullptr, 0)
+               < 0) {
+            if (errno != EINTR) {
+                m_good = false;
+                return;
+            }
+        }
+    }
+
+    // Process completions, optionally blocking until at least one is available.
+    void reap(bool block)
+    {
+        auto head = *field(m_cq_ring, m_params.cq_off.head);
+        auto tail = __atomic_load_n(field(m_cq_ring, m_params.cq_off.tail), __ATOMIC_ACQUIRE);
+        if (head == tail && block) {
+            enter(0, 1);
+            if (!m_good) {
+                // Do not spin on a broken ring.
+                m_in_flight = 0;
+                m_free.clear();
+                for (unsigned idx = 0; idx < m_buffers; ++idx) {
+                    m_free.push_back(idx);
+                }
+                return;
+            }
+            tail = __atomic_load_n(field(m_cq_ring, m_params.cq_off.tail), __ATOMIC_ACQUIRE);
+        }
+
+        const auto mask = *field(m_cq_ring, m_params.cq_off.ring_mask);
+        const auto cqes = reinterpret_cast<io_uring_cqe*>(
+            static_cast<char*>(m_cq_ring) + m_params.cq_off.cqes
+        );
+
+        std::vector<unsigned> resubmit;
+        for (; head != tail; ++head) {
+            const auto& cqe = cqes[head & mask];
+            --m_in_flight;
+
+            if (cqe.user_data == sync_tag) {
+                m_good = m_good && cqe.res >= 0;
+                continue;
+            }
+
+            const auto idx = static_cast<unsigned>(cqe.user_data);
+            auto& pending = m_pending[idx];
+            if (cqe.res <= 0) {
+                m_good = false;
+                m_free.push_back(idx);
+                continue;
+            }
+
+            pending.done += static_cast<std::size_t>(cqe.res);
+            if (pending.done < pending.size) {
+                resubmit.push_back(idx);
+            } else {
+                m_free.push_back(idx);
+            }
+        }
+        __atomic_store_n(field(m_cq_ring, m_params.cq_off.head), head, __ATOMIC_RELEASE);
+
+        // Short writes are continued where they stopped.
+        for (const auto idx : resubmit) {
+            push_write(idx);
+        }
+    }
+
+    // Target file.
+    int                             m_fd;
+    // Number of buffers.
+    unsigned                        m_buffers;
+    // Size of each buffer.
+    std::size_t                     m_size;
+    // Memory of all buffers.
+    std::unique_ptr<std::uint8_t[]> m_memory;
+    // Indices of free buffers.
+    std::vector<unsigned>           m_free;
+    // Progress per buffer.
+    std::vector<Pending>            m_pending;
+    // Ring file descriptor.
+    int                             m_ring_fd;
+    // Submission queue ring mapping.
+    void*                           m_sq_ring;
+    // Completion queue ring mapping.
+    void*                           m_cq_ring;
+    // Submission queue entries mapping.
+    void*                           m_sqes;
+    // Sizes of the mappings.
+    std::size_t                     m_sq_ring_size, m_cq_ring_size, m_sqes_size;
+    // Ring parameters.
+    io_uring_params                 m_params;
+    // Number of submitted but uncompleted operations.
+    unsigned                        m_in_flight;
+    // Cleared on the first error.
+    bool                            m_good;
+};
+
+#endif
+
+inline std::unique_ptr<Writer> Writer::create(
+    int fd,
+    Backend backend,
+    unsigned buffers,
+    std::size_t size
+) {
+#if defined(MINPROF_HAS_URING)
+    if (backend != THREAD) {
+        if (auto writer = UringWriter::create(fd, buffers, size)) {
+            return std::unique_ptr<Writer>{writer.release()};
+        }
+    }
+#else
+    (void)backend;
+#endif
+
+    return std::unique_ptr<Writer>{new ThreadWriter{fd, buffers, size}};
+}
+
+/** \brief Periodic dumper writing through an asynchronous Writer.
+ *
+ * Every dump() formats the counters into memory and hands them to a Writer targeting a temporary
+ * file next to the destination, which is renamed over the destination once the write and its
+ * fdatasync completed. Readers, and a process dying mid-dump, thus only ever see complete dumps.
+ *
+ * The Writer is created by the first dump with a single buffer large enough for it, and retargeted
+ * to every new temporary file, so that its thread or ring and its registered buffer are set up
+ * once. It is only recreated when a dump outgrows the buffer, which then doubles.
+ *
+ * Completion is polled on the next dump() without blocking. If the previous dump is still being
+ * written at that point, the new one is kept in memory and written once the previous one completed,
+ * superseding any older dump still waiting.
+ */
+class Dumper {
+public:
+    /** \brief Format function writing a dump to a stream. */
+    using format_type = void (*)(std::ostream&);
+
+public:
+    /** \brief Prepare a file for dumping.
+     *
+     * Creates the temporary file for the first dump, use good() to check for errors.
+     *
+     * \param   [in]    file_name   Name of the file.
+     * \param   [in]    backend     Writer backend to use.
+     * \param   [in]    format      Dump format, e.g. StaticCounterRegistry::dump_threads.
+     */
+    explicit Dumper(
+        const char* file_name,
+        Writer::Backend backend = Writer::AUTO,
+        format_type format = &StaticCounterRegistry::dump
+    )
+    : m_file_name{file_name}, m_temp_name{m_file_name + ".tmp"}, m_backend{backend},
+      m_format{format}, m_fd{-1}, m_good{true}, m_waiting{false}, m_busy{false}, m_stream{},
+      m_text{}, m_writer{}, m_capacity{0}
+    {
+        m_fd = open();
+        m_good = m_fd >= 0;
+    }
+    /** \brief Write the last dump, wait for it and close the file. */
+    ~Dumper()
+    {
+        finish(true);
+        if (m_waiting && m_good) {
+            start();
+            finish(true);
+        }
+        if (m_fd >= 0) {
+            ::close(m_fd);
+            ::unlink(m_temp_name.c_str());
+        }
+    }
+
+    // No copy constructor.
+    Dumper(const Dumper&) = delete;
+    // No copy assignment.
+    Dumper& operator=(const Dumper&) = delete;
+    // No move constructor.
+    Dumper(Dumper&&) = delete;
+    // No move assignment.
+    Dumper& operator=(Dumper&&) = delete;
+
+    /** \brief Get the Writer of the dumps.
+     *
+     * \retval  nullptr Nothing was dumped yet.
+     * \return  Writer instance.
+     */
+    const Writer* writer() const noexcept
+    {
+        return m_writer.get();
+    }
+    /** \brief Check whether all files could be created, written and renamed so far.
+     *
+     * \retval  true    No errors.
+     * \retval  false   A file could not be opened, written or renamed.
+     */
+    bool good() const noexcept
+    {
+        return m_good && (!m_writer || m_writer->good());
+    }
+
+    /** \brief Dump all counters, replacing the previous dump once written.
+     *
+     * Never waits for the disk: returns as soon as the dump is formatted and either submitted, or
+     * queued behind the dump still in flight.
+     */
+    void dump()
+    {
+        if (!m_good) {
+            return;
+        }
+
+        m_stream.str(std::string{});
+        m_format(m_stream);
+        m_text = m_stream.str();
+        m_waiting = true;
+
+        if (finish(false)) {
+            start();
+        }
+    }
+
+private:
+    // Open the temporary file.
+    int open() const noexcept
+    {
+        return ::open(m_temp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    // Submit the waiting dump to the Writer, whose single buffer holds all of it.
+    void start()
+    {
+        if (m_fd < 0) {
+            m_fd = open();
+        }
+        if (m_fd < 0) {
+            m_good = false;
+            return;
+        }
+
+        const auto size = m_text.size();
+        if (!m_writer || size > m_capacity) {
+            auto capacity = m_capacity > 0 ? m_capacity : std::size_t{1} << 16;
+            while (capacity < size) {
+                capacity *= 2;
+            }
+            m_writer.reset();
+            m_writer = Writer::create(m_fd, m_backend, 1, capacity);
+            m_capacity = capacity;
+        } else {
+            m_writer->retarget(m_fd);
+        }
+
+        m_writer->write(m_text.data(), size, 0);
+        m_writer->sync();
+        m_waiting = false;
+        m_busy = true;
+    }
+
+    // Complete the dump in flight by renaming it over the destination.
+    bool finish(bool block)
+    {
+        if (!m_busy) {
+            return true;
+        }
+        if (block) {
+            m_writer->wait();
+        } else if (!m_writer->idle()) {
+            return false;
+        }
+
+        m_good = m_good && m_writer->good();
+        m_busy = false;
+        ::close(m_fd);
+        m_fd = -1;
+        if (m_good && std::rename(m_temp_name.c_str(), m_file_name.c_str()) != 0) {
+            m_good = false;
+        }
+
+        return true;
+    }
+
+    // Destination file name.
+    std::string             m_file_name;
+    // Temporary file name.
+    std::string             m_temp_name;
+    // Writer backend.
+    Writer::Backend         m_backend;
+    // Dump format.
+    format_type             m_format;
+    // Temporary file, or -1 if not open.
+    int                     m_fd;
+    // Cleared on the first error.
+    bool                    m_good;
+    // Set while m_text holds a dump not yet submitted.
+    bool                    m_waiting;
+    // Set while a dump is being written.
+    bool                    m_busy;
+    // Formatting buffer.
+    std::ostringstream      m_stream;
+    // Dump waiting to be submitted.
+    std::string             m_text;
+    // Writer of all dumps, created by the first one.
+    std::unique_ptr<Writer> m_writer;
+    // Size of the Writer's buffer.
+    std::size_t             m_capacity;
+};
+
+}
+
+/* Exemplary usage:
+ *
+ * Dump periodically without blocking on the disk, readers of minprof.csv only see complete dumps:
+ *
+ * minprof::Dumper dumper{"minprof.csv", minprof::Writer::URING};
+ * ...
+ * dumper.dump();
+ *
+ */
+
+#endif